@@ -3,9 +3,12 @@
 
 #include "audio/device.h"
 #include "audio/internals.h"
+#include "res_manager.h"
+#include "residency.h"
 #include <fwk/audio/sound.h>
 #include <fwk/io/file_stream.h>
 #include <fwk/io/file_system.h>
+#include <fwk/io/memory_stream.h>
 #include <map>
 #include <string.h>
 
@@ -49,6 +52,7 @@ void uploadToBuffer(const Sound &sound, unsigned buffer_id) {
 namespace {
 
 	const char *s_prefix = "data/sounds/";
+	const char *s_pack_prefix = "sounds/";
 	const char *s_suffix = ".wav";
 
 	class DSound {
@@ -68,14 +72,19 @@ namespace {
 		DSound(const DSound &) = delete;
 		void operator=(const DSound &) = delete;
 
-		void load() {
+		// Returns size of buffer data
+		i64 load() {
 			DASSERT(!isRandomDummy());
 			DASSERT(!m_name.empty());
 			if(isLoaded())
-				return;
+				return 0;
 
 			Sound sound;
-			{
+			auto pack_name = format("%%%", s_pack_prefix, m_name, s_suffix);
+			if(auto packed = ResManager::findPacked(pack_name)) {
+				auto ldr = memoryLoader(*packed);
+				sound = std::move(Sound::load(ldr).get()); // TODO
+			} else {
 				auto ldr =
 					std::move(fileLoader(format("%%%", s_prefix, m_name, s_suffix)).get()); // TODO
 				sound = std::move(Sound::load(ldr).get()); // TODO
@@ -88,7 +97,13 @@ namespace {
 			}
 
 			uploadToBuffer(sound, m_id);
-			//TODO: alDeleteBuffers(1, &m_id);
+			return sound.data().size();
+		}
+
+		void unload() {
+			if(m_id)
+				alDeleteBuffers(1, &m_id);
+			m_id = 0;
 		}
 
 		bool isLoaded() const { return m_id != 0; }
@@ -114,8 +129,12 @@ namespace {
 		0,
 	};
 	int s_num_free_sources = 0;
+	// Sounds bound to sources are referenced until they stop playing
+	int s_source_sounds[max_sources];
 	double s_last_time = 0.0;
 
+	ResidencyTracker s_residency(ResidencyCategory::sound_buffers);
+
 	bool s_is_initialized = false;
 }
 
@@ -129,21 +148,35 @@ void initSoundMap() {
 
 	vector<std::map<string, SoundIndex>::iterator> iters;
 
-	auto file_entries = findFiles(s_prefix);
-	iters.resize(file_entries.size(), s_sound_map.end());
+	// Names relative to s_prefix; Only top directory is scanned
+	vector<string> file_names;
+	if(auto *pack = ResManager::activePack()) {
+		auto [first, end] = pack->prefixRange(s_pack_prefix);
+		for(int n = first; n < end; n++) {
+			string name = pack->name(n);
+			removePrefix(name, s_pack_prefix);
+			if(name.find('/') == string::npos)
+				file_names.emplace_back(std::move(name));
+		}
+	}
+	if(file_names.empty())
+		for(auto &entry : findFiles(s_prefix)) {
+			string name = (string)entry.path;
+			removePrefix(name, s_prefix);
+			file_names.emplace_back(std::move(name));
+		}
+	iters.resize(file_names.size(), s_sound_map.end());
 
 	string suffix = s_suffix;
 	int sound_count = 0;
 
-	for(int n = 0; n < (int)file_entries.size(); n++) {
-		string name = (string)file_entries[n].path;
-		removePrefix(name, s_prefix);
-
+	for(int n = 0; n < (int)file_names.size(); n++) {
+		string name = file_names[n];
 		string spec_name = toLower(name);
 
 		if(removeSuffix(spec_name, suffix)) {
 			name.resize(spec_name.size());
-			file_entries[n].path = name;
+			file_names[n] = name;
 
 			while(spec_name.back() >= '0' && spec_name.back() <= '9')
 				spec_name.pop_back();
@@ -173,7 +206,7 @@ void initSoundMap() {
 			continue;
 		SoundIndex &idx = it->second;
 		s_sounds[idx.first_idx].m_map_name = it->first;
-		s_sounds[idx.first_idx + ++idx.variation_count].m_name = file_entries[n].path;
+		s_sounds[idx.first_idx + ++idx.variation_count].m_name = file_names[n];
 	}
 
 	for(auto it = s_sound_map.begin(); it != s_sound_map.end(); ++it)
@@ -197,6 +230,7 @@ void initDevice() {
 		alGetError();
 		alGenSources(max_sources, (ALuint *)s_sources);
 		testError("Error while creating audio source.");
+		std::fill(begin(s_source_sounds), end(s_source_sounds), -1);
 
 		alDistanceModel(AL_LINEAR_DISTANCE_CLAMPED);
 		alSpeedOfSound(16.666666f * 343.3);
@@ -225,6 +259,13 @@ void freeDevice() {
 	alDeleteSources(max_sources, s_sources);
 	memset(s_sources, 0, sizeof(s_sources));
 	s_num_free_sources = 0;
+	for(auto &sound_id : s_source_sounds)
+		if(sound_id != -1) {
+			s_residency.release(sound_id);
+			sound_id = -1;
+		}
+	for(int n = 0; n < (int)s_sounds.size(); n++)
+		s_residency.setResident(n, 0);
 
 	s_sound_map.clear();
 	s_sounds.clear();
@@ -248,10 +289,23 @@ void tick() {
 	for(int n = 0; n < max_sources; n++) {
 		ALint state;
 		alGetSourcei(s_sources[n], AL_SOURCE_STATE, &state);
-		if(state != AL_PLAYING)
+		if(state != AL_PLAYING) {
 			s_free_sources[s_num_free_sources++] = n;
+			if(s_source_sounds[n] != -1) {
+				alSourcei(s_sources[n], AL_BUFFER, 0);
+				s_residency.release(s_source_sounds[n]);
+				s_source_sounds[n] = -1;
+			}
+		}
 	}
 
+	if(s_residency.overBudget())
+		s_residency.trim([](int sound_id) {
+			s_sounds[sound_id].unload();
+			s_residency.setResident(sound_id, 0);
+			return true;
+		});
+
 	//		printf("active: %d\n", max_sources - s_num_free_sources);
 
 	double time = getTime();
@@ -302,8 +356,9 @@ void loadSound(int sound_id) {
 		if(sound->isRandomDummy()) {
 			for(int i = 0; i < sound->m_variation_count; i++)
 				loadSound(sound_id + 1 + i);
-		} else
-			sound->load();
+		} else {
+			s_residency.setResident(sound_id, sound->load());
+		}
 	}
 }
 
@@ -328,7 +383,12 @@ uint prepSource(int sound_id) {
 	if(!s_num_free_sources)
 		return 0;
 
-	uint source_id = s_sources[s_free_sources[--s_num_free_sources]];
+	int source_idx = s_free_sources[--s_num_free_sources];
+	uint source_id = s_sources[source_idx];
+	DASSERT(s_source_sounds[source_idx] == -1);
+	s_source_sounds[source_idx] = sound_id;
+	s_residency.acquire(sound_id);
+
 	alSourcei(source_id, AL_BUFFER, sound->m_id);
 	alSourcef(source_id, AL_ROLLOFF_FACTOR, 1.0f);
 	alSourcef(source_id, AL_MAX_DISTANCE, s_max_distance);
@@ -17,8 +17,10 @@ namespace audio {
 // Sounds with the same name modulo numerical suffix are grouped together.
 // For example: empburst1.wav and empburst2.wav.
 //
+// Memory used by sound buffers is limited by sound_buffers residency budget; Buffers which
+// aren't playing are freed (least recently used first) when it goes over the budget.
+//
 //TODO: handle non-existent sounds silently in release build (or log them to a file)
-//TODO: add upper limit for sound buffers memory
 //TODO: add possibility to access specific sound variation (by it's name)
 
 static constexpr int max_sources = 16;
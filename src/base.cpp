@@ -66,7 +66,7 @@ void saveString(FileStream &sr, Str str) {
 	sr.saveData(str);
 }
 
-Ex<string> loadString(FileStream &sr) {
+Ex<string> loadString(Stream &sr) {
 	u32 len;
 	u8 tmp;
 
@@ -187,10 +187,19 @@ float3 project(const float3 &point, const Plane3F &plane) {
 }
 
 vector<float3> genPointsOnPlane(const FBox &box, const float3 &dir, int density, bool outside) {
-	DASSERT(density > 1);
+	vector<float3> out(density * density);
+	out.resize(genPointsOnPlane(out, box, dir, density, outside));
+	return out;
+}
 
-	if(box.width() < big_epsilon && box.height() < big_epsilon && box.depth() < big_epsilon)
-		return {box.center()};
+int genPointsOnPlane(Span<float3> out, const FBox &box, const float3 &dir, int density,
+					 bool outside) {
+	DASSERT(density > 1 && out.size() >= density * density);
+
+	if(box.width() < big_epsilon && box.height() < big_epsilon && box.depth() < big_epsilon) {
+		out[0] = box.center();
+		return 1;
+	}
 
 	float radius = distance(box.center(), box.min());
 	Plane3F plane(dir, box.center() + dir * radius);
@@ -205,14 +214,15 @@ vector<float3> genPointsOnPlane(const FBox &box, const float3 &dir, int density,
 		}
 	}
 
-	if(distanceSq(other, origin) < big_epsilon)
-		return {box.center()};
+	if(distanceSq(other, origin) < big_epsilon) {
+		out[0] = box.center();
+		return 1;
+	}
 
 	float3 px = normalize(other - origin);
 	float3 py = dir;
 	float3 pz = cross(px, py);
-
-	vector<float3> out;
+	int count = 0;
 
 	float mult = 1.0f / float(density - 1);
 	for(int x = 0; x < density; x++)
@@ -222,10 +232,10 @@ vector<float3> genPointsOnPlane(const FBox &box, const float3 &dir, int density,
 
 			float isect = isectDist(Ray3F(point + dir, -dir), box);
 			if(isect < inf)
-				out.push_back(outside ? point : point - dir * (isect - 1.0f));
+				out[count++] = outside ? point : point - dir * (isect - 1.0f);
 		}
 
-	return out;
+	return count;
 }
 
 vector<float3> genPoints(const FBox &bbox, int density) {
@@ -341,3 +351,27 @@ string toUTF8Checked(const string32 &str) {
 		return *result;
 	FATAL("Error while converting string to UTF8");
 }
+
+static u64 rotl(u64 value, int bits) { return (value << bits) | (value >> (64 - bits)); }
+
+u64 hashData(const void *data, i64 size, u64 seed) {
+	const u64 mul1 = 0x9e3779b97f4a7c15ull, mul2 = 0xff51afd7ed558ccdull;
+	auto *bytes = (const u8 *)data;
+	u64 hash = seed ^ (u64(size) * mul1);
+
+	i64 pos = 0;
+	for(; pos + 8 <= size; pos += 8) {
+		// Words are always read as little-endian
+		u64 word = 0;
+		for(int n = 0; n < 8; n++)
+			word |= u64(bytes[pos + n]) << (n * 8);
+		hash = rotl(hash ^ (word * mul1), 31) * mul2;
+	}
+	for(; pos < size; pos++)
+		hash = rotl(hash ^ (bytes[pos] * mul1), 31) * mul2;
+
+	hash ^= hash >> 33;
+	hash *= mul2;
+	hash ^= hash >> 33;
+	return hash;
+}
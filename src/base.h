@@ -44,6 +44,10 @@ bool areOverlapping(const FRect &a, const FRect &b);
 string32 toUTF32Checked(Str);
 string toUTF8Checked(const string32 &);
 
+// 64-bit hash used for persistent keys; it depends only on the given bytes (not on byte order
+// of the platform), so it's stable across runs & platforms as long as the data is the same
+u64 hashData(const void *data, i64 size, u64 seed = 0);
+
 // These can be used to look for wrong uses of min & max on vectors
 //template <class T, class X = EnableIfVector<T, T>> T max(T a, T b) { static_assert(sizeof(T) == 0, ""); return a; }
 //template <class T, class X = EnableIfVector<T, T>> T min(T a, T b) { static_assert(sizeof(T) == 0, ""); return b; }
@@ -79,7 +83,7 @@ void encodeInt(MemoryStream &sr, int value);
 int decodeInt(MemoryStream &sr);
 
 void saveString(FileStream &, Str);
-Ex<string> loadString(FileStream &);
+Ex<string> loadString(Stream &);
 
 struct MoveVector {
 	MoveVector(const int2 &start, const int2 &end);
@@ -128,6 +132,9 @@ inline float2 worldToScreen(const float2 &pos) { return worldToScreen(float3(pos
 
 // Plane3F touches the sphere which encloses the box
 vector<float3> genPointsOnPlane(const FBox &box, const float3 &dir, int density, bool outside);
+// Fills out (which has to hold density^2 points) & returns number of generated points
+int genPointsOnPlane(Span<float3> out, const FBox &box, const float3 &dir, int density,
+					 bool outside);
 vector<float3> genPoints(const FBox &bbox, int density);
 
 void findPerpendicular(const float3 &v1, float3 &v2, float3 &v3);
@@ -165,6 +172,8 @@ bool isInsideFrustum(const float3 &eye_pos, const float3 &eye_dir, float min_dot
 					 const Box<float3> &box);
 
 class SceneRenderer;
+class TextureArena;
+class TileIndex;
 
 // TODO: replace shared_ptr with Dynamic
 
@@ -175,6 +184,7 @@ class Entity;
 class TileMap;
 class EntityMap;
 class World;
+class WorldLoadProgress;
 class Actor;
 class Character;
 class Inventory;
@@ -0,0 +1,195 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+// Benchmark & correctness test of PackedTexture decoding kernels.
+// Every frame of converted sprites is composed (just like in MultiImage::cacheUpload) and all
+// layers are decoded with each supported kernel. Results are compared with scalar kernel.
+
+#include "game/sprite.h"
+
+#include <fwk/gfx/image.h>
+#include <fwk/io/file_stream.h>
+#include <fwk/io/file_system.h>
+#include <fwk/sys/expected.h>
+
+using game::Sprite;
+
+namespace {
+
+struct KernelStats {
+	double blit_time = 0.0, decode_time = 0.0;
+	i64 blit_pixels = 0, decode_pixels = 0;
+	int mismatches = 0;
+};
+
+struct FrameRef {
+	const Sprite::MultiImage *image;
+	const Sprite::MultiPalette *palette;
+};
+
+vector<FrameRef> listFrames(const Sprite &sprite) {
+	vector<FrameRef> out;
+	vector<bool> visited(sprite.imageCount(), false);
+
+	for(int seq_id = 0; seq_id < sprite.size(); seq_id++) {
+		auto &palette = sprite.palette(sprite[seq_id].palette_id);
+		for(int frame_id = 0; frame_id < sprite.frameCount(seq_id); frame_id++) {
+			if(sprite.frame(seq_id, frame_id).id < 0)
+				continue;
+			for(int dir_id = 0; dir_id < sprite.dirCount(seq_id); dir_id++) {
+				int image_id = sprite.imageIndex(seq_id, frame_id, dir_id);
+				auto &image = sprite.image(image_id);
+				if(visited[image_id] || image.rect.empty())
+					continue;
+				visited[image_id] = true;
+				out.emplace_back(&image, &palette);
+			}
+		}
+	}
+
+	return out;
+}
+
+void compose(const FrameRef &frame, Image &out) {
+	out.resize(frame.image->rect.size());
+	out.fill(IColor(0, 0, 0, 0));
+	for(int l = 0; l < Sprite::layer_count; l++)
+		frame.image->images[l].blit(out, frame.image->points[l], frame.palette->access(l),
+									frame.palette->size(l));
+}
+
+bool sameImages(const Image &a, const Image &b) {
+	return a.size() == b.size() &&
+		   memcmp(&a.pixels<IColor>()[0], &b.pixels<IColor>()[0],
+				  a.width() * a.height() * sizeof(IColor)) == 0;
+}
+
+void benchSprite(const Sprite &sprite, int iterations, EnumMap<DecodeKernel, KernelStats> &stats) {
+	auto frames = listFrames(sprite);
+	vector<Image> reference(frames.size());
+	vector<PodVector<IColor>> reference_layers(frames.size() * Sprite::layer_count);
+
+	Image temp;
+	PodVector<IColor> layer_temp;
+
+	for(auto kernel : all<DecodeKernel>) {
+		if(!PackedTexture::isSupported(kernel))
+			continue;
+		PackedTexture::setDecodeKernel(kernel);
+		auto &kstats = stats[kernel];
+		bool is_reference = kernel == DecodeKernel::scalar;
+
+		double time = getTime();
+		for(int iter = 0; iter < iterations; iter++)
+			for(int n = 0; n < (int)frames.size(); n++) {
+				compose(frames[n], temp);
+				if(iter == 0) {
+					if(is_reference)
+						reference[n] = temp;
+					else if(!sameImages(reference[n], temp))
+						kstats.mismatches++;
+				}
+				kstats.blit_pixels += temp.width() * temp.height();
+			}
+		kstats.blit_time += getTime() - time;
+
+		time = getTime();
+		for(int iter = 0; iter < iterations; iter++)
+			for(int n = 0; n < (int)frames.size(); n++)
+				for(int l = 0; l < Sprite::layer_count; l++) {
+					auto &layer = frames[n].image->images[l];
+					if(layer.empty())
+						continue;
+					auto &palette = *frames[n].palette;
+					layer_temp.resize(layer.width() * layer.height());
+					layer.decode(layer_temp.data(), palette.access(l), palette.size(l));
+
+					if(iter == 0) {
+						auto &ref = reference_layers[n * Sprite::layer_count + l];
+						if(is_reference)
+							ref = layer_temp;
+						else if(ref.size() != layer_temp.size() ||
+								memcmp(ref.data(), layer_temp.data(),
+									   ref.size() * sizeof(IColor)) != 0)
+							kstats.mismatches++;
+					}
+					kstats.decode_pixels += layer_temp.size();
+				}
+		kstats.decode_time += getTime() - time;
+	}
+}
+
+}
+
+Ex<int> exMain(int argc, char **argv) {
+	string filter;
+	int iterations = 4;
+
+	for(int n = 1; n < argc; n++) {
+		if(strcmp(argv[n], "-f") == 0 && n + 1 < argc)
+			filter = argv[++n];
+		else if(strcmp(argv[n], "-i") == 0 && n + 1 < argc)
+			iterations = max(1, atoi(argv[++n]));
+		else {
+			printf("Usage:\n%s [options]\n\n"
+				   "Options:\n"
+				   "-f filter    Testing only those sprites that match given filter\n"
+				   "-i count     Number of iterations per sprite (default: 4)\n\n",
+				   argv[0]);
+			return 0;
+		}
+	}
+
+	const char *prefix = "data/sprites/";
+	auto file_names = findFiles(prefix, FindFileOpt::regular_file | FindFileOpt::recursive);
+	makeSorted(file_names);
+
+	auto default_kernel = PackedTexture::decodeKernel();
+	EnumMap<DecodeKernel, KernelStats> stats;
+	int sprite_count = 0;
+
+	for(auto &entry : file_names) {
+		string name = (string)entry.path;
+		if(name.find(filter) == string::npos || !removeSuffix(name, ".sprite"))
+			continue;
+
+		auto loader = EX_PASS(fileLoader(entry.path));
+		Sprite sprite;
+		EXPECT(sprite.load(loader));
+		benchSprite(sprite, iterations, stats);
+		if(++sprite_count % 50 == 0) {
+			printf(".");
+			fflush(stdout);
+		}
+	}
+	PackedTexture::setDecodeKernel(default_kernel);
+	printf("\nSprites: %d  iterations: %d  default kernel: %s\n\n", sprite_count, iterations,
+		   toString(default_kernel));
+
+	printf("%-8s  %14s  %16s  %10s\n", "kernel", "blit MPix/s", "decode MPix/s", "mismatches");
+	for(auto kernel : all<DecodeKernel>) {
+		if(!PackedTexture::isSupported(kernel))
+			continue;
+		auto &kstats = stats[kernel];
+		auto mpix = [](i64 pixels, double time) {
+			return time > 0.0 ? pixels / time * 1e-6 : 0.0;
+		};
+		printf("%-8s  %14.2f  %16.2f  %10d\n", toString(kernel),
+			   mpix(kstats.blit_pixels, kstats.blit_time),
+			   mpix(kstats.decode_pixels, kstats.decode_time), kstats.mismatches);
+	}
+
+	for(auto kernel : all<DecodeKernel>)
+		if(stats[kernel].mismatches)
+			return 1;
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	auto result = exMain(argc, argv);
+	if(!result) {
+		result.error().print();
+		return 1;
+	}
+	return *result;
+}
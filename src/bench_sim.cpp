@@ -0,0 +1,317 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+// Headless benchmark of world simulation on real maps.
+// Map is loaded in server mode (without GfxDevice) with death match game mode; additional AI
+// actors are spawned & whole world is simulated for a fixed number of ticks with constant time
+// step. Results (ms/tick percentiles for each phase & allocations per tick) are printed as
+// a table and saved in JSON format. With -zero_alloc measured ticks are expected not to allocate
+// through operator new; allocations are reported per tag. Storage of fwk containers isn't
+// tracked (see sys/alloc_tracker.h).
+
+#include "audio/device.h"
+#include "game/actor.h"
+#include "game/brain.h"
+#include "game/death_match.h"
+#include "game/tile.h"
+#include "game/trigger.h"
+#include "game/world.h"
+#include "res_manager.h"
+#include "sys/alloc_tracker.h"
+#include "sys/profiler.h"
+#include "sys/stats.h"
+
+#include <algorithm>
+#include <fwk/io/file_system.h>
+#include <fwk/sys/expected.h>
+
+using namespace game;
+
+namespace {
+
+DEFINE_ENUM(SimPhase, total, think, grid, navi, game_mode);
+
+// Scope names which are recorded in World::simulate
+const EnumMap<SimPhase, const char *> phase_scopes = {
+	{"World::simulate", "World::think", "World::updateGrid", "World::updateNaviColliders",
+	 "GameMode::tick"}};
+
+struct Sample {
+	EnumMap<SimPhase, double> times; // ms
+	i64 num_allocs, alloc_bytes;
+};
+
+// Places actors in spawn zones (if there are any) or on top of random walkable tiles
+int spawnActors(World &world, int count, const Proto &proto, int num_factions) {
+	vector<FBox> spawn_boxes;
+	for(int n = 0; n < world.entityCount(); n++)
+		if(auto *trigger = world.refEntity<Trigger>(n))
+			if(trigger->classId() == TriggerClassId::spawn_zone)
+				spawn_boxes.emplace_back(trigger->boundingBox());
+	if(spawn_boxes.empty()) {
+		auto &tile_map = world.tileMap();
+		for(int n = 0; n < tile_map.size(); n++) {
+			auto &object = tile_map[n];
+			if(object.ptr && Flags::test(object.ptr->flags(), Flags::walkable_tile)) {
+				FBox bbox = object.bbox;
+				spawn_boxes.emplace_back(float3(bbox.x(), bbox.ey(), bbox.z()),
+										 float3(bbox.ex(), bbox.ey() + 1.0f, bbox.ez()));
+			}
+		}
+	}
+	if(spawn_boxes.empty())
+		return 0;
+
+	int num_spawned = 0;
+	for(int n = 0; n < count; n++) {
+		ActorInventory inventory;
+		PEntity entity = (PEntity) new Actor(proto, inventory);
+		float3 bbox_size = entity->bboxSize();
+
+		bool found = false;
+		for(int it = 0; it < 100 && !found; it++) {
+			FBox box = spawn_boxes[rand() % spawn_boxes.size()];
+			float3 pos = box.min() + float3(frand() * max(0.0f, box.width() - bbox_size.x), 1.0f,
+											frand() * max(0.0f, box.depth() - bbox_size.z));
+			if(!world.findAny(FBox(pos, pos + bbox_size), {Flags::all | Flags::colliding}).empty())
+				continue;
+			pos.y -= 1.0f;
+			entity->setPos(pos);
+			found = true;
+		}
+		if(!found)
+			continue;
+
+		EntityRef ref = world.addEntity(std::move(entity));
+		Actor *actor = world.refEntity<Actor>(ref);
+		actor->fixPosition();
+		actor->setFactionId(1 + n % num_factions);
+		actor->attachAI<ActorBrain>(&world);
+		num_spawned++;
+	}
+	return num_spawned;
+}
+
+u64 worldHash(World &world) {
+	u64 hash = 0;
+	for(int n = 0; n < world.entityCount(); n++)
+		if(auto *actor = world.refEntity<Actor>(n)) {
+			float3 pos = actor->pos();
+			int hit_points = actor->hitPoints();
+			hash = hashData(&pos, sizeof(pos), hash);
+			hash = hashData(&hit_points, sizeof(hit_points), hash);
+		}
+	return hash;
+}
+
+}
+
+Ex<int> exMain(int argc, char **argv) {
+	string map_name, output_file, proto_id = "rad_scorpion";
+	int num_actors = 32, num_ticks = 1000, num_warmup = 50, num_factions = 2;
+	unsigned seed = 1;
+	double time_step = 1.0 / 30.0;
+	bool zero_alloc = false, full_think = false;
+
+	for(int n = 1; n < argc; n++) {
+		if(strcmp(argv[n], "-a") == 0 && n + 1 < argc)
+			num_actors = max(0, atoi(argv[++n]));
+		else if(strcmp(argv[n], "-t") == 0 && n + 1 < argc)
+			num_ticks = max(1, atoi(argv[++n]));
+		else if(strcmp(argv[n], "-w") == 0 && n + 1 < argc)
+			num_warmup = max(0, atoi(argv[++n]));
+		else if(strcmp(argv[n], "-f") == 0 && n + 1 < argc)
+			num_factions = max(1, atoi(argv[++n]));
+		else if(strcmp(argv[n], "-s") == 0 && n + 1 < argc)
+			seed = (unsigned)atoi(argv[++n]);
+		else if(strcmp(argv[n], "-dt") == 0 && n + 1 < argc)
+			time_step = clamp(atof(argv[++n]), 0.001, 1.0);
+		else if(strcmp(argv[n], "-p") == 0 && n + 1 < argc)
+			proto_id = argv[++n];
+		else if(strcmp(argv[n], "-o") == 0 && n + 1 < argc)
+			output_file = argv[++n];
+		else if(strcmp(argv[n], "-zero_alloc") == 0)
+			zero_alloc = true;
+		else if(strcmp(argv[n], "-full_think") == 0)
+			full_think = true;
+		else if(argv[n][0] != '-' && map_name.empty())
+			map_name = argv[n];
+		else {
+			map_name.clear();
+			break;
+		}
+	}
+
+	if(map_name.empty()) {
+		printf("Usage:\n%s map_name [options]\n\n"
+			   "Options:\n"
+			   "-a count     Number of spawned AI actors (default: 32)\n"
+			   "-t count     Number of measured ticks (default: 1000)\n"
+			   "-w count     Number of warm-up ticks (default: 50)\n"
+			   "-f count     Number of factions of spawned actors (default: 2)\n"
+			   "-s seed      Random seed (default: 1)\n"
+			   "-dt time     Time step in seconds (default: 1/30)\n"
+			   "-p proto     Proto of spawned actors (default: rad_scorpion)\n"
+			   "-o file      Saves results in JSON format to given file;\n"
+			   "             By default they are printed in the last line of output\n"
+			   "-zero_alloc  Fails if measured ticks allocate with operator new\n"
+			   "             (fwk::vector & PodVector storage isn't tracked)\n"
+			   "-full_think  Disables think scheduling; By default there are no players, so\n"
+			   "             all actors think at the lowest rate\n\n"
+			   "Example: %s mission05.mod -a 64\n",
+			   argv[0], argv[0]);
+		return 0;
+	}
+
+	ResManager res_mgr(none, true);
+	audio::initSoundMap();
+	game::loadData();
+
+	srand(seed);
+	double load_time = getTime();
+	World world(map_name, World::Mode::server);
+	world.assignGameMode<DeathMatchServer>();
+	world.setThinkScheduling(!full_think);
+	load_time = getTime() - load_time;
+
+	EXPECT(findProto(proto_id, ProtoId::actor).isValid());
+	int num_spawned = spawnActors(world, num_actors, getProto(proto_id, ProtoId::actor),
+								  num_factions);
+	printf("Map: %s (loaded in %.2f sec)  spawned actors: %d / %d\n", map_name.c_str(),
+		   load_time, num_spawned, num_actors);
+
+	Profiler::setEnabled(true);
+	AllocTracker::setEnabled(true);
+	vector<Sample> samples;
+	samples.reserve(num_ticks);
+	// Maximum allocations in a single measured tick, for each tag
+	vector<AllocTracker::TagStats> tag_stats;
+	for(int tick = 0; tick < num_warmup + num_ticks; tick++) {
+		i64 num_allocs = AllocTracker::totalCount(), alloc_bytes = AllocTracker::totalBytes();
+		if(zero_alloc && tick >= num_warmup) {
+			NoAllocScope no_alloc;
+			world.simulate(time_step);
+		} else {
+			world.simulate(time_step);
+		}
+		num_allocs = AllocTracker::totalCount() - num_allocs;
+		alloc_bytes = AllocTracker::totalBytes() - alloc_bytes;
+		Profiler::nextFrame();
+		AllocTracker::nextFrame();
+		if(tick < num_warmup)
+			continue;
+
+		for(auto &tag : AllocTracker::stats()) {
+			auto it = std::find_if(begin(tag_stats), end(tag_stats),
+								   [&](auto &stats) { return strcmp(stats.name, tag.name) == 0; });
+			if(it == end(tag_stats))
+				it = tag_stats.insert(end(tag_stats), {tag.name});
+			it->max_count = max(it->max_count, tag.count);
+			it->max_bytes = max(it->max_bytes, tag.bytes);
+			it->total_count += tag.count;
+			it->total_bytes += tag.bytes;
+		}
+
+		Sample sample{};
+		sample.num_allocs = num_allocs;
+		sample.alloc_bytes = alloc_bytes;
+		for(auto &scope : Profiler::frameStats())
+			for(auto phase : all<SimPhase>)
+				if(strcmp(scope.name, phase_scopes[phase]) == 0)
+					sample.times[phase] += scope.avg_ms;
+		// Grid is updated inside think loop
+		sample.times[SimPhase::think] -= sample.times[SimPhase::grid];
+		samples.emplace_back(sample);
+	}
+	Profiler::setEnabled(false);
+	i64 num_violations = AllocTracker::numViolations();
+	AllocTracker::setEnabled(false);
+
+	EnumMap<SimPhase, Percentiles> phase_stats;
+	for(auto phase : all<SimPhase>) {
+		vector<double> values;
+		for(auto &sample : samples)
+			values.emplace_back(sample.times[phase]);
+		phase_stats[phase] = computePercentiles(values);
+	}
+	vector<double> allocs, alloc_kbytes;
+	for(auto &sample : samples) {
+		allocs.emplace_back(double(sample.num_allocs));
+		alloc_kbytes.emplace_back(double(sample.alloc_bytes) / 1024.0);
+	}
+	auto alloc_stats = computePercentiles(allocs);
+	auto alloc_kbyte_stats = computePercentiles(alloc_kbytes);
+	u64 state_hash = worldHash(world);
+
+	printf("\n%-10s  %8s  %8s  %8s  %8s  %8s\n", "phase", "mean", "p50", "p90", "p99", "max");
+	auto printRow = [](const char *name, const Percentiles &stats, const char *fmt) {
+		printf("%-10s ", name);
+		for(double value : {stats.mean, stats.p50, stats.p90, stats.p99, stats.max})
+			printf(fmt, value);
+		printf("\n");
+	};
+	for(auto phase : all<SimPhase>)
+		printRow(toString(phase), phase_stats[phase], "  %8.3f");
+	printRow("allocs", alloc_stats, "  %8.1f");
+	printRow("alloc KB", alloc_kbyte_stats, "  %8.1f");
+	printf("\nTimes in ms per tick; state hash: %016llx\n", (unsigned long long)state_hash);
+
+	std::erase_if(tag_stats, [](auto &stats) { return stats.total_count == 0; });
+	std::sort(begin(tag_stats), end(tag_stats),
+			  [](auto &a, auto &b) { return a.total_bytes > b.total_bytes; });
+	if(!tag_stats.empty()) {
+		printf("\n%-16s  %10s  %10s  %10s  %10s\n", "alloc tag", "allocs/tick", "KB/tick",
+			   "max allocs", "max KB");
+		for(auto &tag : tag_stats)
+			printf("%-16s  %10.1f  %10.2f  %10lld  %10.2f\n", tag.name,
+				   double(tag.total_count) / num_ticks,
+				   double(tag.total_bytes) / 1024.0 / num_ticks, (long long)tag.max_count,
+				   double(tag.max_bytes) / 1024.0);
+	}
+	if(zero_alloc)
+		printf("\nZero-alloc check: %s (%lld tracked allocations in measured ticks)\n",
+			   num_violations ? "FAILED" : "passed", (long long)num_violations);
+
+	TextFormatter json;
+	auto jsonStats = [&](const Percentiles &stats) {
+		json.stdFormat("{\"mean\":%.4f,\"p50\":%.4f,\"p90\":%.4f,\"p99\":%.4f,\"max\":%.4f}",
+					   stats.mean, stats.p50, stats.p90, stats.p99, stats.max);
+	};
+	json.stdFormat("{\"map\":\"%s\",\"actors\":%d,\"spawned\":%d,\"ticks\":%d,\"warmup\":%d,"
+				   "\"seed\":%u,\"time_step\":%.6f,\"load_time\":%.3f,\"state_hash\":\"%016llx\","
+				   "\"ms_per_tick\":{",
+				   map_name.c_str(), num_actors, num_spawned, num_ticks, num_warmup, seed,
+				   time_step, load_time, (unsigned long long)state_hash);
+	for(auto phase : all<SimPhase>) {
+		json.stdFormat("%s\"%s\":", phase == SimPhase::total ? "" : ",", toString(phase));
+		jsonStats(phase_stats[phase]);
+	}
+	json("},\"allocs_per_tick\":");
+	jsonStats(alloc_stats);
+	json(",\"alloc_kbytes_per_tick\":");
+	jsonStats(alloc_kbyte_stats);
+	json(",\"alloc_tags\":{");
+	for(int n = 0; n < (int)tag_stats.size(); n++)
+		json.stdFormat("%s\"%s\":{\"allocs\":%lld,\"bytes\":%lld}", n ? "," : "",
+					   tag_stats[n].name, (long long)tag_stats[n].total_count,
+					   (long long)tag_stats[n].total_bytes);
+	json("}");
+	if(zero_alloc)
+		json.stdFormat(",\"zero_alloc_violations\":%lld", (long long)num_violations);
+	json.stdFormat(",\"think_scheduling\":%s}\n", full_think ? "false" : "true");
+
+	if(output_file.empty())
+		printf("%s", json.text().c_str());
+	else
+		EXPECT(saveFile(output_file, json.text()));
+	return zero_alloc && num_violations > 0 ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+	auto result = exMain(argc, argv);
+	if(!result) {
+		result.error().print();
+		return 1;
+	}
+	return *result;
+}
@@ -0,0 +1,477 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+// Micro-benchmarks of spatial queries: Grid traces & searches, NaviMap path finding and
+// OccluderConfig updates. Each benchmark runs on a synthetic scene (generated from a fixed seed)
+// and on every given map. Inputs are generated up-front; the same inputs are used in every
+// repetition. Cache misses are counted with perf_event_open (where available).
+
+#include "audio/device.h"
+#include "game/tile_map.h"
+#include "game/world.h"
+#include "navi_heightmap.h"
+#include "navi_map.h"
+#include "occluder_map.h"
+#include "res_manager.h"
+
+#include <fwk/sys/expected.h>
+
+#if defined(__linux__)
+#define PERF_COUNTERS
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace game;
+
+namespace {
+
+// Results are accumulated, so that benchmarked code cannot be optimized away
+volatile u64 s_sink = 0;
+
+class CacheMissCounter {
+  public:
+	CacheMissCounter() {
+#ifdef PERF_COUNTERS
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		m_fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+	}
+	~CacheMissCounter() {
+#ifdef PERF_COUNTERS
+		if(m_fd != -1)
+			close(m_fd);
+#endif
+	}
+
+	CacheMissCounter(const CacheMissCounter &) = delete;
+	void operator=(const CacheMissCounter &) = delete;
+
+	bool isValid() const { return m_fd != -1; }
+
+	void start() {
+#ifdef PERF_COUNTERS
+		if(m_fd != -1) {
+			ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+	}
+
+	i64 stop() {
+		i64 value = 0;
+#ifdef PERF_COUNTERS
+		if(m_fd != -1) {
+			ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+			if(read(m_fd, &value, sizeof(value)) != sizeof(value))
+				value = 0;
+		}
+#endif
+		return value;
+	}
+
+  private:
+	int m_fd = -1;
+};
+
+class BenchRunner {
+  public:
+	BenchRunner(double min_time, string filter) : m_min_time(min_time), m_filter(filter) {
+		printf("%-36s  %12s  %12s  %14s\n", "benchmark", "ops", "ns/op", "misses/op");
+	}
+
+	// func performs num_ops operations; It's called repeatedly for at least min_time seconds
+	template <class Func> void run(const string &scene, const char *name, int num_ops, Func func) {
+		string full_name = format("%/%", scene, name);
+		if(num_ops == 0 || full_name.find(m_filter) == string::npos)
+			return;
+
+		func(); // warm-up
+		i64 total_ops = 0, misses = 0;
+		double time = 0.0;
+		while(time < m_min_time) {
+			m_counter.start();
+			double start = getTime();
+			func();
+			time += getTime() - start;
+			misses += m_counter.stop();
+			total_ops += num_ops;
+		}
+
+		printf("%-36s  %12lld  %12.1f", full_name.c_str(), (long long)total_ops,
+			   time * 1e9 / total_ops);
+		if(m_counter.isValid())
+			printf("  %14.2f\n", double(misses) / total_ops);
+		else
+			printf("  %14s\n", "-");
+		fflush(stdout);
+	}
+
+  private:
+	CacheMissCounter m_counter;
+	double m_min_time;
+	string m_filter;
+};
+
+float randomFloat(float min, float max) { return min + frand() * (max - min); }
+
+// City-like scene: floor tiles with buildings made of walls & roofs
+struct SyntheticScene {
+	static constexpr int tile_size = 6, wall_height = 12;
+
+	SyntheticScene(int size) : grid(int2(size, size)), occluders(grid) {
+		static int dummy_object;
+		auto add = [&](const IBox &box, FlagsType flags, vector<IBox> &navi_boxes) {
+			FBox bbox(box);
+			Grid::ObjectDef def(&dummy_object, bbox, (IRect)worldToScreen(bbox),
+								flags | Flags::visible | Flags::colliding);
+			int id = grid.findFreeObject();
+			grid.add(id, def);
+			navi_boxes.emplace_back(box);
+			return id;
+		};
+
+		int num_tiles = size / tile_size;
+		for(int x = 0; x < num_tiles; x++)
+			for(int z = 0; z < num_tiles; z++) {
+				int3 pos(x * tile_size, 0, z * tile_size);
+				add({pos, pos + int3(tile_size, 1, tile_size)}, Flags::floor_tile, walkable);
+			}
+
+		int num_buildings = num_tiles * num_tiles / 64;
+		for(int n = 0; n < num_buildings; n++) {
+			int2 bsize(2 + rand() % 5, 2 + rand() % 5);
+			int2 bpos(rand() % max(1, num_tiles - bsize.x), rand() % max(1, num_tiles - bsize.y));
+			int3 origin(bpos.x * tile_size, 1, bpos.y * tile_size);
+
+			for(int x = 0; x < bsize.x; x++)
+				for(int z = 0; z < bsize.y; z++) {
+					bool edge_x = x == 0 || x == bsize.x - 1, edge_z = z == 0 || z == bsize.y - 1;
+					// Leaving an entrance in every building
+					if((edge_x || edge_z) && !(x == bsize.x / 2 && z == 0)) {
+						int3 wmin = origin + int3(x, 0, z) * tile_size;
+						int3 wsize(edge_x ? 1 : tile_size, wall_height, edge_z ? 1 : tile_size);
+						if(x == bsize.x - 1 && edge_x)
+							wmin.x += tile_size - 1;
+						if(z == bsize.y - 1 && edge_z)
+							wmin.z += tile_size - 1;
+						add({wmin, wmin + wsize}, Flags::wall_tile, blockers);
+					}
+				}
+
+			int roof_id = -1;
+			for(int x = 0; x < bsize.x; x++)
+				for(int z = 0; z < bsize.y; z++) {
+					int3 rmin = origin + int3(x * tile_size, wall_height, z * tile_size);
+					int id = add({rmin, rmin + int3(tile_size, 1, tile_size)}, Flags::roof_tile,
+								 walkable);
+					if(roof_id == -1)
+						roof_id = id;
+				}
+			if(grid[roof_id].occluder_id == -1)
+				occluders.addOccluder(roof_id, wall_height);
+		}
+
+		grid.updateNodes();
+
+		NaviHeightmap heightmap(grid.dimensions());
+		heightmap.update(walkable, blockers);
+		navi_map.update(heightmap);
+		navi_map.updateReachability();
+	}
+
+	Grid grid;
+	OccluderMap occluders;
+	vector<IBox> walkable, blockers;
+	NaviMap navi_map{3};
+};
+
+struct Scene {
+	string name;
+	const Grid *grid;
+	const OccluderMap *occluders;
+	const NaviMap *navi_map;
+	int (*pixel_intersect)(const Grid &, const int2 &);
+};
+
+// Floor height at given point or -1 if there is nothing below
+float floorHeight(const Grid &grid, const float2 &xz) {
+	float3 top = asXZY(xz, float(Grid::max_height - 1));
+	auto isect = grid.trace(Segment3F(top, asXZY(xz, 0.0f)), -1,
+							Flags::walkable_tile | Flags::colliding);
+	return isect.first == -1 ? -1.0f : top.y - isect.second;
+}
+
+// Spectator positions along a closed Lissajous curve over the whole scene
+vector<FBox> cameraPath(const Grid &grid, int num_points) {
+	vector<FBox> out;
+	float2 size(grid.dimensions());
+	float3 spectator_size(3, 7, 3);
+	for(int n = 0; n < num_points; n++) {
+		float t = float(n) / num_points * 2.0f * pi;
+		float2 xz(size.x * (0.5f + 0.4f * std::sin(t)), size.y * (0.5f + 0.4f * std::sin(2 * t)));
+		float height = floorHeight(grid, xz);
+		if(height >= 0.0f)
+			out.emplace_back(asXZY(xz, height), asXZY(xz, height) + spectator_size);
+	}
+	return out;
+}
+
+// Pairs of shooter & target boxes; targets are placed nearby, so that rays are coherent
+vector<pair<FBox, FBox>> shootingPairs(const Grid &grid, int count) {
+	vector<pair<FBox, FBox>> out;
+	float2 size(grid.dimensions());
+	float3 agent_size(3, 7, 3);
+	for(int it = 0; it < count * 16 && (int)out.size() < count; it++) {
+		float2 src(randomFloat(0, size.x), randomFloat(0, size.y));
+		float2 dst = src + float2(randomFloat(-48, 48), randomFloat(-48, 48));
+		float src_height = floorHeight(grid, src), dst_height = floorHeight(grid, dst);
+		if(src_height < 0.0f || dst_height < 0.0f || distance(src, dst) < 4.0f)
+			continue;
+		float3 src_pos = asXZY(src, src_height + 1.0f), dst_pos = asXZY(dst, dst_height + 1.0f);
+		out.emplace_back(FBox(src_pos, src_pos + agent_size), FBox(dst_pos, dst_pos + agent_size));
+	}
+	return out;
+}
+
+// The same ray patterns, which are used in ThinkingEntity::computeBestShootingRay
+// (25 & 8 rays) and ThinkingEntity::estimateHitChance (256 rays)
+vector<Segment3F> shootingRays(const FBox &source, const FBox &target, int pattern) {
+	vector<Segment3F> out;
+	float3 dir = normalize(target.center() - source.center());
+	if(pattern == 25) {
+		auto sources = genPointsOnPlane(source, dir, 5, true);
+		auto targets = genPointsOnPlane(target, -dir, 5, false);
+		for(auto &src : sources)
+			for(auto &dst : targets)
+				out.emplace_back(src, dst);
+	} else if(pattern == 8) {
+		float3 src = source.center();
+		for(auto &dst : genPointsOnPlane(target, normalize(src - target.center()), 8, false))
+			out.emplace_back(src, dst);
+	} else {
+		int density = 16;
+		float mul = 1.0f / (density - 1);
+		for(int x = 0; x < density; x++)
+			for(int y = 0; y < density; y++) {
+				auto ray_dir = normalize(perturbVector(dir, x * mul, y * mul, 0.05f));
+				out.emplace_back(source.center(), source.center() + ray_dir * 64.0f);
+			}
+	}
+	return out;
+}
+
+struct NaviPair {
+	int3 src, dst;
+	int src_id, dst_id;
+};
+
+vector<NaviPair> reachablePairs(const NaviMap &navi_map, int count) {
+	vector<NaviPair> out;
+	int num_quads = navi_map.quadCount();
+	if(!num_quads)
+		return out;
+
+	auto randomPoint = [&](int &quad_id) {
+		quad_id = rand() % num_quads;
+		auto &quad = navi_map[quad_id];
+		IRect rect = quad.rect;
+		int2 offset(rand() % max(1, rect.width()), rand() % max(1, rect.height()));
+		return asXZY(rect.min() + offset, (int)quad.min_height);
+	};
+
+	for(int it = 0; it < count * 16 && (int)out.size() < count; it++) {
+		NaviPair pair;
+		pair.src = randomPoint(pair.src_id);
+		pair.dst = randomPoint(pair.dst_id);
+		if(!navi_map[pair.src_id].is_disabled && !navi_map[pair.dst_id].is_disabled &&
+		   navi_map.isReachable(pair.src_id, pair.dst_id))
+			out.emplace_back(pair);
+	}
+	return out;
+}
+
+void benchScene(BenchRunner &runner, const Scene &scene, int num_inputs) {
+	auto &grid = *scene.grid;
+	int flags = Flags::all | Flags::colliding;
+
+	auto shooting = shootingPairs(grid, num_inputs);
+	vector<Segment3F> segments;
+	for(auto &[src, dst] : shooting)
+		segments.emplace_back(src.center(), dst.center());
+	runner.run(scene.name, "Grid::trace", segments.size(), [&] {
+		for(auto &segment : segments)
+			s_sink += grid.trace(segment, -1, flags).first;
+	});
+
+	for(int pattern : {25, 8, 256}) {
+		vector<vector<Segment3F>> bundles;
+		int num_rays = 0;
+		for(auto &[src, dst] : shooting) {
+			bundles.emplace_back(shootingRays(src, dst, pattern));
+			num_rays += bundles.back().size();
+		}
+		vector<pair<int, float>> results;
+		auto name = format("Grid::traceCoherent(%)", pattern);
+		runner.run(scene.name, name.c_str(), num_rays, [&] {
+			for(auto &bundle : bundles) {
+				results.resize(bundle.size());
+				grid.traceCoherent(bundle, results, -1, flags);
+				s_sink += results.size();
+			}
+		});
+	}
+
+	vector<FBox> boxes;
+	for(auto &[src, dst] : shooting)
+		boxes.emplace_back(enclose(src, dst));
+	vector<int> found;
+	runner.run(scene.name, "Grid::findAll(box)", boxes.size(), [&] {
+		for(auto &box : boxes) {
+			found.clear();
+			grid.findAll(found, box, -1, flags);
+			s_sink += found.size();
+		}
+	});
+
+	auto path = cameraPath(grid, num_inputs);
+	vector<IRect> view_rects;
+	for(auto &spectator : path) {
+		int2 center = worldToScreen((int3)spectator.center());
+		view_rects.emplace_back(center - int2(400, 300), center + int2(400, 300));
+	}
+	runner.run(scene.name, "Grid::findAll(rect)", view_rects.size(), [&] {
+		for(auto &rect : view_rects) {
+			found.clear();
+			grid.findAll(found, rect, Flags::all | Flags::visible);
+			s_sink += found.size();
+		}
+	});
+
+	vector<int2> pixels;
+	for(auto &rect : view_rects)
+		pixels.emplace_back(rect.min() + int2(rand() % rect.width(), rand() % rect.height()));
+	runner.run(scene.name, "Grid::pixelIntersect", pixels.size(), [&] {
+		for(auto &pixel : pixels)
+			s_sink += scene.pixel_intersect(grid, pixel);
+	});
+
+	if(scene.navi_map) {
+		auto &navi_map = *scene.navi_map;
+		auto pairs = reachablePairs(navi_map, num_inputs);
+		vector<int3> path_points;
+		runner.run(scene.name, "NaviMap::findPath", pairs.size(), [&] {
+			for(auto &pair : pairs) {
+				path_points.clear();
+				s_sink += navi_map.findPath(path_points, pair.src, pair.dst);
+			}
+		});
+		runner.run(scene.name, "NaviMap::findClosestPos", pairs.size(), [&] {
+			for(auto &pair : pairs) {
+				int3 out;
+				IBox target_box(pair.dst - int3(2, 0, 2), pair.dst + int3(2, 4, 2));
+				s_sink += navi_map.findClosestPos(out, pair.src, 4, target_box);
+			}
+		});
+		runner.run(scene.name, "NaviMap::isReachable", pairs.size(), [&] {
+			for(auto &pair : pairs)
+				s_sink += navi_map.isReachable(pair.src, pair.dst);
+		});
+	}
+
+	if(scene.occluders && scene.occluders->size()) {
+		OccluderConfig config(*scene.occluders);
+		runner.run(scene.name, "OccluderConfig::update", path.size(), [&] {
+			for(auto &spectator : path)
+				s_sink += config.update(spectator);
+		});
+	}
+}
+
+}
+
+Ex<int> exMain(int argc, char **argv) {
+	vector<string> map_names;
+	string filter;
+	int synthetic_size = 768, num_inputs = 256;
+	double min_time = 0.25;
+	unsigned seed = 1;
+
+	for(int n = 1; n < argc; n++) {
+		if(strcmp(argv[n], "-m") == 0 && n + 1 < argc)
+			map_names.emplace_back(argv[++n]);
+		else if(strcmp(argv[n], "-f") == 0 && n + 1 < argc)
+			filter = argv[++n];
+		else if(strcmp(argv[n], "-g") == 0 && n + 1 < argc)
+			synthetic_size = clamp(atoi(argv[++n]), 0, 4096);
+		else if(strcmp(argv[n], "-n") == 0 && n + 1 < argc)
+			num_inputs = max(1, atoi(argv[++n]));
+		else if(strcmp(argv[n], "-t") == 0 && n + 1 < argc)
+			min_time = max(0.01, atof(argv[++n]));
+		else if(strcmp(argv[n], "-s") == 0 && n + 1 < argc)
+			seed = (unsigned)atoi(argv[++n]);
+		else {
+			printf("Usage:\n%s [options]\n\n"
+				   "Options:\n"
+				   "-m map       Benchmarks given map too (can be used multiple times)\n"
+				   "-f filter    Runs only benchmarks which match given filter\n"
+				   "-g size      Size of synthetic scene (default: 768; 0 disables it)\n"
+				   "-n count     Number of inputs per benchmark (default: 256)\n"
+				   "-t seconds   Minimum time per benchmark (default: 0.25)\n"
+				   "-s seed      Random seed (default: 1)\n\n",
+				   argv[0]);
+			return 0;
+		}
+	}
+
+	BenchRunner runner(min_time, filter);
+
+	if(synthetic_size > 0) {
+		srand(seed);
+		SyntheticScene synthetic(synthetic_size);
+		Scene scene{format("synthetic%", synthetic_size), &synthetic.grid, &synthetic.occluders,
+					&synthetic.navi_map, [](const Grid &grid, const int2 &pos) {
+						return grid.pixelIntersect(
+							pos, [](const Grid::ObjectDef &, const int2 &) { return true; });
+					}};
+		benchScene(runner, scene, num_inputs);
+	}
+
+	if(!map_names.empty()) {
+		ResManager res_mgr(none, true);
+		audio::initSoundMap();
+		game::loadData();
+
+		for(auto &map_name : map_names) {
+			World world(map_name, World::Mode::server);
+			auto &tile_map = world.tileMap();
+			Scene scene{map_name, &tile_map, &tile_map.occluderMap(), world.naviMap(3),
+						[](const Grid &grid, const int2 &pos) {
+							return static_cast<const TileMap &>(grid).pixelIntersect(
+								pos, Flags::all | Flags::visible);
+						}};
+			srand(seed);
+			benchScene(runner, scene, num_inputs);
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	auto result = exMain(argc, argv);
+	if(!result) {
+		result.error().print();
+		return 1;
+	}
+	return *result;
+}
@@ -4,6 +4,8 @@
 #include "game/sprite.h"
 #include "game/tile.h"
 #include "game/tile_map.h"
+#include "res_pack.h"
+#include "sys/parallel.h"
 
 #include <fwk/io/file_stream.h>
 #include <fwk/io/file_system.h>
@@ -11,8 +13,14 @@
 #include <fwk/sys/on_fail.h>
 
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
 #include <set>
+#include <thread>
 #include <zip.h>
+#include <zlib.h>
 
 using game::Sprite;
 using game::Tile;
@@ -164,51 +172,282 @@ Ex<void> convertResource(ResTypeId type, InputStream &ldr, FileStream &svr, Str
 	return {};
 }
 
-Pair<i64> convertResource(ResTypeId res_type, ZStr src_file_name, ZStr dst_file_name, Str name) {
-	// TODO: errors
-	auto source = fileLoader(src_file_name);
-	if(!source)
-		print("Error while opening file for reading: '%'\n", src_file_name);
-
-	auto target = fileSaver(dst_file_name);
-	if(!target)
-		print("Error while opening file for writing: '%'\n", dst_file_name);
-	auto result = convertResource(res_type, *source, *target, name);
-	if(!result) {
-		print("Error while converting % '%' -> '%':\n", res_type, src_file_name, dst_file_name);
-		result.error().print();
+// Identity of a source file; Output is up to date if source identity matches the one
+// recorded in the manifest during previous conversion
+struct SourceInfo {
+	i64 size = -1, time = 0;
+	u32 hash = 0;
+};
+
+// Text file with single line per converted output: hash size time path
+// All entries are invalidated when converter_version changes
+class Manifest {
+  public:
+	static constexpr int version = 2;
+	// Should be increased whenever output of any converter changes (format, algorithm, etc.)
+	static constexpr int converter_version = 1;
+
+	Manifest(string file_name) : m_file_name(std::move(file_name)) {
+		auto data = loadFile(m_file_name);
+		if(!data)
+			return;
+		data->push_back(0);
+
+		const char *line = data->data();
+		int file_version = 0, file_converter_version = 0;
+		if(sscanf(line, "version %d converter %d", &file_version, &file_converter_version) != 2 ||
+		   file_version != version || file_converter_version != converter_version)
+			return;
+		while((line = strchr(line, '\n'))) {
+			line++;
+			SourceInfo info;
+			long long size, time;
+			int offset = 0;
+			if(sscanf(line, "%x %lld %lld %n", &info.hash, &size, &time, &offset) != 3)
+				continue;
+			const char *end = strchr(line + offset, '\n');
+			info.size = size;
+			info.time = time;
+			m_entries[string(line + offset, end ? end : line + strlen(line))] = info;
+		}
+	}
+
+	Maybe<SourceInfo> find(const string &dst_path) const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_entries.find(dst_path);
+		if(it == m_entries.end())
+			return none;
+		return it->second;
+	}
+
+	void update(const string &dst_path, const SourceInfo &info) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_entries[dst_path] = info;
+	}
+
+	void remove(const string &dst_path) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_entries.erase(dst_path);
+	}
+
+	Ex<void> save() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto saver = EX_PASS(fileSaver(m_file_name));
+		string text = format("version % converter %\n", version, converter_version);
+		for(auto &[path, info] : m_entries)
+			text += stdFormat("%08x %lld %lld %s\n", info.hash, (long long)info.size,
+							  (long long)info.time, path.c_str());
+		saver.saveData(cspan(text));
+		EX_CATCH();
+		return {};
+	}
+
+  private:
+	string m_file_name;
+	std::map<string, SourceInfo> m_entries;
+	mutable std::mutex m_mutex;
+};
+
+class Archive;
+
+struct ConvertTask {
+	ResTypeId type;
+	string name, src_path, dst_path;
+	Archive *archive = nullptr;
+	int archive_index = -1;
+
+	// Filled during reading
+	SourceInfo source;
+	vector<char> data;
+	bool is_up_to_date = false;
+
+	// Filled during conversion
+	i64 dst_size = 0;
+	double time = 0.0;
+	Maybe<Error> error;
+};
+
+// Sources are read (and checked against manifest) on the calling thread, in order; Reading
+// from archives is not thread-safe, so only the calling thread touches them. CPU-bound
+// conversion is done by a pool of workers. Progress is reported in order of tasks.
+class ConvertPipeline {
+  public:
+	using ProgressFunc = std::function<void(const ConvertTask &)>;
+
+	ConvertPipeline(Manifest &manifest, int num_threads, bool force)
+		: m_manifest(manifest), m_num_threads(num_threads), m_force(force) {
+		if(m_num_threads <= 0)
+			m_num_threads = parallelThreadCount();
+	}
+
+	void run(vector<ConvertTask> &tasks, ProgressFunc progress_func) {
+		m_tasks = &tasks;
+		m_progress_func = std::move(progress_func);
+		m_done.assign(tasks.size(), false);
+		m_queue.clear();
+		m_next_report = 0;
+		m_queued_bytes = 0;
+		m_reading_finished = false;
+
+		vector<std::thread> workers;
+		for(int t = 0; t < m_num_threads; t++)
+			workers.emplace_back([this]() { workerLoop(); });
+
+		for(int n = 0; n < (int)tasks.size(); n++) {
+			read(tasks[n]);
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if(tasks[n].is_up_to_date || tasks[n].error) {
+				finish(n);
+				continue;
+			}
+			// Limiting memory used by sources waiting for conversion
+			m_queue_cv.wait(lock, [&]() { return m_queued_bytes < max_queued_bytes; });
+			m_queued_bytes += tasks[n].data.size();
+			m_queue.push_back(n);
+			m_work_cv.notify_one();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_reading_finished = true;
+			m_work_cv.notify_all();
+		}
+		for(auto &worker : workers)
+			worker.join();
+		m_tasks = nullptr;
+	}
+
+  private:
+	static constexpr i64 max_queued_bytes = 256 * 1024 * 1024;
+
+	bool isUpToDate(const ConvertTask &task, bool compare_hash) const {
+		if(m_force || !access(task.dst_path))
+			return false;
+		auto prev = m_manifest.find(task.dst_path);
+		if(!prev || prev->size != task.source.size)
+			return false;
+		return compare_hash ? prev->hash == task.source.hash : prev->time == task.source.time;
+	}
+
+	void read(ConvertTask &task);
+	void convert(ConvertTask &task);
+	void workerLoop();
+	void finish(int index);
+
+	Manifest &m_manifest;
+	vector<ConvertTask> *m_tasks = nullptr;
+	ProgressFunc m_progress_func;
+	int m_num_threads;
+	bool m_force;
+
+	std::mutex m_mutex;
+	std::condition_variable m_work_cv, m_queue_cv;
+	std::deque<int> m_queue;
+	vector<bool> m_done;
+	i64 m_queued_bytes = 0;
+	int m_next_report = 0;
+	bool m_reading_finished = false;
+};
+
+void ConvertPipeline::convert(ConvertTask &task) {
+	double time = getTime();
+	auto result = [&]() -> Ex<void> {
+		auto ldr = memoryLoader(task.data);
+		auto svr = EX_PASS(fileSaver(task.dst_path));
+		EXPECT(convertResource(task.type, ldr, svr, task.name));
+		task.dst_size = svr.size();
+		EX_CATCH();
+		return {};
+	}();
+	task.time = getTime() - time;
+
+	if(result)
+		m_manifest.update(task.dst_path, task.source);
+	else {
+		m_manifest.remove(task.dst_path);
+		task.error = result.error();
+	}
+}
+
+void ConvertPipeline::workerLoop() {
+	while(true) {
+		int index;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_work_cv.wait(lock, [&]() { return !m_queue.empty() || m_reading_finished; });
+			if(m_queue.empty())
+				return;
+			index = m_queue.front();
+			m_queue.pop_front();
+		}
+
+		auto &task = (*m_tasks)[index];
+		convert(task);
+		i64 data_size = task.data.size();
+		task.data = {};
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queued_bytes -= data_size;
+		m_queue_cv.notify_one();
+		finish(index);
+	}
+}
+
+// Has to be called with locked m_mutex
+void ConvertPipeline::finish(int index) {
+	m_done[index] = true;
+	while(m_next_report < (int)m_done.size() && m_done[m_next_report]) {
+		auto &task = (*m_tasks)[m_next_report++];
+		if(m_progress_func)
+			m_progress_func(task);
+		if(task.error) {
+			print("Error while converting % '%' -> '%':\n", task.type, task.src_path,
+				  task.dst_path);
+			task.error->print();
+		}
+	}
+}
+
+struct ConvertStats {
+	void add(const ConvertTask &task) {
+		if(task.error)
+			errors++;
+		else if(task.is_up_to_date)
+			up_to_date++;
+		else {
+			converted++;
+			src_bytes += task.source.size;
+			dst_bytes += task.dst_size;
+		}
+	}
+
+	void print() const {
+		printf("Converted: %d  up to date: %d  errors: %d\n", converted, up_to_date, errors);
+		printf("Total: %6dKB -> %6dKB\n", int(src_bytes / 1024), int(dst_bytes / 1024));
 	}
-	return {source ? source->size() : 0, target ? target->size() : 0};
+
+	i64 src_bytes = 0, dst_bytes = 0;
+	int converted = 0, up_to_date = 0, errors = 0;
+};
+
+static i64 modificationTime(const string &path) {
+	std::error_code error;
+	auto time = std::filesystem::last_write_time(path, error);
+	return error ? 0 : (i64)time.time_since_epoch().count();
 }
 
 template <ResTypeId res_type>
 void convertDir(const char *src_dir, const char *dst_dir, const char *old_ext, const char *new_ext,
-				bool detailed, const string &filter) {
+				bool detailed, const string &filter, ConvertPipeline &pipeline) {
 	FilePath main_path = FilePath(src_dir).absolute().get();
 
 	printf("Scanning...\n");
 	auto file_names = findFiles(main_path, FindFileOpt::regular_file | FindFileOpt::recursive);
 	makeSorted(file_names);
-	int total_before = 0, total_after = 0;
 
-	printf("Recreating directories...\n");
+	vector<ConvertTask> tasks;
 	for(auto &fname : file_names) {
-		FilePath path = fname.path.relative(main_path);
-		FilePath dir = FilePath(dst_dir) / path.parent();
-		mkdirRecursive(dir).check();
-	}
-
-	if(!detailed) {
-		printf("Converting");
-		fflush(stdout);
-	}
-
-	for(int n = 0; n < file_names.size(); n++) {
-		if(!detailed && n * 100 / file_names.size() > (n - 1) * 100 / file_names.size()) {
-			printf(".");
-			fflush(stdout);
-		}
-		FilePath full_path = file_names[n].path;
+		FilePath full_path = fname.path;
 		if(((const string &)full_path).find(filter) == string::npos)
 			continue;
 
@@ -218,24 +457,40 @@ void convertDir(const char *src_dir, const char *dst_dir, const char *old_ext, c
 
 		if(removeSuffix(lo_name, old_ext)) {
 			name.resize(lo_name.size());
-
-			FilePath new_path = FilePath(dst_dir) / path.parent() / (name + new_ext);
-			FilePath parent = new_path.parent();
-
-			double time = getTime();
-			auto [src_size, dst_size] = convertResource(res_type, full_path, new_path, name);
-			time = getTime() - time;
-			if(detailed)
-				printf("%40s  %6dKB -> %6dKB   %9.4f ms\n", name.c_str(), (int)(src_size / 1024),
-					   (int)(dst_size / 1024), time * 1024.0);
-			total_before += src_size;
-			total_after += dst_size;
+			auto &task = tasks.emplace_back();
+			task.type = res_type;
+			task.name = name;
+			task.src_path = (string)full_path;
+			task.dst_path = (string)(FilePath(dst_dir) / path.parent() / (name + new_ext));
 		}
 	}
 
+	if(!detailed) {
+		printf("Converting");
+		fflush(stdout);
+	}
+
+	ConvertStats stats;
+	int count = 0;
+	pipeline.run(tasks, [&](const ConvertTask &task) {
+		int n = count++;
+		stats.add(task);
+		if(detailed) {
+			if(task.is_up_to_date)
+				printf("%40s  up to date\n", task.name.c_str());
+			else
+				printf("%40s  %6dKB -> %6dKB   %9.4f ms\n", task.name.c_str(),
+					   (int)(task.source.size / 1024), (int)(task.dst_size / 1024),
+					   task.time * 1000.0);
+		} else if(n * 100 / tasks.size() > (n - 1) * 100 / tasks.size()) {
+			printf(".");
+			fflush(stdout);
+		}
+	});
+
 	if(!detailed)
 		printf("\n");
-	printf("Total: %6dKB -> %6dKB\n", total_before / 1024, total_after / 1024);
+	stats.print();
 }
 
 struct ResPath {
@@ -265,12 +520,16 @@ class Archive {
 	Archive(const Archive &) = delete;
 	void operator=(const Archive &) = delete;
 
-	void readFile(int index, vector<char> &data) {
+	struct zip_stat stat(int index) const {
 		DASSERT(index >= 0 && index < m_file_count);
-
 		struct zip_stat stat;
 		int ret = zip_stat_index(m_zip, index, 0, &stat);
 		ASSERT(ret == 0);
+		return stat;
+	}
+
+	void readFile(int index, vector<char> &data) {
+		auto stat = this->stat(index);
 		ASSERT(stat.size < 128 * 1024 * 1024); //TODO: safety check, increase if needed
 		data.resize(stat.size);
 
@@ -298,7 +557,49 @@ class Archive {
 	int m_file_count;
 };
 
-void convertAll(const char *fot_path, const string &filter) {
+void ConvertPipeline::read(ConvertTask &task) {
+	if(task.archive) {
+		// Zip entries carry their own size, time & crc, so there is no need to read them
+		struct zip_stat stat = task.archive->stat(task.archive_index);
+		task.source.size = stat.size;
+		task.source.time = stat.mtime;
+		task.source.hash = stat.crc;
+		task.is_up_to_date = isUpToDate(task, true);
+		if(!task.is_up_to_date)
+			task.archive->readFile(task.archive_index, task.data);
+	} else {
+		std::error_code error;
+		task.source.size = (i64)std::filesystem::file_size(task.src_path, error);
+		task.source.time = modificationTime(task.src_path);
+		if(!error && isUpToDate(task, false)) {
+			task.source.hash = m_manifest.find(task.dst_path)->hash;
+			task.is_up_to_date = true;
+			return;
+		}
+
+		auto data = loadFile(task.src_path);
+		if(!data) {
+			task.error = data.error();
+			return;
+		}
+		task.data = std::move(*data);
+		task.source.size = task.data.size();
+		task.source.hash = crc32(0, (const unsigned char *)task.data.data(), task.data.size());
+
+		// Only modification time has changed (for example after copying)
+		if(isUpToDate(task, true)) {
+			task.is_up_to_date = true;
+			task.data = {};
+			m_manifest.update(task.dst_path, task.source);
+		}
+	}
+
+	if(!task.is_up_to_date)
+		if(auto result = mkdirRecursive(FilePath(task.dst_path).parent()); !result)
+			task.error = result.error();
+}
+
+void convertAll(const char *fot_path, const string &filter, ConvertPipeline &pipeline) {
 	FilePath core_path = (FilePath(fot_path) / "core").absolute().get();
 
 	printf("FOT core: %s\n", core_path.c_str());
@@ -310,7 +611,6 @@ void convertAll(const char *fot_path, const string &filter) {
 
 	std::map<string, string> files[arraySize(s_paths)];
 	bool only_archives = 0;
-	unsigned long long bytes = 0;
 
 	for(int n = 0; n < all_files.size(); n++) {
 		for(int t = 0; t < arraySize(s_paths); t++) {
@@ -334,40 +634,46 @@ void convertAll(const char *fot_path, const string &filter) {
 		}
 	}
 
+	// Printing names of big resources and dots for every MB of small ones
+	unsigned long long bytes = 0;
+	ConvertStats stats;
+	auto progress = [&](const ConvertTask &task) {
+		stats.add(task);
+		bool is_small = task.type == ResTypeId::tile ||
+						(task.archive && task.type == ResTypeId::sound);
+		if(!is_small || bytes > 1024 * 1024) {
+			if(is_small) {
+				printf(".");
+				fflush(stdout);
+			} else {
+				printf("%s%s\n", task.name.c_str(), task.is_up_to_date ? " (up to date)" : "");
+			}
+			bytes = 0;
+		} else {
+			bytes += task.source.size;
+		}
+	};
+
 	printf("Converting plain files...\n");
+	vector<ConvertTask> tasks;
 	for(int t = 0; t < arraySize(s_paths); t++) {
 		ResTypeId type = s_paths[t].type;
 		if(type == ResTypeId::archive)
 			continue;
 
-		FilePath target_dir = s_new_path[type];
-		FilePath src_main_path = core_path / s_paths[t].prefix;
-
-		for(auto it = files[t].begin(); it != files[t].end(); ++it) {
-			FilePath dir = target_dir / FilePath(it->first).parent();
-			mkdirRecursive(dir).check();
-		}
-
 		for(auto it = files[t].begin(); it != files[t].end(); ++it) {
-			auto src_path = format("%/%", core_path, it->second);
-			auto dst_path = format("%/%%", s_new_path[type], it->first, s_new_suffix[type]);
-			auto [src_size, dst_size] = convertResource(type, src_path, dst_path, src_path);
-
-			if(type != ResTypeId::tile || bytes > 1024 * 1024) {
-				if(type == ResTypeId::tile) {
-					printf(".");
-					fflush(stdout);
-				} else {
-					printf("%s\n", it->first.c_str());
-				}
-				bytes = 0;
-			} else {
-				bytes += src_size;
-			}
+			auto &task = tasks.emplace_back();
+			task.type = type;
+			task.src_path = format("%/%", core_path, it->second);
+			task.dst_path = format("%/%%", s_new_path[type], it->first, s_new_suffix[type]);
+			task.name = it->first;
 		}
 	}
+	pipeline.run(tasks, progress);
+	tasks.clear();
 
 	printf("Converting archives...\n");
+	vector<Dynamic<Archive>> archives;
 	for(int t = 0; t < arraySize(s_paths); t++) {
 		ResTypeId type = s_paths[t].type;
 		if(type != ResTypeId::archive)
@@ -379,10 +685,10 @@ void convertAll(const char *fot_path, const string &filter) {
 			snprintf(archive_path, sizeof(archive_path), "%s/%s%s", src_path.c_str(),
 					 it->first.c_str(), s_old_suffix[type]);
 
-			Archive archive(archive_path);
-			printf("Archive %s: %d\n", it->first.c_str(), archive.fileCount());
+			auto &archive = archives.emplace_back(archive_path);
+			printf("Archive %s: %d\n", it->first.c_str(), archive->fileCount());
 
-			vector<string> names = archive.getNames();
+			vector<string> names = archive->getNames();
 			for(int n = 0; n < (int)names.size(); n++) {
 				string name;
 				int tindex = -1;
@@ -405,47 +711,58 @@ void convertAll(const char *fot_path, const string &filter) {
 					continue;
 				ResTypeId type = s_paths[tindex].type;
 
-				vector<char> data;
-				archive.readFile(n, data);
-
-				char dst_path[512];
-				snprintf(dst_path, sizeof(dst_path), "%s/%s%s", s_new_path[type], name.c_str(),
-						 s_new_suffix[type]);
-
-				FilePath dir = FilePath(dst_path).parent();
-				mkdirRecursive(dir).check();
-
-				auto ldr = memoryLoader(data);
-				auto svr = std::move(fileSaver(dst_path).get());
-
-				if((type != ResTypeId::tile && type != ResTypeId::sound) || bytes > 1024 * 1024) {
-					if(type == ResTypeId::tile || type == ResTypeId::sound) {
-						printf(".");
-						fflush(stdout);
-					} else {
-						printf("%s\n", name.c_str());
-					}
-					bytes = 0;
-				} else
-					bytes += ldr.size();
-				auto result = convertResource(type, ldr, svr, name);
-				if(!result)
-					result.error().print();
+				auto &task = tasks.emplace_back();
+				task.type = type;
+				task.name = name;
+				task.src_path = format("%:%", archive_path, names[n]);
+				task.dst_path = format("%/%%", s_new_path[type], name, s_new_suffix[type]);
+				task.archive = &*archive;
+				task.archive_index = n;
 			}
-
-			printf("\n");
 		}
 	}
+	pipeline.run(tasks, progress);
 
+	printf("\n");
+	stats.print();
 	printf("\nDone.\n");
 }
 
+// Puts converted resources into a single pack, which is used by the game instead of
+// separate files from those directories
+Ex<void> createPack(const char *data_dir, const char *pack_name) {
+	const char *dirs[] = {"sprites/", "tiles/", "fonts/", "sounds/", "gui/"};
+	FilePath data_path = FilePath(data_dir).absolute().get();
+
+	printf("Scanning...\n");
+	vector<Pair<string>> files;
+	for(auto *dir : dirs) {
+		auto entries =
+			findFiles(data_path / dir, FindFileOpt::regular_file | FindFileOpt::recursive);
+		for(auto &entry : entries)
+			files.emplace_back((string)entry.path.relative(data_path), (string)entry.path);
+	}
+
+	auto pack_path = data_path / pack_name;
+	printf("Packing %d files into %s...\n", (int)files.size(), pack_path.c_str());
+	double time = getTime();
+	EXPECT(ResPack::create(pack_path, std::move(files)));
+	auto pack = EX_PASS(ResPack::open(pack_path));
+	printf("Done: %d files (%.2f seconds)\n", pack.size(), getTime() - time);
+	return {};
+}
+
 int main(int argc, char **argv) {
 	string command, path, filter;
 	int jobs = 0;
+	bool force = false;
 
 	for(int n = 1; n < argc; n++) {
-		if(strcmp(argv[n], "-f") == 0 && n + 1 < argc) {
+		if(strcmp(argv[n], "-j") == 0 && n + 1 < argc) {
+			jobs = atoi(argv[++n]);
+		} else if(strcmp(argv[n], "-r") == 0) {
+			force = true;
+		} else if(strcmp(argv[n], "-f") == 0 && n + 1 < argc) {
 			ASSERT(filter.empty());
 			filter = argv[++n];
 		} else if(strcmp(argv[n], "-p") == 0 && n + 1 < argc) {
@@ -472,25 +789,31 @@ int main(int argc, char **argv) {
 	}
 #endif
 
+	Manifest manifest("data/convert_manifest.txt");
+	ConvertPipeline pipeline(manifest, jobs, force);
+
 	if(command == "tiles") {
 		if(path.empty())
 			path = "refs/tiles/";
-		convertDir<ResTypeId::tile>(path.c_str(), "data/tiles", ".til", ".tile", 0, filter);
+		convertDir<ResTypeId::tile>(path.c_str(), "data/tiles", ".til", ".tile", 0, filter, pipeline);
 	} else if(command == "maps") {
 		if(path.empty())
 			path = "refs/maps/";
-		convertDir<ResTypeId::map>(path.c_str(), "data/maps/", ".mis", ".xml", 1, filter);
+		convertDir<ResTypeId::map>(path.c_str(), "data/maps/", ".mis", ".xml", 1, filter, pipeline);
 	} else if(command == "sprites") {
 		if(path.empty())
 			path = "refs/sprites/";
-		convertDir<ResTypeId::sprite>(path.c_str(), "data/sprites/", ".spr", ".sprite", 1, filter);
+		convertDir<ResTypeId::sprite>(path.c_str(), "data/sprites/", ".spr", ".sprite", 1, filter, pipeline);
 	} else if(command == "sounds") {
 		if(path.empty())
 			path = "refs/sound/game/";
-		convertDir<ResTypeId::sound>(path.c_str(), "data/sounds/", ".wav", ".wav", 1, filter);
+		convertDir<ResTypeId::sound>(path.c_str(), "data/sounds/", ".wav", ".wav", 1, filter, pipeline);
 	}
 
-	else if(command == "all") {
+	else if(command == "pack") {
+		if(auto result = createPack("data/", "resources.pack"); !result)
+			result.error().print();
+	} else if(command == "all") {
 		if(path.empty())
 			path = "refs/";
 		if(!verifyFTPath(path)) {
@@ -500,7 +823,7 @@ int main(int argc, char **argv) {
 			printf("Invalid path specified\n");
 			return 0;
 		}
-		convertAll(path.c_str(), filter);
+		convertAll(path.c_str(), filter, pipeline);
 
 #ifdef _WIN32
 		MessageBox(0, L"All done!", L"Message", MB_OK);
@@ -510,19 +833,27 @@ int main(int argc, char **argv) {
 			printf("Unknown command: %s\n", command.c_str());
 
 		printf(
-			"Usage:\n%s [options] tiles|sprites|maps|all\n\n"
+			"Usage:\n%s [options] tiles|sprites|maps|all|pack\n\n"
 			"tiles:       converting tiles in .til format from refs/tiles/ directory\n"
 			"sprites:     converting sprites in .spr format from refs/sprites/ directory\n"
 			"maps:        converting maps in .mis format from refs/maps directory\n"
 			"sounds:      copying    sounds in .wav format from refs/sound/game directory\n"
-			"all:         converting everyting (also from .bos files), path has to be specified\n\n"
+			"all:         converting everyting (also from .bos files), path has to be specified\n"
+			"pack:        packing converted sprites, tiles, fonts, sounds & gui images into\n"
+			"             data/resources.pack; it has to be recreated after every conversion\n\n"
 			"Options:\n"
 			"-f filter    Converting only those files that match given filter\n"
 			"-p path      Specify different path\n"
+			"-j count     Number of conversion threads (default: all cores)\n"
+			"-r           Reconverting all files, even if they are up to date\n"
 			"\n",
 			argv[0]);
 		return 0;
 	}
 
+	if(auto result = manifest.save(); !result) {
+		print("Error while saving conversion manifest\n");
+		result.error().print();
+	}
 	return 0;
 }
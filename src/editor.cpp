@@ -297,7 +297,8 @@ class EditorWindow : public Window {
 	double m_start_time = getTime();
 };
 
-void preloadTiles() {
+// Editor keeps pointers to tiles in many places, so they are all kept resident
+vector<ResidencyRef> preloadTiles() {
 	printf("Enumerating tiles\n");
 	auto file_names = findFiles("data/tiles/", FindFileOpt::regular_file | FindFileOpt::recursive);
 
@@ -305,6 +306,8 @@ void preloadTiles() {
 	auto [prefix, suffix] = ResManager::instance().prefixSuffix(ResType::tile);
 	auto current_path = FilePath::current().get(); // TODO
 	FilePath tiles_path = FilePath(prefix).absolute(current_path);
+	auto &res_mgr = ResManager::instance();
+	vector<ResidencyRef> refs;
 
 	for(int n = 0; n < file_names.size(); n++) {
 		ON_FAIL("\nError while loading file: %", file_names[n].path);
@@ -316,10 +319,14 @@ void preloadTiles() {
 
 		FilePath tile_path = file_names[n].path.absolute(current_path).relative(tiles_path);
 		string tile_name = tile_path;
-		if(removeSuffix(tile_name, suffix))
-			ResManager::instance().getTile(tile_name);
+		if(removeSuffix(tile_name, suffix)) {
+			auto index = res_mgr.tileIndex(tile_name);
+			refs.emplace_back(res_mgr.tileRef(index));
+			res_mgr.getTile(index);
+		}
 	}
 	printf("\n");
+	return refs;
 }
 
 Ex<int> exMain() {
@@ -329,7 +336,7 @@ Ex<int> exMain() {
 
 	ResManager res_mgr(gfx_device.device_ref);
 	TextureCache tex_cache(*gfx_device.device_ref);
-	preloadTiles();
+	auto tile_refs = preloadTiles();
 	game::loadData(true);
 
 	EditorWindow window(gfx_device);
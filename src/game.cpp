@@ -3,12 +3,16 @@
 
 #include "audio/device.h"
 #include "game/base.h"
+#include "game/sprite.h"
 #include "io/game_loop.h"
 #include "io/main_menu_loop.h"
 #include "net/server.h"
 #include "res_manager.h"
+#include "sys/alloc_tracker.h"
 #include "sys/config.h"
+#include "sys/frame_allocator.h"
 #include "sys/gfx_device.h"
+#include "sys/profiler.h"
 
 #include <fwk/vulkan/vulkan_window.h>
 
@@ -32,15 +36,25 @@ struct GameApp {
 
 		if(s_is_closing)
 			m_main_loop->exit();
-		if(!m_main_loop->tick(time_diff))
-			return false;
+		{
+			PROFILE_SCOPE("GameApp::tick");
+			if(!m_main_loop->tick(time_diff))
+				return false;
+		}
 
-		int2 window_size = m_gfx_device.window_ref->size();
-		Canvas2D canvas(IRect(window_size), Orient2D::y_down);
-		m_main_loop->draw(canvas);
-		m_gfx_device.drawFrame(canvas).check();
+		{
+			PROFILE_SCOPE("GameApp::draw");
+			int2 window_size = m_gfx_device.window_ref->size();
+			Canvas2D canvas(IRect(window_size), Orient2D::y_down);
+			m_main_loop->draw(canvas);
+			m_gfx_device.drawFrame(canvas).check();
+		}
 		TextureCache::instance().nextFrame().check();
+		Sprite::nextFrame();
 		audio::tick();
+		Profiler::nextFrame();
+		AllocTracker::nextFrame();
+		FrameAllocator::nextFrame();
 		return true;
 	}
 
@@ -59,7 +73,8 @@ Ex<int> exMain(int argc, char **argv) {
 	srand((int)getTime());
 
 	net::ServerConfig server_config;
-	string map_name;
+	string map_name, profile_trace;
+	int profile_frames = 0;
 	bool init_audio = true;
 
 	for(int a = 1; a < argc; a++) {
@@ -78,6 +93,14 @@ Ex<int> exMain(int argc, char **argv) {
 			init_audio = false;
 		else if(strcmp(argv[a], "-fullscreen") == 0)
 			config.fullscreen_on = true;
+		else if(strcmp(argv[a], "-disk_cache") == 0)
+			config.disk_texture_cache = true;
+		else if(strcmp(argv[a], "-profile_trace") == 0) {
+			ASSERT(a + 2 < argc);
+			profile_frames = atoi(argv[a + 1]);
+			profile_trace = argv[a + 2];
+			a += 2;
+		}
 		else if(strcmp(argv[a], "-server") == 0) {
 			ASSERT(a + 1 < argc);
 			auto xml_config = std::move(XmlDocument::load(argv[a + 1]).get()); // TODO
@@ -93,6 +116,9 @@ Ex<int> exMain(int argc, char **argv) {
 		}
 	}
 	config.resolution = vmax(config.resolution, int2(640, 480));
+	Profiler::setEnabled(config.profiler_on);
+	if(!profile_trace.empty())
+		Profiler::captureTrace(profile_trace, profile_frames);
 
 	if(init_audio)
 		audio::initDevice();
@@ -105,9 +131,17 @@ Ex<int> exMain(int argc, char **argv) {
 	if(!console_mode) {
 		gfx_device = EX_PASS(GfxDevice::create("game", config));
 		tex_cache.emplace(*gfx_device->device_ref);
+		tex_cache->setAsyncDecoding(true);
+		Sprite::setPrefetching(true);
 	}
 
 	ResManager res_mgr(gfx_device ? gfx_device->device_ref : Maybe<VDeviceRef>(), console_mode);
+	if(tex_cache && config.disk_texture_cache) {
+		auto file_name = res_mgr.cacheFile("textures.bin");
+		Ex<> result = file_name ? tex_cache->openDiskCache(*file_name) : Ex<>(file_name.error());
+		if(!result)
+			result.error().print();
+	}
 	game::loadData(true);
 	io::PLoop main_loop;
 
@@ -117,8 +151,7 @@ Ex<int> exMain(int argc, char **argv) {
 		printf("Creating server: %s (map: %s)\n", server_config.m_server_name.c_str(),
 			   map_name.c_str());
 		net::PServer server(new net::Server(server_config));
-		PWorld world(new World(map_name, World::Mode::server));
-		server->setWorld(world);
+		server->setWorld(server->makeWorld());
 		main_loop.reset(new io::GameLoop(gfx_device.get(), std::move(server), false));
 		if(console_mode) {
 			handleCtrlC(ctrlCHandler);
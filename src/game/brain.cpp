@@ -7,6 +7,7 @@
 #include "game/turret.h"
 #include "game/weapon.h"
 #include "navi_map.h"
+#include "sys/alloc_tracker.h"
 
 namespace game {
 
@@ -115,6 +116,7 @@ void ActorBrain::informBuddies(EntityRef enemy) {
 }
 
 void ActorBrain::think() {
+	ALLOC_TAG("ai");
 	ThinkingEntity *entity = this->entity();
 	Actor *actor = this->actor();
 	if(!entity)
@@ -93,9 +93,15 @@ void Container::onSoundEvent() {
 	replicateSound(m_proto.sound_ids[sound_type], pos());
 }
 
-void Container::open() { m_target_state = ContainerState::opened; }
+void Container::open() {
+	m_target_state = ContainerState::opened;
+	wakeUp();
+}
 
-void Container::close() { m_target_state = ContainerState::closed; }
+void Container::close() {
+	m_target_state = ContainerState::closed;
+	wakeUp();
+}
 
 void Container::think() {
 	if(m_proto.is_always_opened)
@@ -118,6 +124,13 @@ void Container::think() {
 	}
 }
 
+bool Container::canSleep() const {
+	// Transitions between opening / closing states are finished in onAnimFinished
+	bool in_transition = m_state == ContainerState::opening || m_state == ContainerState::closing;
+	return m_proto.is_always_opened ||
+		   (!m_update_anim && (in_transition || m_target_state == m_state));
+}
+
 void Container::onAnimFinished() {
 	if(m_proto.is_always_opened)
 		return;
@@ -129,6 +142,7 @@ void Container::onAnimFinished() {
 		m_state = ContainerState::closed;
 		m_update_anim = true;
 	}
+	wakeUp();
 }
 
 }
@@ -50,6 +50,7 @@ class Container : public EntityImpl<Container, ContainerProto, EntityId::contain
 
   private:
 	void think() override;
+	bool canSleep() const override;
 	void onAnimFinished() override;
 	void initialize();
 
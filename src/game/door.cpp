@@ -174,6 +174,7 @@ void Door::changeState(DoorState target) {
 		m_bbox = bbox;
 		m_state = result;
 		m_update_anim = true;
+		wakeUp();
 	}
 }
 
@@ -229,6 +230,12 @@ void Door::think() {
 	}
 }
 
+bool Door::canSleep() const {
+	// Sliding doors have to close automatically
+	bool waits_for_close = classId() == DoorClassId::sliding && m_state == DoorState::opened_in;
+	return !m_update_anim && !waits_for_close;
+}
+
 void Door::onAnimFinished() {
 	for(int n = 0; n < arraySize(s_transitions); n++)
 		if(m_state == s_transitions[n].result) {
@@ -237,6 +244,7 @@ void Door::onAnimFinished() {
 			m_update_anim = true;
 			if(m_state == DoorState::opened_in && classId() == DoorClassId::sliding)
 				m_close_time = currentTime() + 3.0;
+			wakeUp();
 			break;
 		}
 }
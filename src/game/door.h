@@ -58,6 +58,7 @@ class Door : public EntityImpl<Door, DoorProto, EntityId::door> {
 	void initializeOpenDir();
 
 	void think() override;
+	bool canSleep() const override;
 	void onAnimFinished() override;
 	FBox computeBBox(DoorState) const;
 	void changeState(DoorState);
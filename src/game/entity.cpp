@@ -6,6 +6,7 @@
 #include "game/sprite.h"
 #include "game/world.h"
 #include "gfx/scene_renderer.h"
+#include "sys/profiler.h"
 #include <fwk/math/rotation.h>
 
 namespace game {
@@ -21,14 +22,17 @@ EntityProto::EntityProto(const TupleParser &parser) : Proto(parser) {
 	description = parser("description");
 }
 
-Entity::Entity(const Sprite &sprite) : m_sprite(sprite), m_pos(0.0f, 0.0f, 0.0f) {
+Entity::Entity(const Sprite &sprite)
+	: m_sprite(sprite), m_sprite_ref(Sprite::residencyRef(sprite.index())),
+	  m_pos(0.0f, 0.0f, 0.0f) {
 	resetAnimState();
 }
 
 Entity::~Entity() = default;
 
 //TODO: redundant initialization?
-Entity::Entity(const Sprite &sprite, CXmlNode node) : m_sprite(sprite) {
+Entity::Entity(const Sprite &sprite, CXmlNode node)
+	: m_sprite(sprite), m_sprite_ref(Sprite::residencyRef(sprite.index())) {
 	m_pos = node.attrib<float3>("pos");
 	resetAnimState();
 	setDirAngle(node.attrib<float>("angle", 0.0f));
@@ -45,7 +49,8 @@ XmlNode Entity::save(XmlNode parent) const {
 static constexpr int flag_compressed = 1, flag_is_looped = 2, flag_is_finished = 4,
 					 flag_has_overlay = 8;
 
-Entity::Entity(const Sprite &sprite, MemoryStream &sr) : EntityWorldProxy(sr), m_sprite(sprite) {
+Entity::Entity(const Sprite &sprite, MemoryStream &sr)
+	: EntityWorldProxy(sr), m_sprite(sprite), m_sprite_ref(Sprite::residencyRef(sprite.index())) {
 	resetAnimState();
 
 	u8 flags;
@@ -70,6 +75,9 @@ Entity::Entity(const Sprite &sprite, MemoryStream &sr) : EntityWorldProxy(sr), m
 		m_oseq_idx = -1;
 		m_oframe_idx = -1;
 	}
+
+	if(m_seq_idx >= 0 && m_seq_idx < m_sprite.size())
+		m_sprite.prefetchSequence(m_seq_idx, m_dir_idx);
 }
 
 void Entity::resetAnimState() {
@@ -125,7 +133,7 @@ const IRect Entity::currentScreenRect() const {
 }
 
 void Entity::addToRender(SceneRenderer &out, Color color) const {
-	//PROFILE("Entity::addToRender");
+	PROFILE_SCOPE("Entity::addToRender");
 	IRect rect = m_sprite.getRect(m_seq_idx, m_frame_idx, m_dir_idx);
 	if(!areOverlapping(out.targetRect(), rect + (int2)worldToScreen(m_pos)))
 		return;
@@ -138,6 +146,15 @@ void Entity::addToRender(SceneRenderer &out, Color color) const {
 
 	FRect tex_rect;
 	auto tex = m_sprite.getFrame(m_seq_idx, m_frame_idx, m_dir_idx, tex_rect);
+	if(tex) {
+		m_rendered_seq_idx = m_seq_idx;
+		m_rendered_frame_idx = m_frame_idx;
+		m_rendered_dir_idx = m_dir_idx;
+	} else if(m_rendered_seq_idx != -1) {
+		rect = m_sprite.getRect(m_rendered_seq_idx, m_rendered_frame_idx, m_rendered_dir_idx);
+		tex = m_sprite.getFrame(m_rendered_seq_idx, m_rendered_frame_idx, m_rendered_dir_idx,
+								tex_rect);
+	}
 	bool added = out.add(tex, rect, m_pos, bbox, color, tex_rect, as_overlay);
 
 	if(added && m_oseq_idx != -1 && m_oframe_idx != -1) {
@@ -205,6 +222,7 @@ void Entity::playSequence(int seq_idx, bool handle_events) {
 		m_seq_idx = seq_idx;
 		m_dir_idx = m_sprite.findDir(m_seq_idx, m_dir_angle);
 		m_is_seq_looped = m_sprite.isSequenceLooped(seq_idx);
+		m_sprite.prefetchSequence(m_seq_idx, m_dir_idx);
 	}
 }
 
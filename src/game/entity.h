@@ -107,8 +107,11 @@ class EntityWorldProxy {
 	void addNewEntity(const float3 &pos, const Args &...args);
 	void addEntity(PEntity &&new_entity);
 
+	// Time since last think; With think scheduling it may span several ticks
 	double timeDelta() const;
 	double currentTime() const;
+	// Wakes entity up if it's sleeping & makes it think every tick for a while
+	void wakeUp();
 	float random() const;
 
 	ObjectRef findAny(const FBox &box, const FindFilter &filter = FindFilter()) const;
@@ -195,6 +198,9 @@ class Entity : public EntityWorldProxy {
 	// Assumes that object is hooked to World
 	virtual void think() {}
 	virtual void nextFrame();
+	// Checked after think; sleeping entities don't think until they're woken up
+	// (nextFrame is still called)
+	virtual bool canSleep() const { return false; }
 
   protected:
 	virtual void onFireEvent(const int3 &projectile_offset) {}
@@ -216,6 +222,7 @@ class Entity : public EntityWorldProxy {
 	const Sprite &m_sprite;
 
   private:
+	ResidencyRef m_sprite_ref;
 	float3 m_pos;
 
 	void handleEventFrame(const Sprite::Frame &);
@@ -228,6 +235,9 @@ class Entity : public EntityWorldProxy {
 	short m_frame_idx, m_oframe_idx; // normal frame, overlay frame
 	bool m_is_seq_looped;
 	bool m_is_seq_finished;
+
+	// Last rendered frame; it's used when current frame is still being decoded
+	mutable short m_rendered_seq_idx = -1, m_rendered_frame_idx = -1, m_rendered_dir_idx = -1;
 };
 
 template <class Type, class ProtoType, EntityId entity_id, class Base = Entity>
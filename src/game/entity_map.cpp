@@ -2,6 +2,8 @@
 // This file is part of FreeFT. See license.txt for details.
 
 #include "entity_map.h"
+
+#include "sys/frame_allocator.h"
 #include <algorithm>
 
 namespace game {
@@ -42,7 +44,7 @@ void EntityMap::updateOccluderId(int object_id) {
 	FBox bbox = object.ptr->boundingBox();
 	bbox = {bbox.x(), 0.0f, bbox.z(), bbox.ex(), max(0.0f, bbox.y()), bbox.ez()};
 
-	vector<int> temp;
+	FrameVector<int> temp;
 	temp.reserve(128);
 	m_tile_map.findAll(temp, bbox);
 
@@ -21,15 +21,16 @@ void EntityRef::load(MemoryStream &sr) {
 	m_unique_id = m_index == -1 ? -1 : decodeInt(sr);
 }
 
-static int getUniqueId() {
-	static int s_counter = 0;
-	return s_counter++;
-}
+static int s_unique_id_counter = 0;
+
+static int getUniqueId() { return s_unique_id_counter++; }
 
 EntityWorldProxy::EntityWorldProxy() : m_index(-1), m_unique_id(getUniqueId()), m_world(nullptr) {}
 
 EntityWorldProxy::EntityWorldProxy(MemoryStream &sr) : m_index(-1), m_world(nullptr) {
 	m_unique_id = decodeInt(sr);
+	// Entities created later shouldn't reuse loaded ids
+	s_unique_id_counter = max(s_unique_id_counter, m_unique_id + 1);
 }
 
 EntityWorldProxy::EntityWorldProxy(const EntityWorldProxy &rhs) : EntityWorldProxy() {}
@@ -113,6 +114,11 @@ double EntityWorldProxy::currentTime() const { return m_world ? m_world->current
 
 float EntityWorldProxy::random() const { return m_world ? m_world->random() : 0.0f; }
 
+void EntityWorldProxy::wakeUp() {
+	if(m_world)
+		m_world->wakeUp(m_index);
+}
+
 bool EntityWorldProxy::isClient() const { return m_world && m_world->isClient(); }
 
 bool EntityWorldProxy::isServer() const { return m_world && m_world->isServer(); }
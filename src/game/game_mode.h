@@ -99,6 +99,7 @@ class GameModeServer : public GameMode {
 	virtual void onClientConnected(int client_id, const string &nick_name);
 	virtual void onClientDisconnected(int client_id);
 	friend class net::Server;
+	friend class ReplayPlayer;
 
 	void replicateClient(int client_id, int target_id = -1);
 };
@@ -2,13 +2,73 @@
 // This file is part of FreeFT. See license.txt for details.
 
 #include "game/level.h"
+
+#include "game/proto.h"
+#include "game/tile.h"
 #include "res_manager.h"
+#include "sys/mapped_file.h"
 #include <algorithm>
+#include <fwk/io/file_stream.h>
 #include <fwk/io/file_system.h>
+#include <fwk/io/memory_stream.h>
 #include <zlib.h>
 
 namespace game {
 
+namespace {
+
+	// Compiled map: header followed by body with sections (offsets are relative to body):
+	// tile names (offsets table & characters), tile instances, occluder boxes & entities
+	// (each prefixed with its size, serialized just like for network replication).
+	// It has to be bumped whenever format or entity serialization changes.
+	constexpr u32 compiled_magic = 0x50414d43; // 'CMAP'
+	constexpr u32 compiled_version = 1;
+
+	struct CompiledHeader {
+		u32 magic, version;
+		u32 source_crc, proto_crc, body_crc, body_size;
+		int2 tile_map_size, entity_map_size;
+		u32 num_tiles, num_instances, num_occluders, num_entities;
+		u32 name_offsets_offset, names_offset, names_size;
+		u32 instances_offset, occluders_offset, entities_offset, entities_size;
+	};
+
+	struct CompiledInstance {
+		int3 pos;
+		int tile_id;
+		int occluder_id;
+	};
+
+	u32 computeCrc(CSpan<char> data, u32 crc = 0) {
+		return crc32(crc, (const unsigned char *)data.data(), data.size());
+	}
+
+	// Entities refer to protos by their indices
+	u32 protoCrc() {
+		u32 crc = 0;
+		for(auto type : all<ProtoId>)
+			for(int n = 0; n < countProtos(type); n++) {
+				auto &id = getProto(n, type).id;
+				crc = computeCrc(CSpan<char>(id.c_str(), (int)id.size() + 1), crc);
+			}
+		return crc;
+	}
+
+	template <class T> u32 appendSection(vector<char> &body, CSpan<T> data) {
+		while(body.size() % 8)
+			body.emplace_back(0);
+		u32 offset = body.size();
+		auto *bytes = (const char *)data.data();
+		body.insert(body.end(), bytes, bytes + data.size() * sizeof(T));
+		return offset;
+	}
+
+	template <class T> Ex<CSpan<T>> section(CSpan<char> body, u32 offset, u32 count) {
+		EXPECT(offset % alignof(T) == 0 && offset + i64(count) * sizeof(T) <= body.size());
+		return CSpan<T>((const T *)(body.data() + offset), (int)count);
+	}
+}
+
 static vector<char> applyPatch(vector<char> &orig, vector<char> &patch) {
 	auto patch_lines = splitLines({patch.data(), patch.size()});
 	vector<Str> out_lines;
@@ -86,11 +146,19 @@ static vector<char> applyPatch(vector<char> &orig, vector<char> &patch) {
 
 Level::Level() : entity_map(tile_map) {}
 
-Ex<void> Level::load(ZStr map_name) {
-	XmlDocument doc;
+void Level::referenceTiles(CSpan<TileIndex> indices) {
+	auto &res_mgr = ResManager::instance();
+	vector<ResidencyRef> refs;
+	refs.reserve(indices.size());
+	for(auto index : indices)
+		refs.emplace_back(res_mgr.tileRef(index));
+	m_tile_refs = std::move(refs);
+}
 
+Ex<void> Level::load(ZStr map_name, const ProgressFunc &tiles_progress) {
 	auto &res_mgr = ResManager::instance();
 
+	vector<char> xml_data;
 	auto file_name = format("maps/%", map_name);
 	if(file_name.ends_with(".mod")) {
 		string orig_file_name = file_name.substr(0, file_name.size() - 4);
@@ -98,15 +166,179 @@ Ex<void> Level::load(ZStr map_name) {
 
 		auto orig = res_mgr.getOther(orig_file_name);
 		auto mod = res_mgr.getOther(file_name);
-		vector<char> patched = applyPatch(orig, mod);
-		doc = EX_PASS(XmlDocument::make(patched));
+		xml_data = applyPatch(orig, mod);
 	} else {
-		auto xml_data = res_mgr.getOther(file_name);
-		doc = EX_PASS(XmlDocument::make(xml_data));
+		xml_data = res_mgr.getOther(file_name);
+	}
+
+	u32 source_crc = computeCrc(xml_data);
+	auto compiled_name = res_mgr.cacheFile(format("maps/%.cmap", map_name));
+	if(compiled_name) {
+		if(auto compiled = MappedFile::open(*compiled_name)) {
+			auto result = loadCompiled(compiled->data(), source_crc, tiles_progress);
+			if(result)
+				return {};
+			// Outdated or broken; it will be recompiled
+		}
 	}
 
+	auto doc = EX_PASS(XmlDocument::make(xml_data));
+
+	// Tiles are loaded in parallel before the tile map is created
+	vector<TileIndex> tile_indices;
+	if(auto tile_map_node = doc.child("tile_map"))
+		for(auto tnode = tile_map_node.child("tile"); tnode; tnode = tnode.sibling("tile"))
+			tile_indices.emplace_back(res_mgr.tileIndex(tnode.attrib("name")));
+	referenceTiles(tile_indices);
+	EXPECT(res_mgr.loadTiles(tile_indices, tiles_progress));
 	EXPECT(tile_map.loadFromXML(doc));
-	return entity_map.loadFromXML(doc);
+	EXPECT(entity_map.loadFromXML(doc));
+
+	if(compiled_name) {
+		auto result = saveCompiled(*compiled_name, source_crc);
+		if(!result) {
+			print("Error while saving compiled map: '%'\n", *compiled_name);
+			result.error().print();
+		}
+	}
+	return {};
+}
+
+Ex<void> Level::loadCompiled(CSpan<char> data, u32 source_crc,
+							 const ProgressFunc &tiles_progress) {
+	EXPECT(data.size() >= (int)sizeof(CompiledHeader));
+	CompiledHeader header;
+	memcpy(&header, data.data(), sizeof(header));
+	EXPECT(header.magic == compiled_magic && header.version == compiled_version);
+	EXPECT(header.source_crc == source_crc);
+	EXPECT(header.proto_crc == protoCrc());
+
+	CSpan<char> body(data.data() + sizeof(header), data.size() - (int)sizeof(header));
+	EXPECT(body.size() == (int)header.body_size && computeCrc(body) == header.body_crc);
+
+	auto name_offsets =
+		EX_PASS(section<u32>(body, header.name_offsets_offset, header.num_tiles + 1));
+	auto names = EX_PASS(section<char>(body, header.names_offset, header.names_size));
+	auto instances = EX_PASS(
+		section<CompiledInstance>(body, header.instances_offset, header.num_instances));
+	auto occluders = EX_PASS(section<FBox>(body, header.occluders_offset, header.num_occluders));
+	auto entities = EX_PASS(section<char>(body, header.entities_offset, header.entities_size));
+
+	auto &res_mgr = ResManager::instance();
+	vector<TileIndex> tile_indices;
+	tile_indices.reserve(header.num_tiles);
+	for(int n = 0; n < (int)header.num_tiles; n++) {
+		u32 begin = name_offsets[n], end = name_offsets[n + 1];
+		EXPECT(begin < end && end <= (u32)names.size() && names[end - 1] == 0);
+		tile_indices.emplace_back(res_mgr.tileIndex(&names[begin]));
+	}
+	referenceTiles(tile_indices);
+	EXPECT(res_mgr.loadTiles(tile_indices, tiles_progress));
+
+	vector<const Tile *> tiles;
+	tiles.reserve(tile_indices.size());
+	for(auto index : tile_indices)
+		tiles.emplace_back(&res_mgr.getTile(index));
+
+	tile_map.occluderMap().clear();
+	tile_map.clear();
+	tile_map.resize(header.tile_map_size);
+	for(auto &instance : instances) {
+		EXPECT(instance.tile_id >= 0 && instance.tile_id < (int)tiles.size());
+		EXPECT(instance.occluder_id >= -1 && instance.occluder_id < (int)occluders.size());
+		int index = tile_map.maybeAdd(*tiles[instance.tile_id], instance.pos);
+		EXPECT(index != -1);
+		tile_map.Grid::operator[](index).occluder_id = instance.occluder_id;
+	}
+	EXPECT(tile_map.occluderMap().assign(occluders));
+
+	entity_map.clear();
+	entity_map.resize(header.entity_map_size);
+	auto loader = memoryLoader(entities);
+	for(int n = 0; n < (int)header.num_entities; n++) {
+		u32 size = 0;
+		loader >> size;
+		EX_CATCH();
+		auto entity_data = EX_PASS(section<char>(entities, loader.pos(), size));
+		auto entity_loader = memoryLoader(entity_data);
+		Dynamic<Entity> new_entity(Entity::construct(entity_loader));
+		EX_CATCH();
+		entity_map.add(std::move(new_entity));
+		loader.seek(loader.pos() + size);
+	}
+	return {};
+}
+
+Ex<void> Level::saveCompiled(ZStr file_name, u32 source_crc) const {
+	CompiledHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = compiled_magic;
+	header.version = compiled_version;
+	header.source_crc = source_crc;
+	header.proto_crc = protoCrc();
+	header.tile_map_size = tile_map.dimensions();
+	header.entity_map_size = entity_map.dimensions();
+
+	HashMap<const Tile *, int> tile_ids;
+	vector<u32> name_offsets = {0};
+	vector<char> names;
+	vector<CompiledInstance> instances;
+
+	for(int n = 0; n < tile_map.size(); n++) {
+		auto &object = tile_map[n];
+		if(!object.ptr)
+			continue;
+		auto it = tile_ids.find(object.ptr);
+		int tile_id = it == tile_ids.end() ? -1 : it->value;
+		if(tile_id == -1) {
+			tile_id = tile_ids.size();
+			tile_ids.emplace(object.ptr, tile_id);
+			auto &name = object.ptr->resourceName();
+			names.insert(names.end(), name.begin(), name.end());
+			names.emplace_back(0);
+			name_offsets.emplace_back(names.size());
+		}
+		instances.emplace_back(int3(object.bbox.min()), tile_id, object.occluder_id);
+	}
+
+	auto &occluder_map = tile_map.occluderMap();
+	vector<FBox> occluders;
+	for(int n = 0; n < occluder_map.size(); n++)
+		occluders.emplace_back(occluder_map[n].bbox);
+
+	vector<char> entities;
+	for(int n = 0; n < entity_map.size(); n++) {
+		auto *entity = entity_map[n].ptr;
+		if(!entity)
+			continue;
+		auto saver = memorySaver();
+		saver << entity->typeId();
+		entity->save(saver);
+		u32 size = saver.data().size();
+		entities.insert(entities.end(), (const char *)&size, (const char *)(&size + 1));
+		insertBack(entities, saver.data());
+		header.num_entities++;
+	}
+
+	vector<char> body;
+	header.num_tiles = tile_ids.size();
+	header.num_instances = instances.size();
+	header.num_occluders = occluders.size();
+	header.name_offsets_offset = appendSection<u32>(body, name_offsets);
+	header.names_offset = appendSection<char>(body, names);
+	header.names_size = names.size();
+	header.instances_offset = appendSection<CompiledInstance>(body, instances);
+	header.occluders_offset = appendSection<FBox>(body, occluders);
+	header.entities_offset = appendSection<char>(body, entities);
+	header.entities_size = entities.size();
+	header.body_size = body.size();
+	header.body_crc = computeCrc(body);
+
+	auto saver = EX_PASS(fileSaver(file_name));
+	saver.saveData(CSpan<char>((const char *)&header, sizeof(header)));
+	saver.saveData(body);
+	EX_CATCH();
+	return {};
 }
 
 Ex<void> Level::save(ZStr file_name) const {
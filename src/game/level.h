@@ -6,20 +6,40 @@
 #include "game/entity_map.h"
 #include "game/tile_map.h"
 #include "occluder_map.h"
+#include "residency.h"
+#include <functional>
 
 namespace game {
 class Level {
   public:
+	using ProgressFunc = std::function<void(float)>;
+
 	Level();
 
 	// Loads maps from .xml and .mod files; .mod maps are essentially
 	// ed scripts that are applied to .xml map with the same base name
 	// map name demo_map.xml -> file data/maps/demo_map.xml
-	Ex<void> load(ZStr map_name);
+	//
+	// Parsed maps are compiled into binary form and kept in cache directory
+	// (cache/maps/demo_map.xml.cmap). Next time, if source map didn't change, compiled
+	// version is used instead.
+	//
+	// Tiles are loaded on multiple threads; tiles_progress is called with values in [0, 1]
+	Ex<void> load(ZStr map_name, const ProgressFunc &tiles_progress = {});
 	Ex<void> save(ZStr map_name) const;
 
+	Ex<void> loadCompiled(CSpan<char> data, u32 source_crc,
+						  const ProgressFunc &tiles_progress = {});
+	Ex<void> saveCompiled(ZStr file_name, u32 source_crc) const;
+
 	TileMap tile_map;
 	EntityMap entity_map;
+
+  private:
+	// Tiles used by the map are kept resident for as long as the level exists
+	void referenceTiles(CSpan<TileIndex>);
+
+	vector<ResidencyRef> m_tile_refs;
 };
 
 }
@@ -0,0 +1,185 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#include "game/replay.h"
+
+#include "game/death_match.h"
+#include "game/game_mode.h"
+#include "net/base.h"
+#include <fwk/io/file_stream.h>
+
+namespace game {
+
+static constexpr u32 replay_version = 2;
+
+void ReplayHeader::save(Stream &sr) const {
+	sr << map_name << game_mode << seed << hash_interval << initial_hash;
+}
+
+void ReplayHeader::load(Stream &sr) {
+	sr >> map_name >> game_mode >> seed >> hash_interval >> initial_hash;
+}
+
+u64 worldStateHash(World &world) {
+	double time = world.currentTime();
+	u64 hash = hashData(&time, sizeof(time));
+
+	char buffer[net::limits::packet_size];
+	for(int n = 0; n < world.entityCount(); n++) {
+		const Entity *entity = world.refEntity(n);
+		if(!entity)
+			continue;
+		auto temp = memorySaver(buffer);
+		encodeInt(temp, n);
+		temp << entity->typeId();
+		entity->save(temp);
+		auto data = temp.data();
+		hash = hashData(data.data(), data.size(), hash);
+	}
+	return hash;
+}
+
+ReplayRecorder::ReplayRecorder(World &world, u32 seed, int hash_interval)
+	: m_events(memorySaver()) {
+	DASSERT(world.isServer() && world.gameModeId());
+	m_header.map_name = world.mapName();
+	m_header.game_mode = *world.gameModeId();
+	m_header.seed = seed;
+	m_header.hash_interval = max(hash_interval, 1);
+	m_header.initial_hash = worldStateHash(world);
+}
+
+void ReplayRecorder::onTick(World &world, double time_diff) {
+	if(time_diff != m_time_step) {
+		m_events << ReplayEventId::time_step << time_diff;
+		m_time_step = time_diff;
+	}
+
+	m_num_ticks++;
+	if(m_num_ticks % m_header.hash_interval == 0)
+		m_events << ReplayEventId::hashed_tick << worldStateHash(world);
+	else
+		m_events << ReplayEventId::tick;
+}
+
+void ReplayRecorder::onMessage(CSpan<char> data, int client_id) {
+	m_events << ReplayEventId::message;
+	encodeInt(m_events, client_id);
+	encodeInt(m_events, data.size());
+	m_events.saveData(data);
+}
+
+void ReplayRecorder::onClientConnected(int client_id, const string &nick_name) {
+	m_events << ReplayEventId::client_connected;
+	encodeInt(m_events, client_id);
+	m_events << nick_name;
+}
+
+void ReplayRecorder::onClientDisconnected(int client_id) {
+	m_events << ReplayEventId::client_disconnected;
+	encodeInt(m_events, client_id);
+}
+
+Ex<> ReplayRecorder::save(ZStr file_name) const {
+	auto saver = EX_PASS(fileSaver(file_name));
+	saver.saveSignature("REPL");
+	saver << replay_version;
+	m_header.save(saver);
+	auto events = m_events.data();
+	saver << u32(events.size());
+	saver.saveData(events);
+	EX_CATCH();
+	return {};
+}
+
+ReplayPlayer::ReplayPlayer(ReplayHeader header, vector<char> events)
+	: m_header(std::move(header)), m_events(memoryLoader(std::move(events))) {}
+
+Ex<ReplayPlayer> ReplayPlayer::load(ZStr file_name) {
+	auto loader = EX_PASS(fileLoader(file_name));
+	EXPECT(loader.loadSignature("REPL"));
+
+	u32 version = 0, size = 0;
+	loader >> version;
+	EX_CATCH();
+	EXPECT(version == replay_version);
+
+	ReplayHeader header;
+	header.load(loader);
+	loader >> size;
+	EX_CATCH();
+	EXPECT(header.hash_interval >= 1 && size <= loader.size() - loader.pos());
+
+	vector<char> events(size);
+	loader.loadData(events);
+	EX_CATCH();
+	return ReplayPlayer(std::move(header), std::move(events));
+}
+
+Ex<PWorld> ReplayPlayer::makeWorld() {
+	EXPECT(m_header.game_mode == GameModeId::death_match);
+	// Same order as on the server: entities draw from RNG when they are created
+	srand(m_header.seed);
+	PWorld world(new World(m_header.map_name, World::Mode::server));
+	world->assignGameMode<DeathMatchServer>();
+	if(worldStateHash(*world) != m_header.initial_hash)
+		m_diverged_tick = 0;
+	return world;
+}
+
+Ex<bool> ReplayPlayer::tick(World &world) {
+	auto *game_mode = dynamic_cast<GameModeServer *>(world.gameMode());
+	EXPECT(game_mode);
+
+	while(!m_events.atEnd()) {
+		ReplayEventId event_id;
+		m_events >> event_id;
+		EX_CATCH();
+
+		switch(event_id) {
+		case ReplayEventId::time_step:
+			m_events >> m_time_step;
+			break;
+		case ReplayEventId::message: {
+			int client_id = decodeInt(m_events);
+			int size = decodeInt(m_events);
+			EXPECT(size >= 0 && size <= m_events.size() - m_events.pos());
+			vector<char> data(size);
+			m_events.loadData(data);
+			auto message = memoryLoader(std::move(data));
+			world.onMessage(message, client_id);
+		} break;
+		case ReplayEventId::client_connected: {
+			int client_id = decodeInt(m_events);
+			string nick_name;
+			m_events >> nick_name;
+			game_mode->onClientConnected(client_id, nick_name);
+		} break;
+		case ReplayEventId::client_disconnected:
+			game_mode->onClientDisconnected(decodeInt(m_events));
+			break;
+		case ReplayEventId::tick:
+		case ReplayEventId::hashed_tick: {
+			u64 hash = 0;
+			if(event_id == ReplayEventId::hashed_tick)
+				m_events >> hash;
+			EX_CATCH();
+			EXPECT(m_time_step > 0.0);
+
+			world.simulate(m_time_step);
+			m_current_tick++;
+			if(event_id == ReplayEventId::hashed_tick) {
+				m_num_hashed_ticks++;
+				if(!m_diverged_tick && worldStateHash(world) != hash)
+					m_diverged_tick = m_current_tick;
+			}
+			return true;
+		}
+		}
+		EX_CATCH();
+	}
+
+	return false;
+}
+
+}
@@ -0,0 +1,88 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#pragma once
+
+#include "game/world.h"
+
+namespace game {
+
+// Deterministic record & replay of server sessions.
+//
+// Global RNG (which is used by whole simulation, World::random included) is reseeded right
+// before the world is created, because entities draw from it in their constructors.
+// Recording starts after world is loaded & game mode is assigned: hash of initial world state
+// is stored & from then on every input of the simulation is logged: time step of each
+// World::simulate, messages received from clients (orders, client updates) and clients
+// connecting & disconnecting. Every hash_interval ticks a hash of world state is logged as
+// well, so that replay can detect divergence.
+//
+// Replay is only bit-exact if the same binary & data files are used and nothing else in the
+// process calls rand() between ticks (which holds for console servers).
+DEFINE_ENUM(ReplayEventId, time_step, tick, hashed_tick, message, client_connected,
+			client_disconnected);
+
+struct ReplayHeader {
+	void save(Stream &) const;
+	void load(Stream &);
+
+	string map_name;
+	GameModeId game_mode = GameModeId::death_match;
+	u32 seed = 0;
+	int hash_interval = 1;
+	u64 initial_hash = 0;
+};
+
+// Hashes serialized state of all entities & world time
+u64 worldStateHash(World &);
+
+class ReplayRecorder {
+  public:
+	// World should be created right after reseeding RNG with given seed
+	ReplayRecorder(World &, u32 seed, int hash_interval = 1);
+
+	// Called by World at the end of simulate
+	void onTick(World &, double time_diff);
+	void onMessage(CSpan<char> data, int client_id);
+	void onClientConnected(int client_id, const string &nick_name);
+	void onClientDisconnected(int client_id);
+
+	int numTicks() const { return m_num_ticks; }
+	Ex<> save(ZStr file_name) const;
+
+  private:
+	ReplayHeader m_header;
+	MemoryStream m_events;
+	double m_time_step = 0.0;
+	int m_num_ticks = 0;
+};
+
+class ReplayPlayer {
+  public:
+	static Ex<ReplayPlayer> load(ZStr file_name);
+
+	const ReplayHeader &header() const { return m_header; }
+
+	// Reseeds RNG, loads the map & assigns game mode; If initial world state differs from
+	// the recorded one, replay is marked as diverged at tick 0
+	Ex<PWorld> makeWorld();
+
+	// Applies logged events & simulates single tick; Returns false at the end of the log
+	Ex<bool> tick(World &);
+
+	int currentTick() const { return m_current_tick; }
+	int numHashedTicks() const { return m_num_hashed_ticks; }
+	// First tick after which world state differed from the recorded one (0: initial state)
+	Maybe<int> divergedTick() const { return m_diverged_tick; }
+
+  private:
+	ReplayPlayer(ReplayHeader, vector<char> events);
+
+	ReplayHeader m_header;
+	MemoryStream m_events;
+	double m_time_step = 0.0;
+	int m_current_tick = 0, m_num_hashed_ticks = 0;
+	Maybe<int> m_diverged_tick;
+};
+
+}
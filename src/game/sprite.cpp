@@ -3,11 +3,17 @@
 
 #include "game/sprite.h"
 
+#include "sys/profiler.h"
 #include <fwk/gfx/image.h>
 #include <fwk/io/file_stream.h>
+#include <fwk/io/memory_stream.h>
 #include <fwk/math/rotation.h>
 
 namespace game {
+
+// Marks offset table at the end of sprite file
+static constexpr u32 offsets_magic = 0x46465351; // 'QSFF'
+
 static const char *s_event_names[6] = {
 	"step_left", "step_right", "hit", "fire", "sound", "pickup",
 };
@@ -41,7 +47,7 @@ int Sprite::Frame::paramCount(char id) {
 
 Sprite::Sprite() : m_bbox(0, 0, 0), m_offset(0, 0), m_is_partial(false), m_index(-1) {}
 
-Ex<Sprite::Sequence> Sprite::Sequence::load(FileStream &sr) {
+Ex<Sprite::Sequence> Sprite::Sequence::load(Stream &sr) {
 	Sequence out;
 	out.name = EX_PASS(loadString(sr));
 	sr.unpack(out.frame_count, out.dir_count, out.first_frame, out.palette_id, out.overlay_id);
@@ -53,7 +59,7 @@ void Sprite::Sequence::save(FileStream &sr) const {
 	sr.pack(frame_count, dir_count, first_frame, palette_id, overlay_id);
 }
 
-Ex<Sprite::MultiPalette> Sprite::MultiPalette::load(FileStream &sr) {
+Ex<Sprite::MultiPalette> Sprite::MultiPalette::load(Stream &sr) {
 	MultiPalette out;
 	u32 size = 0;
 	sr >> size;
@@ -69,7 +75,7 @@ void Sprite::MultiPalette::save(FileStream &sr) const {
 	sr.saveData(offset);
 }
 
-Ex<void> Sprite::MultiImage::load(FileStream &sr) {
+Ex<void> Sprite::MultiImage::load(Stream &sr) {
 	for(auto &image : images)
 		image = EX_PASS(PackedTexture::load(sr));
 	sr.loadData(points);
@@ -114,6 +120,18 @@ void Sprite::MultiImage::cacheUpload(Image &image) const {
 	}
 }
 
+u64 Sprite::MultiImage::persistentKey() const {
+	DASSERT(prev_palette);
+	int header[5] = {rect.x(), rect.y(), rect.ex(), rect.ey(), layer_count};
+	u64 key = hashData(header, sizeof(header), 's');
+	for(int l = 0; l < layer_count; l++) {
+		key = images[l].hash(key);
+		key = hashData(&points[l], sizeof(points[l]), key);
+		key = hashData(prev_palette->access(l), prev_palette->size(l) * sizeof(Color), key);
+	}
+	return key ? key : 1;
+}
+
 PVImageView Sprite::MultiImage::toTexture(const MultiPalette &palette, FRect &tex_rect,
 										  bool put_in_atlas) const {
 	if(cacheId() == -1) {
@@ -124,6 +142,14 @@ PVImageView Sprite::MultiImage::toTexture(const MultiPalette &palette, FRect &te
 	return accessTexture(tex_rect, put_in_atlas);
 }
 
+void Sprite::MultiImage::prefetch(const MultiPalette &palette) const {
+	if(cacheId() == -1) {
+		prev_palette = &palette;
+		bindToCache();
+	}
+	prefetchTexture();
+}
+
 bool Sprite::MultiImage::testPixel(const int2 &screen_pos) const {
 	if(!rect.containsCell(screen_pos))
 		return false;
@@ -133,7 +159,7 @@ bool Sprite::MultiImage::testPixel(const int2 &screen_pos) const {
 	return false;
 }
 
-Ex<void> Sprite::load(FileStream &sr, bool full_load) {
+Ex<void> Sprite::load(Stream &sr, SpriteLoadMode mode) {
 	EXPECT(sr.loadSignature("SPRITE"));
 
 	sr.unpack(m_offset, m_bbox);
@@ -147,24 +173,158 @@ Ex<void> Sprite::load(FileStream &sr, bool full_load) {
 	sr.loadData(m_frames);
 	sr >> m_max_rect;
 
-	m_is_partial = !full_load;
-	if(full_load) {
-		sr >> size;
-		m_palettes.reserve(size);
-		for(int n : intRange(size))
-			m_palettes.emplace_back(EX_PASS(MultiPalette::load(sr)));
-
-		sr >> size;
-		m_images.resize(size);
-		for(auto &image : m_images)
-			EXPECT(image.load(sr));
-	} else {
-		m_palettes.clear();
-		m_images.clear();
+	m_palettes.clear();
+	m_images.clear();
+	m_image_offsets.clear();
+	m_seq_last_use.clear();
+	m_image_refs.clear();
+	m_data = {};
+
+	m_is_partial = mode == SpriteLoadMode::partial;
+	if(m_is_partial)
+		return {};
+
+	sr >> size;
+	m_palettes.reserve(size);
+	for(int n : intRange(size))
+		m_palettes.emplace_back(EX_PASS(MultiPalette::load(sr)));
+
+	sr >> size;
+	i64 images_pos = sr.pos();
+	if(mode == SpriteLoadMode::lazy && sr.size() - images_pos >= 8) {
+		// Offset table is at the end of the file; files converted earlier don't have it
+		u32 num_offsets = 0, magic = 0;
+		sr.seek(sr.size() - 8);
+		sr >> num_offsets >> magic;
+		i64 table_pos = sr.size() - 8 - i64(num_offsets) * sizeof(i64);
+		if(magic == offsets_magic && num_offsets == size && table_pos >= images_pos) {
+			sr.seek(table_pos);
+			m_image_offsets.resize(size);
+			sr.loadData(m_image_offsets);
+			m_images.resize(size);
+			m_image_refs.resize(size, 0);
+			m_seq_last_use.resize(m_sequences.size(), -1);
+			m_file_name = sr.name();
+			return {};
+		}
+		sr.seek(images_pos);
+	}
+
+	m_images.resize(size);
+	for(auto &image : m_images)
+		EXPECT(image.load(sr));
+	return {};
+}
+
+Ex<void> Sprite::load(CSpan<char> data, SpriteLoadMode mode) {
+	auto ldr = memoryLoader(data);
+	EXPECT(load(ldr, mode));
+	if(isLazy())
+		m_data = data;
+	return {};
+}
+
+void Sprite::sequenceImages(int seq_id, vector<int> &out) const {
+	const Sequence &seq = m_sequences[seq_id];
+	out.clear();
+	for(int n = 0; n < seq.frame_count; n++) {
+		int frame_id = m_frames[seq.first_frame + n].id;
+		if(frame_id >= 0)
+			for(int dir_id = 0; dir_id < seq.dir_count; dir_id++)
+				out.emplace_back(frame_id + dir_id);
+	}
+	makeSortedUnique(out);
+}
+
+bool Sprite::isSequenceLoaded(int seq_id) const {
+	DASSERT(seq_id >= 0 && seq_id < size());
+	return !isLazy() || m_seq_last_use[seq_id] != -1;
+}
+
+Ex<vector<Sprite::MultiImage>> Sprite::readImages(CSpan<int> indices) const {
+	vector<MultiImage> out(indices.size());
+	Maybe<FileStream> file_ldr;
+	Maybe<MemoryStream> memory_ldr;
+	for(int n = 0; n < indices.size(); n++) {
+		int idx = indices[n];
+		EXPECT(idx >= 0 && idx < (int)m_image_offsets.size());
+		Stream *ldr = nullptr;
+		if(!m_data.empty()) {
+			if(!memory_ldr)
+				memory_ldr = memoryLoader(m_data);
+			ldr = &*memory_ldr;
+		} else {
+			if(!file_ldr)
+				file_ldr = EX_PASS(fileLoader(m_file_name));
+			ldr = &*file_ldr;
+		}
+		ldr->seek(m_image_offsets[idx]);
+		EXPECT(out[n].load(*ldr));
+	}
+	return out;
+}
+
+Ex<void> Sprite::loadSequence(int seq_id) const {
+	if(isSequenceLoaded(seq_id))
+		return {};
+	PROFILE_SCOPE("Sprite::loadSequence");
+
+	vector<int> indices, missing;
+	sequenceImages(seq_id, indices);
+	for(int idx : indices) {
+		EXPECT(idx < (int)m_images.size());
+		if(m_image_refs[idx] == 0)
+			missing.emplace_back(idx);
 	}
+	auto images = EX_PASS(readImages(missing));
+
+	for(int n = 0; n < (int)missing.size(); n++)
+		m_images[missing[n]] = images[n];
+	for(int idx : indices)
+		m_image_refs[idx]++;
+	m_seq_last_use[seq_id] = s_frame_id;
+	updateResidency();
 	return {};
 }
 
+void Sprite::installSequence(int seq_id, CSpan<int> indices, CSpan<MultiImage> images) const {
+	DASSERT(indices.size() == images.size());
+	if(isSequenceLoaded(seq_id))
+		return;
+	for(int n = 0; n < indices.size(); n++)
+		if(m_image_refs[indices[n]]++ == 0)
+			m_images[indices[n]] = images[n];
+	m_seq_last_use[seq_id] = s_frame_id;
+	updateResidency();
+}
+
+void Sprite::unloadSequence(int seq_id) const {
+	if(!isLazy() || !isSequenceLoaded(seq_id))
+		return;
+
+	vector<int> indices;
+	sequenceImages(seq_id, indices);
+	for(int idx : indices)
+		if(--m_image_refs[idx] == 0) {
+			m_images[idx].unbindFromCache();
+			m_images[idx] = MultiImage();
+		}
+	m_seq_last_use[seq_id] = -1;
+	updateResidency();
+}
+
+const Sprite::MultiImage &Sprite::accessImage(int seq_id, int frame_id, int dir_id) const {
+	if(isLazy()) {
+		// TODO: pass errors?
+		if(m_seq_last_use[seq_id] == -1)
+			loadSequence(seq_id).check();
+		else if(m_seq_last_use[seq_id] != s_frame_id)
+			updateResidency(true);
+		m_seq_last_use[seq_id] = s_frame_id;
+	}
+	return m_images[imageIndex(seq_id, frame_id, dir_id)];
+}
+
 void Sprite::save(FileStream &sr) const {
 	sr.saveSignature("SPRITE");
 	sr.pack(m_offset, m_bbox);
@@ -178,8 +338,19 @@ void Sprite::save(FileStream &sr) const {
 	for(auto &pal : m_palettes)
 		pal.save(sr);
 	sr << u32(m_images.size());
-	for(auto &image : m_images)
+
+	for(int seq_id : intRange(size()))
+		loadSequence(seq_id).check();
+	vector<i64> offsets;
+	offsets.reserve(m_images.size());
+	for(auto &image : m_images) {
+		offsets.emplace_back(sr.pos());
 		image.save(sr);
+	}
+
+	// Offset table allows loading images lazily
+	sr.saveData(offsets);
+	sr << u32(offsets.size()) << offsets_magic;
 }
 
 void Sprite::clear() {
@@ -220,14 +391,33 @@ PVImageView Sprite::getFrame(int seq_id, int frame_id, int dir_id, FRect &tex_re
 	DASSERT(!isPartial());
 
 	const MultiPalette &palette = m_palettes[m_sequences[seq_id].palette_id];
-	return m_images[imageIndex(seq_id, frame_id, dir_id)].toTexture(palette, tex_rect,
-																	put_in_atlas);
+	return accessImage(seq_id, frame_id, dir_id).toTexture(palette, tex_rect, put_in_atlas);
+}
+
+void Sprite::prefetchSequence(int seq_id, int dir_id) const {
+	if(isPartial())
+		return;
+	// Sequences of lazy sprites are never loaded here; It would read the file during a tick.
+	// Sequence state can only be checked on the main thread.
+	if(isLazy() && (!onMainThread() || !isSequenceLoaded(seq_id))) {
+		prefetchImages(m_index, seq_id);
+		return;
+	}
+	if(!onMainThread() || !TextureCache::isInitialized() ||
+	   !TextureCache::instance().asyncDecoding())
+		return;
+
+	const Sequence &seq = m_sequences[seq_id];
+	const MultiPalette &palette = m_palettes[seq.palette_id];
+	for(int n = 0; n < seq.frame_count; n++)
+		if(m_frames[seq.first_frame + n].id >= 0)
+			accessImage(seq_id, n, dir_id).prefetch(palette);
 }
 
 IRect Sprite::getRect(int seq_id, int frame_id, int dir_id) const {
 	DASSERT(!isPartial());
 
-	return m_images[imageIndex(seq_id, frame_id, dir_id)].rect - m_offset;
+	return accessImage(seq_id, frame_id, dir_id).rect - m_offset;
 }
 
 void Sprite::updateMaxRect() {
@@ -241,8 +431,7 @@ void Sprite::updateMaxRect() {
 }
 
 bool Sprite::testPixel(const int2 &screen_pos, int seq_id, int frame_id, int dir_id) const {
-	const MultiImage &image = m_images[imageIndex(seq_id, frame_id, dir_id)];
-	return image.testPixel(screen_pos + m_offset);
+	return accessImage(seq_id, frame_id, dir_id).testPixel(screen_pos + m_offset);
 }
 
 int Sprite::findSequence(Str name) const {
@@ -280,6 +469,14 @@ int Sprite::memorySize() const {
 	return (int)bytes;
 }
 
+i64 Sprite::imagesMemorySize() const {
+	i64 bytes = 0;
+	for(int n = 0; n < (int)m_images.size(); n++)
+		if(!isLazy() || m_image_refs[n] > 0)
+			bytes += m_images[n].memorySize();
+	return bytes;
+}
+
 void Sprite::printInfo() const {
 	int img_bytes = 0, bytes = memorySize();
 	for(int n = 0; n < (int)m_images.size(); n++)
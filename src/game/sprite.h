@@ -6,15 +6,22 @@
 #include "game/base.h"
 #include "gfx/packed_texture.h"
 #include "gfx/texture_cache.h"
+#include "residency.h"
 
 namespace game {
 
+// partial: only sequences & frames are loaded
+// lazy: images of each sequence are loaded when first accessed (if file has an offset table)
+DEFINE_ENUM(SpriteLoadMode, partial, lazy, full);
+
 //TODO: naming: toTexture, getFrame etc
 class Sprite {
   public:
 	Sprite();
 	template <class InputStream> Ex<void> legacyLoad(InputStream &, Str);
-	Ex<void> load(FileStream &sr, bool full_load = true);
+	Ex<void> load(Stream &sr, SpriteLoadMode = SpriteLoadMode::full);
+	// Data has to stay valid as long as sprite is used (lazy sprites load images from it)
+	Ex<void> load(CSpan<char> data, SpriteLoadMode = SpriteLoadMode::full);
 	void save(FileStream &sr) const;
 
 	enum EventId {
@@ -48,7 +55,7 @@ class Sprite {
 	static_assert(sizeof(Frame) == 12, "Wrong size of Sprite::Frame");
 
 	struct Sequence {
-		static Ex<Sequence> load(FileStream &);
+		static Ex<Sequence> load(Stream &);
 		void save(FileStream &) const;
 
 		string name;
@@ -59,7 +66,7 @@ class Sprite {
 	};
 
 	struct MultiPalette {
-		static Ex<MultiPalette> load(FileStream &);
+		static Ex<MultiPalette> load(Stream &);
 		void save(FileStream &) const;
 
 		int size(int layer) const;
@@ -77,11 +84,13 @@ class Sprite {
 
 		virtual void cacheUpload(Image &) const;
 		virtual int2 textureSize() const { return rect.size(); }
+		virtual u64 persistentKey() const;
 
-		Ex<void> load(FileStream &);
+		Ex<void> load(Stream &);
 		void save(FileStream &) const;
 
 		PVImageView toTexture(const MultiPalette &, FRect &, bool put_in_atlas = true) const;
+		void prefetch(const MultiPalette &) const;
 		bool testPixel(const int2 &) const;
 		int memorySize() const;
 
@@ -104,11 +113,23 @@ class Sprite {
 
 	PVImageView getFrame(int seq_id, int frame_id, int dir_id, FRect &tex_rect,
 						 bool put_in_atlas = true) const;
+	// Starts decoding frames of given sequence in the background (if TextureCache allows it);
+	// Images of lazy sequences which aren't loaded yet are only read (if prefetching is enabled)
+	// Can be called from any thread; Textures are only prefetched on the main thread
+	void prefetchSequence(int seq_id, int dir_id) const;
+
+	bool isLazy() const { return !m_image_offsets.empty(); }
+	bool isSequenceLoaded(int seq_id) const;
+	// Lazy sprites: images are shared between sequences and freed when no loaded sequence uses them
+	Ex<void> loadSequence(int seq_id) const;
+	void unloadSequence(int seq_id) const;
 
 	// Search is case-insensitive
 	int findSequence(Str name) const;
 
 	int memorySize() const;
+	// Memory used by loaded images
+	i64 imagesMemorySize() const;
 	void printInfo() const;
 	void printSequencesInfo() const;
 	void printSequenceInfo(int seq_id) const;
@@ -122,6 +143,7 @@ class Sprite {
 		return m_frames[m_sequences[seq_id].first_frame + frame_id];
 	}
 
+	// Images of lazy sprites may be empty if their sequences are not loaded
 	int imageCount() const { return m_images.size(); }
 	const MultiImage &image(int id) const { return m_images[id]; }
 
@@ -135,8 +157,7 @@ class Sprite {
 	static TextureCache cache;
 
 	// Preloads basic information of all sprites
-	// load sprites in full, when requested
-	// TODO: add free/unload functions
+	// load sprites lazily, when requested
 	static void initMap();
 	static int count();
 	static int find(const string &name);
@@ -146,6 +167,23 @@ class Sprite {
 	static const Sprite &getDummy();
 	static bool isValidIndex(int idx);
 
+	// Should be called every frame; periodically unloads sequences which weren't used
+	// for more than max_idle_frames
+	static void nextFrame(int max_idle_frames = 60 * 60);
+	// Returns number of unloaded sequences
+	static int unloadIdleSequences(int max_idle_frames);
+
+	// Referenced sprites (used by live entities) stay resident; When memory used by sprite
+	// images goes over the budget, unreferenced lazy sprites are unloaded (LRU first)
+	static ResidencyRef residencyRef(int idx);
+
+	// Images of lazy sequences passed to prefetchSequence are read on a background thread &
+	// installed in nextFrame; Sequences accessed before that are still loaded synchronously
+	// (visible in profiler as Sprite::loadSequence). Disabled by default (servers don't need it).
+	static void setPrefetching(bool enable);
+	// Returns number of unloaded sprites
+	static int trimResidency();
+
 	bool isPartial() const { return m_is_partial; }
 	int index() const { return m_index; }
 	void setIndex(int index) { m_index = index; }
@@ -153,12 +191,35 @@ class Sprite {
 	void setResourceName(const string &name) { m_resource_name = name; }
 
   private:
+	const MultiImage &accessImage(int seq_id, int frame_id, int dir_id) const;
+	void sequenceImages(int seq_id, vector<int> &out) const;
+	void updateResidency(bool touch_only = false) const;
+
+	// Only uses data which doesn't change after loading, so it can be called from any thread
+	Ex<vector<MultiImage>> readImages(CSpan<int> indices) const;
+	// Loads given sequence (if it's not loaded yet) using images read by readImages
+	void installSequence(int seq_id, CSpan<int> indices, CSpan<MultiImage> images) const;
+
+	static bool onMainThread();
+	static void prefetchImages(int idx, int seq_id);
+	static void prefetchLoop();
+	static void installPrefetched();
+
+	static int s_frame_id;
+
 	vector<Sequence> m_sequences;
 	vector<Frame> m_frames;
 	vector<MultiPalette> m_palettes;
-	vector<MultiImage> m_images;
+	mutable vector<MultiImage> m_images; // lazy sprites load & free them in const methods
 	string m_resource_name;
 
+	// Only for lazy sprites
+	vector<i64> m_image_offsets;
+	mutable vector<int> m_seq_last_use; // -1: not loaded
+	mutable vector<u16> m_image_refs;
+	string m_file_name;
+	CSpan<char> m_data; // Used instead of file if not empty
+
 	IRect m_max_rect;
 	int2 m_offset;
 	int3 m_bbox; //TODO: naming
@@ -2,62 +2,238 @@
 // This file is part of FreeFT. See license.txt for details.
 
 #include "game/sprite.h"
+#include "res_manager.h"
+#include <condition_variable>
 #include <cstdio>
 #include <cstring>
+#include <fwk/hash_map.h>
 #include <fwk/io/file_stream.h>
 #include <fwk/io/file_system.h>
-#include <map>
+#include <mutex>
+#include <thread>
 
 namespace game {
 
 namespace {
 	const char *s_prefix = "data/sprites/";
+	const char *s_pack_prefix = "sprites/";
 	const char *s_suffix = ".sprite";
 
-	std::map<string, int> s_sprite_map;
-	std::map<string, int> s_locase_sprite_map;
+	HashMap<string, int> s_sprite_map;
+	HashMap<string, int> s_locase_sprite_map;
 	vector<Sprite> s_sprites;
+
+	ResidencyTracker &spriteResidency() {
+		static ResidencyTracker tracker(ResidencyCategory::sprite_images);
+		return tracker;
+	}
+
+	// Protects loading of sprites: entities (and their sprites) are also created by level
+	// loading thread, while main thread goes over all sprites in unloadIdleSequences
+	std::mutex s_load_mutex;
+	std::thread::id s_main_thread;
+
+	// Sequences are requested from any thread; read images are installed on the main thread
+	struct Prefetcher {
+		~Prefetcher() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stop = true;
+			}
+			cond.notify_all();
+			if(thread.joinable())
+				thread.join();
+		}
+
+		std::mutex mutex;
+		std::condition_variable cond;
+		std::thread thread;
+		struct Done {
+			int idx, seq_id;
+			vector<int> indices;
+			vector<Sprite::MultiImage> images;
+		};
+
+		// Mutex has to be locked
+		void removePending(int idx, int seq_id) {
+			for(int n = 0; n < (int)pending.size(); n++)
+				if(pending[n] == pair<int, int>(idx, seq_id)) {
+					pending.erase(pending.begin() + n);
+					break;
+				}
+		}
+
+		vector<pair<int, int>> queue;	// sprite & sequence indices
+		vector<pair<int, int>> pending; // queued, being read or waiting for installation
+		vector<Done> done;
+		bool enabled = false, stop = false;
+	};
+
+	Prefetcher s_prefetcher;
 }
 
-static void loadSprite(int idx, bool full) {
+int Sprite::s_frame_id = 0;
+
+static void loadSprite(int idx, SpriteLoadMode mode) {
 	DASSERT(idx >= 0 && idx < (int)s_sprites.size());
 	Sprite &sprite = s_sprites[idx];
 	sprite.setIndex(idx);
 
-	char file_name[1024];
-	snprintf(file_name, sizeof(file_name), "%s%s%s", s_prefix, sprite.resourceName().c_str(),
-			 s_suffix);
-	auto ldr = fileLoader(file_name);
-	ASSERT(ldr); // TODO: proper error handling
-	sprite.load(*ldr, full).check();
+	// Packed sprites are loaded straight from mapped memory
+	auto packed =
+		ResManager::findPacked(format("%%%", s_pack_prefix, sprite.resourceName(), s_suffix));
+	if(packed) {
+		sprite.load(*packed, mode).check();
+	} else {
+		char file_name[1024];
+		snprintf(file_name, sizeof(file_name), "%s%s%s", s_prefix,
+				 sprite.resourceName().c_str(), s_suffix);
+		auto ldr = fileLoader(file_name);
+		ASSERT(ldr); // TODO: proper error handling
+		sprite.load(*ldr, mode).check();
+	}
+	spriteResidency().setResident(idx, sprite.imagesMemorySize());
+}
+
+void Sprite::updateResidency(bool touch_only) const {
+	if(m_index < 0 || m_index >= (int)s_sprites.size() || &s_sprites[m_index] != this)
+		return;
+	if(touch_only)
+		spriteResidency().touch(m_index);
+	else
+		spriteResidency().setResident(m_index, imagesMemorySize());
+}
+
+ResidencyRef Sprite::residencyRef(int idx) {
+	if(!isValidIndex(idx))
+		return {};
+	return ResidencyRef(spriteResidency(), idx);
+}
+
+int Sprite::trimResidency() {
+	return spriteResidency().trim([](int idx) {
+		auto &sprite = s_sprites[idx];
+		if(!sprite.isLazy())
+			return false;
+		for(int seq_id = 0; seq_id < sprite.size(); seq_id++)
+			sprite.unloadSequence(seq_id);
+		return true;
+	});
+}
+
+void Sprite::setPrefetching(bool enable) {
+	std::lock_guard<std::mutex> lock(s_prefetcher.mutex);
+	s_prefetcher.enabled = enable;
+}
+
+bool Sprite::onMainThread() { return std::this_thread::get_id() == s_main_thread; }
+
+// Sprite has to be loaded already (lazily); images of given sequence are read in the background
+void Sprite::prefetchImages(int idx, int seq_id) {
+	if(!isValidIndex(idx))
+		return;
+
+	std::lock_guard<std::mutex> lock(s_prefetcher.mutex);
+	auto &pf = s_prefetcher;
+	if(!pf.enabled)
+		return;
+	pair<int, int> request(idx, seq_id);
+	if(isOneOf(request, pf.pending))
+		return;
+	pf.pending.emplace_back(request);
+	pf.queue.emplace_back(request);
+	if(!pf.thread.joinable())
+		pf.thread = std::thread(prefetchLoop);
+	pf.cond.notify_one();
+}
+
+void Sprite::prefetchLoop() {
+	auto &pf = s_prefetcher;
+	std::unique_lock<std::mutex> lock(pf.mutex);
+	while(true) {
+		pf.cond.wait(lock, [&]() { return pf.stop || !pf.queue.empty(); });
+		if(pf.stop)
+			break;
+		auto [idx, seq_id] = pf.queue.front();
+		pf.queue.erase(pf.queue.begin());
+		lock.unlock();
+
+		// Sequences & frames don't change after sprite is loaded
+		auto &sprite = s_sprites[idx];
+		vector<int> indices;
+		sprite.sequenceImages(seq_id, indices);
+		auto images = sprite.readImages(indices);
+
+		lock.lock();
+		if(images)
+			pf.done.emplace_back(
+				Prefetcher::Done{idx, seq_id, std::move(indices), std::move(*images)});
+		else {
+			images.error().print();
+			pf.removePending(idx, seq_id);
+		}
+	}
+}
+
+void Sprite::installPrefetched() {
+	vector<Prefetcher::Done> done;
+	{
+		std::lock_guard<std::mutex> lock(s_prefetcher.mutex);
+		auto &pf = s_prefetcher;
+		done.swap(pf.done);
+		for(auto &entry : done)
+			pf.removePending(entry.idx, entry.seq_id);
+	}
+	for(auto &entry : done)
+		s_sprites[entry.idx].installSequence(entry.seq_id, entry.indices, entry.images);
 }
 
 void Sprite::initMap() {
+	s_main_thread = std::this_thread::get_id();
 	if(!s_sprite_map.empty())
 		return;
 
-	auto file_entries = findFiles(s_prefix, FindFileOpt::regular_file | FindFileOpt::recursive);
-
 	string suffix = s_suffix;
-	int sprite_count = 0;
+	vector<string> names;
 
-	for(int n = 0; n < (int)file_entries.size(); n++) {
-		string name = (string)file_entries[n].path;
-		removePrefix(name, s_prefix);
+	// With resource pack there is no need to scan directories
+	if(auto *pack = ResManager::activePack()) {
+		auto [first, end] = pack->prefixRange(s_pack_prefix);
+		for(int n = first; n < end; n++) {
+			string name = pack->name(n);
+			removePrefix(name, s_pack_prefix);
+			if(removeSuffix(name, suffix))
+				names.emplace_back(std::move(name));
+		}
+	}
 
-		if(removeSuffix(name, suffix))
-			s_sprite_map.emplace(name, sprite_count++);
+	if(names.empty()) {
+		auto file_entries =
+			findFiles(s_prefix, FindFileOpt::regular_file | FindFileOpt::recursive);
+		for(int n = 0; n < (int)file_entries.size(); n++) {
+			string name = (string)file_entries[n].path;
+			removePrefix(name, s_prefix);
+			if(removeSuffix(name, suffix))
+				names.emplace_back(std::move(name));
+		}
+		makeSorted(names);
 	}
 
-	s_sprites.resize(sprite_count);
-	for(auto &pair : s_sprite_map)
-		s_sprites[pair.second].setResourceName(pair.first.c_str());
+	// Sprite indices are used everywhere after protos are loaded; names are only
+	// resolved when parsing protos
+	s_sprites.resize(names.size());
+	for(int n = 0; n < (int)names.size(); n++) {
+		s_sprites[n].setResourceName(names[n]);
+		s_sprite_map.emplace(names[n], n);
 
-	for(auto &pair : s_sprite_map) {
-		string locase = toLower(pair.first);
-		if(s_locase_sprite_map.find(locase) != s_locase_sprite_map.end())
+		string locase = toLower(names[n]);
+		auto it = s_locase_sprite_map.find(locase);
+		if(it != s_locase_sprite_map.end()) {
 			print("Warning: locase name collision: %\n", locase);
-		s_locase_sprite_map[locase] = pair.second;
+			it->value = n;
+		} else {
+			s_locase_sprite_map.emplace(locase, n);
+		}
 	}
 }
 
@@ -67,16 +243,17 @@ int Sprite::find(const string &name) {
 	auto it = s_sprite_map.find(name);
 	if(it == s_sprite_map.end()) {
 		it = s_locase_sprite_map.find(toLower(name));
-		return it == s_locase_sprite_map.end() ? -1 : it->second;
+		return it == s_locase_sprite_map.end() ? -1 : it->value;
 	}
-	return it->second;
+	return it->value;
 }
 
 const Sprite &Sprite::get(int idx) {
 	DASSERT(isValidIndex(idx));
+	std::lock_guard<std::mutex> lock(s_load_mutex);
 	Sprite &sprite = s_sprites[idx];
 	if(sprite.isPartial())
-		loadSprite(idx, true);
+		loadSprite(idx, SpriteLoadMode::lazy);
 	return sprite;
 }
 
@@ -94,11 +271,37 @@ const Sprite &Sprite::getPartial(const string &name) {
 	int idx = find(name);
 	if(idx == -1)
 		FATAL("Sprite not found: %s", name.c_str());
+	std::lock_guard<std::mutex> lock(s_load_mutex);
 	Sprite &sprite = s_sprites[idx];
 	if(sprite.index() == -1)
-		loadSprite(idx, false);
+		loadSprite(idx, SpriteLoadMode::partial);
 	return sprite;
 }
 
 bool Sprite::isValidIndex(int idx) { return idx >= 0 && idx < (int)s_sprites.size(); }
+
+void Sprite::nextFrame(int max_idle_frames) {
+	installPrefetched();
+	if(++s_frame_id % 256 == 0)
+		unloadIdleSequences(max_idle_frames);
+	if(s_frame_id % 16 == 0 && spriteResidency().overBudget())
+		trimResidency();
+}
+
+int Sprite::unloadIdleSequences(int max_idle_frames) {
+	std::lock_guard<std::mutex> lock(s_load_mutex);
+	int count = 0;
+	for(auto &sprite : s_sprites) {
+		if(!sprite.isLazy())
+			continue;
+		for(int seq_id = 0; seq_id < sprite.size(); seq_id++) {
+			int last_use = sprite.m_seq_last_use[seq_id];
+			if(last_use != -1 && s_frame_id - last_use > max_idle_frames) {
+				sprite.unloadSequence(seq_id);
+				count++;
+			}
+		}
+	}
+	return count;
+}
 }
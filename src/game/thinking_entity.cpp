@@ -5,6 +5,9 @@
 #include "game/brain.h"
 #include "game/orders/idle.h"
 #include "game/weapon.h"
+#include "sys/alloc_tracker.h"
+#include "sys/frame_allocator.h"
+#include "sys/profiler.h"
 
 namespace game {
 
@@ -68,6 +71,7 @@ bool ThinkingEntity::setOrder(POrder &&order, bool force) {
 	}
 
 	replicate();
+	wakeUp();
 
 	//TODO: pass information about wheter this order can be handled
 	return true;
@@ -133,6 +137,7 @@ void ThinkingEntity::onSoundEvent() { handleOrder(EntityEvent::sound); }
 
 void ThinkingEntity::onImpact(DamageType dmg_type, float damage, const float3 &force,
 							  EntityRef source) {
+	wakeUp();
 	if(m_ai)
 		m_ai->onImpact(dmg_type, damage, force, source);
 }
@@ -152,7 +157,8 @@ float ThinkingEntity::inaccuracy(const Weapon &weapon) const {
 }
 
 Segment3F ThinkingEntity::computeBestShootingRay(const FBox &target_box, const Weapon &weapon) {
-	//PROFILE_RARE("ThinkingEntity::shootingRay");
+	PROFILE_SCOPE("ThinkingEntity::shootingRay");
+	ALLOC_TAG("shooting_rays");
 
 	FBox shooting_box = shootingBox(weapon);
 	float3 center = shooting_box.center();
@@ -160,20 +166,22 @@ Segment3F ThinkingEntity::computeBestShootingRay(const FBox &target_box, const W
 
 	float3 source;
 	{
-		vector<float3> sources = genPointsOnPlane(shooting_box, dir, 5, true);
-		vector<float3> targets = genPointsOnPlane(target_box, -dir, 5, false);
+		FrameVector<float3> sources(5 * 5), targets(5 * 5);
+		sources.resize(genPointsOnPlane(sources, shooting_box, dir, 5, true));
+		targets.resize(genPointsOnPlane(targets, target_box, -dir, 5, false));
 		DASSERT(!sources.empty());
 		DASSERT(!targets.empty());
 
 		int best_source = -1, best_hits = 0;
 		float best_dist = 0.0f;
 
-		vector<Segment3F> segments;
+		FrameVector<Segment3F> segments;
+		segments.reserve(sources.size() * targets.size());
 		for(int s = 0; s < (int)sources.size(); s++)
 			for(int t = 0; t < (int)targets.size(); t++)
 				segments.push_back(Segment3F(sources[s], targets[t]));
 
-		vector<Intersection> results;
+		FrameVector<Intersection> results(segments.size());
 		world()->traceCoherent(segments, results, {Flags::all | Flags::colliding, ref()});
 
 		int errors = 0, ok = 0;
@@ -210,15 +218,17 @@ Segment3F ThinkingEntity::computeBestShootingRay(const FBox &target_box, const W
 	{
 		float best_score = -inf;
 
-		vector<float3> targets =
-			genPointsOnPlane(target_box, normalize(source - target_box.center()), 8, false);
-		vector<char> target_hits(targets.size(), 0);
+		FrameVector<float3> targets(8 * 8);
+		targets.resize(genPointsOnPlane(targets, target_box,
+										normalize(source - target_box.center()), 8, false));
+		FrameVector<char> target_hits(targets.size(), 0);
 
-		vector<Segment3F> segments;
+		FrameVector<Segment3F> segments;
+		segments.reserve(targets.size());
 		for(int t = 0; t < (int)targets.size(); t++)
 			segments.push_back(Segment3F(source, targets[t]));
 
-		vector<Intersection> isects;
+		FrameVector<Intersection> isects(segments.size());
 		world()->traceCoherent(segments, isects, {Flags::all | Flags::colliding, ref()});
 
 		int num_hits = 0;
@@ -254,13 +264,15 @@ Segment3F ThinkingEntity::computeBestShootingRay(const FBox &target_box, const W
 }
 
 float ThinkingEntity::estimateHitChance(const Weapon &weapon, const FBox &target_bbox) {
-	//	PROFILE_RARE("ThinkingEntity::estimateHitChance");
+	PROFILE_SCOPE("ThinkingEntity::estimateHitChance");
+	ALLOC_TAG("shooting_rays");
 
 	Segment3F segment = computeBestShootingRay(target_bbox, weapon);
 
 	float inaccuracy = this->inaccuracy(weapon);
-	vector<Segment3F> segments;
 	int density = 16;
+	FrameVector<Segment3F> segments;
+	segments.reserve(density * density);
 
 	for(int x = 0; x < density; x++)
 		for(int y = 0; y < density; y++) {
@@ -277,7 +289,7 @@ float ThinkingEntity::estimateHitChance(const Weapon &weapon, const FBox &target
 				segments.push_back(Segment3F(ray.origin(), ray.at(dist)));
 		}
 
-	vector<Intersection> isects;
+	FrameVector<Intersection> isects(segments.size());
 	world()->traceCoherent(segments, isects, {Flags::all | Flags::colliding, ref()});
 
 	int num_hits = 0;
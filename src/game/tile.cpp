@@ -5,6 +5,7 @@
 
 #include "gfx/drawing.h"
 #include "gfx/scene_renderer.h"
+#include "gfx/texture_arena.h"
 #include <fwk/gfx/canvas_2d.h>
 #include <fwk/gfx/image.h>
 #include <fwk/io/file_stream.h>
@@ -33,9 +34,9 @@ void TileFrame::operator=(const TileFrame &rhs) {
 	m_offset = rhs.m_offset;
 }
 
-Ex<void> TileFrame::load(Stream &sr) {
+Ex<void> TileFrame::load(Stream &sr, CSpan<char> source) {
 	sr >> m_offset;
-	m_texture = EX_PASS(PackedTexture::load(sr));
+	m_texture = EX_PASS(PackedTexture::load(sr, source));
 	return {};
 }
 void TileFrame::save(FileStream &sr) const {
@@ -45,11 +46,22 @@ void TileFrame::save(FileStream &sr) const {
 
 int2 TileFrame::textureSize() const { return m_texture.size(); }
 
+int TileFrame::memorySize() const {
+	return sizeof(TileFrame) - sizeof(PackedTexture) + m_texture.memorySize();
+}
+
 void TileFrame::cacheUpload(Image &tex) const {
 	DASSERT(m_palette_ref);
 	m_texture.toTexture(tex, m_palette_ref->data(), m_palette_ref->size());
 }
 
+u64 TileFrame::persistentKey() const {
+	DASSERT(m_palette_ref);
+	u64 key = m_texture.hash('t');
+	key = hashData(m_palette_ref->data(), m_palette_ref->size() * sizeof(Color), key);
+	return key ? key : 1;
+}
+
 Image TileFrame::texture() const {
 	Image out;
 	m_texture.toTexture(out, m_palette_ref->data(), m_palette_ref->size());
@@ -63,8 +75,19 @@ PVImageView TileFrame::deviceTexture(FRect &tex_rect) const {
 }
 
 Tile::Tile()
-	: m_type_id(TileId::unknown), m_surface_id(SurfaceId::unknown), m_first_frame(&m_palette),
-	  m_see_through(false), m_walk_through(false), m_is_invisible(false) {}
+	: m_palette(make_shared<const Palette>()), m_first_frame(m_palette.get()),
+	  m_type_id(TileId::unknown), m_surface_id(SurfaceId::unknown), m_see_through(false),
+	  m_walk_through(false), m_is_invisible(false) {}
+
+int Tile::memorySize() const {
+	int bytes = sizeof(Tile) - sizeof(TileFrame) + m_first_frame.memorySize();
+	bytes += m_resource_name.size();
+	// Palettes are shared through the arena, but each tile is charged for its palette
+	bytes += m_palette->size() * sizeof(Color);
+	for(auto &frame : m_frames)
+		bytes += frame.memorySize();
+	return bytes;
+}
 
 FlagsType Tile::flags() const {
 	return tileIdToFlag(m_type_id) | (m_see_through ? (FlagsType)0 : Flags::occluding) |
@@ -117,7 +140,7 @@ template <class InputStream> Ex<void> Tile::legacyLoad(InputStream &sr, Str name
 	Palette first_pal;
 
 	for(int n = 0; n < zar_count; n++) {
-		TileFrame frame(&m_palette);
+		TileFrame frame;
 		Palette palette;
 		frame.m_texture = EX_PASS(PackedTexture::legacyLoad(sr, palette));
 		i32 off_x, off_y;
@@ -133,8 +156,9 @@ template <class InputStream> Ex<void> Tile::legacyLoad(InputStream &sr, Str name
 		}
 	}
 
-	m_palette = EX_PASS(Palette::legacyLoad(sr));
-	ASSERT(first_pal == m_palette);
+	auto palette = EX_PASS(Palette::legacyLoad(sr));
+	ASSERT(first_pal == palette);
+	setPalette(make_shared<const Palette>(std::move(palette)));
 
 	m_offset -= worldToScreen(int3(m_bbox.x, 0, m_bbox.z));
 	updateMaxRect();
@@ -143,28 +167,39 @@ template <class InputStream> Ex<void> Tile::legacyLoad(InputStream &sr, Str name
 	return {};
 }
 
-Ex<void> Tile::load(Stream &sr) {
+Ex<void> Tile::load(Stream &sr, CSpan<char> source) {
 	EXPECT(sr.loadSignature("TILE"));
 	unsigned char type_id, surface_id;
 	sr.unpack(type_id, surface_id, m_bbox, m_offset, m_see_through, m_walk_through, m_is_invisible);
 	m_type_id = type_id >= count<TileId> ? TileId::unknown : (TileId)type_id;
 	m_surface_id = surface_id >= count<SurfaceId> ? SurfaceId::unknown : (SurfaceId)surface_id;
-	EXPECT(m_first_frame.load(sr));
+	EXPECT(m_first_frame.load(sr, source));
 
 	u32 size = 0;
 	sr >> size;
 	EXPECT(size <= 4096); // TODO: checks for size everywhere where needed?
 	m_frames.resize(size);
 	for(auto &frame : m_frames)
-		EXPECT(frame.load(sr));
-	m_palette = EX_PASS(Palette::load(sr));
-
-	for(int n = 0; n < (int)m_frames.size(); n++)
-		m_frames[n].m_palette_ref = &m_palette;
+		EXPECT(frame.load(sr, source));
+	setPalette(make_shared<const Palette>(EX_PASS(Palette::load(sr))));
 	updateMaxRect();
 	return {};
 }
 
+void Tile::setPalette(shared_ptr<const Palette> palette) {
+	m_palette = std::move(palette);
+	m_first_frame.m_palette_ref = m_palette.get();
+	for(auto &frame : m_frames)
+		frame.m_palette_ref = m_palette.get();
+}
+
+void Tile::share(TextureArena &arena) {
+	m_first_frame.m_texture.share(arena);
+	for(auto &frame : m_frames)
+		frame.m_texture.share(arena);
+	setPalette(arena.intern(*m_palette));
+}
+
 template Ex<void> Tile::legacyLoad(MemoryStream &, Str);
 template Ex<void> Tile::legacyLoad(FileStream &, Str);
 
@@ -178,7 +213,7 @@ void Tile::save(FileStream &sr) const {
 	sr << u32(m_frames.size());
 	for(auto &frame : m_frames)
 		frame.save(sr);
-	m_palette.save(sr);
+	m_palette->save(sr);
 }
 
 void Tile::draw(Canvas2D &out, const int2 &pos, Color col) const {
@@ -14,17 +14,19 @@ class TileFrame : public CachedTexture {
 	TileFrame(const Palette *palette = nullptr) : m_palette_ref(palette) {}
 	TileFrame(const TileFrame &);
 	void operator=(const TileFrame &);
-	Ex<void> load(Stream &);
+	Ex<void> load(Stream &, CSpan<char> source = {});
 	void save(FileStream &) const;
 
 	virtual void cacheUpload(Image &) const;
 	virtual int2 textureSize() const;
+	virtual u64 persistentKey() const;
 
 	int2 dimensions() const { return m_texture.size(); }
 	Image texture() const;
 	PVImageView deviceTexture(FRect &tex_rect) const;
 
 	const IRect rect() const;
+	int memorySize() const;
 
   protected:
 	const Palette *m_palette_ref;
@@ -39,9 +41,14 @@ class Tile {
   public:
 	Tile();
 	template <class InputStream> Ex<void> legacyLoad(InputStream &, Str name);
-	Ex<void> load(Stream &);
+	// If source is not empty, stream has to read from it; Pixel data isn't copied then:
+	// frames reference the source memory, which has to outlive the tile.
+	Ex<void> load(Stream &, CSpan<char> source = {});
 	void save(FileStream &) const;
 
+	// Pixel data & palette are moved to the arena; Identical data is stored only once
+	void share(TextureArena &);
+
 	FlagsType flags() const;
 
 	TileId type() const { return m_type_id; }
@@ -65,14 +72,16 @@ class Tile {
 
 	const TileFrame &accessFrame(int frame_counter) const;
 	int frameCount() const { return 1 + (int)m_frames.size(); }
+	int memorySize() const;
 
 	const string &resourceName() const { return m_resource_name; }
 	void setResourceName(const string &name) { m_resource_name = name; }
 
   protected:
 	void updateMaxRect();
+	void setPalette(shared_ptr<const Palette>);
 
-	Palette m_palette;
+	shared_ptr<const Palette> m_palette;
 	TileFrame m_first_frame;
 	vector<TileFrame> m_frames;
 	int2 m_offset;
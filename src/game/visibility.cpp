@@ -4,6 +4,7 @@
 #include "game/visibility.h"
 #include "game/tile.h"
 #include "gfx/scene_renderer.h"
+#include "sys/frame_allocator.h"
 #include <algorithm>
 
 namespace game {
@@ -180,7 +181,7 @@ const Entity *WorldViewer::refEntity(EntityRef ref) const {
 }
 
 void WorldViewer::addToRender(SceneRenderer &renderer) const {
-	vector<int> inds;
+	FrameVector<int> inds;
 	inds.reserve(8192);
 
 	const TileMap &tile_map = m_world->tileMap();
@@ -215,7 +216,7 @@ Intersection WorldViewer::pixelIntersect(const int2 &screen_pos, const FindFilte
 
 	if(filter.flags() & Flags::tile) {
 		const TileMap &tile_map = m_world->tileMap();
-		vector<int> inds;
+		FrameVector<int> inds;
 		tile_map.findAll(inds, IRect(screen_pos, screen_pos + int2(1, 1)),
 						 filter.flags() | Flags::visible);
 
@@ -3,23 +3,55 @@
 
 #include "game/world.h"
 #include "audio/device.h"
+#include "game/actor.h"
 #include "game/game_mode.h"
+#include "game/replay.h"
 #include "game/thinking_entity.h"
 #include "game/tile.h"
 #include "navi_heightmap.h"
 #include "net/socket.h"
+#include "res_manager.h"
+#include "sys/alloc_tracker.h"
+#include "sys/frame_allocator.h"
+#include "sys/parallel.h"
+#include "sys/profiler.h"
 #include "tile_map.h"
 #include <algorithm>
+#include <fwk/io/file_stream.h>
+#include <zlib.h>
 
 namespace game {
 
-World::World(string map_name, Mode mode)
+void WorldLoadProgress::set(WorldLoadStage stage, float stage_fraction) {
+	m_fraction = clamp(stage_fraction, 0.0f, 1.0f);
+	m_stage = (int)stage;
+}
+
+float WorldLoadProgress::total() const {
+	static const EnumMap<WorldLoadStage, float> weights = {{0.1f, 0.4f, 0.1f, 0.4f, 0.0f}};
+	auto stage = this->stage();
+	float out = 0.0f;
+	for(auto prev : all<WorldLoadStage>)
+		if(prev < stage)
+			out += weights[prev];
+	return min(out + weights[stage] * m_fraction.load(), 1.0f);
+}
+
+World::World(string map_name, Mode mode, WorldLoadProgress *progress)
 	: m_mode(mode), m_last_anim_frame_time(0.0), m_last_time(0.0), m_time_delta(0.0),
 	  m_current_time(0.0), m_anim_frame(0), m_tile_map(m_level.tile_map),
-	  m_entity_map(m_level.entity_map), m_replicator(nullptr) {
+	  m_entity_map(m_level.entity_map), m_replicator(nullptr), m_load_progress(progress) {
 
 	ASSERT(!map_name.empty());
-	m_level.load(map_name).check(); // TODO
+	if(progress)
+		progress->set(WorldLoadStage::level);
+	auto tiles_progress = [progress](float fraction) {
+		if(progress)
+			progress->set(WorldLoadStage::tiles, fraction);
+	};
+	m_level.load(map_name, tiles_progress).check(); // TODO
+	if(progress)
+		progress->set(WorldLoadStage::entities);
 
 	for(int n = 0; n < m_tile_map.size(); n++) {
 		//TODO: leave them and use them
@@ -39,7 +71,13 @@ World::World(string map_name, Mode mode)
 
 	//		m_tile_map.printInfo();
 	m_map_name = map_name;
+	if(progress)
+		progress->set(WorldLoadStage::navigation);
 	updateNaviMap(true);
+
+	if(progress)
+		progress->set(WorldLoadStage::finished);
+	m_load_progress = nullptr;
 }
 
 World::~World() {}
@@ -47,6 +85,7 @@ World::~World() {}
 float World::random() { return frand(); }
 
 void World::updateNaviMap(bool full_recompute) {
+	ALLOC_TAG("navi");
 	//TODO: what about static entities that are added during the game?
 
 	if(full_recompute) {
@@ -67,17 +106,46 @@ void World::updateNaviMap(bool full_recompute) {
 			   Flags::test(m_entity_map[n].flags, Flags::static_entity | Flags::colliding))
 				blockers.push_back(encloseIntegral(m_entity_map[n].ptr->boundingBox()));
 
-		NaviHeightmap heightmap(m_tile_map.dimensions());
-		heightmap.update(bboxes, blockers);
-		//heightmap.saveLevels();
-		//heightmap.printInfo();
+		// Key depends on everything that is used to compute navigation maps
+		u32 key = crc32(0, (const unsigned char *)bboxes.data(), bboxes.size() * sizeof(IBox));
+		key = crc32(key, (const unsigned char *)blockers.data(), blockers.size() * sizeof(IBox));
+		int2 dims = m_tile_map.dimensions();
+		key = crc32(key, (const unsigned char *)&dims, sizeof(dims));
+		u32 build_version = NaviMap::build_version;
+		key = crc32(key, (const unsigned char *)&build_version, sizeof(build_version));
+		for(auto &navi_map : m_navi_maps) {
+			int agent_size = navi_map.agentSize();
+			key = crc32(key, (const unsigned char *)&agent_size, sizeof(agent_size));
+		}
 
-		for(int m = 0; m < (int)m_navi_maps.size(); m++) {
-			m_navi_maps[m].update(heightmap);
-			//m_navi_maps[m].printInfo();
+		auto file_name = ResManager::instance().cacheFile(format("navi/%.navi", m_map_name));
+		if(!file_name || !loadNaviMaps(*file_name, key)) {
+			NaviHeightmap heightmap(m_tile_map.dimensions());
+			heightmap.update(bboxes, blockers);
+			//heightmap.saveLevels();
+			//heightmap.printInfo();
+
+			// Maps for different agent sizes are independent
+			int num_maps = (int)m_navi_maps.size();
+			int threads_per_map = max(1, (parallelThreadCount() + num_maps - 1) / num_maps);
+			std::atomic<int> num_finished = 0;
+			parallelFor(num_maps, num_maps, [&](int m) {
+				m_navi_maps[m].update(heightmap, threads_per_map);
+				//m_navi_maps[m].printInfo();
+				if(m_load_progress)
+					m_load_progress->set(WorldLoadStage::navigation,
+										 float(++num_finished) / num_maps);
+			});
+
+			if(file_name)
+				if(auto result = saveNaviMaps(*file_name, key); !result) {
+					print("Error while saving navigation maps: '%'\n", *file_name);
+					result.error().print();
+				}
 		}
 	}
 
+	PROFILE_SCOPE("World::updateNaviColliders");
 	for(int m = 0; m < (int)m_navi_maps.size(); m++) {
 		NaviMap &navi_map = m_navi_maps[m];
 		navi_map.removeColliders();
@@ -96,11 +164,46 @@ void World::updateNaviMap(bool full_recompute) {
 	}
 }
 
+static constexpr u32 navi_cache_version = 1;
+
+Ex<void> World::loadNaviMaps(ZStr file_name, u32 key) {
+	double time = getTime();
+	auto loader = EX_PASS(fileLoader(file_name));
+	EXPECT(loader.loadSignature("NAVI"));
+
+	u32 version = 0, file_key = 0, count = 0;
+	loader >> version >> file_key >> count;
+	EX_CATCH();
+	EXPECT(version == navi_cache_version && file_key == key && count == m_navi_maps.size());
+
+	vector<NaviMap> navi_maps;
+	for(auto &navi_map : m_navi_maps) {
+		navi_maps.emplace_back(navi_map.agentSize());
+		EXPECT(navi_maps.back().load(loader));
+		EXPECT(navi_maps.back().agentSize() == navi_map.agentSize());
+	}
+	m_navi_maps.swap(navi_maps);
+	printf("Loaded navigation maps from cache (%.2f seconds)\n", getTime() - time);
+	return {};
+}
+
+Ex<void> World::saveNaviMaps(ZStr file_name, u32 key) const {
+	auto saver = EX_PASS(fileSaver(file_name));
+	saver.saveSignature("NAVI");
+	saver << navi_cache_version << key << u32(m_navi_maps.size());
+	for(auto &navi_map : m_navi_maps)
+		navi_map.save(saver);
+	EX_CATCH();
+	return {};
+}
+
 EntityRef World::addEntity(PEntity &&ptr, int index) {
 	DASSERT(ptr);
 	Entity *entity = ptr.get();
 	index = m_entity_map.add(std::move(ptr), index);
 	entity->hook(this, index);
+	if(index < (int)m_think_states.size())
+		m_think_states[index] = {};
 	replicate(index);
 
 	return entity->ref();
@@ -114,7 +217,35 @@ void World::removeEntity(EntityRef ref) {
 	}
 }
 
+void World::wakeUp(int index) {
+	if(index < 0 || index >= (int)m_think_states.size())
+		return;
+	auto &state = m_think_states[index];
+	state.is_sleeping = false;
+	state.awake_until = max(state.awake_until, m_current_time + wake_up_time);
+}
+
+int World::thinkInterval(int index, CSpan<float2> player_pos) const {
+	auto &object = m_entity_map[index];
+	// Only actors & turrets are throttled; everything else thinks every tick (unless sleeping)
+	if(!m_game_mode || !(object.flags & (Flags::actor | Flags::turret)))
+		return 1;
+	if(m_think_states[index].awake_until > m_current_time)
+		return 1;
+
+	float2 pos = object.ptr->pos().xz();
+	float min_dist_sq = inf;
+	for(auto &ppos : player_pos)
+		min_dist_sq = min(min_dist_sq, distanceSq(pos, ppos));
+
+	if(min_dist_sq <= think_near_dist * think_near_dist)
+		return 1;
+	return min_dist_sq <= think_far_dist * think_far_dist ? 2 : 4;
+}
+
 void World::simulate(double time_diff) {
+	PROFILE_SCOPE("World::simulate");
+	ALLOC_TAG("world");
 	//TODO: synchronizing time between client/server
 
 	DASSERT(time_diff > 0.0);
@@ -138,17 +269,60 @@ void World::simulate(double time_diff) {
 		m_anim_frame = 0;
 	Tile::setFrameCounter(m_anim_frame);
 
-	for(int n = 0; n < m_entity_map.size(); n++) {
-		auto &object = m_entity_map[n];
-		if(!object.ptr)
-			continue;
+	{
+		PROFILE_SCOPE("World::think");
+		bool scheduling = m_think_scheduling && !isClient();
+		FrameVector<float2> player_pos;
+		if(scheduling) {
+			if((int)m_think_states.size() < m_entity_map.size())
+				m_think_states.resize(m_entity_map.size());
+			for(int n = 0; n < m_entity_map.size(); n++) {
+				auto &object = m_entity_map[n];
+				if(object.ptr && (object.flags & Flags::actor))
+					if(static_cast<const Actor *>(object.ptr)->clientId() != -1)
+						player_pos.emplace_back(object.ptr->pos().xz());
+			}
+		}
 
-		object.ptr->think();
-		if(object.flags & Flags::dynamic_entity)
-			m_entity_map.update(n);
+		ProfileTimer grid_timer("World::updateGrid");
+		for(int n = 0; n < m_entity_map.size(); n++) {
+			auto &object = m_entity_map[n];
+			if(!object.ptr)
+				continue;
+
+			bool is_scheduled = scheduling && n < (int)m_think_states.size();
+			bool should_think = true, is_sleeping = false;
+			if(is_scheduled) {
+				auto &state = m_think_states[n];
+				is_sleeping = state.is_sleeping;
+				int interval = is_sleeping ? 0 : thinkInterval(n, player_pos);
+				should_think = interval && (m_tick + n) % interval == 0;
+
+				if(should_think) {
+					m_time_delta = time_diff + state.skipped_time;
+					state.skipped_time = 0.0;
+				} else {
+					state.skipped_time += time_diff;
+				}
+			}
 
-		for(int f = 0; f < frame_skip; f++)
-			object.ptr->nextFrame();
+			if(should_think) {
+				object.ptr->think();
+				m_time_delta = time_diff;
+			}
+			// Sleeping entities don't move
+			if(!is_sleeping && (object.flags & Flags::dynamic_entity)) {
+				grid_timer.start();
+				m_entity_map.update(n);
+				grid_timer.stop();
+			}
+			if(is_scheduled && should_think && object.ptr->canSleep())
+				m_think_states[n].is_sleeping = true;
+
+			for(int f = 0; f < frame_skip; f++)
+				object.ptr->nextFrame();
+		}
+		m_tick++;
 	}
 
 	for(int n = 0; n < (int)m_replace_list.size(); n++) {
@@ -175,8 +349,15 @@ void World::simulate(double time_diff) {
 	m_last_time = current_time;
 	updateNaviMap(false);
 
-	if(m_game_mode)
+	if(m_game_mode) {
+		PROFILE_SCOPE("GameMode::tick");
+		ALLOC_TAG("game_mode");
 		m_game_mode->tick(time_diff);
+	}
+
+	if(m_replay_recorder)
+		m_replay_recorder->onTick(*this, time_diff);
+	FrameAllocator::nextFrame();
 }
 
 const EntityMap::ObjectDef *World::refEntityDesc(int index) const {
@@ -277,10 +458,12 @@ Intersection World::trace(const Segment3F &segment, const FindFilter &filter) co
 	return out;
 }
 
-void World::traceCoherent(const vector<Segment3F> &segments, vector<Intersection> &out,
+void World::traceCoherent(CSpan<Segment3F> segments, Span<Intersection> out,
 						  const FindFilter &filter) const {
-	out.resize(segments.size());
-	vector<pair<int, float>> results;
+	DASSERT(out.size() == segments.size());
+	for(auto &isect : out)
+		isect = Intersection();
+	FrameVector<pair<int, float>> results(segments.size());
 
 	if(filter.m_flags & Flags::tile) {
 		m_tile_map.traceCoherent(segments, results, -1, filter.m_flags);
@@ -317,7 +500,7 @@ ObjectRef World::findAny(const FBox &box, const FindFilter &filter) const {
 }
 
 void World::findAll(vector<ObjectRef> &out, const FBox &box, const FindFilter &filter) const {
-	vector<int> inds;
+	FrameVector<int> inds;
 	inds.reserve(1024);
 
 	if(filter.m_flags & Flags::tile) {
@@ -337,6 +520,7 @@ void World::findAll(vector<ObjectRef> &out, const FBox &box, const FindFilter &f
 
 bool World::isVisible(const float3 &eye_pos, EntityRef target_ref, EntityRef ignore,
 					  int density) const {
+	ALLOC_TAG("visibility");
 	float step = 0.8f * (density == 1 ? 0.0f : 1.0f / float(density - 1));
 
 	const Entity *target = const_cast<World *>(this)->refEntity(target_ref);
@@ -344,13 +528,14 @@ bool World::isVisible(const float3 &eye_pos, EntityRef target_ref, EntityRef ign
 		return false;
 	const FBox &box = target->boundingBox();
 
-	vector<float3> points =
-		genPointsOnPlane(box, normalize(eye_pos - box.center()), density, false);
-	vector<Segment3F> segments(points.size());
+	FrameVector<float3> points(density * density);
+	points.resize(
+		genPointsOnPlane(points, box, normalize(eye_pos - box.center()), density, false));
+	FrameVector<Segment3F> segments(points.size());
 	for(int n = 0; n < (int)points.size(); n++)
 		segments[n] = Segment3F(eye_pos, points[n]);
 
-	vector<Intersection> isects;
+	FrameVector<Intersection> isects(segments.size());
 	traceCoherent(segments, isects, {Flags::all | Flags::occluding, ignore});
 
 	for(int n = 0; n < (int)points.size(); n++) {
@@ -382,6 +567,17 @@ const NaviMap *World::naviMap(const FBox &bbox) const {
 	return naviMap(agent_size);
 }
 
+NaviMap::QueryCounts World::naviQueryCounts() const {
+	NaviMap::QueryCounts out;
+	for(auto &navi_map : m_navi_maps) {
+		auto &counts = navi_map.queryCounts();
+		out.paths += counts.paths;
+		out.closest_pos += counts.closest_pos;
+		out.reachability += counts.reachability;
+	}
+	return out;
+}
+
 bool World::findClosestPos(int3 &out, const int3 &source, const IBox &target_box,
 						   EntityRef agent_ref) const {
 	const Entity *agent = const_cast<World *>(this)->refEntity(agent_ref);
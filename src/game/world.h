@@ -10,9 +10,27 @@
 #include "game/tile_map.h"
 #include "game/trigger.h"
 #include "navi_map.h"
+#include <atomic>
 
 namespace game {
 
+DEFINE_ENUM(WorldLoadStage, level, tiles, entities, navigation, finished);
+
+// Progress of World construction; It's updated by the loading thread and can be read
+// from any other thread
+class WorldLoadProgress {
+  public:
+	void set(WorldLoadStage, float stage_fraction = 0.0f);
+
+	WorldLoadStage stage() const { return WorldLoadStage(m_stage.load()); }
+	// Progress of whole loading in range [0, 1]
+	float total() const;
+
+  private:
+	std::atomic<int> m_stage = 0;
+	std::atomic<float> m_fraction = 0.0f;
+};
+
 class Replicator {
   public:
 	virtual ~Replicator() = default;
@@ -24,6 +42,7 @@ class Replicator {
 };
 
 class GameMode;
+class ReplayRecorder;
 
 class World {
   public:
@@ -33,7 +52,9 @@ class World {
 		single_player,
 	};
 
-	World(string map_name, Mode mode = Mode::single_player);
+	// Tiles & navigation maps are loaded on multiple threads; progress is optional
+	World(string map_name, Mode mode = Mode::single_player,
+		  WorldLoadProgress *progress = nullptr);
 	~World();
 
 	const char *mapName() const { return m_map_name.c_str(); }
@@ -58,6 +79,20 @@ class World {
 
 	void simulate(double time_diff);
 
+	// Think scheduling (simulation LOD): actors & turrets far from every player think less
+	// often (with accumulated time delta) and idle entities which can sleep (doors, containers)
+	// don't think until they're woken up. Schedule depends only on world state & tick number,
+	// so it's deterministic. It's never used on clients.
+	void setThinkScheduling(bool enable) { m_think_scheduling = enable; }
+	bool thinkScheduling() const { return m_think_scheduling; }
+
+	// Entity will think every tick for at least wake_up_time seconds
+	void wakeUp(int entity_index);
+	static constexpr double wake_up_time = 2.0;
+	static constexpr float think_near_dist = 150.0f, think_far_dist = 300.0f;
+
+	// Static navigation data is cached (in cache/navi/) and recomputed only when
+	// tiles or static entities change
 	void updateNaviMap(bool full_recompute);
 
 	double timeDelta() const { return m_time_delta; }
@@ -75,6 +110,8 @@ class World {
 	const NaviMap *naviMap(int agent_size) const;
 	const NaviMap *naviMap(EntityRef agent) const;
 	const NaviMap *naviMap(const FBox &agent_box) const;
+	// Summed over all navigation maps
+	NaviMap::QueryCounts naviQueryCounts() const;
 
 	const Grid::ObjectDef *refDesc(ObjectRef) const;
 	const EntityMap::ObjectDef *refEntityDesc(int index) const;
@@ -96,7 +133,8 @@ class World {
 	void findAll(vector<ObjectRef> &out, const FBox &box,
 				 const FindFilter &filter = FindFilter()) const;
 	Intersection trace(const Segment3F &, const FindFilter &filter = FindFilter()) const;
-	void traceCoherent(const vector<Segment3F> &, vector<Intersection> &out,
+	// out has to have the same size as segments
+	void traceCoherent(CSpan<Segment3F>, Span<Intersection> out,
 					   const FindFilter &filter = FindFilter()) const;
 
 	bool isInside(const FBox &) const;
@@ -114,6 +152,8 @@ class World {
 	Maybe<GameModeId> gameModeId() const;
 
 	void setReplicator(Replicator *);
+	// Recorder is informed about every simulated tick
+	void setReplayRecorder(ReplayRecorder *recorder) { m_replay_recorder = recorder; }
 	void replicate(int entity_id);
 	void replicate(const Entity *);
 	void onMessage(MemoryStream &, int source_id);
@@ -130,6 +170,10 @@ class World {
 	int filterIgnoreIndex(const FindFilter &filter) const;
 
   private:
+	Ex<void> loadNaviMaps(ZStr file_name, u32 key);
+	int thinkInterval(int entity_index, CSpan<float2> player_pos) const;
+	Ex<void> saveNaviMaps(ZStr file_name, u32 key) const;
+
 	const Mode m_mode;
 	string m_map_name;
 
@@ -149,9 +193,20 @@ class World {
 
 	vector<pair<Dynamic<Entity>, int>> m_replace_list;
 
+	struct ThinkState {
+		double awake_until = 0.0;
+		double skipped_time = 0.0; // since last think
+		bool is_sleeping = false;
+	};
+	vector<ThinkState> m_think_states;
+	int m_tick = 0;
+	bool m_think_scheduling = true;
+
 	PGameMode m_game_mode;
 
 	Replicator *m_replicator;
+	ReplayRecorder *m_replay_recorder = nullptr;
+	WorldLoadProgress *m_load_progress; // Only during construction
 	friend class EntityWorldProxy;
 };
 
@@ -0,0 +1,169 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#include "gfx/disk_texture_cache.h"
+
+#include <fwk/gfx/image.h>
+
+#if (defined(__linux__) || defined(__APPLE__)) && !defined(FWK_PLATFORM_HTML)
+#define TRUNCATE_FILE
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char file_magic[4] = {'F', 'T', 'T', 'C'};
+const u32 file_version = 1;
+
+struct FileHeader {
+	char magic[4];
+	u32 version;
+};
+
+struct EntryHeader {
+	u64 key;
+	u32 width, height;
+};
+
+static_assert(sizeof(EntryHeader) == 16);
+
+}
+
+DiskTextureCache::DiskTextureCache() = default;
+DiskTextureCache::~DiskTextureCache() { close(); }
+
+void DiskTextureCache::close() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	writePending();
+	m_mapped = {};
+	m_index.clear();
+	m_stored.clear();
+	if(m_file)
+		fclose(m_file);
+	m_file = nullptr;
+	m_file_size = 0;
+}
+
+Ex<> DiskTextureCache::open(ZStr file_name, i64 max_bytes) {
+	close();
+
+	FILE *file = fopen(file_name.c_str(), "r+b");
+	if(!file)
+		file = fopen(file_name.c_str(), "w+b");
+	if(!file)
+		return ERROR("Cannot open texture cache: '%'", file_name);
+
+	fseek(file, 0, SEEK_END);
+	i64 file_size = ftell(file);
+	MappedFile mapped;
+	if(file_size > 0) {
+		if(auto result = MappedFile::open(file_name))
+			mapped = std::move(*result);
+		file_size = mapped.size();
+	}
+
+	FileHeader header;
+	bool valid_header = file_size >= (i64)sizeof(header);
+	if(valid_header) {
+		header = *mapped.at<FileHeader>(0);
+		valid_header = memcmp(header.magic, file_magic, sizeof(file_magic)) == 0 &&
+					   header.version == file_version;
+	}
+
+	// Scanning stops at first incomplete entry (if previous run was interrupted while
+	// writing); New entries will overwrite it
+	i64 valid_size = sizeof(FileHeader);
+	if(valid_header) {
+		while(valid_size + (i64)sizeof(EntryHeader) <= file_size) {
+			auto entry = *mapped.at<EntryHeader>(valid_size);
+			i64 data_size = i64(entry.width) * entry.height * sizeof(IColor);
+			i64 end_pos = valid_size + (i64)sizeof(EntryHeader) + data_size;
+			if(entry.key == 0 || data_size == 0 || end_pos > file_size)
+				break;
+			m_index.emplace(entry.key, Entry{valid_size + (i64)sizeof(EntryHeader),
+											 int2(entry.width, entry.height)});
+			valid_size = end_pos;
+		}
+	} else {
+		// Older version or not a cache file at all; starting from scratch
+		mapped = {};
+		file_size = 0;
+
+		file = freopen(file_name.c_str(), "w+b", file);
+		if(!file)
+			return ERROR("Cannot create texture cache: '%'", file_name);
+		memcpy(header.magic, file_magic, sizeof(file_magic));
+		header.version = file_version;
+		if(fwrite(&header, sizeof(header), 1, file) != 1) {
+			fclose(file);
+			return ERROR("Error while writing texture cache: '%'", file_name);
+		}
+	}
+
+#ifdef TRUNCATE_FILE
+	if(valid_size < file_size && ftruncate(fileno(file), valid_size) != 0)
+		print("Warning: cannot truncate texture cache: '%'\n", file_name);
+#endif
+	fseek(file, valid_size, SEEK_SET);
+	m_file = file;
+	m_file_size = valid_size;
+	m_max_bytes = max_bytes;
+	m_mapped = std::move(mapped);
+	return {};
+}
+
+i64 DiskTextureCache::fileSize() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_file_size;
+}
+
+bool DiskTextureCache::load(u64 key, int2 expected_size, Image &out) const {
+	auto it = m_index.find(key);
+	if(it == m_index.end())
+		return false;
+
+	auto &entry = it->value;
+	if(entry.size != expected_size)
+		return false;
+	out.resize(entry.size);
+	memcpy(out.pixels<IColor>().data(), m_mapped.at<char>(entry.offset),
+		   i64(entry.size.x) * entry.size.y * sizeof(IColor));
+	m_hits++;
+	return true;
+}
+
+void DiskTextureCache::store(u64 key, const Image &image) {
+	if(key == 0 || image.empty() || m_index.find(key) != m_index.end())
+		return;
+
+	i64 data_size = i64(image.width()) * image.height() * sizeof(IColor);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(!m_file || m_file_size + (i64)sizeof(EntryHeader) + data_size > m_max_bytes ||
+	   m_stored.find(key) != m_stored.end())
+		return;
+
+	EntryHeader header{key, u32(image.width()), u32(image.height())};
+	i64 offset = m_pending.size();
+	m_pending.resize(offset + sizeof(header) + data_size);
+	memcpy(m_pending.data() + offset, &header, sizeof(header));
+	memcpy(m_pending.data() + offset + sizeof(header), image.pixels<IColor>().data(), data_size);
+
+	m_stored.emplace(key, true);
+	m_file_size += sizeof(EntryHeader) + data_size;
+	m_stores++;
+	if(m_pending.size() >= flush_bytes)
+		writePending();
+}
+
+void DiskTextureCache::writePending() {
+	if(m_pending.empty() || !m_file)
+		return;
+	bool success =
+		fwrite(m_pending.data(), m_pending.size(), 1, m_file) == 1 && fflush(m_file) == 0;
+	m_pending.clear();
+	if(!success) {
+		// Partially written entry will be skipped during next opening
+		fclose(m_file);
+		m_file = nullptr;
+	}
+}
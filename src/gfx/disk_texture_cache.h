@@ -0,0 +1,63 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#pragma once
+
+#include "base.h"
+#include "sys/mapped_file.h"
+#include <atomic>
+#include <fwk/hash_map.h>
+#include <mutex>
+
+// Persistent cache of decoded (RGBA) textures, stored in a single file.
+// Textures are identified by a content-based key (see CachedTexture::persistentKey), so
+// entries become stale automatically when resources change.
+//
+// Entries present at opening are memory-mapped; new ones are buffered in memory & appended to
+// the file in batches of flush_bytes (and when closing); they become visible during the next
+// run. load & store can be called from multiple threads.
+class DiskTextureCache {
+  public:
+	static constexpr int flush_bytes = 4 * 1024 * 1024;
+
+	DiskTextureCache();
+	~DiskTextureCache();
+	DiskTextureCache(const DiskTextureCache &) = delete;
+	void operator=(const DiskTextureCache &) = delete;
+
+	// File is created if it doesn't exist; after max_bytes new entries won't be stored
+	Ex<> open(ZStr file_name, i64 max_bytes = i64(1) << 30);
+	void close();
+	bool isOpen() const { return m_file || !m_mapped.empty(); }
+
+	// Entries with size different than expected_size are treated as missing
+	bool load(u64 key, int2 expected_size, Image &) const;
+	void store(u64 key, const Image &);
+
+	int size() const { return m_index.size(); }
+	i64 fileSize() const;
+
+	// Entries which were served from / written to the cache
+	int hits() const { return m_hits.load(); }
+	int stores() const { return m_stores.load(); }
+
+  private:
+	struct Entry {
+		i64 offset;
+		int2 size;
+	};
+
+	// m_mutex has to be locked
+	void writePending();
+
+	HashMap<u64, Entry> m_index;
+	MappedFile m_mapped;
+
+	mutable std::mutex m_mutex;
+	HashMap<u64, bool> m_stored;
+	vector<char> m_pending; // entries which weren't written to the file yet
+	FILE *m_file = nullptr;
+	i64 m_file_size = 0, m_max_bytes = 0;
+	mutable std::atomic<int> m_hits = 0;
+	std::atomic<int> m_stores = 0;
+};
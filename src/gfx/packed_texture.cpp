@@ -3,6 +3,8 @@
 
 #include "gfx/packed_texture.h"
 
+#include "gfx/texture_arena.h"
+
 #include <fwk/gfx/image.h>
 #include <fwk/io/file_stream.h>
 
@@ -19,7 +21,7 @@ Image::RegisterLoader zar_loader("zar", loadZAR);
 }
 
 bool Palette::operator==(const Palette &rhs) const {
-	return size() == rhs.size() && memcmp(data(), rhs.data(), size()) == 0;
+	return size() == rhs.size() && memcmp(data(), rhs.data(), size() * sizeof(Color)) == 0;
 }
 
 void Palette::resize(int size) {
@@ -142,26 +144,61 @@ template <class Stream> Ex<PackedTexture> PackedTexture::legacyLoad(Stream &sr,
 template Ex<PackedTexture> PackedTexture::legacyLoad(MemoryStream &, Palette &);
 template Ex<PackedTexture> PackedTexture::legacyLoad(FileStream &, Palette &);
 
-Ex<PackedTexture> PackedTexture::load(Stream &sr) {
+Ex<PackedTexture> PackedTexture::load(Stream &sr, CSpan<char> source) {
 	PackedTexture out;
 	sr.unpack(out.m_width, out.m_height, out.m_default_idx, out.m_max_idx);
 	u32 size = 0;
 	sr >> size;
-	out.m_data.resize(size);
-	sr.loadData(out.m_data);
+	if(source.empty() || size == 0) {
+		out.m_data.resize(size);
+		sr.loadData(out.m_data);
+	} else {
+		EX_CATCH();
+		i64 pos = sr.pos();
+		EXPECT(sr.size() == source.size() && pos + size <= source.size());
+		out.m_shared = CSpan<u8>((const u8 *)source.data() + pos, size);
+		sr.seek(pos + size);
+	}
 	return out;
 }
 
 void PackedTexture::save(FileStream &sr) const {
+	auto data = this->data();
 	sr.pack(m_width, m_height, m_default_idx, m_max_idx);
-	sr << u32(m_data.size());
-	sr.saveData(m_data);
+	sr << u32(data.size());
+	sr.saveData(data);
 }
 
-int PackedTexture::memorySize() const { return sizeof(PackedTexture) + m_data.size(); }
+void PackedTexture::share(TextureArena &arena) {
+	if(isShared() || m_data.empty())
+		return;
+	auto block = arena.intern(data());
+	m_shared = block.data;
+	m_shared_ref = std::move(block.ref);
+	m_data.clear();
+}
 
-static const Color blend(Color dst, Color src) __attribute((always_inline));
-static const Color blend(Color dst, Color src) {
+int PackedTexture::memorySize() const {
+	return sizeof(PackedTexture) + m_data.size() + (m_shared_ref ? m_shared.size() : 0);
+}
+
+u64 PackedTexture::hash(u64 seed) const {
+	int header[4] = {m_width, m_height, m_default_idx, m_max_idx};
+	auto data = this->data();
+	return hashData(data.data(), data.size(), hashData(header, sizeof(header), seed));
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SIMD_KERNELS
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#define ALWAYS_INLINE __attribute((always_inline)) inline
+
+namespace {
+
+ALWAYS_INLINE Color blend(Color dst, Color src) {
 	int dr = dst.r, dg = dst.g, db = dst.b, da = dst.a;
 	int sr = src.r, sg = src.g, sb = src.b, sa = src.a;
 
@@ -169,77 +206,244 @@ static const Color blend(Color dst, Color src) {
 				 ((sb - db) * sa + (db << 8)) >> 8, ((256 - da) * sa + (da << 8)) >> 8);
 }
 
-void PackedTexture::blit(Image &out, const int2 &pos, const Color *__restrict pal,
-						 int pal_size) const {
-	DASSERT(pos.x + m_width <= out.width() && pos.y + m_height <= out.height());
-	DASSERT(pos.x >= 0 && pos.y >= 0);
+// Reference implementation; SIMD kernels have to produce exactly the same results
+struct ScalarKernel {
+	static ALWAYS_INLINE void copy(Color *dst, const u8 *idx, int n, const Color *pal) {
+		for(int i = 0; i < n; i++)
+			dst[i] = pal[idx[i]];
+	}
+	static ALWAYS_INLINE void copyOpaque(Color *dst, const u8 *idx, int n, const Color *pal) {
+		for(int i = 0; i < n; i++)
+			dst[i] = Color(pal[idx[i]], 255);
+	}
+	static ALWAYS_INLINE void copyAlpha(Color *dst, const u8 *pairs, int n, const Color *pal) {
+		for(int i = 0; i < n; i++)
+			dst[i] = Color(pal[pairs[i * 2 + 0]], pairs[i * 2 + 1]);
+	}
+	static ALWAYS_INLINE void blendAlpha(Color *dst, const u8 *pairs, int n, const Color *pal) {
+		for(int i = 0; i < n; i++) {
+			Color col(pal[pairs[i * 2 + 0]], pairs[i * 2 + 1]);
+			dst[i] = dst[i].a ? blend(dst[i], col) : col;
+		}
+	}
+	static ALWAYS_INLINE void fillAlpha(Color *dst, const u8 *alpha, int n, Color col) {
+		for(int i = 0; i < n; i++)
+			dst[i] = Color(col, alpha[i]);
+	}
+	static ALWAYS_INLINE void blendFillAlpha(Color *dst, const u8 *alpha, int n, Color col) {
+		for(int i = 0; i < n; i++)
+			dst[i] = blend(dst[i], Color(col, alpha[i]));
+	}
+};
+
+#ifdef SIMD_KERNELS
+
+// blend() for 4 pixels at once. All channels are computed as: (s * sa + d * (256 - sa)) >> 8,
+// with s = 256 for alpha channel; It's equal to blend() and fits in 16 bits
+ALWAYS_INLINE __m128i blend4(__m128i dst, __m128i src) {
+	const __m128i zero = _mm_setzero_si128(), c256 = _mm_set1_epi16(256);
+	const __m128i alpha_lanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+
+	auto blend_half = [&](__m128i d, __m128i s) {
+		__m128i sa = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xff), 0xff);
+		s = _mm_or_si128(_mm_andnot_si128(alpha_lanes, s), _mm_and_si128(alpha_lanes, c256));
+		__m128i v = _mm_add_epi16(_mm_mullo_epi16(s, sa),
+								  _mm_mullo_epi16(d, _mm_sub_epi16(c256, sa)));
+		return _mm_srli_epi16(v, 8);
+	};
+
+	__m128i lo = blend_half(_mm_unpacklo_epi8(dst, zero), _mm_unpacklo_epi8(src, zero));
+	__m128i hi = blend_half(_mm_unpackhi_epi8(dst, zero), _mm_unpackhi_epi8(src, zero));
+	return _mm_packus_epi16(lo, hi);
+}
 
-	Color *dst = &out.pixels<IColor>()(pos);
-	int pixels = m_width * m_height, stride = out.width() - m_width;
+// SSE2 has no gather; palette lookups are scalar, blending is done 4 pixels at a time
+struct SSE2Kernel {
+	static ALWAYS_INLINE __m128i gather(const u8 *idx, int step, const Color *pal) {
+		auto *ipal = (const int *)pal;
+		return _mm_setr_epi32(ipal[idx[0]], ipal[idx[step]], ipal[idx[step * 2]],
+							  ipal[idx[step * 3]]);
+	}
+	static ALWAYS_INLINE __m128i loadAlpha(const u8 *alpha, int step) {
+		return _mm_slli_epi32(_mm_setr_epi32(alpha[0], alpha[step], alpha[step * 2],
+											 alpha[step * 3]),
+							  24);
+	}
+	static ALWAYS_INLINE __m128i withAlpha(__m128i rgb, __m128i alpha) {
+		return _mm_or_si128(_mm_and_si128(rgb, _mm_set1_epi32(0x00ffffff)), alpha);
+	}
 
-	DASSERT(pal && m_max_idx < pal_size);
-	const u8 *data = m_data.data();
-	Color default_col = pal[m_default_idx];
+	static ALWAYS_INLINE void copy(Color *dst, const u8 *idx, int n, const Color *pal) {
+		int i = 0;
+		for(; i + 4 <= n; i += 4)
+			_mm_storeu_si128((__m128i *)(dst + i), gather(idx + i, 1, pal));
+		ScalarKernel::copy(dst + i, idx + i, n - i, pal);
+	}
+	static ALWAYS_INLINE void copyOpaque(Color *dst, const u8 *idx, int n, const Color *pal) {
+		const __m128i opaque = _mm_set1_epi32(0xff000000);
+		int i = 0;
+		for(; i + 4 <= n; i += 4)
+			_mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(gather(idx + i, 1, pal), opaque));
+		ScalarKernel::copyOpaque(dst + i, idx + i, n - i, pal);
+	}
+	static ALWAYS_INLINE void copyAlpha(Color *dst, const u8 *pairs, int n, const Color *pal) {
+		int i = 0;
+		for(; i + 4 <= n; i += 4) {
+			const u8 *src = pairs + i * 2;
+			_mm_storeu_si128((__m128i *)(dst + i),
+							 withAlpha(gather(src, 2, pal), loadAlpha(src + 1, 2)));
+		}
+		ScalarKernel::copyAlpha(dst + i, pairs + i * 2, n - i, pal);
+	}
+	static ALWAYS_INLINE void blendAlpha(Color *dst, const u8 *pairs, int n, const Color *pal) {
+		const __m128i alpha_mask = _mm_set1_epi32(0xff000000);
+		int i = 0;
+		for(; i + 4 <= n; i += 4) {
+			const u8 *src = pairs + i * 2;
+			__m128i s = withAlpha(gather(src, 2, pal), loadAlpha(src + 1, 2));
+			__m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+			__m128i transparent =
+				_mm_cmpeq_epi32(_mm_and_si128(d, alpha_mask), _mm_setzero_si128());
+			__m128i out = _mm_or_si128(_mm_and_si128(transparent, s),
+									   _mm_andnot_si128(transparent, blend4(d, s)));
+			_mm_storeu_si128((__m128i *)(dst + i), out);
+		}
+		ScalarKernel::blendAlpha(dst + i, pairs + i * 2, n - i, pal);
+	}
+	static ALWAYS_INLINE void fillAlpha(Color *dst, const u8 *alpha, int n, Color col) {
+		__m128i rgb = _mm_set1_epi32(*(const int *)&col);
+		int i = 0;
+		for(; i + 4 <= n; i += 4)
+			_mm_storeu_si128((__m128i *)(dst + i), withAlpha(rgb, loadAlpha(alpha + i, 1)));
+		ScalarKernel::fillAlpha(dst + i, alpha + i, n - i, col);
+	}
+	static ALWAYS_INLINE void blendFillAlpha(Color *dst, const u8 *alpha, int n, Color col) {
+		__m128i rgb = _mm_set1_epi32(*(const int *)&col);
+		int i = 0;
+		for(; i + 4 <= n; i += 4) {
+			__m128i s = withAlpha(rgb, loadAlpha(alpha + i, 1));
+			__m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+			_mm_storeu_si128((__m128i *)(dst + i), blend4(d, s));
+		}
+		ScalarKernel::blendFillAlpha(dst + i, alpha + i, n - i, col);
+	}
+};
+
+TARGET_AVX2 inline __m256i blendHalf8(__m256i d, __m256i s) {
+	const __m256i c256 = _mm256_set1_epi16(256);
+	const __m256i alpha_lanes =
+		_mm256_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0);
+
+	__m256i sa = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, 0xff), 0xff);
+	s = _mm256_or_si256(_mm256_andnot_si256(alpha_lanes, s), _mm256_and_si256(alpha_lanes, c256));
+	__m256i v = _mm256_add_epi16(_mm256_mullo_epi16(s, sa),
+								 _mm256_mullo_epi16(d, _mm256_sub_epi16(c256, sa)));
+	return _mm256_srli_epi16(v, 8);
+}
 
-	int line = m_width;
-	while(data < m_data.end()) {
-		int n_pixels = *data >> 2;
-		int command = *data++ & 3;
+// 8-pixel version of blend4
+TARGET_AVX2 inline __m256i blend8(__m256i dst, __m256i src) {
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i lo = blendHalf8(_mm256_unpacklo_epi8(dst, zero), _mm256_unpacklo_epi8(src, zero));
+	__m256i hi = blendHalf8(_mm256_unpackhi_epi8(dst, zero), _mm256_unpackhi_epi8(src, zero));
+	return _mm256_packus_epi16(lo, hi);
+}
 
-#define LOOP(...)                                                                                  \
-	while(n_pixels) {                                                                              \
-		int to_copy = min(n_pixels, line);                                                         \
-		__VA_ARGS__ line -= to_copy;                                                               \
-		dst += to_copy;                                                                            \
-		n_pixels -= to_copy;                                                                       \
-		if(!line) {                                                                                \
-			line = m_width;                                                                        \
-			dst += stride;                                                                         \
-		}                                                                                          \
+// Palette lookups with hardware gather, 8 pixels at a time
+struct AVX2Kernel {
+	static TARGET_AVX2 __m256i gather(__m256i idx, const Color *pal) {
+		return _mm256_i32gather_epi32((const int *)pal, idx, 4);
+	}
+	static TARGET_AVX2 __m256i loadIndices(const u8 *idx) {
+		return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)idx));
+	}
+	// Returns palette colors with alpha taken from the pairs
+	static TARGET_AVX2 __m256i loadPairs(const u8 *pairs, const Color *pal) {
+		__m256i words = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)pairs));
+		__m256i idx = _mm256_and_si256(words, _mm256_set1_epi32(0xff));
+		__m256i alpha = _mm256_and_si256(_mm256_slli_epi32(words, 16),
+										 _mm256_set1_epi32(0xff000000));
+		return _mm256_or_si256(
+			_mm256_and_si256(gather(idx, pal), _mm256_set1_epi32(0x00ffffff)), alpha);
+	}
+	static TARGET_AVX2 __m256i fillColor(const u8 *alpha, __m256i rgb) {
+		return _mm256_or_si256(rgb, _mm256_slli_epi32(loadIndices(alpha), 24));
 	}
 
-		if(__builtin_expect(command == 0, true)) {
-			LOOP()
-		} else if(command == 1) {
-			LOOP(for(int i = 0; i < to_copy; i++) dst[i] = Color(pal[data[i]], 255);
-				 data += to_copy;)
-		} else if(command == 2) {
-			LOOP(for(int i = 0; i < to_copy; i++) {
-				Color col(pal[data[i * 2 + 0]], data[i * 2 + 1]);
-				dst[i] = dst[i].a ? blend(dst[i], col) : col;
-			} data += to_copy * 2;)
-		} else if(command == 3) {
-			LOOP(for(int i = 0; i < to_copy; i++) dst[i] =
-					 blend(dst[i], Color(default_col, data[i]));
-				 data += to_copy;)
+	static TARGET_AVX2 void copy(Color *dst, const u8 *idx, int n, const Color *pal) {
+		int i = 0;
+		for(; i + 8 <= n; i += 8)
+			_mm256_storeu_si256((__m256i *)(dst + i), gather(loadIndices(idx + i), pal));
+		ScalarKernel::copy(dst + i, idx + i, n - i, pal);
+	}
+	static TARGET_AVX2 void copyOpaque(Color *dst, const u8 *idx, int n, const Color *pal) {
+		const __m256i opaque = _mm256_set1_epi32(0xff000000);
+		int i = 0;
+		for(; i + 8 <= n; i += 8) {
+			__m256i v = _mm256_or_si256(gather(loadIndices(idx + i), pal), opaque);
+			_mm256_storeu_si256((__m256i *)(dst + i), v);
 		}
+		ScalarKernel::copyOpaque(dst + i, idx + i, n - i, pal);
 	}
+	static TARGET_AVX2 void copyAlpha(Color *dst, const u8 *pairs, int n, const Color *pal) {
+		int i = 0;
+		for(; i + 8 <= n; i += 8)
+			_mm256_storeu_si256((__m256i *)(dst + i), loadPairs(pairs + i * 2, pal));
+		ScalarKernel::copyAlpha(dst + i, pairs + i * 2, n - i, pal);
+	}
+	static TARGET_AVX2 void blendAlpha(Color *dst, const u8 *pairs, int n, const Color *pal) {
+		const __m256i alpha_mask = _mm256_set1_epi32(0xff000000);
+		int i = 0;
+		for(; i + 8 <= n; i += 8) {
+			__m256i s = loadPairs(pairs + i * 2, pal);
+			__m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+			__m256i transparent =
+				_mm256_cmpeq_epi32(_mm256_and_si256(d, alpha_mask), _mm256_setzero_si256());
+			_mm256_storeu_si256((__m256i *)(dst + i),
+								_mm256_blendv_epi8(blend8(d, s), s, transparent));
+		}
+		ScalarKernel::blendAlpha(dst + i, pairs + i * 2, n - i, pal);
+	}
+	static TARGET_AVX2 void fillAlpha(Color *dst, const u8 *alpha, int n, Color col) {
+		__m256i rgb = _mm256_set1_epi32(*(const int *)&col & 0x00ffffff);
+		int i = 0;
+		for(; i + 8 <= n; i += 8)
+			_mm256_storeu_si256((__m256i *)(dst + i), fillColor(alpha + i, rgb));
+		ScalarKernel::fillAlpha(dst + i, alpha + i, n - i, col);
+	}
+	static TARGET_AVX2 void blendFillAlpha(Color *dst, const u8 *alpha, int n, Color col) {
+		__m256i rgb = _mm256_set1_epi32(*(const int *)&col & 0x00ffffff);
+		int i = 0;
+		for(; i + 8 <= n; i += 8) {
+			__m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+			_mm256_storeu_si256((__m256i *)(dst + i), blend8(d, fillColor(alpha + i, rgb)));
+		}
+		ScalarKernel::blendFillAlpha(dst + i, alpha + i, n - i, col);
+	}
+};
 
-#undef LOOP
-}
-
-void PackedTexture::decode(Color *__restrict dst, const Color *__restrict pal, int pal_size) const {
-	DASSERT(pal && m_max_idx < pal_size);
-	const u8 *data = m_data.data();
-	Color default_col = pal[m_default_idx];
+#endif
 
-	while(data < m_data.end()) {
+// Command stream: [cmd: n_pixels << 2 | type][payload]...
+// type 0: transparent; 1: palette indices; 2: palette index & alpha pairs;
+// type 3: alpha values for default color
+template <class Kernel>
+ALWAYS_INLINE void decodeImpl(const u8 *data, const u8 *end, Color *__restrict dst,
+							  const Color *__restrict pal, Color default_col) {
+	while(data < end) {
 		int n_pixels = *data >> 2;
 		int command = *data++ & 3;
 
 		if(__builtin_expect(command == 0, true)) {
 			memset(dst, 0, n_pixels * sizeof(Color));
 		} else if(command == 1) {
-			for(int i = 0; i < n_pixels; i++)
-				dst[i] = pal[data[i]];
+			Kernel::copy(dst, data, n_pixels, pal);
 			data += n_pixels;
 		} else if(command == 2) {
-			for(int i = 0; i < n_pixels; i++)
-				dst[i] = Color(pal[data[i * 2 + 0]], data[i * 2 + 1]);
+			Kernel::copyAlpha(dst, data, n_pixels, pal);
 			data += n_pixels * 2;
 		} else {
-			for(int i = 0; i < n_pixels; i++)
-				dst[i] = Color(default_col, data[i]);
+			Kernel::fillAlpha(dst, data, n_pixels, default_col);
 			data += n_pixels;
 		}
 
@@ -247,6 +451,138 @@ void PackedTexture::decode(Color *__restrict dst, const Color *__restrict pal, i
 	}
 }
 
+template <class Kernel>
+ALWAYS_INLINE void blitImpl(const u8 *data, const u8 *end, Color *__restrict dst, int width,
+							int stride, const Color *__restrict pal, Color default_col) {
+	int line = width;
+	while(data < end) {
+		int n_pixels = *data >> 2;
+		int command = *data++ & 3;
+
+		while(n_pixels) {
+			int to_copy = min(n_pixels, line);
+			if(command == 1) {
+				Kernel::copyOpaque(dst, data, to_copy, pal);
+				data += to_copy;
+			} else if(command == 2) {
+				Kernel::blendAlpha(dst, data, to_copy, pal);
+				data += to_copy * 2;
+			} else if(command == 3) {
+				Kernel::blendFillAlpha(dst, data, to_copy, default_col);
+				data += to_copy;
+			}
+
+			line -= to_copy;
+			dst += to_copy;
+			n_pixels -= to_copy;
+			if(!line) {
+				line = width;
+				dst += stride;
+			}
+		}
+	}
+}
+
+using DecodeFunc = void (*)(const u8 *, const u8 *, Color *, const Color *, Color);
+using BlitFunc = void (*)(const u8 *, const u8 *, Color *, int, int, const Color *, Color);
+
+void decodeScalar(const u8 *data, const u8 *end, Color *dst, const Color *pal, Color def) {
+	decodeImpl<ScalarKernel>(data, end, dst, pal, def);
+}
+void blitScalar(const u8 *data, const u8 *end, Color *dst, int width, int stride,
+				const Color *pal, Color def) {
+	blitImpl<ScalarKernel>(data, end, dst, width, stride, pal, def);
+}
+
+#ifdef SIMD_KERNELS
+void decodeSSE2(const u8 *data, const u8 *end, Color *dst, const Color *pal, Color def) {
+	decodeImpl<SSE2Kernel>(data, end, dst, pal, def);
+}
+void blitSSE2(const u8 *data, const u8 *end, Color *dst, int width, int stride, const Color *pal,
+			  Color def) {
+	blitImpl<SSE2Kernel>(data, end, dst, width, stride, pal, def);
+}
+TARGET_AVX2 void decodeAVX2(const u8 *data, const u8 *end, Color *dst, const Color *pal,
+							Color def) {
+	decodeImpl<AVX2Kernel>(data, end, dst, pal, def);
+}
+TARGET_AVX2 void blitAVX2(const u8 *data, const u8 *end, Color *dst, int width, int stride,
+						  const Color *pal, Color def) {
+	blitImpl<AVX2Kernel>(data, end, dst, width, stride, pal, def);
+}
+#endif
+
+const EnumMap<DecodeKernel, DecodeFunc> s_decode_funcs = {{
+	decodeScalar,
+#ifdef SIMD_KERNELS
+	decodeSSE2,
+	decodeAVX2,
+#else
+	decodeScalar,
+	decodeScalar,
+#endif
+}};
+
+const EnumMap<DecodeKernel, BlitFunc> s_blit_funcs = {{
+	blitScalar,
+#ifdef SIMD_KERNELS
+	blitSSE2,
+	blitAVX2,
+#else
+	blitScalar,
+	blitScalar,
+#endif
+}};
+
+DecodeKernel bestDecodeKernel() {
+	for(auto kernel : {DecodeKernel::avx2, DecodeKernel::sse2})
+		if(PackedTexture::isSupported(kernel))
+			return kernel;
+	return DecodeKernel::scalar;
+}
+
+DecodeKernel s_decode_kernel = bestDecodeKernel();
+}
+
+bool PackedTexture::isSupported(DecodeKernel kernel) {
+#ifdef SIMD_KERNELS
+	if(kernel == DecodeKernel::avx2) {
+		// May be called before global constructors
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+	}
+	return true;
+#else
+	return kernel == DecodeKernel::scalar;
+#endif
+}
+
+void PackedTexture::setDecodeKernel(DecodeKernel kernel) {
+	ASSERT(isSupported(kernel));
+	s_decode_kernel = kernel;
+}
+
+DecodeKernel PackedTexture::decodeKernel() { return s_decode_kernel; }
+
+void PackedTexture::blit(Image &out, const int2 &pos, const Color *__restrict pal,
+						 int pal_size) const {
+	DASSERT(pos.x + m_width <= out.width() && pos.y + m_height <= out.height());
+	DASSERT(pos.x >= 0 && pos.y >= 0);
+	DASSERT(pal && m_max_idx < pal_size);
+
+	Color *dst = &out.pixels<IColor>()(pos);
+	int stride = out.width() - m_width;
+	auto data = this->data();
+	s_blit_funcs[s_decode_kernel](data.data(), data.end(), dst, m_width, stride, pal,
+								  pal[m_default_idx]);
+}
+
+void PackedTexture::decode(Color *__restrict dst, const Color *__restrict pal, int pal_size) const {
+	DASSERT(pal && m_max_idx < pal_size);
+	auto data = this->data();
+	s_decode_funcs[s_decode_kernel](data.data(), data.end(), dst, pal, pal[m_default_idx]);
+}
+
 void PackedTexture::toTexture(Image &out, const Color *pal, int pal_size) const {
 	DASSERT(m_width > 0 && m_height > 0);
 	out.resize({m_width, m_height});
@@ -257,11 +593,11 @@ bool PackedTexture::testPixel(const int2 &pixel) const {
 	if(pixel.x < 0 || pixel.y < 0 || pixel.x >= m_width || pixel.y >= m_height)
 		return false;
 
-	const u8 *data = m_data.data();
+	const u8 *data = this->data().data(), *end = this->data().end();
 	int target_offset = pixel.x + pixel.y * m_width;
 	int offset = 0;
 
-	while(data < m_data.end()) {
+	while(data < end) {
 		int n_pixels = *data >> 2;
 		int command = *data++ & 3;
 		offset += n_pixels;
@@ -26,6 +26,9 @@ class Palette {
 	PodVector<Color> m_data;
 };
 
+// Kernels used for decoding & blitting PackedTextures
+DEFINE_ENUM(DecodeKernel, scalar, sse2, avx2);
+
 // Pallettized, RLE - encoded (as in ZAR) texture
 // TODO: rename to PackedImage
 class PackedTexture {
@@ -33,22 +36,40 @@ class PackedTexture {
 	PackedTexture();
 
 	template <class Stream> static Ex<PackedTexture> legacyLoad(Stream &, Palette &);
-	static Ex<PackedTexture> load(Stream &);
+	// If source is not empty, stream has to read from it; Data won't be copied then and texture
+	// will reference the source memory directly (it has to outlive the texture).
+	static Ex<PackedTexture> load(Stream &, CSpan<char> source = {});
 	void save(FileStream &) const;
 
+	// Data is moved to the arena (or replaced with identical data which is already there);
+	// Textures which already reference external memory are left as they are.
+	void share(TextureArena &);
+	bool isShared() const { return !m_shared.empty(); }
+	CSpan<u8> data() const { return isShared() ? m_shared : CSpan<u8>(m_data); }
+
 	int width() const { return m_width; }
 	int height() const { return m_height; }
 	int2 size() const { return int2(m_width, m_height); }
 	bool empty() const { return m_width == 0 && m_height == 0; }
+	// Arena data is included (even if it's shared with other textures), external memory isn't
 	int memorySize() const;
+	// Hash of the texture contents (see hashData)
+	u64 hash(u64 seed = 0) const;
 
 	void decode(Color *__restrict out_data, const Color *__restrict pal, int pal_size) const;
 	void toTexture(Image &, const Color *pal, int pal_size) const;
 	void blit(Image &, const int2 &offset, const Color *palette, int size) const;
 	bool testPixel(const int2 &pixel) const;
 
+	// By default the fastest kernel supported by the CPU is used
+	static void setDecodeKernel(DecodeKernel);
+	static DecodeKernel decodeKernel();
+	static bool isSupported(DecodeKernel);
+
   protected:
-	PodVector<u8> m_data;
+	PodVector<u8> m_data; // Empty if data is shared
+	CSpan<u8> m_shared;
+	shared_ptr<const void> m_shared_ref; // Keeps arena data alive
 	int m_width, m_height;
 	u8 m_default_idx, m_max_idx;
 };
@@ -4,6 +4,9 @@
 #include "gfx/scene_renderer.h"
 
 #include "gfx/drawing.h"
+#include "sys/alloc_tracker.h"
+#include "sys/frame_allocator.h"
+#include "sys/profiler.h"
 #include <algorithm>
 #include <fwk/gfx/canvas_2d.h>
 
@@ -66,7 +69,7 @@ struct GNode {
 	int first, second, flag;
 };
 
-static int DFS(const PodVector<char> &graph, PodVector<GNode> &gdata, int count, int i, int time,
+static int DFS(CSpan<char> graph, Span<GNode> gdata, int count, int i, int time,
 			   bool detect_cycles) {
 	gdata[i].flag = 1;
 
@@ -117,7 +120,8 @@ int fastDrawingOrder(const FBox &a, const FBox &b) {
 }
 
 void SceneRenderer::render(Canvas2D &canvas) {
-	//FWK_PROFILE("SceneRenderer::render");
+	PROFILE_SCOPE("SceneRenderer::render");
+	ALLOC_TAG("rendering");
 
 	int node_size = 128;
 
@@ -134,10 +138,10 @@ void SceneRenderer::render(Canvas2D &canvas) {
 	// Screen is divided into a set of squares. Rendered elements are assigned to covered
 	// squares and sorting is done independently for each of the squares, so that, we can
 	// minize problems with rendering order
-	vector<std::pair<int, int>> grid;
+	FrameVector<std::pair<int, int>> grid;
 	grid.reserve(m_elements.size() * 4);
 
-	//FWK_PROFILE_COUNTER("SceneRenderer::total_count", m_elements.size());
+	PROFILE_COUNTER("SceneRenderer::total_count", m_elements.size());
 	for(int n = 0; n < (int)m_elements.size(); n++) {
 		const Element &elem = m_elements[n];
 		IRect rect = elem.rect - m_view_pos;
@@ -157,8 +161,9 @@ void SceneRenderer::render(Canvas2D &canvas) {
 	// Now we need to do topological sort for a graph in which each edge means
 	// than one tile should be drawn before the other; cycles in this graph result
 	// in glitches in the end (unavoidable)
-	PodVector<char> graph(1024);
-	PodVector<GNode> gdata(32);
+	FrameVector<char> graph(1024);
+	FrameVector<GNode> gdata(32);
+	int rendered_count = 0;
 
 	for(int g = 0; g < grid.size();) {
 		int node_id = grid[g].first;
@@ -175,8 +180,8 @@ void SceneRenderer::render(Canvas2D &canvas) {
 		bool any_weak = false;
 
 		{
-			vector<IRect> rects(count);
-			vector<FBox> bboxes(count);
+			FrameVector<IRect> rects(count);
+			FrameVector<FBox> bboxes(count);
 			bool is_overlay[count];
 
 			for(int i = 0; i < count; i++) {
@@ -238,7 +243,7 @@ void SceneRenderer::render(Canvas2D &canvas) {
 		grid_rect = {grid_rect.min(), vmin(grid_rect.max(), m_viewport.max())};
 		canvas.setScissorRect(grid_rect);
 
-		//FWK_PROFILE_COUNTER("SceneRenderer::rendered_count", count);
+		rendered_count += count;
 		for(int i = count - 1; i >= 0; i--) {
 			const Element &elem = m_elements[gdata[i].second];
 
@@ -252,6 +257,7 @@ void SceneRenderer::render(Canvas2D &canvas) {
 
 		g += count;
 	}
+	PROFILE_COUNTER("SceneRenderer::rendered_count", rendered_count);
 
 	//	printf("\nGrid overhead: %.2f\n", (double)grid.size() / (double)m_elements.size());
 
@@ -0,0 +1,132 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#include "gfx/texture_arena.h"
+
+#include "gfx/packed_texture.h"
+
+TextureArena::TextureArena(int chunk_size) : m_chunk_size(chunk_size) {
+	DASSERT(chunk_size > 0);
+}
+TextureArena::~TextureArena() {
+	// All blocks have to be released before the arena is destroyed
+	for(auto &chunk : m_chunks)
+		DASSERT(chunk.refs == 0);
+}
+
+ArenaBlock TextureArena::makeRef(CSpan<u8> data, int chunk_id) {
+	m_chunks[chunk_id].refs++;
+	// Only the deleter is important; it's called even though the pointer is null
+	shared_ptr<const void> ref(nullptr, [this, chunk_id](const void *) { release(chunk_id); });
+	return {data, std::move(ref)};
+}
+
+void TextureArena::release(int chunk_id) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto &chunk = m_chunks[chunk_id];
+	DASSERT(chunk.refs > 0);
+	// Current chunk is kept; new blocks will be allocated from it
+	if(--chunk.refs == 0 && chunk_id != m_chunk_id)
+		freeChunk(chunk_id);
+}
+
+void TextureArena::newChunk(int size) {
+	int prev_id = m_chunk_id;
+	if(!m_free_chunks.empty()) {
+		m_chunk_id = m_free_chunks.back();
+		m_free_chunks.pop_back();
+	} else {
+		m_chunk_id = m_chunks.size();
+		m_chunks.emplace_back();
+	}
+	m_chunks[m_chunk_id].data = PodVector<u8>(size);
+	m_chunk_pos = 0;
+
+	if(prev_id != -1 && m_chunks[prev_id].refs == 0)
+		freeChunk(prev_id);
+}
+
+void TextureArena::freeChunk(int chunk_id) {
+	auto &chunk = m_chunks[chunk_id];
+	for(auto key : chunk.keys) {
+		auto it = m_blocks.find(key);
+		if(it != m_blocks.end() && it->value.chunk_id == chunk_id)
+			m_blocks.erase(key);
+	}
+	chunk.keys.clear();
+	chunk.data = PodVector<u8>();
+	m_free_chunks.emplace_back(chunk_id);
+}
+
+ArenaBlock TextureArena::intern(CSpan<u8> data) {
+	if(data.empty())
+		return {};
+
+	u64 key = hashData(data.data(), data.size());
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_requested_size += data.size();
+
+	auto it = m_blocks.find(key);
+	if(it != m_blocks.end() && it->value.data.size() == data.size() &&
+	   memcmp(it->value.data.data(), data.data(), data.size()) == 0)
+		return makeRef(it->value.data, it->value.chunk_id);
+
+	// Big blocks get their own chunks
+	if(m_chunk_id == -1 || m_chunk_pos + data.size() > m_chunks[m_chunk_id].data.size())
+		newChunk(max(m_chunk_size, data.size()));
+	auto &chunk = m_chunks[m_chunk_id];
+	u8 *dst = chunk.data.data() + m_chunk_pos;
+	memcpy(dst, data.data(), data.size());
+	m_chunk_pos += data.size();
+
+	CSpan<u8> out(dst, data.size());
+	// In case of collision, previous block stays in the index
+	if(m_blocks.find(key) == m_blocks.end()) {
+		m_blocks.emplace(key, BlockInfo{out, m_chunk_id});
+		chunk.keys.emplace_back(key);
+	}
+	return makeRef(out, m_chunk_id);
+}
+
+shared_ptr<const Palette> TextureArena::intern(const Palette &palette) {
+	u64 key = hashData(palette.data(), palette.size() * sizeof(Color));
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_requested_size += palette.size() * sizeof(Color);
+
+	auto it = m_palettes.find(key);
+	if(it != m_palettes.end())
+		if(auto existing = it->value.lock(); existing && *existing == palette)
+			return existing;
+
+	auto out = make_shared<const Palette>(palette);
+	// In case of collision, previous palette stays in the index (unless it's already freed)
+	if(it == m_palettes.end())
+		m_palettes.emplace(key, out);
+	else if(it->value.expired())
+		it->value = out;
+	return out;
+}
+
+i64 TextureArena::memorySize() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	i64 out = 0;
+	for(auto &chunk : m_chunks)
+		out += chunk.data.size();
+	for(auto &it : m_palettes)
+		if(auto palette = it.value.lock())
+			out += palette->size() * sizeof(Color);
+	return out;
+}
+
+i64 TextureArena::requestedSize() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_requested_size;
+}
+
+int TextureArena::paletteCount() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	int count = 0;
+	for(auto &it : m_palettes)
+		count += !it.value.expired();
+	return count;
+}
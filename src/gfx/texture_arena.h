@@ -0,0 +1,65 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#pragma once
+
+#include "base.h"
+#include <fwk/hash_map.h>
+#include <mutex>
+
+class Palette;
+
+// Block of data stored in TextureArena; it stays alive as long as there are references to it.
+struct ArenaBlock {
+	CSpan<u8> data;
+	shared_ptr<const void> ref;
+};
+
+// Storage for immutable texture data & palettes. Identical blocks are stored only once
+// (they are deduplicated by hash), so data shared between many resources doesn't take
+// additional memory.
+//
+// Blocks are allocated from bigger chunks; Stored data never moves. Chunk is freed when
+// all the blocks in it are released. Palettes are freed with their last reference.
+// Arena has to outlive all the blocks. All functions can be called from multiple threads.
+class TextureArena {
+  public:
+	TextureArena(int chunk_size = 4 * 1024 * 1024);
+	~TextureArena();
+
+	TextureArena(const TextureArena &) = delete;
+	void operator=(const TextureArena &) = delete;
+
+	ArenaBlock intern(CSpan<u8>);
+	shared_ptr<const Palette> intern(const Palette &);
+
+	// Memory allocated for stored data
+	i64 memorySize() const;
+	// Memory which would be used without deduplication
+	i64 requestedSize() const;
+	int paletteCount() const;
+
+  private:
+	struct Chunk {
+		PodVector<u8> data;
+		vector<u64> keys;
+		int refs = 0;
+	};
+	struct BlockInfo {
+		CSpan<u8> data;
+		int chunk_id;
+	};
+
+	ArenaBlock makeRef(CSpan<u8>, int chunk_id);
+	void release(int chunk_id);
+	void newChunk(int size);
+	void freeChunk(int chunk_id);
+
+	vector<Chunk> m_chunks;
+	vector<int> m_free_chunks;
+	HashMap<u64, BlockInfo> m_blocks;
+	HashMap<u64, std::weak_ptr<const Palette>> m_palettes;
+	mutable std::mutex m_mutex;
+	i64 m_requested_size = 0;
+	int m_chunk_size, m_chunk_id = -1, m_chunk_pos = 0;
+};
@@ -3,6 +3,8 @@
 
 #include "gfx/texture_cache.h"
 
+#include "gfx/disk_texture_cache.h"
+#include "sys/profiler.h"
 #include <climits>
 #include <fwk/gfx/image.h>
 #include <fwk/vulkan/vulkan_device.h>
@@ -19,6 +21,11 @@ PVImageView CachedTexture::accessTexture(FRect &tex_rect, bool put_in_atlas) con
 	return TextureCache::instance().access(m_id, put_in_atlas, tex_rect);
 }
 
+void CachedTexture::prefetchTexture() const {
+	bindToCache();
+	TextureCache::instance().prefetch(m_id);
+}
+
 void CachedTexture::unbindFromCache() const {
 	if(m_id != -1) {
 		TextureCache::instance().remove(m_id);
@@ -43,9 +50,94 @@ static int textureMemorySize(PVImageView image) {
 
 TextureCache *TextureCache::g_instance = nullptr;
 
+double TextureCache::Stats::hitRate() const {
+	int total = atlas_hits + texture_hits + misses + pending;
+	return total ? double(atlas_hits) / total : 1.0;
+}
+
+TextureCache::AtlasNode::AtlasNode(IRect rect) : rect(rect) { clear(); }
+
+void TextureCache::AtlasNode::clear() {
+	free_rects.clear();
+	free_rects.emplace_back(rect.size());
+	used_pixels = 0;
+	fresh_pixels = 0;
+	fragmented = false;
+}
+
+int TextureCache::AtlasNode::freePixels() const { return rect.width() * rect.height() - used_pixels; }
+
+static bool contains(const IRect &outer, const IRect &inner) {
+	return inner.x() >= outer.x() && inner.y() >= outer.y() && inner.ex() <= outer.ex() &&
+		   inner.ey() <= outer.ey();
+}
+
+// MaxRects with best short side fit heuristic
+Maybe<int2> TextureCache::AtlasNode::insert(int2 size) {
+	int best_id = -1, best_short = INT_MAX, best_long = INT_MAX;
+	for(int n = 0; n < (int)free_rects.size(); n++) {
+		int2 left = free_rects[n].size() - size;
+		if(left.x < 0 || left.y < 0)
+			continue;
+		int short_side = min(left.x, left.y), long_side = max(left.x, left.y);
+		if(short_side < best_short || (short_side == best_short && long_side < best_long)) {
+			best_id = n;
+			best_short = short_side;
+			best_long = long_side;
+		}
+	}
+	if(best_id == -1)
+		return none;
+
+	int2 pos = free_rects[best_id].min();
+	IRect used(pos, pos + size);
+
+	vector<IRect> new_rects;
+	new_rects.reserve(free_rects.size() + 4);
+	for(const IRect &free : free_rects) {
+		if(!areOverlapping(free, used)) {
+			new_rects.emplace_back(free);
+			continue;
+		}
+
+		if(used.x() > free.x())
+			new_rects.emplace_back(free.x(), free.y(), used.x(), free.ey());
+		if(used.ex() < free.ex())
+			new_rects.emplace_back(used.ex(), free.y(), free.ex(), free.ey());
+		if(used.y() > free.y())
+			new_rects.emplace_back(free.x(), free.y(), free.ex(), used.y());
+		if(used.ey() < free.ey())
+			new_rects.emplace_back(free.x(), used.ey(), free.ex(), free.ey());
+	}
+	free_rects.swap(new_rects);
+
+	// Removing rects contained in other rects
+	for(int i = 0; i < (int)free_rects.size(); i++)
+		for(int j = i + 1; j < (int)free_rects.size(); j++) {
+			if(contains(free_rects[j], free_rects[i])) {
+				free_rects[i--] = free_rects.back();
+				free_rects.pop_back();
+				break;
+			}
+			if(contains(free_rects[i], free_rects[j])) {
+				free_rects[j--] = free_rects.back();
+				free_rects.pop_back();
+			}
+		}
+
+	used_pixels += size.x * size.y;
+	return pos;
+}
+
+// Released rect may not be maximal; it will be merged properly during next defragmentation
+void TextureCache::AtlasNode::release(const IRect &local_rect) {
+	free_rects.emplace_back(local_rect);
+	used_pixels -= local_rect.width() * local_rect.height();
+}
+
 TextureCache::TextureCache(VulkanDevice &device, int bytes)
-	: m_device(device), m_memory_limit(bytes), m_memory_size(0), m_last_update(0), m_last_node(0),
-	  m_atlas_counter(0) {
+	: m_device(device), m_memory_limit(bytes), m_memory_size(0), m_last_update(0),
+	  m_last_defrag(0), m_atlas_counter(0) {
 	ASSERT(g_instance == nullptr);
 	g_instance = this;
 
@@ -62,6 +154,7 @@ TextureCache::TextureCache(VulkanDevice &device, int bytes)
 
 TextureCache::~TextureCache() {
 	ASSERT(g_instance == this);
+	stopWorkers();
 	g_instance = nullptr;
 
 	for(int n = 0; n < (int)m_resources.size(); n++)
@@ -79,7 +172,422 @@ TextureCache::~TextureCache() {
 #define MAIN_REMOVE(list, idx)                                                                     \
 	listRemove([&](int i) -> ListNode & { return m_resources[i].main_node; }, list, idx)
 
+// Marks texture as used during current frame; Nodes keep track of pixels used by such textures
+void TextureCache::touch(int res_id) {
+	Resource &res = m_resources[res_id];
+	if(res.last_update == m_last_update)
+		return;
+	res.last_update = m_last_update;
+	if(res.atlas_node_id != -1)
+		m_atlas_nodes[res.atlas_node_id].fresh_pixels += res.size.x * res.size.y;
+}
+
+bool TextureCache::inAtlasQueue(int res_id) const {
+	auto &res = m_resources[res_id];
+	return res.atlas_node_id == -1 && (res.atlas_node.prev != -1 || res.atlas_node.next != -1 ||
+									   m_atlas_queue.head == res_id);
+}
+
+// Prefers the fullest node in which texture fits without evictions; Otherwise
+// selects the node with the most free & stale area
+int TextureCache::selectNode(int2 size, int skip_node) const {
+	int best_fit = -1, best_used = -1;
+	for(int n = 0; n < (int)m_atlas_nodes.size(); n++) {
+		auto &node = m_atlas_nodes[n];
+		if(n == skip_node || n == m_repack.node_id || node.used_pixels <= best_used)
+			continue;
+		for(auto &free : node.free_rects)
+			if(free.width() >= size.x && free.height() >= size.y) {
+				best_fit = n;
+				best_used = node.used_pixels;
+				break;
+			}
+	}
+	if(best_fit != -1)
+		return best_fit;
+
+	int best_node = -1, best_score = size.x * size.y - 1;
+	for(int n = 0; n < (int)m_atlas_nodes.size(); n++) {
+		if(n == skip_node || n == m_repack.node_id)
+			continue;
+		int score = m_atlas_nodes[n].freePixels() + m_atlas_nodes[n].stalePixels();
+		if(score > best_score) {
+			best_node = n;
+			best_score = score;
+		}
+	}
+	return best_node;
+}
+
+void TextureCache::evictFromAtlas(int res_id) {
+	Resource &res = m_resources[res_id];
+	DASSERT(res.atlas_node_id != -1);
+	AtlasNode &node = m_atlas_nodes[res.atlas_node_id];
+#ifdef LOGGING
+	printf("Removing from atlas node %d: %dKB\n", res.atlas_node_id,
+		   (res.size.x * res.size.y * 4) / 1024);
+#endif
+	ATLAS_REMOVE(node.list, res_id);
+	node.release(IRect(res.atlas_pos, res.atlas_pos + res.size) - node.rect.min());
+	if(res.last_update == m_last_update)
+		node.fresh_pixels -= res.size.x * res.size.y;
+	res.atlas_node_id = -1;
+	m_atlas_counter--;
+}
+
+// With async decoding, texture has to be decoded by workers first (it's kept in atlas_staging)
+Ex<> TextureCache::uploadToAtlas(int res_id) {
+	Resource &res = m_resources[res_id];
+	Image tex = std::move(res.atlas_staging);
+	res.atlas_staging = {};
+	if(tex.empty()) {
+		DASSERT(!asyncDecoding());
+		decode(res.res_ptr, tex);
+	}
+	DASSERT(tex.size() == res.size);
+
+	// TODO: scissor rect is not supported
+	EXPECT(m_atlas->image()->upload(tex, res.atlas_pos, 0, VImageLayout::general));
+	m_stats.upload_bytes += res.size.x * res.size.y * (int)sizeof(IColor);
+	recycleImage(std::move(tex));
+	return {};
+}
+
+Ex<bool> TextureCache::insertIntoAtlas(int res_id, int node_id) {
+	Resource &res = m_resources[res_id];
+	AtlasNode &node = m_atlas_nodes[node_id];
+	DASSERT(res.atlas_node_id == -1);
+
+	auto pos = node.insert(res.size);
+	if(!pos) {
+		// Evicting least recently used textures until new one fits
+		pair<int, int> indices[1024];
+		int count = 0;
+		for(int id = node.list.head; id != -1 && count < arraySize(indices);) {
+			const Resource &other = m_resources[id];
+			if(other.last_update < m_last_update)
+				indices[count++] = {other.last_update, id};
+			id = other.atlas_node.next;
+		}
+		std::sort(indices, indices + count);
+
+		for(int n = 0; n < count && !pos; n++) {
+			evictFromAtlas(indices[n].second);
+			m_stats.evictions++;
+			pos = node.insert(res.size);
+		}
+		if(!pos) {
+			// There is enough space, it's just badly fragmented
+			if(node.freePixels() >= res.size.x * res.size.y)
+				node.fragmented = true;
+			return false;
+		}
+	}
+
+	res.atlas_pos = node.rect.min() + *pos;
+	EX_PASS(uploadToAtlas(res_id));
+#ifdef LOGGING
+	printf("Inserting to atlas node %d: %dKB\n", node_id, (res.size.x * res.size.y * 4) / 1024);
+#endif
+	ATLAS_INSERT(node.list, res_id);
+	res.atlas_node_id = node_id;
+	res.wants_atlas = false;
+	if(res.last_update == m_last_update)
+		node.fresh_pixels += res.size.x * res.size.y;
+	m_atlas_counter++;
+	return true;
+}
+
+// Repacks all textures in given node (bigger first); Textures which don't fit are dropped
+Ex<> TextureCache::defragment(int node_id) {
+	AtlasNode &node = m_atlas_nodes[node_id];
+	vector<pair<int, int>> indices;
+	for(int id = node.list.head; id != -1; id = m_resources[id].atlas_node.next)
+		indices.emplace_back(-m_resources[id].size.y, id);
+	std::sort(begin(indices), end(indices));
+	m_stats.defragmentations++;
+
+	if(asyncDecoding()) {
+		// New layout is planned right away, but textures stay where they are until all the
+		// moved ones are decoded again by workers; Pixels already in the atlas stay valid
+		DASSERT(m_repack.node_id == -1);
+		m_repack.node_id = node_id;
+		m_repack.layout = AtlasNode(node.rect);
+		m_repack.entries.clear();
+		for(auto [_, id] : indices) {
+			Resource &res = m_resources[id];
+			Maybe<int2> pos;
+			if(auto local_pos = m_repack.layout.insert(res.size))
+				pos = node.rect.min() + *local_pos;
+			m_repack.entries.emplace_back(RepackEntry{id, res.size, pos});
+			if(pos && *pos != res.atlas_pos) {
+				res.wants_atlas = true;
+				submitDecode(id);
+			}
+		}
+		node.fragmented = false;
+		return finishRepack();
+	}
+
+	while(node.list.head != -1)
+		ATLAS_REMOVE(node.list, node.list.head);
+	node.clear();
+
+	for(auto [_, id] : indices) {
+		Resource &res = m_resources[id];
+		auto pos = node.insert(res.size);
+		if(!pos) {
+			res.atlas_node_id = -1;
+			m_atlas_counter--;
+			m_stats.evictions++;
+			continue;
+		}
+
+		res.atlas_pos = node.rect.min() + *pos;
+		EX_PASS(uploadToAtlas(id));
+		ATLAS_INSERT(node.list, id);
+		if(res.last_update == m_last_update)
+			node.fresh_pixels += res.size.x * res.size.y;
+	}
+	return {};
+}
+
+// Switches repacked node to the new layout once all moved textures are decoded; Textures which
+// were removed in the meantime are skipped, the ones which didn't fit are dropped
+Ex<> TextureCache::finishRepack() {
+	int node_id = m_repack.node_id;
+	AtlasNode &node = m_atlas_nodes[node_id];
+	bool ready = true;
+	for(auto &entry : m_repack.entries) {
+		Resource &res = m_resources[entry.res_id];
+		if(res.atlas_node_id == node_id && entry.pos && *entry.pos != res.atlas_pos &&
+		   res.atlas_staging.empty() && asyncDecoding()) {
+			// Decoding jobs could have been dropped (when workers were restarted)
+			submitDecode(entry.res_id);
+			ready = false;
+		}
+	}
+	if(!ready)
+		return {};
+
+	node.free_rects = m_repack.layout.free_rects;
+	node.used_pixels = m_repack.layout.used_pixels;
+	node.fresh_pixels = 0;
+	for(auto &entry : m_repack.entries) {
+		Resource &res = m_resources[entry.res_id];
+		if(res.atlas_node_id != node_id) {
+			if(entry.pos)
+				node.release(IRect(*entry.pos, *entry.pos + entry.size) - node.rect.min());
+			continue;
+		}
+
+		if(!entry.pos) {
+			ATLAS_REMOVE(node.list, entry.res_id);
+			res.atlas_node_id = -1;
+			m_atlas_counter--;
+			m_stats.evictions++;
+		} else if(*entry.pos != res.atlas_pos) {
+			res.atlas_pos = *entry.pos;
+			EX_PASS(uploadToAtlas(entry.res_id));
+		}
+		res.wants_atlas = false;
+		if(res.atlas_node_id != -1 && res.last_update == m_last_update)
+			node.fresh_pixels += res.size.x * res.size.y;
+	}
+
+	m_repack.node_id = -1;
+	m_repack.entries.clear();
+	return {};
+}
+
+void TextureCache::setAsyncDecoding(bool enable, int num_threads) {
+	stopWorkers();
+	if(!enable)
+		return;
+
+	if(num_threads <= 0)
+		num_threads = clamp((int)std::thread::hardware_concurrency() - 1, 1, 4);
+	m_stop_workers = false;
+	for(int n = 0; n < num_threads; n++)
+		m_workers.emplace_back([this]() { decodeLoop(); });
+}
+
+void TextureCache::stopWorkers() {
+	{
+		std::lock_guard<std::mutex> lock(m_decode_mutex);
+		m_stop_workers = true;
+	}
+	m_decode_cond.notify_all();
+	for(auto &worker : m_workers)
+		worker.join();
+	m_workers.clear();
+
+	// Jobs which weren't started are dropped; finished ones will still be uploaded
+	for(auto &job : m_decode_queue)
+		m_resources[job.res_id].decode_pending = false;
+	m_decode_queue.clear();
+}
+
+void TextureCache::decodeLoop() {
+	std::unique_lock<std::mutex> lock(m_decode_mutex);
+	while(true) {
+		m_decode_cond.wait(lock, [this]() { return m_stop_workers || !m_decode_queue.empty(); });
+		if(m_stop_workers)
+			break;
+
+		DecodeJob job = std::move(m_decode_queue.front());
+		m_decode_queue.pop_front();
+		if(!m_staging_pool.empty()) {
+			job.image = std::move(m_staging_pool.back());
+			m_staging_pool.pop_back();
+		}
+		m_decoding.emplace_back(job.res_id);
+		lock.unlock();
+
+		decode(job.res_ptr, job.image);
+
+		lock.lock();
+		m_decoding.erase(std::find(begin(m_decoding), end(m_decoding), job.res_id));
+		m_decoded.emplace_back(std::move(job));
+		m_done_cond.notify_all();
+	}
+}
+
+void TextureCache::submitDecode(int res_id) {
+	Resource &res = m_resources[res_id];
+	if(res.decode_pending)
+		return;
+	res.decode_pending = true;
+
+	{
+		std::lock_guard<std::mutex> lock(m_decode_mutex);
+		m_decode_queue.emplace_back(DecodeJob{res_id, res.res_ptr, {}});
+	}
+	m_decode_cond.notify_one();
+}
+
+// Blocks if given texture is being decoded right now
+void TextureCache::cancelDecode(int res_id) {
+	Resource &res = m_resources[res_id];
+	if(!res.decode_pending)
+		return;
+
+	std::unique_lock<std::mutex> lock(m_decode_mutex);
+	m_done_cond.wait(lock, [&]() {
+		return std::find(begin(m_decoding), end(m_decoding), res_id) == end(m_decoding);
+	});
+
+	for(auto it = m_decode_queue.begin(); it != m_decode_queue.end(); ++it)
+		if(it->res_id == res_id) {
+			m_decode_queue.erase(it);
+			break;
+		}
+	for(int n = 0; n < (int)m_decoded.size(); n++)
+		if(m_decoded[n].res_id == res_id) {
+			m_staging_pool.emplace_back(std::move(m_decoded[n].image));
+			m_decoded.erase(m_decoded.begin() + n);
+			break;
+		}
+	res.decode_pending = false;
+}
+
+void TextureCache::recycleImage(Image &&image) {
+	if(!asyncDecoding() || image.empty())
+		return;
+	std::lock_guard<std::mutex> lock(m_decode_mutex);
+	if((int)m_staging_pool.size() < (int)m_workers.size() * 2)
+		m_staging_pool.emplace_back(std::move(image));
+}
+
+// Uploads textures decoded by workers, as long as upload budget allows
+// Textures which wait for the atlas are kept in staging & queued for insertion
+Ex<> TextureCache::uploadDecoded() {
+	vector<DecodeJob> decoded, delayed;
+	{
+		std::lock_guard<std::mutex> lock(m_decode_mutex);
+		decoded.swap(m_decoded);
+	}
+
+	vector<Image> images;
+	int bytes = 0;
+	for(auto &job : decoded) {
+		if(bytes >= m_upload_budget) {
+			delayed.emplace_back(std::move(job));
+			continue;
+		}
+
+		Resource &res = m_resources[job.res_id];
+		res.decode_pending = false;
+		if(res.wants_atlas) {
+			// Texture waits for the atlas queue or for repacking of its node
+			res.atlas_staging = std::move(job.image);
+			if(res.atlas_node_id == -1 && !inAtlasQueue(job.res_id))
+				ATLAS_INSERT(m_atlas_queue, job.res_id);
+			continue;
+		}
+		if(!res.device_texture && res.atlas_node_id == -1) {
+			EX_PASS(createTexture(job.res_id, job.image));
+			bytes += job.image.width() * job.image.height() * (int)sizeof(IColor);
+		}
+		images.emplace_back(std::move(job.image));
+	}
+
+	std::lock_guard<std::mutex> lock(m_decode_mutex);
+	m_decoded.insert(m_decoded.begin(), std::make_move_iterator(delayed.begin()),
+					 std::make_move_iterator(delayed.end()));
+	int max_pool_size = (int)m_workers.size() * 2;
+	for(auto &image : images)
+		if((int)m_staging_pool.size() < max_pool_size)
+			m_staging_pool.emplace_back(std::move(image));
+	return {};
+}
+
+Ex<> TextureCache::openDiskCache(ZStr file_name) {
+	int num_workers = m_workers.size();
+	stopWorkers();
+	m_disk_cache.emplace();
+	auto result = m_disk_cache->open(file_name);
+	if(!result)
+		m_disk_cache.reset();
+	if(num_workers)
+		setAsyncDecoding(true, num_workers);
+	return result;
+}
+
+// Decoded textures are taken from disk cache if possible; newly decoded ones are stored there
+void TextureCache::decode(const CachedTexture *res_ptr, Image &out) {
+	u64 key = m_disk_cache ? res_ptr->persistentKey() : 0;
+	if(key && m_disk_cache->load(key, res_ptr->textureSize(), out))
+		return;
+	res_ptr->cacheUpload(out);
+	if(key)
+		m_disk_cache->store(key, out);
+}
+
+Ex<> TextureCache::createTexture(int res_id, const Image &tex) {
+	Resource &res = m_resources[res_id];
+	DASSERT(!res.device_texture);
+
+	auto image = EX_PASS(VulkanImage::createAndUpload(m_device, tex));
+	res.device_texture = VulkanImageView::create(image);
+	res.size = int2(tex.width(), tex.height());
+
+	int new_size = textureMemorySize(res.device_texture);
+#ifdef LOGGING
+	printf("Loading %dKB (current: %dKB / %dKB)\n", new_size / 1024, m_memory_size / 1024,
+		   m_memory_limit / 1024);
+#endif
+	m_memory_size += new_size;
+	m_stats.upload_bytes += new_size;
+	while(m_memory_size > m_memory_limit && m_main_list.tail != -1)
+		unload(m_main_list.tail);
+
+	MAIN_INSERT(m_main_list, res_id);
+	return {};
+}
+
 Ex<> TextureCache::nextFrame() {
+	PROFILE_SCOPE("TextureCache::nextFrame");
 	if(!m_atlas) {
 		int max_size = 4096;
 
@@ -95,107 +603,111 @@ Ex<> TextureCache::nextFrame() {
 #endif
 
 		int x_nodes = m_atlas_size.x / node_size, y_nodes = m_atlas_size.y / node_size;
-		m_atlas_nodes.resize(x_nodes * y_nodes);
+		m_atlas_nodes.clear();
+		m_atlas_nodes.reserve(x_nodes * y_nodes);
 		for(int y = 0; y < y_nodes; y++)
 			for(int x = 0; x < x_nodes; x++)
-				m_atlas_nodes[x + y * x_nodes] = AtlasNode{IRect(x, y, x + 1, y + 1) * node_size};
+				m_atlas_nodes.emplace_back(IRect(x, y, x + 1, y + 1) * node_size);
 	}
 
+	EX_PASS(uploadDecoded());
+
 	if(m_atlas_queue.head != -1) {
+		// Bigger textures are inserted first; the rest stays in the queue for following frames
 		pair<int, int> indices[1024];
-		int count = 0;
-		AtlasNode &atlas_node = m_atlas_nodes[m_last_node];
-
-		for(int id = atlas_node.list.head; id != -1 && count < arraySize(indices) / 2;) {
-			const Resource &res = m_resources[id];
-			indices[count++] = {-res.last_update, id};
-			id = res.atlas_node.next;
-		}
-
-		int pixel_count = 0, max_pixels = node_size * node_size;
-		for(int id = m_atlas_queue.head;
-			id != -1 && count < arraySize(indices) && pixel_count < max_pixels;) {
+		int count = 0, pixel_count = 0;
+		for(int id = m_atlas_queue.head; id != -1 && count < arraySize(indices) &&
+										 pixel_count < max_upload_pixels;) {
 			const Resource &res = m_resources[id];
-			indices[count++] = {-res.last_update, id};
+			indices[count++] = {-res.size.x * res.size.y, id};
 			pixel_count += res.size.x * res.size.y;
 			id = res.atlas_node.next;
 		}
-
-		// TODO: handle situation in which resources already in atlas have timestamp >= than new
-		// resources,
-		// and there is almost no space for new resources. Such a node should be skipped
+		for(int n = 0; n < count; n++)
+			ATLAS_REMOVE(m_atlas_queue, indices[n].second);
 		std::sort(indices, indices + count);
 
-		int2 pos(0, 0);
-		int max_y = 0;
-
-		// TODO: better texture fitting; something similar to buddy algorithm?
 		for(int n = 0; n < count; n++) {
-			int index = indices[n].second;
-			Resource &res = m_resources[index];
-			bool can_fit = true;
-
-			if(res.size.y + pos.y > node_size)
-				can_fit = false;
-			if(can_fit && res.size.x + pos.x > node_size) {
-				if(res.size.x > node_size || res.size.y + max_y + pos.y > node_size)
-					can_fit = false;
-				else {
-					pos = int2(0, pos.y + max_y);
-					max_y = 0;
-				}
+			int res_id = indices[n].second;
+			Resource &res = m_resources[res_id];
+			int node_id = selectNode(res.size, -1);
+			if(node_id != -1 && asyncDecoding() && res.atlas_staging.empty()) {
+				// It will be queued again when it's decoded
+				res.wants_atlas = true;
+				submitDecode(res_id);
+				continue;
 			}
 
-			if(!can_fit) {
-				if(res.atlas_node_id != -1) {
-#ifdef LOGGING
-					printf("Removing from atlas node %d: %dKB\n", m_last_node,
-						   (res.size.x * res.size.y * 4) / 1024);
-#endif
-					ATLAS_REMOVE(atlas_node.list, index);
-					res.atlas_node_id = -1;
-					m_atlas_counter--;
+			bool inserted = false;
+			if(node_id != -1) {
+				inserted = EX_PASS(insertIntoAtlas(res_id, node_id));
+				if(!inserted) {
+					node_id = selectNode(res.size, node_id);
+					if(node_id != -1)
+						inserted = EX_PASS(insertIntoAtlas(res_id, node_id));
 				}
-				continue;
 			}
-
-			Image tex;
-			res.res_ptr->cacheUpload(tex);
-			DASSERT(tex.size() == res.size);
-			res.atlas_pos = pos + atlas_node.rect.min();
-
-			// TODO: scissor rect is not supported
-			EXPECT(m_atlas->image()->upload(tex, res.atlas_pos, 0, VImageLayout::general));
-
-			if(res.atlas_node_id == -1) {
-#ifdef LOGGING
-				printf("Inserting to atlas node %d: %dKB\n", m_last_node,
-					   (res.size.x * res.size.y * 4) / 1024);
-#endif
-				ATLAS_REMOVE(m_atlas_queue, index);
-				ATLAS_INSERT(atlas_node.list, index);
-				res.atlas_node_id = m_last_node;
-				m_atlas_counter++;
+			if(!inserted) {
+				// There is no space in the atlas right now; texture stays standalone
+				res.wants_atlas = false;
+				if(!res.atlas_staging.empty()) {
+					if(!res.device_texture)
+						EX_PASS(createTexture(res_id, res.atlas_staging));
+					recycleImage(std::move(res.atlas_staging));
+					res.atlas_staging = {};
+				}
 			}
-
-			max_y = max(max_y, res.size.y);
-			pos.x += res.size.x;
 		}
+	}
 
-		m_last_node = (m_last_node + 1) % (int)m_atlas_nodes.size();
-		while(m_atlas_queue.head != -1)
-			ATLAS_REMOVE(m_atlas_queue, m_atlas_queue.head);
+	// Defragmenting at most one node per frame
+	if(m_repack.node_id != -1)
+		EX_PASS(finishRepack());
+	for(int n = 0; n < (int)m_atlas_nodes.size() && m_repack.node_id == -1; n++) {
+		int node_id = (m_last_defrag + n) % (int)m_atlas_nodes.size();
+		if(m_atlas_nodes[node_id].fragmented) {
+			EX_PASS(defragment(node_id));
+			m_last_defrag = node_id + 1;
+			break;
+		}
 	}
 
+	m_last_stats = m_stats;
+	m_stats = {};
+
 	if(m_last_update == INT_MAX) {
 		for(int n = 0; n < (int)m_resources.size(); n++)
 			m_resources[n].last_update = 0;
 		m_last_update = 0;
 	}
 	m_last_update++;
+	for(auto &node : m_atlas_nodes)
+		node.fresh_pixels = 0;
 	return {};
 }
 
+float TextureCache::atlasFillRatio() const {
+	if(m_atlas_nodes.empty())
+		return 0.0f;
+	i64 used = 0;
+	for(auto &node : m_atlas_nodes)
+		used += node.used_pixels;
+	return float(double(used) / (double(m_atlas_nodes.size()) * node_size * node_size));
+}
+
+string TextureCache::statsText() const {
+	auto &stats = m_last_stats;
+	return stdFormat("Atlas: hit rate: %.1f%% fill: %.1f%% textures: %d\n"
+					 "Evictions: %d defrag: %d upload: %dKB misses: %d pending: %d\n",
+					 stats.hitRate() * 100.0, atlasFillRatio() * 100.0f, m_atlas_counter,
+					 stats.evictions, stats.defragmentations, int(stats.upload_bytes / 1024),
+					 stats.misses, stats.pending) +
+		   (m_disk_cache ? stdFormat("Disk cache: textures: %d hits: %d stored: %d\n",
+									 m_disk_cache->size(), m_disk_cache->hits(),
+									 m_disk_cache->stores()) :
+						   string());
+}
+
 int TextureCache::add(CachedTexture *res_ptr, const int2 &size) {
 	DASSERT(res_ptr);
 	Resource new_res{res_ptr, PVImageView(), size, int2(0, 0), -1, 0};
@@ -226,24 +738,33 @@ void TextureCache::unload(int res_id) {
 
 void TextureCache::remove(int res_id) {
 	DASSERT(isValidId(res_id));
+	cancelDecode(res_id);
 	Resource &res = m_resources[res_id];
-	ATLAS_REMOVE(res.atlas_node_id == -1 ? m_atlas_queue : m_atlas_nodes[res.atlas_node_id].list,
-				 res_id);
-	if(res.atlas_node_id != -1) {
-		m_atlas_counter--;
-		res.atlas_node_id = -1;
-	}
+	res.atlas_staging = {};
+	res.wants_atlas = false;
+	if(res.atlas_node_id != -1)
+		evictFromAtlas(res_id);
+	else
+		ATLAS_REMOVE(m_atlas_queue, res_id);
 
 	unload(res_id);
 	MAIN_INSERT(m_free_list, res_id);
 	m_resources[res_id].res_ptr = nullptr;
 }
 
+void TextureCache::prefetch(int res_id) {
+	DASSERT(isValidId(res_id));
+	Resource &res = m_resources[res_id];
+	if(asyncDecoding() && !res.device_texture && res.atlas_node_id == -1 &&
+	   res.res_ptr->textureSize() != int2(0))
+		submitDecode(res_id);
+}
+
 PVImageView TextureCache::access(int res_id, bool put_in_atlas, FRect &tex_rect) {
 	DASSERT(isValidId(res_id));
 
 	Resource &res = m_resources[res_id];
-	res.last_update = m_last_update;
+	touch(res_id);
 	if(res.res_ptr->textureSize() == int2(0))
 		return {};
 
@@ -252,39 +773,37 @@ PVImageView TextureCache::access(int res_id, bool put_in_atlas, FRect &tex_rect)
 			unload(res_id);
 		float2 mul(1.0f / float(m_atlas_size.x), 1.0f / float(m_atlas_size.y));
 		tex_rect = FRect(float2(res.atlas_pos) * mul, float2(res.atlas_pos + res.size) * mul);
+		m_stats.atlas_hits++;
 		return m_atlas;
-	} else if(put_in_atlas && res.atlas_node.prev == -1 && res.atlas_node.next == -1 &&
-			  m_atlas_queue.head != res_id) {
-		DASSERT(res.atlas_node_id == -1);
-		if(res.size.x <= node_size / 2 && res.size.y <= node_size / 2)
+	} else if(put_in_atlas && !inAtlasQueue(res_id)) {
+		if(res.size.x <= node_size / 2 && res.size.y <= node_size / 2) {
 			ATLAS_INSERT(m_atlas_queue, res_id);
+			res.wants_atlas = true;
+		}
 	}
 
 	if(!res.device_texture) {
 		DASSERT(res.res_ptr);
-		Image temp_tex;
-		res.res_ptr->cacheUpload(temp_tex);
+		if(asyncDecoding()) {
+			// Decoded texture may already wait for the atlas
+			if(res.atlas_staging.empty())
+				submitDecode(res_id);
+			m_stats.pending++;
+			return {};
+		}
 
-		auto image = VulkanImage::createAndUpload(m_device, temp_tex);
+		Image temp_tex;
+		decode(res.res_ptr, temp_tex);
 		// TODO: pass errors?
-		image.check();
-		res.device_texture = VulkanImageView::create(*image);
-		res.size = int2(temp_tex.width(), temp_tex.height());
-
-		int new_size = textureMemorySize(res.device_texture);
-#ifdef LOGGING
-		printf("Loading %dKB (current: %dKB / %dKB)\n", new_size / 1024, m_memory_size / 1024,
-			   m_memory_limit / 1024);
-#endif
-		m_memory_size += new_size;
-		while(m_memory_size > m_memory_limit && m_main_list.tail != -1)
-			unload(m_main_list.tail);
-
-		MAIN_INSERT(m_main_list, res_id);
+		createTexture(res_id, temp_tex).check();
+		if(inAtlasQueue(res_id))
+			res.atlas_staging = std::move(temp_tex);
+		m_stats.misses++;
 	} else {
 		// Moving to front
 		MAIN_REMOVE(m_main_list, res_id);
 		MAIN_INSERT(m_main_list, res_id);
+		m_stats.texture_hits++;
 	}
 
 	auto dev_size = res.device_texture->size();
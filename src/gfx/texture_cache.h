@@ -4,11 +4,17 @@
 #pragma once
 
 #include "base.h"
+#include <condition_variable>
+#include <deque>
+#include <fwk/gfx/image.h>
 #include <fwk/list_node.h>
+#include <mutex>
+#include <thread>
 #include <fwk/vulkan/vulkan_image.h>
 #include <fwk/vulkan_base.h>
 
 class TextureCache;
+class DiskTextureCache;
 
 class CachedTexture {
   public:
@@ -18,14 +24,20 @@ class CachedTexture {
 	virtual ~CachedTexture();
 
 	PVImageView accessTexture(FRect &, bool put_in_atlas = true) const;
+	// Starts decoding texture in the background (if async decoding is enabled)
+	void prefetchTexture() const;
 	int cacheId() const { return m_id; }
 
 	bool isBind() const { return m_id != -1; }
 	void bindToCache() const;
 	void unbindFromCache() const;
 
+	// With async decoding enabled, it may be called from worker threads
 	virtual void cacheUpload(Image &) const = 0;
 	virtual int2 textureSize() const = 0;
+	// Key under which decoded texture is kept in DiskTextureCache; 0 means: don't store it
+	// It has to depend on all the data used in cacheUpload; may be called from worker threads
+	virtual u64 persistentKey() const { return 0; }
 
   private:
 	void onCacheDestroy();
@@ -37,14 +49,37 @@ class CachedTexture {
 // accesed textures are valid only until nextFrame, if the texture
 // was in the atlas, it's data might change, so accessTexture should be called every frame
 //
-// TODO: texture packing in the atlas can be greatly improved:
-// - instead of round robin, select next AtlasNode based on active texture count, free space, etc.
-// - when packing textures, use some smarter algorithm to save space
-// - use PBO to copy textures from res.device_texture, and not from system memory
+// Atlas is divided into nodes; each node packs its textures with MaxRects (best short side fit).
+// Queued textures are inserted into nodes with the most free & stale area; if they don't fit,
+// least recently used textures from the selected node are evicted. Fragmented nodes are
+// repacked, at most one per frame. With async decoding moved textures are decoded again by
+// workers; until all of them are ready, old placement stays valid (see finishRepack).
+//
+// With async decoding enabled, textures which are missing are decoded on worker threads and
+// access returns null until they are uploaded (at most upload_budget bytes each nextFrame).
+// Textures which go into the atlas are also decoded by workers; decoded image is kept
+// in staging until the texture is inserted, so atlas uploads never decode on render thread.
+//
+// Optionally decoded textures can be kept in DiskTextureCache; textures found there
+// are copied straight from the mapped file, without any decoding.
+//
+// TODO: use PBO to copy textures from res.device_texture, and not from system memory
 //
 // Only single instance allowed
 class TextureCache {
   public:
+	struct Stats {
+		double hitRate() const;
+
+		int atlas_hits = 0;   // served from atlas
+		int texture_hits = 0; // served from already created standalone texture
+		int misses = 0;		  // standalone texture had to be created
+		int pending = 0;	  // texture is still being decoded
+		int evictions = 0;
+		int defragmentations = 0;
+		i64 upload_bytes = 0;
+	};
+
 	TextureCache(VulkanDevice &, int max_bytes = 32 * 1024 * 1024);
 	~TextureCache();
 
@@ -55,19 +90,36 @@ class TextureCache {
 		DASSERT(g_instance);
 		return *g_instance;
 	}
+	static bool isInitialized() { return g_instance != nullptr; }
 
 	bool isValidId(int res_id) const { return res_id >= 0 && res_id < size(); }
 	int size() const { return (int)m_resources.size(); }
 
 	void unload(int res_id);
 	PVImageView access(int res_id, bool put_in_atlas, FRect &);
+	void prefetch(int res_id);
 	PVImageView atlas() { return m_atlas; }
 
+	void setAsyncDecoding(bool enable, int num_threads = 0);
+	bool asyncDecoding() const { return !m_workers.empty(); }
+	void setUploadBudget(int bytes) { m_upload_budget = bytes; }
+	int uploadBudget() const { return m_upload_budget; }
+
+	// Should be called before any textures are accessed
+	Ex<> openDiskCache(ZStr file_name);
+	const DiskTextureCache *diskCache() const { return m_disk_cache.get(); }
+
 	void setMemoryLimit(int bytes) { m_memory_limit = bytes; }
 	int memoryLimit() const { return m_memory_limit; }
 	int memorySize() const { return m_memory_size; }
 	Ex<> nextFrame();
 
+	// Statistics gathered during last finished frame
+	const Stats &stats() const { return m_last_stats; }
+	// Part of the atlas occupied by textures (0 - 1)
+	float atlasFillRatio() const;
+	string statsText() const;
+
   private:
 	static TextureCache *g_instance;
 
@@ -85,28 +137,96 @@ class TextureCache {
 
 		ListNode main_node{}; // shared by two lists: m_main_list, m_free_list
 		ListNode atlas_node{}; // shared by two lists: AtlasNode::list, m_atlas_queue
+		Image atlas_staging;   // decoded texture which waits for insertion into the atlas
+		bool decode_pending = false;
+		bool wants_atlas = false;
+	};
+
+	struct DecodeJob {
+		int res_id;
+		const CachedTexture *res_ptr;
+		Image image;
 	};
 
 	static constexpr int node_size = 256;
+	static constexpr int max_upload_pixels = node_size * node_size;
 
 	struct AtlasNode {
+		AtlasNode(IRect rect = {});
+
+		// Returns offset within the node
+		Maybe<int2> insert(int2 size);
+		void release(const IRect &local_rect);
+		void clear();
+		int freePixels() const;
+		// Pixels of textures which weren't accessed during current frame
+		int stalePixels() const { return used_pixels - fresh_pixels; }
+
 		IRect rect;
 		List list{};
+		vector<IRect> free_rects; // maximal free rectangles (in node coordinates)
+		int used_pixels = 0;
+		int fresh_pixels = 0; // used by textures accessed during current frame
+		bool fragmented = false;
 	};
 
+	bool inAtlasQueue(int res_id) const;
+	void touch(int res_id);
+	int selectNode(int2 size, int skip_node) const;
+	void evictFromAtlas(int res_id);
+	Ex<bool> insertIntoAtlas(int res_id, int node_id);
+	Ex<> uploadToAtlas(int res_id);
+	Ex<> defragment(int node_id);
+	Ex<> finishRepack();
+
+	void decode(const CachedTexture *, Image &);
+	Ex<> createTexture(int res_id, const Image &);
+	Ex<> uploadDecoded();
+	void submitDecode(int res_id);
+	void cancelDecode(int res_id);
+	void recycleImage(Image &&);
+	void decodeLoop();
+	void stopWorkers();
+
 	VulkanDevice &m_device;
-	PodVector<AtlasNode> m_atlas_nodes;
+	vector<AtlasNode> m_atlas_nodes;
 	PVImageView m_atlas;
 	int2 m_atlas_size;
 	int m_atlas_counter;
+	Stats m_stats, m_last_stats;
 
 	vector<Resource> m_resources;
 	int m_memory_limit;
 	int m_memory_size;
 	int m_last_update;
-	int m_last_node;
+	int m_last_defrag;
+
+	// Node which is being repacked asynchronously; pos is none if texture doesn't fit
+	struct RepackEntry {
+		int res_id;
+		int2 size;
+		Maybe<int2> pos;
+	};
+	struct Repack {
+		int node_id = -1;
+		AtlasNode layout;
+		vector<RepackEntry> entries;
+	} m_repack;
 
 	List m_main_list;
 	List m_free_list;
 	List m_atlas_queue;
+
+	// Async decoding; queues & staging pool are protected by m_decode_mutex
+	std::mutex m_decode_mutex;
+	std::condition_variable m_decode_cond, m_done_cond;
+	std::deque<DecodeJob> m_decode_queue;
+	vector<DecodeJob> m_decoded;
+	vector<int> m_decoding;
+	vector<Image> m_staging_pool;
+	vector<std::thread> m_workers;
+	bool m_stop_workers = false;
+	int m_upload_budget = 4 * 1024 * 1024;
+
+	Dynamic<DiskTextureCache> m_disk_cache;
 };
@@ -62,7 +62,9 @@ class Grid {
 	void updateNodes();
 
 	int findAny(const FBox &box, int ignored_id = -1, int flags = object_flags) const;
-	void findAll(vector<int> &out, const FBox &box, int ignored_id = -1,
+	// Found indices are appended to out (vector<int> or FrameVector<int>)
+	template <class TVector>
+	void findAll(TVector &out, const FBox &box, int ignored_id = -1,
 				 int flags = object_flags) const;
 
 	pair<int, float> trace(const Segment3F &segment, int ignored_id = -1,
@@ -71,10 +73,12 @@ class Grid {
 	pair<int, float> trace(const Ray3F &ray, float tmin, float tmax, int ignored_id,
 						   int flags) const;
 
-	void traceCoherent(const vector<Segment3F> &segments, vector<pair<int, float>> &out,
+	// out has to have the same size as segments
+	void traceCoherent(CSpan<Segment3F> segments, Span<pair<int, float>> out,
 					   int ignored_id = -1, int flags = object_flags) const;
 
-	void findAll(vector<int> &out, const IRect &view_rect, int flags = object_flags) const;
+	template <class TVector>
+	void findAll(TVector &out, const IRect &view_rect, int flags = object_flags) const;
 	int pixelIntersect(const int2 &pos, bool (*pixelTest)(const ObjectDef &, const int2 &pos),
 					   int flags = object_flags) const;
 
@@ -3,6 +3,8 @@
 
 #include "grid.h"
 
+#include "sys/frame_allocator.h"
+
 int Grid::findAny(const FBox &box, int ignored_id, int flags) const {
 	IRect grid_box = nodeCoords(box);
 
@@ -28,7 +30,8 @@ int Grid::findAny(const FBox &box, int ignored_id, int flags) const {
 	return -1;
 }
 
-void Grid::findAll(vector<int> &out, const FBox &box, int ignored_id, int flags) const {
+template <class TVector>
+void Grid::findAll(TVector &out, const FBox &box, int ignored_id, int flags) const {
 	IRect grid_box = nodeCoords(box);
 
 	for(int y = grid_box.y(); y <= grid_box.ey(); y++)
@@ -138,9 +141,11 @@ pair<int, float> Grid::trace(const Ray3F &ray, float tmin, float tmax, int ignor
 	return {out, out_dist};
 }
 
-void Grid::traceCoherent(const vector<Segment3F> &segments, vector<pair<int, float>> &out,
-						 int ignored_id, int flags) const {
-	out.resize(segments.size(), {-1, inf});
+void Grid::traceCoherent(CSpan<Segment3F> segments, Span<pair<int, float>> out, int ignored_id,
+						 int flags) const {
+	DASSERT(out.size() == segments.size());
+	for(auto &result : out)
+		result = {-1, inf};
 
 	if(segments.empty())
 		return;
@@ -170,7 +175,7 @@ void Grid::traceCoherent(const vector<Segment3F> &segments, vector<pair<int, flo
 	float max_dist = -inf;
 	IntervalF idir[3], origin[3];
 	{
-		auto first = *segments.front().asRay();
+		auto first = *segments[0].asRay();
 		auto first_idir = first.invDir();
 
 		idir[0] = first_idir.x;
@@ -226,7 +231,8 @@ void Grid::traceCoherent(const vector<Segment3F> &segments, vector<pair<int, flo
 		}
 }
 
-void Grid::findAll(vector<int> &out, const IRect &view_rect, int flags) const {
+template <class TVector>
+void Grid::findAll(TVector &out, const IRect &view_rect, int flags) const {
 	IRect grid_box(0, 0, m_size.x, m_size.y);
 
 	for(int y = grid_box.y(); y < grid_box.ey(); y++) {
@@ -299,3 +305,8 @@ int Grid::pixelIntersect(const int2 &screen_pos, bool (*pixelTest)(const ObjectD
 
 	return best;
 }
+
+template void Grid::findAll(vector<int> &, const FBox &, int, int) const;
+template void Grid::findAll(FrameVector<int> &, const FBox &, int, int) const;
+template void Grid::findAll(vector<int> &, const IRect &, int) const;
+template void Grid::findAll(FrameVector<int> &, const IRect &, int) const;
@@ -12,10 +12,16 @@
 #include "game/pc_controller.h"
 #include "game/visibility.h"
 #include "gfx/scene_renderer.h"
+#include "gfx/texture_cache.h"
 #include "hud/console.h"
 #include "hud/hud.h"
 #include "hud/target_info.h"
+#include "net/host.h"
+#include "res_manager.h"
+#include "residency.h"
+#include "sys/alloc_tracker.h"
 #include "sys/gfx_device.h"
+#include "sys/profiler.h"
 
 #include <fwk/gfx/canvas_2d.h>
 #include <fwk/gfx/font.h>
@@ -28,10 +34,6 @@ namespace io {
 static const float s_exit_anim_length = 0.7f;
 static const float2 target_info_size(200.0f, 80.0f);
 
-static string s_profiler_stats;
-
-void Controller::setProfilerStats(string stats) { s_profiler_stats = std::move(stats); }
-
 Controller::Controller(GfxDevice &gfx_device, PWorld world, bool debug_info)
 	: m_gfx_device(gfx_device), m_world(world), m_viewer(world), m_view_pos(0, 0),
 	  m_show_debug_info(debug_info), m_debug_navi(false), m_debug_ai(false), m_is_exiting(0),
@@ -281,6 +283,35 @@ void Controller::update(double time_diff) {
 			break;
 
 		auto strings = fromString<vector<string>>(command);
+		if(strings.size() == 1 && strings[0] == "res_info") {
+			ResidencyTracker::printInfo();
+			auto &arena = ResManager::instance().tileArena();
+			printf("Tile arena: %lld KB (%lld KB without deduplication), palettes: %d\n",
+				   (long long)(arena.memorySize() / 1024),
+				   (long long)(arena.requestedSize() / 1024), arena.paletteCount());
+			continue;
+		}
+		if(strings.size() == 1 && strings[0] == "res_trim") {
+			int num_tiles = ResManager::instance().trimTiles();
+			int num_sprites = Sprite::trimResidency();
+			printf("Evicted tiles: %d sprites: %d\n", num_tiles, num_sprites);
+			continue;
+		}
+		if(strings.size() == 1 && strings[0] == "net_stats") {
+			if(m_net_host)
+				printf("%s", m_net_host->statsText().c_str());
+			else
+				printf("Not connected\n");
+			continue;
+		}
+		if(strings.size() == 3 && strings[0] == "res_budget") {
+			// Budget is given in megabytes
+			if(auto category = maybeFromString<ResidencyCategory>(strings[1]))
+				ResidencyTracker::setBudget(*category, i64(fromString<int>(strings[2])) << 20);
+			else
+				printf("Invalid residency category: %s\n", strings[1].c_str());
+			continue;
+		}
 		if(strings.size() != 2) {
 			printf("Invalid command: %s\n", command.c_str());
 			continue;
@@ -297,6 +328,16 @@ void Controller::update(double time_diff) {
 			m_time_multiplier = clamp(fromString<float>(param), 0.0f, 10.0f);
 		else if(strings[0] == "see_all")
 			m_viewer.setSeeAll(fromString<bool>(param));
+		else if(strings[0] == "profiler")
+			Profiler::setEnabled(fromString<bool>(param));
+		else if(strings[0] == "alloc_tracker")
+			AllocTracker::setEnabled(fromString<bool>(param));
+		else if(strings[0] == "profile_trace") {
+			if(auto file_name = ResManager::instance().cacheFile("profiler/trace.json"))
+				Profiler::captureTrace(*file_name, fromString<int>(param));
+			else
+				file_name.error().print();
+		}
 		else
 			printf("Invalid command: %s\n", strings[0].c_str());
 	}
@@ -388,7 +429,17 @@ void Controller::drawDebugInfo(Canvas2D &out) const {
 		fmt("\n\n");
 	}
 
-	fmt("%", s_profiler_stats);
+	if(m_net_host)
+		for(int n = 0; n < m_net_host->numRemoteHosts(); n++)
+			if(auto *host = m_net_host->getRemoteHost(n)) {
+				auto summary = host->summary();
+				fmt.stdFormat("Net %d: in %.1f KB/s out %.1f KB/s rtt %.0f ms budget %.0f%%\n", n,
+							  summary.bytes_in / 1024.0, summary.bytes_out / 1024.0,
+							  summary.rtt * 1000.0f, summary.max_budget_used * 100.0f);
+			}
+	fmt("%", TextureCache::instance().statsText());
+	fmt("%", Profiler::statsText());
+	fmt("%", AllocTracker::statsText());
 
 	int2 extents = font.evalExtents(fmt.text()).size();
 	extents.y = (extents.y + 19) / 20 * 20;
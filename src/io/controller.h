@@ -8,6 +8,10 @@
 #include "game/world.h"
 #include <fwk/sys/input.h>
 
+namespace net {
+class LocalHost;
+}
+
 namespace hud {
 class Hud;
 class HudConsole;
@@ -29,7 +33,9 @@ class Controller {
 
 	double timeMultiplier() const { return m_time_multiplier; }
 	void setTimeMultiplier(double mul) { m_time_multiplier = mul; }
-	static void setProfilerStats(string);
+
+	// Network stats of given host are available on the console & in debug info
+	void setNetHost(const net::LocalHost *host) { m_net_host = host; }
 
   protected:
 	void updatePC();
@@ -77,6 +83,7 @@ class Controller {
 	game::Path m_last_path;
 
 	ShownMessage m_main_message;
+	const net::LocalHost *m_net_host = nullptr;
 
 	int m_is_exiting;
 };
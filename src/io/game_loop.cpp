@@ -10,6 +10,7 @@
 #include "io/controller.h"
 #include "net/client.h"
 #include "net/server.h"
+#include "res_manager.h"
 
 using namespace game;
 
@@ -38,6 +39,7 @@ GameLoop::GameLoop(GfxDevice *gfx_device, net::PServer &&server, bool from_main)
 	if(!m_server->config().m_console_mode) {
 		DASSERT(gfx_device);
 		m_controller.reset(new Controller(*gfx_device, m_world, m_config.profiler_on));
+		m_controller->setNetHost(m_server.get());
 	}
 }
 
@@ -49,6 +51,7 @@ GameLoop::GameLoop(GfxDevice &gfx_device, net::PClient &&client, bool from_main)
 
 	//TODO: wait until initial entity information is loaded?
 	m_controller.reset(new Controller(gfx_device, m_world, m_config.profiler_on));
+	m_controller->setNetHost(m_client.get());
 }
 
 GameLoop::GameLoop(GfxDevice &gfx_device, game::PWorld world, bool from_main)
@@ -59,7 +62,14 @@ GameLoop::GameLoop(GfxDevice &gfx_device, game::PWorld world, bool from_main)
 	m_controller.reset(new Controller(gfx_device, m_world, m_config.profiler_on));
 }
 
-GameLoop::~GameLoop() {}
+GameLoop::~GameLoop() {
+	// Tiles used only by this world can be evicted now
+	m_controller.reset();
+	m_world.reset();
+	m_client.reset();
+	m_server.reset();
+	ResManager::instance().trimTiles();
+}
 
 bool GameLoop::onTick(double time_diff) {
 	double multiplier = !m_world->isClient() && !m_world->isServer() && m_controller ?
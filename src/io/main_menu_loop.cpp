@@ -120,8 +120,9 @@ bool MainMenuLoop::onEvent(const Event &ev) {
 		string map_name = abs_path.relative(FilePath("data/maps/").absolute(current));
 
 		if(m_mode == mode_starting_single && ev.value) {
-			m_future_world = std::async(std::launch::async, [map_name]() {
-				return PWorld(new World(map_name, World::Mode::single_player));
+			auto progress = m_load_progress = make_shared<WorldLoadProgress>();
+			m_future_world = std::async(std::launch::async, [map_name, progress]() {
+				return PWorld(new World(map_name, World::Mode::single_player, progress.get()));
 			});
 		} else if(m_mode == mode_starting_server && ev.value) {
 			net::ServerConfig config;
@@ -129,8 +130,10 @@ bool MainMenuLoop::onEvent(const Event &ev) {
 			config.m_server_name = format("Test server #%", rand() % 256);
 			m_server.reset(new net::Server(config));
 
-			m_future_world = std::async(std::launch::async, [map_name]() {
-				return PWorld(new World(map_name, World::Mode::server));
+			auto progress = m_load_progress = make_shared<WorldLoadProgress>();
+			auto *server = m_server.get();
+			m_future_world = std::async(std::launch::async, [server, progress]() {
+				return server->makeWorld(progress.get());
 			});
 		}
 
@@ -230,8 +233,9 @@ bool MainMenuLoop::onTick(double time_diff) {
 			m_client = std::move(m_multi_menu->getClient());
 			const string map_name = m_client->levelInfo().map_name;
 
-			m_future_world = std::async(std::launch::async, [map_name]() {
-				return PWorld(new World(map_name, World::Mode::client));
+			auto progress = m_load_progress = make_shared<WorldLoadProgress>();
+			m_future_world = std::async(std::launch::async, [map_name, progress]() {
+				return PWorld(new World(map_name, World::Mode::client, progress.get()));
 			});
 			m_mode = mode_loading;
 		}
@@ -267,8 +271,12 @@ void MainMenuLoop::onDraw(Canvas2D &canvas) {
 	if(m_sub_menu)
 		m_sub_menu->draw(canvas);
 
-	if(m_mode == mode_loading)
-		m_loading.draw(canvas, canvas.viewport().size() - int2(180, 50));
+	if(m_mode == mode_loading) {
+		Maybe<float> progress;
+		if(m_load_progress)
+			progress = m_load_progress->total();
+		m_loading.draw(canvas, canvas.viewport().size() - int2(180, 50), progress);
+	}
 }
 
 }
@@ -57,6 +57,7 @@ class MainMenuLoop : public ui::Window, public Loop {
 	IRect m_back_rect;
 
 	std::future<game::PWorld> m_future_world;
+	shared_ptr<game::WorldLoadProgress> m_load_progress;
 	net::PClient m_client;
 	net::PServer m_server;
 	PLoop m_sub_loop;
@@ -4,75 +4,218 @@
 #include "navi_heightmap.h"
 
 #include "grid.h"
+#include "sys/parallel.h"
 #include <algorithm>
 #include <fwk/gfx/image.h>
+#include <tuple>
 
+#if defined(__x86_64__) || defined(_M_X64)
+#define SIMD_COLUMNS
+#include <emmintrin.h>
+#endif
+
+// Heights of all levels of a single cell are kept together during rasterisation, so that
+// they can be processed with a single SSE register
 static constexpr int max_levels = 16;
 
+namespace {
+
+struct Column {
+	u8 levels[max_levels];
+};
+
+// Returns first level which is free or not lower than min_value; max_levels if there is none
+int findLevel(const Column &column, int min_value) {
+#ifdef SIMD_COLUMNS
+	__m128i values = _mm_loadu_si128((const __m128i *)column.levels);
+	__m128i free = _mm_cmpeq_epi8(values, _mm_set1_epi8(NaviHeightmap::invalid_value));
+	__m128i high = _mm_cmpeq_epi8(_mm_max_epu8(values, _mm_set1_epi8((char)min_value)), values);
+	int mask = _mm_movemask_epi8(_mm_or_si128(free, high));
+	return mask ? __builtin_ctz(mask) : max_levels;
+#else
+	for(int level = 0; level < max_levels; level++) {
+		int value = column.levels[level];
+		if(value == NaviHeightmap::invalid_value || value >= min_value)
+			return level;
+	}
+	return max_levels;
+#endif
+}
+
+// Invalidates all levels with heights in [min_value, max_value]
+void clearLevels(Column &column, int min_value, int max_value) {
+#ifdef SIMD_COLUMNS
+	static_assert(NaviHeightmap::invalid_value == 0);
+	__m128i values = _mm_loadu_si128((const __m128i *)column.levels);
+	__m128i above = _mm_cmpeq_epi8(_mm_max_epu8(values, _mm_set1_epi8((char)min_value)), values);
+	__m128i below = _mm_cmpeq_epi8(_mm_min_epu8(values, _mm_set1_epi8((char)max_value)), values);
+	values = _mm_andnot_si128(_mm_and_si128(above, below), values);
+	_mm_storeu_si128((__m128i *)column.levels, values);
+#else
+	for(auto &value : column.levels)
+		if(value >= min_value && value <= max_value)
+			value = NaviHeightmap::invalid_value;
+#endif
+}
+
+struct Span {
+	int x, ex;
+	u8 min_y, max_y;
+};
+
+// For every row: spans of boxes which overlap it (in the order of boxes)
+struct RowSpans {
+	RowSpans(CSpan<IBox> boxes, int num_rows) : offsets(num_rows + 1, 0) {
+		for(auto &box : boxes)
+			for(int z = box.z(); z < box.ez(); z++)
+				offsets[z + 1]++;
+		for(int z = 0; z < num_rows; z++)
+			offsets[z + 1] += offsets[z];
+
+		spans.resize(offsets.back());
+		vector<int> fill(offsets.begin(), offsets.end() - 1);
+		for(auto &box : boxes) {
+			Span span{box.x(), box.ex(), (u8)box.y(), (u8)box.ey()};
+			for(int z = box.z(); z < box.ez(); z++)
+				spans[fill[z]++] = span;
+		}
+	}
+
+	CSpan<Span> row(int z) const {
+		return CSpan<Span>(spans.data() + offsets[z], offsets[z + 1] - offsets[z]);
+	}
+
+	vector<int> offsets;
+	PodVector<Span> spans;
+};
+
+// Blockers are independent from each other, so overlapping spans with the same height
+// range can be merged
+void mergeSpans(vector<Span> &spans) {
+	std::sort(begin(spans), end(spans), [](const Span &a, const Span &b) {
+		return a.min_y != b.min_y ? a.min_y < b.min_y :
+			   a.max_y != b.max_y ? a.max_y < b.max_y :
+									a.x < b.x;
+	});
+
+	int count = 0;
+	for(auto &span : spans) {
+		if(count > 0) {
+			auto &prev = spans[count - 1];
+			if(prev.min_y == span.min_y && prev.max_y == span.max_y && span.x <= prev.ex) {
+				prev.ex = max(prev.ex, span.ex);
+				continue;
+			}
+		}
+		spans[count++] = span;
+	}
+	spans.resize(count);
+}
+
+IBox clampBox(const IBox &box, int2 size) {
+	return {vmax(box.min(), int3(0, 0, 0)), vmin(box.max(), int3(size.x, 255, size.y))};
+}
+}
+
 NaviHeightmap::NaviHeightmap(const int2 &size) {
 	DASSERT(size.x >= 0 && size.y >= 0);
 	m_size = size;
 	m_level_count = 0;
 }
 
-void NaviHeightmap::update(const vector<IBox> &walkable, const vector<IBox> &blockers) {
+// For each cell covered by a walkable box (in sorted order), the first level which is free
+// or not much lower than the box gets box height. Cells are independent, so rows are
+// rasterised in parallel bands.
+void NaviHeightmap::update(const vector<IBox> &walkable, const vector<IBox> &blockers,
+						   int num_threads) {
 	m_level_count = 0;
 	m_data.clear();
 
 	PodVector<IBox> bboxes(walkable.size());
-	for(int n = 0; n < bboxes.size(); n++) {
-		IBox bbox = walkable[n];
-		bboxes[n] = {vmax(bbox.min(), int3(0, 0, 0)),
-					 vmin(bbox.max(), int3(m_size.x, 255, m_size.y))};
+	int num_boxes = 0;
+	for(auto &box : walkable) {
+		auto bbox = clampBox(box, m_size);
+		if(bbox.width() > 0 && bbox.depth() > 0)
+			bboxes[num_boxes++] = bbox;
 	}
+	bboxes.resize(num_boxes);
 
-	std::sort(bboxes.data(), bboxes.end(), [](const IBox &a, const IBox &b) {
-		return a.y() == b.y() ? a.x() == b.x() ? a.z() < b.z() : a.x() < b.x() : a.y() < b.y();
-	});
+	// Order of boxes affects the results, so it has to be fully specified
+	auto box_key = [](const IBox &box) {
+		return std::tuple(box.y(), box.x(), box.z(), box.ex(), box.ey(), box.ez());
+	};
+	std::sort(bboxes.data(), bboxes.end(),
+			  [&](const IBox &a, const IBox &b) { return box_key(a) < box_key(b); });
 
-	for(int n = 0; n < bboxes.size(); n++) {
-		const IBox &bbox = bboxes[n];
-		int min_y = bbox.y(), max_y = bbox.ey();
+	vector<IBox> clamped_blockers;
+	clamped_blockers.reserve(blockers.size());
+	for(auto &box : blockers) {
+		auto blocker = clampBox(box, m_size);
+		if(blocker.width() > 0 && blocker.depth() > 0) {
+			// Levels slightly below blockers are also invalidated
+			blocker = {int3(blocker.x(), max(0, blocker.y() - 4), blocker.z()), blocker.max()};
+			clamped_blockers.emplace_back(blocker);
+		}
+	}
 
-		for(int z = 0; z < bbox.depth(); z++)
-			for(int x = 0; x < bbox.width(); x++) {
-				int level = 0;
-				int px = x + bbox.x();
-				int pz = z + bbox.z();
+	RowSpans walkable_rows(bboxes, m_size.y);
+	RowSpans blocker_rows(clamped_blockers, m_size.y);
 
-				while(level < m_level_count) {
-					int value = m_data[index(px, pz, level)];
-					if(value == invalid_value || value >= min_y - 4)
-						break;
-					level++;
-				}
-				if(level == m_level_count) {
+	// Every band of rows is rasterised separately & stored level by level
+	const int band_size = 16;
+	int num_bands = (m_size.y + band_size - 1) / band_size;
+	vector<PodVector<u8>> band_data(num_bands);
+	vector<int> band_levels(num_bands, 0);
+
+	parallelFor(num_bands, num_threads, [&](int band) {
+		int first_z = band * band_size, num_rows = min(m_size.y - first_z, band_size);
+		PodVector<Column> columns(m_size.x * num_rows);
+		memset(columns.data(), invalid_value, columns.size() * sizeof(Column));
+		vector<Span> blocker_spans;
+		int num_levels = 0;
+
+		for(int z = first_z; z < first_z + num_rows; z++) {
+			Column *row = columns.data() + (z - first_z) * m_size.x;
+
+			for(auto &span : walkable_rows.row(z)) {
+				int min_value = max(0, span.min_y - 4);
+				for(int x = span.x; x < span.ex; x++) {
+					int level = findLevel(row[x], min_value);
 					if(level == max_levels)
 						continue;
-					addLevel();
+					row[x].levels[level] = span.max_y;
+					num_levels = max(num_levels, level + 1);
 				}
-
-				m_data[index(px, pz, level)] = max_y;
 			}
-	}
 
-	for(int n = 0; n < (int)blockers.size(); n++) {
-		IBox blocker(vmax(blockers[n].min(), int3(0, 0, 0)),
-					 vmin(blockers[n].max(), int3(m_size.x, 255, m_size.y)));
-		u8 min_y = max(0, blocker.y() - 4), max_y = blocker.ey();
-
-		for(int z = 0; z < blocker.depth(); z++)
-			for(int x = 0; x < blocker.width(); x++) {
-				int level = 0;
-				int px = x + blocker.x();
-				int pz = z + blocker.z();
-
-				while(level < m_level_count) {
-					u8 &value = m_data[index(px, pz, level++)];
-					if(value >= min_y && value <= max_y)
-						value = invalid_value;
-				}
-			}
+			auto spans = blocker_rows.row(z);
+			blocker_spans.assign(spans.begin(), spans.end());
+			mergeSpans(blocker_spans);
+			for(auto &span : blocker_spans)
+				for(int x = span.x; x < span.ex; x++)
+					clearLevels(row[x], span.min_y, span.max_y);
+		}
+
+		auto &data = band_data[band];
+		data.resize(columns.size() * num_levels);
+		for(int level = 0; level < num_levels; level++) {
+			u8 *dst = data.data() + level * columns.size();
+			for(int n = 0; n < columns.size(); n++)
+				dst[n] = columns[n].levels[level];
+		}
+		band_levels[band] = num_levels;
+	});
+
+	for(int levels : band_levels)
+		m_level_count = max(m_level_count, levels);
+	m_data.resize(m_size.x * m_size.y * m_level_count, invalid_value);
+
+	for(int band = 0; band < num_bands; band++) {
+		int first_z = band * band_size, num_rows = min(m_size.y - first_z, band_size);
+		int band_pixels = m_size.x * num_rows;
+		for(int level = 0; level < band_levels[band]; level++)
+			memcpy(&m_data[index(0, first_z, level)],
+				   band_data[band].data() + level * band_pixels, band_pixels);
 	}
 }
 
@@ -105,12 +248,6 @@ void NaviHeightmap::printInfo() const {
 		   m_level_count, level_mem, m_level_count, level_mem * m_level_count);
 }
 
-void NaviHeightmap::addLevel() {
-	ASSERT(m_level_count < max_levels);
-	m_level_count++;
-	m_data.resize(m_size.x * m_size.y * m_level_count, invalid_value);
-}
-
 bool NaviHeightmap::test(int x, int y, int level, int extents) const {
 	int max_extents = 8;
 
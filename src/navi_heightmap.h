@@ -11,7 +11,8 @@ class NaviHeightmap {
 
 	NaviHeightmap(const int2 &size);
 
-	void update(const vector<IBox> &walkable, const vector<IBox> &blockers);
+	// Rows are rasterised on multiple threads (if num_threads <= 0, default count is used)
+	void update(const vector<IBox> &walkable, const vector<IBox> &blockers, int num_threads = 0);
 
 	int2 dimensions() const { return m_size; }
 
@@ -29,8 +30,6 @@ class NaviHeightmap {
 	void printInfo() const;
 
   private:
-	void addLevel();
-
 	vector<u8> m_data;
 	int m_level_count;
 	int2 m_size;
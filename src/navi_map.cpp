@@ -5,8 +5,11 @@
 
 #include "gfx/scene_renderer.h"
 #include "navi_map.h"
+#include "sys/parallel.h"
+#include "sys/profiler.h"
 #include <algorithm>
 #include <cstring>
+#include <fwk/io/file_stream.h>
 #include <fwk/pod_vector.h>
 
 NaviMap::NaviMap(int extend) : m_size(0, 0), m_agent_size(extend) {}
@@ -54,8 +57,20 @@ static IRect findBestRect(const short *counts, const short *skip_list, int2 size
 	return best;
 }
 
-void NaviMap::extractQuads(const PodVector<u8> &bitmap, const int2 &bsize, int sx, int sy) {
-	int2 size(min((int)sector_size, bsize.x - sx), min((int)sector_size, bsize.y - sy));
+namespace {
+
+// Pixels of a single connected region of given height, clipped to one sector; Quads are
+// extracted from different sectors in parallel and merged in order of job creation
+struct SectorJob {
+	int2 origin, size;
+	PodVector<u8> pixels; // sector_size * sector_size
+	vector<NaviMap::Quad> quads;
+};
+
+void extractQuads(SectorJob &job) {
+	const int sector_size = NaviMap::sector_size;
+	int2 size = job.size;
+	const u8 *bitmap = job.pixels.data();
 
 	int pixels = 0;
 	PodVector<short> counts(sector_size * size.y * 2);
@@ -64,7 +79,7 @@ void NaviMap::extractQuads(const PodVector<u8> &bitmap, const int2 &bsize, int s
 	for(int y = 0; y < size.y; y++) {
 		int yoff = y * sector_size;
 		for(int x = 0; x < size.x; x++) {
-			if(bitmap[sx + x + (sy + y) * bsize.x]) {
+			if(bitmap[x + yoff]) {
 				counts[x + yoff] = 1 + (y > 0 ? counts[x + yoff - sector_size] : 0);
 				pixels++;
 			} else
@@ -81,7 +96,6 @@ void NaviMap::extractQuads(const PodVector<u8> &bitmap, const int2 &bsize, int s
 
 	while(pixels > 0) {
 		IRect best = findBestRect(&counts[0], &skips[0], size);
-		//	printf("%d %d %d %d +(%d %d)\n", best.x(), best.y(), best.width(), best.height(), sx, sy);
 
 		for(int y = best.y(); y < best.ey(); y++) {
 			int yoff = y * sector_size;
@@ -103,24 +117,115 @@ void NaviMap::extractQuads(const PodVector<u8> &bitmap, const int2 &bsize, int s
 			}
 		}
 
-		IRect rect = best + int2(sx, sy);
-		u8 min_height = bitmap[rect.x() + rect.y() * bsize.x];
+		u8 min_height = bitmap[best.x() + best.y() * sector_size];
 		u8 max_height = min_height;
 
-		for(int y = rect.y(); y < rect.ey(); y++)
-			for(int x = rect.x(); x < rect.ex(); x++) {
-				u8 height = bitmap[x + y * bsize.x];
+		for(int y = best.y(); y < best.ey(); y++)
+			for(int x = best.x(); x < best.ex(); x++) {
+				u8 height = bitmap[x + y * sector_size];
 				min_height = min(min_height, height);
 				max_height = max(max_height, height);
 			}
 
-		m_quads.push_back(Quad(rect, min_height, max_height));
-		listInsert(ACC_QUAD, m_sectors[findSector(rect.min())], (int)m_quads.size() - 1);
-
+		job.quads.emplace_back(best + job.origin, min_height, max_height);
 		pixels -= best.width() * best.height();
 	}
 }
 
+// Splits pixels of given height into regions with limited height difference and creates
+// extraction jobs for every sector overlapped by those regions
+void findRegions(PodVector<u8> &bitmap, const int2 &bsize, int pixel_count,
+				 vector<SectorJob> &out) {
+	const int sector_size = NaviMap::sector_size;
+	PodVector<u8> subbitmap = bitmap;
+	fill(subbitmap, 0);
+
+	vector<int2> positions;
+	int max_diff = 0;
+	int start_line = 0;
+
+	while(pixel_count) {
+		IRect subrect;
+		positions.clear();
+		int hmin, hmax;
+
+		for(int y = start_line; y < bsize.y; y++) {
+			for(int x = 0; x < bsize.x; x++)
+				if(bitmap[x + y * bsize.x]) {
+					hmin = hmax = bitmap[x + y * bsize.x];
+					positions.push_back(int2(x, y));
+					subrect = IRect(x, y, x, y);
+					break;
+				}
+
+			if(!positions.empty())
+				break;
+			start_line = y + 1;
+		}
+
+		while(!positions.empty()) {
+			int2 pos = positions.back();
+			positions.pop_back();
+
+			int offset = pos.x + pos.y * bsize.x;
+			int height = bitmap[offset];
+			if(!height)
+				continue;
+			if(max(height - hmin, hmax - height) > max_diff)
+				continue;
+
+			hmin = min(hmin, height);
+			hmax = max(hmax, height);
+
+			subrect = {vmin(subrect.min(), pos), vmax(subrect.max(), pos)};
+			bitmap[offset] = 0;
+			subbitmap[offset] = height;
+			pixel_count--;
+
+			int2 offsets[4] = {int2(-1, 0), int2(0, -1), int2(1, 0), int2(0, 1)};
+
+			int neighbours[4] = {pos.x > 0 ? bitmap[offset - 1] : 0,
+								 pos.y > 0 ? bitmap[offset - bsize.x] : 0,
+								 pos.x < bsize.x - 1 ? bitmap[offset + 1] : 0,
+								 pos.y < bsize.y - 1 ? bitmap[offset + bsize.x] : 0};
+
+			for(int n = 0; n < 4; n++) {
+				int height = neighbours[n];
+				if(height && max(height - hmin, hmax - height) <= max_diff)
+					positions.push_back(pos + offsets[n]);
+			}
+		}
+		subrect = subrect.enlarge(int2(), int2(1, 1));
+
+		for(int sy = 0; sy < bsize.y; sy += sector_size)
+			for(int sx = 0; sx < bsize.x; sx += sector_size) {
+				IRect sector(sx, sy, sx + sector_size, sy + sector_size);
+				if(!areOverlapping(subrect, sector))
+					continue;
+
+				SectorJob job;
+				job.origin = int2(sx, sy);
+				job.size = int2(min(sector_size, bsize.x - sx), min(sector_size, bsize.y - sy));
+				job.pixels.resize(sector_size * sector_size);
+				fill(job.pixels, 0);
+
+				bool is_empty = true;
+				for(int y = 0; y < job.size.y; y++) {
+					const u8 *src = subbitmap.data() + sx + (sy + y) * bsize.x;
+					memcpy(job.pixels.data() + y * sector_size, src, job.size.x);
+					for(int x = 0; x < job.size.x; x++)
+						is_empty &= src[x] == 0;
+				}
+				if(!is_empty)
+					out.emplace_back(std::move(job));
+			}
+
+		for(int y = subrect.y(); y < subrect.ey(); y++)
+			memset(subbitmap.data() + y * bsize.x + subrect.x(), 0, subrect.width());
+	}
+}
+}
+
 static const IRect computeEdge(const IRect &quad1, const IRect &quad2) {
 	bool is_horizontal = quad1.ex() > quad2.x() && quad1.x() < quad2.ex();
 	int2 emin = vmax(quad1.min(), quad2.min()), emax = vmin(quad1.max(), quad2.max());
@@ -144,39 +249,42 @@ static const IRect computeEdge(const IRect &quad1, const IRect &quad2) {
 	return edge;
 }
 
-void NaviMap::addAdjacencyInfo(int quad1_id, int quad2_id) {
+bool NaviMap::areConnected(int quad1_id, int quad2_id) const {
 	DASSERT(quad1_id != quad2_id);
-	Quad &quad1 = m_quads[quad1_id];
-	Quad &quad2 = m_quads[quad2_id];
+	const Quad &quad1 = m_quads[quad1_id];
+	const Quad &quad2 = m_quads[quad2_id];
+
+	return quad1.min_height <= quad2.max_height + 1 && quad2.min_height <= quad1.max_height + 1 &&
+		   areAdjacent(quad1.rect, quad2.rect);
+}
 
-	if(quad1.min_height <= quad2.max_height + 1 && quad2.min_height <= quad1.max_height + 1 &&
-	   areAdjacent(quad1.rect, quad2.rect)) {
-		quad1.neighbours.push_back(quad2_id);
-		quad2.neighbours.push_back(quad1_id);
+void NaviMap::addAdjacencyInfo(int quad1_id, int quad2_id) {
+	if(areConnected(quad1_id, quad2_id)) {
+		m_quads[quad1_id].neighbours.push_back(quad2_id);
+		m_quads[quad2_id].neighbours.push_back(quad1_id);
 	}
 }
 
-void NaviMap::update(const NaviHeightmap &heightmap) {
+void NaviMap::update(const NaviHeightmap &heightmap, int num_threads) {
 	int2 bsize = heightmap.dimensions();
 	m_size = int2(bsize.x + sector_size - 1, bsize.y + sector_size - 1) / sector_size;
 	m_quads.clear();
-
+	m_sectors.clear();
 	m_sectors.resize(m_size.x * m_size.y);
 
-	printf("Creating navigation map: ");
-	fflush(stdout);
 	double time = getTime();
-
 	int level_count = heightmap.levelCount();
 
 	static constexpr int max_levels = 256;
 
 	vector<PodVector<u8>> bitmaps(level_count);
-	vector<int> level_pixels(max_levels, 0);
+	vector<vector<int>> pixels_per_level(level_count);
 
-	for(int l = 0; l < level_count; l++) {
-		bitmaps[l].resize(bsize.x * bsize.y);
+	parallelFor(level_count, num_threads, [&](int l) {
 		PodVector<u8> &bitmap = bitmaps[l];
+		vector<int> &level_pixels = pixels_per_level[l];
+		bitmap.resize(bsize.x * bsize.y);
+		level_pixels.resize(max_levels, 0);
 		fill(bitmap, 0);
 
 		for(int y = 0; y < bsize.y; y++)
@@ -186,13 +294,22 @@ void NaviMap::update(const NaviHeightmap &heightmap) {
 					bitmap[x + y * bsize.x] = height;
 					level_pixels[height]++;
 				}
-	}
-
-	for(int h = 1; h < max_levels; h++) {
-		int pixel_count = level_pixels[h];
-		if(!pixel_count)
-			continue;
+	});
 
+	vector<int> heights;
+	vector<int> level_pixels(max_levels, 0);
+	for(int l = 0; l < level_count; l++)
+		for(int h = 0; h < max_levels; h++)
+			level_pixels[h] += pixels_per_level[l][h];
+	for(int h = 1; h < max_levels; h++)
+		if(level_pixels[h])
+			heights.push_back(h);
+
+	// Regions are found independently for each height, then quads are extracted from every
+	// (region, sector) pair; Merging in order of heights & jobs keeps quad ids deterministic
+	vector<vector<SectorJob>> height_jobs(heights.size());
+	parallelFor((int)heights.size(), num_threads, [&](int n) {
+		int h = heights[n];
 		PodVector<u8> bitmap(bsize.x * bsize.y);
 		fill(bitmap, 0);
 
@@ -202,93 +319,99 @@ void NaviMap::update(const NaviHeightmap &heightmap) {
 				if(lbitmap[i] == h)
 					bitmap[i] = h;
 		}
+		findRegions(bitmap, bsize, level_pixels[h], height_jobs[n]);
+	});
+	bitmaps.clear();
+
+	vector<SectorJob *> jobs;
+	for(auto &hjobs : height_jobs)
+		for(auto &job : hjobs)
+			jobs.emplace_back(&job);
+	parallelFor((int)jobs.size(), num_threads, [&](int n) { extractQuads(*jobs[n]); });
+
+	for(auto *job : jobs)
+		for(auto &quad : job->quads) {
+			m_quads.emplace_back(quad);
+			listInsert(ACC_QUAD, m_sectors[findSector(quad.rect.min())], quadCount() - 1);
+		}
+	height_jobs.clear();
+	m_static_count = (int)m_quads.size();
 
-		PodVector<u8> subbitmap = bitmap;
-		fill(subbitmap, 0);
-
-		vector<int2> positions;
-		int max_diff = 0;
-		int start_line = 0;
-
-		while(pixel_count) {
-			IRect subrect;
-			positions.clear();
-			int hmin, hmax;
-
-			for(int y = start_line; y < bsize.y; y++) {
-				for(int x = 0; x < bsize.x; x++)
-					if(bitmap[x + y * bsize.x]) {
-						hmin = hmax = bitmap[x + y * bsize.x];
-						positions.push_back(int2(x, y));
-						subrect = IRect(x, y, x, y);
-						break;
-					}
-
-				if(!positions.empty())
-					break;
-				start_line = y + 1;
-			}
-
-			while(!positions.empty()) {
-				int2 pos = positions.back();
-				positions.pop_back();
-
-				int offset = pos.x + pos.y * bsize.x;
-				int height = bitmap[offset];
-				if(!height)
-					continue;
-				if(max(height - hmin, hmax - height) > max_diff)
-					continue;
-
-				hmin = min(hmin, height);
-				hmax = max(hmax, height);
-
-				subrect = {vmin(subrect.min(), pos), vmax(subrect.max(), pos)};
-				bitmap[offset] = 0;
-				subbitmap[offset] = height;
-				pixel_count--;
+	// Adjacent pairs are found in parallel and added in the same order as in serial version
+	static constexpr int chunk_size = 256;
+	int num_chunks = (quadCount() + chunk_size - 1) / chunk_size;
+	vector<vector<pair<int, int>>> adjacent(num_chunks);
+
+	parallelFor(num_chunks, num_threads, [&](int chunk) {
+		vector<int> indices;
+		int end = min(quadCount(), (chunk + 1) * chunk_size);
+		for(int i = chunk * chunk_size; i < end; i++) {
+			indices.clear();
+			const Quad &quad = m_quads[i];
+			IBox bbox = quad.box();
+
+			findQuads(IBox(bbox.min() - int3(1, 1, 1), bbox.max() + int3(1, 1, 1)), indices);
+			for(int j = 0; j < (int)indices.size(); j++)
+				if(indices[j] < i && areConnected(i, indices[j]))
+					adjacent[chunk].emplace_back(i, indices[j]);
+		}
+	});
 
-				int2 offsets[4] = {int2(-1, 0), int2(0, -1), int2(1, 0), int2(0, 1)};
+	for(auto &pairs : adjacent)
+		for(auto [quad1_id, quad2_id] : pairs) {
+			m_quads[quad1_id].neighbours.push_back(quad2_id);
+			m_quads[quad2_id].neighbours.push_back(quad1_id);
+		}
 
-				int neighbours[4] = {pos.x > 0 ? bitmap[offset - 1] : 0,
-									 pos.y > 0 ? bitmap[offset - bsize.x] : 0,
-									 pos.x < bsize.x - 1 ? bitmap[offset + 1] : 0,
-									 pos.y < bsize.y - 1 ? bitmap[offset + bsize.x] : 0};
+	for(int n = 0; n < (int)m_quads.size(); n++)
+		m_quads[n].static_ncount = (int)m_quads[n].neighbours.size();
+	printf("Created navigation map (agent size: %d): %d quads (%.2f seconds)\n", m_agent_size,
+		   (int)m_quads.size(), getTime() - time);
+}
 
-				for(int n = 0; n < 4; n++) {
-					int height = neighbours[n];
-					if(height && max(height - hmin, hmax - height) <= max_diff)
-						positions.push_back(pos + offsets[n]);
-				}
-			}
-			subrect = subrect.enlarge(int2(), int2(1, 1));
+Ex<void> NaviMap::load(Stream &sr) {
+	sr >> m_agent_size >> m_size;
+	EXPECT(m_size.x >= 0 && m_size.y >= 0 && m_size.x <= 1024 && m_size.y <= 1024);
 
-			for(int sy = 0; sy < bsize.y; sy += sector_size)
-				for(int sx = 0; sx < bsize.x; sx += sector_size)
-					if(areOverlapping(subrect, IRect(sx, sy, sx + sector_size, sy + sector_size)))
-						extractQuads(subbitmap, bsize, sx, sy);
+	u32 count = 0;
+	sr >> count;
+	EX_CATCH();
+	m_quads.clear();
+	m_quads.reserve(count);
+	m_sectors.clear();
+	m_sectors.resize(m_size.x * m_size.y);
 
-			for(int y = subrect.y(); y < subrect.ey(); y++)
-				memset(subbitmap.data() + y * bsize.x + subrect.x(), 0, subrect.width());
-		}
+	for(int n = 0; n < (int)count; n++) {
+		IRect rect;
+		u8 min_height, max_height;
+		u32 ncount = 0;
+		sr.unpack(rect, min_height, max_height, ncount);
+		EX_CATCH();
+		EXPECT(rect.x() >= 0 && rect.y() >= 0 && rect.ex() <= m_size.x * sector_size &&
+			   rect.ey() <= m_size.y * sector_size && ncount <= count);
+
+		m_quads.emplace_back(rect, min_height, max_height);
+		auto &quad = m_quads.back();
+		quad.neighbours.resize(ncount);
+		sr.loadData(quad.neighbours);
+		EX_CATCH();
+		for(int id : quad.neighbours)
+			EXPECT(id >= 0 && id < (int)count);
+		quad.static_ncount = (int)ncount;
+		listInsert(ACC_QUAD, m_sectors[findSector(rect.min())], n);
 	}
 	m_static_count = (int)m_quads.size();
+	return {};
+}
 
-	vector<int> indices;
-	for(int i = 0; i < (int)m_quads.size(); i++) {
-		indices.clear();
-		const Quad &quad = m_quads[i];
-		IBox bbox = quad.box();
-
-		findQuads(IBox(bbox.min() - int3(1, 1, 1), bbox.max() + int3(1, 1, 1)), indices);
-		for(int j = 0; j < (int)indices.size(); j++)
-			if(indices[j] < i)
-				addAdjacencyInfo(i, indices[j]);
+void NaviMap::save(FileStream &sr) const {
+	sr << m_agent_size << m_size;
+	sr << u32(m_static_count);
+	for(int n = 0; n < m_static_count; n++) {
+		auto &quad = m_quads[n];
+		sr.pack(quad.rect, quad.min_height, quad.max_height, u32(quad.static_ncount));
+		sr.saveData(cspan(quad.neighbours.data(), quad.static_ncount));
 	}
-
-	for(int n = 0; n < (int)m_quads.size(); n++)
-		m_quads[n].static_ncount = (int)m_quads[n].neighbours.size();
-	printf("%d quads (%.2f seconds)\n", (int)m_quads.size(), getTime() - time);
 }
 
 void NaviMap::addCollider(int parent_id, const IRect &rect, int collider_id) {
@@ -360,7 +483,7 @@ void NaviMap::removeColliders() {
 
 void NaviMap::updateReachability() {
 	//TODO: this is probably too slow
-	//FWK_PROFILE("NaviMap::updateReachability");
+	PROFILE_SCOPE("NaviMap::updateReachability");
 
 	vector<int> groups(m_quads.size(), -1);
 
@@ -448,11 +571,13 @@ bool NaviMap::isReachable(int src_id, int target_id) const {
 }
 
 bool NaviMap::isReachable(const int3 &source, const int3 &target) const {
+	m_query_counts.reachability++;
 	return isReachable(findQuad(source, -1, true), findQuad(target, -1, true));
 }
 
 bool NaviMap::findClosestPos(int3 &out, const int3 &pos, int source_height,
 							 const IBox &target_box) const {
+	m_query_counts.closest_pos++;
 	IBox enlarged_box = target_box.enlarge(int3(1, source_height - 1, 1), int3(1, 0, 1));
 
 	vector<int> quads;
@@ -814,7 +939,8 @@ vector<NaviMap::PathNode> NaviMap::findPath(const int2 &start, const int2 &end,
 
 bool NaviMap::findPath(vector<int3> &out, const int3 &start, const int3 &end,
 					   int filter_collider) const {
-	//FWK_PROFILE_RARE("NaviMap::findPath");
+	PROFILE_SCOPE("NaviMap::findPath");
+	m_query_counts.paths++;
 
 	int start_id = findQuad(start, filter_collider);
 	int end_id = findQuad(end, filter_collider);
@@ -13,10 +13,19 @@ class NaviHeightmap;
 class NaviMap {
   public:
 	static constexpr int sector_size = 32;
+	// Should be increased whenever generation of navigation data (NaviHeightmap & NaviMap)
+	// changes; it's a part of the key of cached navigation maps
+	static constexpr u32 build_version = 2;
 
 	NaviMap(int agent_size);
 
-	void update(const NaviHeightmap &);
+	// Quads are extracted on up to num_threads threads (0: all available); Results don't
+	// depend on the number of threads
+	void update(const NaviHeightmap &, int num_threads = 0);
+
+	// Only static quads (computed in update) are serialized; colliders have to be added again
+	Ex<void> load(Stream &);
+	void save(FileStream &) const;
 
 	int2 dimensions() const { return m_size * sector_size; }
 	int agentSize() const { return m_agent_size; }
@@ -68,6 +77,12 @@ class NaviMap {
 	int quadCount() const { return (int)m_quads.size(); }
 	const Quad &operator[](int idx) const { return m_quads[idx]; }
 
+	// Number of queries since the map was created
+	struct QueryCounts {
+		i64 paths = 0, closest_pos = 0, reachability = 0;
+	};
+	const QueryCounts &queryCounts() const { return m_query_counts; }
+
   private:
 	vector<PathNode> findPath(const int2 &start, const int2 &end, int start_id, int end_id,
 							  bool do_refining, int filter_collider) const;
@@ -76,7 +91,7 @@ class NaviMap {
 		return xz.x / sector_size + xz.y / sector_size * m_size.x;
 	}
 
-	void extractQuads(const PodVector<u8> &, const int2 &bsize, int sx, int sy);
+	bool areConnected(int quad1_id, int quad2_id) const;
 	void addAdjacencyInfo(int target_id, int src_id);
 	void addCollider(int quad_id, const IRect &rect, int collider_id);
 
@@ -85,4 +100,5 @@ class NaviMap {
 	vector<Quad> m_quads;
 	vector<List> m_sectors;
 	int2 m_size; // in sectors
+	mutable QueryCounts m_query_counts;
 };
@@ -3,6 +3,8 @@
 
 #include "net/chunk.h"
 
+#include "sys/alloc_tracker.h"
+
 namespace net {
 
 Chunk::Chunk() : m_left_over(nullptr), m_type(ChunkType::invalid), m_data_size(0) {
@@ -40,6 +42,7 @@ void Chunk::setData(CSpan<char> data) {
 	if(data.size() > (int)sizeof(m_data)) {
 		int left_over_size = data.size() - sizeof(m_data);
 		m_left_over = (char *)malloc(left_over_size);
+		AllocTracker::recordAlloc(left_over_size);
 		memcpy(m_left_over, data.data() + sizeof(m_data), left_over_size);
 	}
 	memcpy(m_data, data.data(), min((int)sizeof(m_data), data.size()));
@@ -7,6 +7,7 @@
 #include "game/world.h"
 #include "net/host.h"
 #include "net/socket.h"
+#include "sys/alloc_tracker.h"
 
 #include "game/death_match.h"
 
@@ -103,6 +104,7 @@ void Client::setWorld(game::PWorld world) {
 }
 
 void Client::beginFrame() {
+	ALLOC_TAG("net");
 	LocalHost::receive();
 
 	if(m_server_id == -1)
@@ -155,6 +157,7 @@ void Client::beginFrame() {
 }
 
 void Client::finishFrame() {
+	ALLOC_TAG("net");
 	m_timestamp++;
 
 	if(m_server_id == -1)
@@ -173,6 +176,7 @@ void Client::finishFrame() {
 	}
 
 	finishSending();
+	sampleStats();
 
 	if(host->timeout() > double(timeout)) {
 		disconnect();
@@ -62,6 +62,28 @@ namespace {
 
 }
 
+int ChunkSizeHistogram::bucket(int size) {
+	int out = 0;
+	while(out + 1 < num_buckets && size >= (16 << out))
+		out++;
+	return out;
+}
+
+const char *ChunkSizeHistogram::typeName(ChunkType type) {
+	static const char *names[num_types] = {
+		"invalid",	   "multiple_chunks", "ack",		   "join",		   "join_accept",
+		"join_refuse", "leave",			  "ping",		   "level_info",   "level_loaded",
+		"timestamp",   "entity_full",	  "entity_delete", "entity_update", "message"};
+	int idx = int(type);
+	return idx >= 0 && idx < num_types ? names[idx] : "unknown";
+}
+
+void ChunkSizeHistogram::add(ChunkType type, int size) {
+	int idx = int(type);
+	if(idx >= 0 && idx < num_types)
+		counts[idx][bucket(size)]++;
+}
+
 #define INSERT(list, idx)                                                                          \
 	listInsert([this](int i) -> ListNode & { return m_chunks[i].m_node; }, list, idx)
 #define REMOVE(list, idx)                                                                          \
@@ -79,6 +101,7 @@ RemoteHost::RemoteHost(const Address &address, int max_bytes_per_frame, int curr
 	  m_last_timestamp(0), m_out_packet(memorySaver(limits::packet_size)) {
 	DASSERT(address.isValid());
 	m_channels.resize(max_channels);
+	m_stats.channels.resize(max_channels);
 	m_last_time_received = getTime();
 }
 
@@ -87,6 +110,8 @@ double RemoteHost::timeout() const { return getTime() - m_last_time_received; }
 void RemoteHost::sendPacket() {
 	logEnd(m_out_packet.size());
 	m_socket->send(m_out_packet.data(), m_address);
+	m_stats.bytes_out += m_out_packet.data().size();
+	m_stats.packets_out++;
 }
 
 void RemoteHost::newPacket(bool is_first) {
@@ -100,6 +125,7 @@ void RemoteHost::newPacket(bool is_first) {
 		.save(m_out_packet);
 
 	packet.packet_id = m_out_packet_id;
+	packet.send_time = getTime();
 	m_packet_idx = packet_idx;
 
 	logBegin(true, m_address, m_out_packet_id);
@@ -178,6 +204,10 @@ bool RemoteHost::sendChunk(int chunk_idx) {
 	encodeInt(m_out_packet, chunk.size());
 	chunk.saveData(m_out_packet);
 	m_bytes_left -= m_out_packet.pos() - prev_pos;
+	m_stats.chunks_out++;
+	m_stats.channels[chunk.m_channel_id].bytes_out += chunk.size();
+	m_stats.channels[chunk.m_channel_id].chunks_out++;
+	m_chunk_sizes.add(chunk.m_type, chunk.size());
 
 	REMOVE(m_channels[chunk.m_channel_id].chunks, chunk_idx);
 	INSERT(m_packets[m_packet_idx].chunks, chunk_idx);
@@ -209,6 +239,10 @@ bool RemoteHost::sendUChunk(int chunk_idx, CSpan<char> data, ChunkType type) {
 	m_out_packet.saveData(data);
 	m_bytes_left -= m_out_packet.pos() - prev_pos;
 	U_INSERT(m_packets[m_packet_idx].uchunks, chunk_idx);
+	m_stats.uchunks_out++;
+	m_stats.channels[chunk.channel_id].bytes_out += data.size();
+	m_stats.channels[chunk.channel_id].chunks_out++;
+	m_chunk_sizes.add(type, data.size());
 
 	return true;
 }
@@ -266,6 +300,7 @@ void RemoteHost::finishSending() {
 	if(m_out_packet.pos() > PacketInfo::header_size)
 		sendPacket();
 	m_socket = nullptr;
+	m_budget_used = float(m_max_bpf - m_bytes_left) / float(m_max_bpf);
 }
 
 void RemoteHost::beginReceiving() {
@@ -291,6 +326,8 @@ struct OrderIChunks {
 void RemoteHost::receive(InPacket packet, int timestamp, double time) {
 	m_last_timestamp = timestamp;
 	m_last_time_received = time;
+	m_stats.bytes_in += packet.size();
+	m_stats.packets_in++;
 
 	if(m_remote_id == -1)
 		m_remote_id = packet.currentId();
@@ -352,6 +389,10 @@ void RemoteHost::handlePacket(InPacket &packet) {
 		   channel_id >= (int)m_channels.size())
 			goto ERROR;
 
+		m_stats.channels[channel_id].bytes_in += data_size;
+		m_stats.channels[channel_id].chunks_in++;
+		m_chunk_sizes.add(type, data_size);
+
 		char data[PacketInfo::max_size];
 		packet.loadData({data, data_size});
 		//TODO: load directly into chunk
@@ -446,6 +487,12 @@ void RemoteHost::finishReceiving() {
 
 void RemoteHost::acceptPacket(int packet_idx) {
 	Packet &packet = m_packets[packet_idx];
+	double rtt = getTime() - packet.send_time;
+	if(m_stats.rtt == 0.0)
+		m_stats.rtt = rtt;
+	m_stats.jitter = m_stats.jitter * 0.75 + fabs(rtt - m_stats.rtt) * 0.25;
+	m_stats.rtt = m_stats.rtt * 0.875 + rtt * 0.125;
+
 	int chunk_idx = packet.chunks.head;
 	while(chunk_idx != -1) {
 		Chunk &chunk = m_chunks[chunk_idx];
@@ -476,6 +523,7 @@ void RemoteHost::resendPacket(int packet_idx) {
 		int next_idx = chunk.m_node.next;
 		chunk.m_node = ListNode();
 		INSERT(m_channels[chunk.m_channel_id].chunks, chunk_idx);
+		m_stats.chunks_resent++;
 		chunk_idx = next_idx;
 	}
 	chunk_idx = packet.uchunks.head;
@@ -485,6 +533,7 @@ void RemoteHost::resendPacket(int packet_idx) {
 		chunk.node = ListNode();
 		U_INSERT(m_free_uchunks, chunk_idx);
 		m_lost_uchunk_indices.push_back(chunk.chunk_id);
+		m_stats.uchunks_lost++;
 		chunk_idx = next_idx;
 	}
 
@@ -506,6 +555,74 @@ const Chunk *RemoteHost::getIChunk() {
 	return out;
 }
 
+void RemoteHost::sampleStats(double time) {
+	HostSample sample;
+	sample.time = time;
+	sample.bytes_in = int(m_stats.bytes_in - m_sampled_stats.bytes_in);
+	sample.bytes_out = int(m_stats.bytes_out - m_sampled_stats.bytes_out);
+	sample.packets_in = int(m_stats.packets_in - m_sampled_stats.packets_in);
+	sample.packets_out = int(m_stats.packets_out - m_sampled_stats.packets_out);
+	sample.chunks_resent = int(m_stats.chunks_resent - m_sampled_stats.chunks_resent);
+	sample.uchunks_lost = int(m_stats.uchunks_lost - m_sampled_stats.uchunks_lost);
+	sample.unacked_packets = m_packets.listSize();
+	sample.rtt = float(m_stats.rtt);
+	sample.jitter = float(m_stats.jitter);
+	sample.budget_used = m_budget_used;
+	m_sampled_stats = m_stats;
+	m_budget_used = 0.0f;
+
+	if((int)m_samples.size() < max_samples)
+		m_samples.emplace_back(sample);
+	else
+		m_samples[m_next_sample] = sample;
+	m_next_sample = (m_next_sample + 1) % max_samples;
+}
+
+vector<HostSample> RemoteHost::samples() const {
+	if((int)m_samples.size() < max_samples)
+		return m_samples;
+	vector<HostSample> out(m_samples.begin() + m_next_sample, m_samples.end());
+	out.insert(out.end(), m_samples.begin(), m_samples.begin() + m_next_sample);
+	return out;
+}
+
+HostSummary RemoteHost::summary() const {
+	HostSummary out;
+	auto samples = this->samples();
+	if(samples.empty())
+		return out;
+
+	// Deltas of first sample cover the time before it
+	for(int n = 1; n < (int)samples.size(); n++) {
+		auto &sample = samples[n];
+		out.bytes_in += sample.bytes_in;
+		out.bytes_out += sample.bytes_out;
+		out.packets_in += sample.packets_in;
+		out.packets_out += sample.packets_out;
+	}
+	for(auto &sample : samples) {
+		out.chunks_resent += sample.chunks_resent;
+		out.uchunks_lost += sample.uchunks_lost;
+		out.avg_unacked += sample.unacked_packets;
+		out.max_unacked = max(out.max_unacked, sample.unacked_packets);
+		out.avg_budget_used += sample.budget_used;
+		out.max_budget_used = max(out.max_budget_used, sample.budget_used);
+	}
+	out.avg_unacked /= samples.size();
+	out.avg_budget_used /= samples.size();
+
+	out.duration = samples.back().time - samples.front().time;
+	if(out.duration > 0.0) {
+		out.bytes_in /= out.duration;
+		out.bytes_out /= out.duration;
+		out.packets_in /= out.duration;
+		out.packets_out /= out.duration;
+	}
+	out.rtt = samples.back().rtt;
+	out.jitter = samples.back().jitter;
+	return out;
+}
+
 bool RemoteHost::canFit(int data_size) const { return estimateSize(data_size) <= m_bytes_left; }
 
 int RemoteHost::estimateSize(int data_size) const { return data_size + 8; }
@@ -679,6 +796,115 @@ void LocalHost::finishSending() {
 	m_current_id = -1;
 }
 
+void LocalHost::sampleStats() {
+	double time = getTime();
+	for(auto &host : m_remote_hosts)
+		if(host)
+			host->sampleStats(time);
+}
+
+string LocalHost::statsText() const {
+	TextFormatter fmt;
+	for(int n = 0; n < (int)m_remote_hosts.size(); n++) {
+		const RemoteHost *host = m_remote_hosts[n].get();
+		if(!host)
+			continue;
+
+		auto summary = host->summary();
+		auto &stats = host->stats();
+		fmt.stdFormat("Host %d (%s)%s\n", n, host->address().toString().c_str(),
+					  host->isVerified() ? "" : " unverified");
+		fmt.stdFormat("  in: %.1f KB/s %.0f pkt/s  out: %.1f KB/s %.0f pkt/s  (last %.1f sec)\n",
+					  summary.bytes_in / 1024.0, summary.packets_in, summary.bytes_out / 1024.0,
+					  summary.packets_out, summary.duration);
+		fmt.stdFormat("  rtt: %.1f ms  jitter: %.1f ms  unacked: %.1f (max %d)\n",
+					  summary.rtt * 1000.0f, summary.jitter * 1000.0f, summary.avg_unacked,
+					  summary.max_unacked);
+		fmt.stdFormat("  resent chunks: %d (total %lld)  lost uchunks: %d (total %lld)\n",
+					  summary.chunks_resent, (long long)stats.chunks_resent, summary.uchunks_lost,
+					  (long long)stats.uchunks_lost);
+		fmt.stdFormat("  budget used: %.0f%% (max %.0f%%)\n", summary.avg_budget_used * 100.0f,
+					  summary.max_budget_used * 100.0f);
+
+		for(int c = 0; c < (int)stats.channels.size(); c++) {
+			auto &channel = stats.channels[c];
+			if(channel.chunks_in || channel.chunks_out)
+				fmt.stdFormat("  channel %d: in %lld KB (%lld chunks)  out %lld KB (%lld chunks)\n",
+							  c, (long long)(channel.bytes_in / 1024),
+							  (long long)channel.chunks_in, (long long)(channel.bytes_out / 1024),
+							  (long long)channel.chunks_out);
+		}
+
+		auto &sizes = host->chunkSizes();
+		fmt("  chunk sizes: <16 <32 <64 <128 <256 <512 <1024 >=1024\n");
+		for(int t = 0; t < ChunkSizeHistogram::num_types; t++) {
+			i64 total = 0;
+			for(auto count : sizes.counts[t])
+				total += count;
+			if(!total)
+				continue;
+			fmt.stdFormat("    %-14s", ChunkSizeHistogram::typeName(ChunkType(t)));
+			for(auto count : sizes.counts[t])
+				fmt.stdFormat(" %lld", (long long)count);
+			fmt("\n");
+		}
+	}
+	return fmt.text();
+}
+
+string LocalHost::statsJson() const {
+	TextFormatter fmt;
+	fmt.stdFormat("{\"time\":%.3f,\"hosts\":[", getTime());
+	bool first = true;
+	for(int n = 0; n < (int)m_remote_hosts.size(); n++) {
+		const RemoteHost *host = m_remote_hosts[n].get();
+		if(!host)
+			continue;
+
+		auto summary = host->summary();
+		auto &stats = host->stats();
+		fmt.stdFormat("%s{\"id\":%d,\"address\":\"%s\",\"duration\":%.3f,"
+					  "\"bytes_in\":%.1f,\"bytes_out\":%.1f,\"packets_in\":%.2f,"
+					  "\"packets_out\":%.2f,\"rtt_ms\":%.2f,\"jitter_ms\":%.2f,"
+					  "\"unacked_avg\":%.2f,\"unacked_max\":%d,\"chunks_resent\":%d,"
+					  "\"uchunks_lost\":%d,\"budget_avg\":%.3f,\"budget_max\":%.3f,"
+					  "\"channels\":[",
+					  first ? "" : ",", n, host->address().toString().c_str(), summary.duration,
+					  summary.bytes_in, summary.bytes_out, summary.packets_in,
+					  summary.packets_out, summary.rtt * 1000.0f, summary.jitter * 1000.0f,
+					  summary.avg_unacked, summary.max_unacked, summary.chunks_resent,
+					  summary.uchunks_lost, summary.avg_budget_used, summary.max_budget_used);
+		first = false;
+
+		for(int c = 0; c < (int)stats.channels.size(); c++) {
+			auto &channel = stats.channels[c];
+			fmt.stdFormat("%s[%lld,%lld,%lld,%lld]", c == 0 ? "" : ",",
+						  (long long)channel.bytes_in, (long long)channel.chunks_in,
+						  (long long)channel.bytes_out, (long long)channel.chunks_out);
+		}
+		fmt("],\"chunk_sizes\":{");
+
+		auto &sizes = host->chunkSizes();
+		bool first_type = true;
+		for(int t = 0; t < ChunkSizeHistogram::num_types; t++) {
+			i64 total = 0;
+			for(auto count : sizes.counts[t])
+				total += count;
+			if(!total)
+				continue;
+			fmt.stdFormat("%s\"%s\":[", first_type ? "" : ",",
+						  ChunkSizeHistogram::typeName(ChunkType(t)));
+			for(int b = 0; b < ChunkSizeHistogram::num_buckets; b++)
+				fmt.stdFormat("%s%lld", b == 0 ? "" : ",", (long long)sizes.counts[t][b]);
+			fmt("]");
+			first_type = false;
+		}
+		fmt("}}");
+	}
+	fmt("]}");
+	return fmt.text();
+}
+
 void LocalHost::printStats() const {
 	int nchunks = 0, data_size = 0;
 
@@ -69,6 +69,56 @@ template <class Object> class LinkedVector {
 	int m_list_size;
 };
 
+// Traffic counters of a single remote host (accumulated since connection)
+struct HostStats {
+	struct Channel {
+		i64 bytes_in = 0, bytes_out = 0;
+		i64 chunks_in = 0, chunks_out = 0;
+	};
+
+	i64 bytes_in = 0, bytes_out = 0;
+	i64 packets_in = 0, packets_out = 0;
+	i64 chunks_out = 0, chunks_resent = 0;	 // reliable
+	i64 uchunks_out = 0, uchunks_lost = 0; // unreliable
+	double rtt = 0.0;	 // smoothed round trip time in seconds (includes remote frame delay)
+	double jitter = 0.0; // smoothed deviation of rtt
+	vector<Channel> channels;
+};
+
+// Number of sent & received chunks of each type, bucketed by size
+struct ChunkSizeHistogram {
+	static constexpr int num_types = int(ChunkType::message) + 1, num_buckets = 8;
+	// Bucket n contains sizes in range [16 << (n - 1), 16 << n); last one is unbounded
+	static int bucket(int size);
+	static const char *typeName(ChunkType);
+
+	void add(ChunkType type, int size);
+
+	i64 counts[num_types][num_buckets] = {};
+};
+
+// Sampled once per frame; counters are deltas since previous sample
+struct HostSample {
+	double time;
+	int bytes_in, bytes_out;
+	int packets_in, packets_out;
+	int chunks_resent, uchunks_lost;
+	int unacked_packets;
+	float rtt, jitter;	// in seconds
+	float budget_used; // part of bytes per frame limit used in last frame
+};
+
+// Rates & averages computed over samples stored in RemoteHost
+struct HostSummary {
+	double duration = 0.0;
+	double bytes_in = 0.0, bytes_out = 0.0;		// per second
+	double packets_in = 0.0, packets_out = 0.0; // per second
+	int chunks_resent = 0, uchunks_lost = 0;
+	float avg_unacked = 0.0f, avg_budget_used = 0.0f, max_budget_used = 0.0f;
+	int max_unacked = 0;
+	float rtt = 0.0f, jitter = 0.0f;
+};
+
 class RemoteHost {
   public:
 	RemoteHost(const Address &address, int max_bytes_per_frame, int current_id, int remote_id);
@@ -82,6 +132,7 @@ class RemoteHost {
 
 		SeqNumber packet_id;
 		List chunks, uchunks;
+		double send_time = 0.0;
 	};
 
 	struct Channel {
@@ -119,6 +170,14 @@ class RemoteHost {
 
 	double timeout() const;
 
+	const HostStats &stats() const { return m_stats; }
+	const ChunkSizeHistogram &chunkSizes() const { return m_chunk_sizes; }
+	static constexpr int max_samples = 256;
+	void sampleStats(double time);
+	// Samples in chronological order
+	vector<HostSample> samples() const;
+	HostSummary summary() const;
+
   protected:
 	void sendChunks(int max_channel);
 
@@ -163,6 +222,12 @@ class RemoteHost {
 	int m_current_id, m_remote_id;
 	SeqNumber m_out_packet_id, m_in_packet_id;
 
+	HostStats m_stats, m_sampled_stats;
+	ChunkSizeHistogram m_chunk_sizes;
+	vector<HostSample> m_samples;
+	int m_next_sample = 0;
+	float m_budget_used = 0.0f;
+
 	//TODO: special rules for un-verified hosts (limit packets per frame, etc.)
 	bool m_is_verified;
 
@@ -213,6 +278,12 @@ class LocalHost {
 	void finishSending();
 	int timestamp() const { return m_timestamp; }
 
+	// Should be called once per frame, after sending
+	void sampleStats();
+	// Summary of each remote host for the console
+	string statsText() const;
+	// Single line in JSON format
+	string statsJson() const;
 	void printStats() const;
 
   protected:
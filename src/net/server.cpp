@@ -12,13 +12,16 @@
 #include "game/game_mode.h"
 #include "game/world.h"
 #include "navi_map.h"
+#include "sys/alloc_tracker.h"
 
 using namespace game;
 using namespace net;
 
 namespace net {
 
-ServerConfig::ServerConfig() : m_console_mode(false), m_port(0), m_max_players(16) {}
+ServerConfig::ServerConfig()
+	: m_console_mode(false), m_port(0), m_max_players(16), m_stats_interval(10),
+	  m_telemetry_port(0), m_telemetry_interval(1.0f) {}
 
 ServerConfig::ServerConfig(const CXmlNode &node) : ServerConfig() {
 	if(auto attrib = node.tryAttrib("max_players")) {
@@ -33,6 +36,20 @@ ServerConfig::ServerConfig(const CXmlNode &node) : ServerConfig() {
 	}
 	if(auto attrib = node.tryAttrib("password"))
 		m_password = attrib;
+	if(auto attrib = node.tryAttrib("replay_file"))
+		m_replay_file = attrib;
+	if(auto attrib = node.tryAttrib("stats_interval")) {
+		m_stats_interval = fromString<int>(attrib);
+		ASSERT(m_stats_interval >= 0);
+	}
+	if(auto attrib = node.tryAttrib("telemetry_port")) {
+		m_telemetry_port = fromString<int>(attrib);
+		ASSERT(m_telemetry_port >= 0 && m_telemetry_port < 65536);
+	}
+	if(auto attrib = node.tryAttrib("telemetry_interval")) {
+		m_telemetry_interval = fromString<float>(attrib);
+		ASSERT(m_telemetry_interval > 0.0f);
+	}
 	m_map_name = node.attrib("map_name");
 	m_server_name = node.attrib("name");
 
@@ -49,17 +66,40 @@ void ServerConfig::save(XmlNode &node) {
 	node.addAttrib("max_players", m_max_players);
 	node.addAttrib("console_mode", m_console_mode);
 	node.addAttrib("password", node.own(m_password));
+	node.addAttrib("stats_interval", m_stats_interval);
+	if(m_telemetry_port) {
+		node.addAttrib("telemetry_port", m_telemetry_port);
+		node.addAttrib("telemetry_interval", m_telemetry_interval);
+	}
+	if(!m_replay_file.empty())
+		node.addAttrib("replay_file", node.own(m_replay_file));
 }
 
 Server::Server(const ServerConfig &config)
 	: LocalHost(Address(config.m_port)), m_config(config), m_game_mode(nullptr) {
-	m_lobby_timeout = m_current_time = getTime();
+	m_lobby_timeout = m_current_time = m_replay_save_time = m_frame_start_time = getTime();
+	m_stats_time = m_current_time + config.m_stats_interval;
+	m_telemetry_time = m_current_time + config.m_telemetry_interval;
+
+	if(config.m_console_mode && config.m_telemetry_port) {
+		if(auto telemetry = TelemetryServer::make(config.m_telemetry_port)) {
+			m_telemetry.emplace(std::move(*telemetry));
+			printf("Telemetry available on 127.0.0.1:%d\n", config.m_telemetry_port);
+		} else {
+			telemetry.error().print();
+		}
+	}
 }
 
 Server::~Server() {
 	//TODO: inform clients that server is closing
 	//TODO: proper error handling
 
+	if(m_replay_recorder) {
+		saveReplay();
+		m_world->setReplayRecorder(nullptr);
+	}
+
 	OutPacket out({0, -1, -1, PacketFlag::lobby});
 	out << LobbyChunkId::server_down;
 	sendLobbyPacket(out.data());
@@ -133,6 +173,8 @@ void Server::handleHostReceiving(RemoteHost &host, int client_id) {
 				   client.nick_name.c_str(), host.address().toString().c_str());
 		} else if(chunk.type() == ChunkType::level_loaded &&
 				  client.mode == ClientMode::connecting) {
+			if(m_replay_recorder)
+				m_replay_recorder->onClientConnected(client_id, client.nick_name);
 			m_game_mode->onClientConnected(client_id, client.nick_name);
 
 			//TODO: timeout for level_loaded?
@@ -145,6 +187,8 @@ void Server::handleHostReceiving(RemoteHost &host, int client_id) {
 			disconnectClient(client_id);
 			break;
 		} else if(chunk.type() == ChunkType::message && client.mode == ClientMode::connected) {
+			if(m_replay_recorder)
+				m_replay_recorder->onMessage(chunk_ptr->data(), client_id);
 			m_world->onMessage(chunk, client_id);
 		}
 	}
@@ -199,6 +243,7 @@ void Server::handleHostSending(RemoteHost &host, int client_id) {
 }
 
 void Server::beginFrame() {
+	ALLOC_TAG("net");
 	if(!m_world)
 		return;
 
@@ -206,7 +251,7 @@ void Server::beginFrame() {
 	Address source;
 
 	double time = getTime();
-	m_current_time = time;
+	m_current_time = m_frame_start_time = time;
 
 	LocalHost::receive();
 
@@ -245,13 +290,17 @@ void Server::beginFrame() {
 }
 
 void Server::finishFrame() {
+	ALLOC_TAG("net");
 	if(!m_world)
 		return;
 	m_timestamp++;
 
 	for(int h = 0; h < (int)m_clients.size(); h++)
-		if(m_clients[h].mode == ClientMode::to_be_removed)
+		if(m_clients[h].mode == ClientMode::to_be_removed) {
+			if(m_replay_recorder)
+				m_replay_recorder->onClientDisconnected(h);
 			m_game_mode->onClientDisconnected(h);
+		}
 
 	for(int h = 0; h < numRemoteHosts(); h++) {
 		RemoteHost *host = getRemoteHost(h);
@@ -281,6 +330,28 @@ void Server::finishFrame() {
 	}
 
 	m_replication_list.clear();
+	sampleStats();
+
+	if(m_telemetry) {
+		double tick_time = getTime() - m_frame_start_time;
+		auto &counters = m_telemetry_counters;
+		counters.num_ticks++;
+		counters.tick_time += tick_time;
+		counters.max_tick_time = max(counters.max_tick_time, tick_time);
+		if(m_current_time >= m_telemetry_time)
+			sendTelemetry();
+		m_telemetry->update();
+	}
+
+	if(m_config.m_console_mode && m_config.m_stats_interval > 0 && m_current_time >= m_stats_time) {
+		printf("net_stats %s\n", statsJson().c_str());
+		fflush(stdout);
+		m_stats_time = m_current_time + m_config.m_stats_interval;
+	}
+
+	// Replay is saved periodically, so that it's available even if server crashes
+	if(m_replay_recorder && m_current_time >= m_replay_save_time)
+		saveReplay();
 
 	if(m_current_time >= m_lobby_timeout) {
 		OutPacket out({0, -1, -1, PacketFlag::lobby});
@@ -300,6 +371,14 @@ void Server::finishFrame() {
 	}
 }
 
+PWorld Server::makeWorld(WorldLoadProgress *progress) {
+	if(!m_config.m_replay_file.empty()) {
+		m_replay_seed = (u32)rand();
+		srand(*m_replay_seed);
+	}
+	return PWorld(new World(m_config.m_map_name, World::Mode::server, progress));
+}
+
 void Server::setWorld(PWorld world) {
 	DASSERT(world);
 
@@ -312,6 +391,92 @@ void Server::setWorld(PWorld world) {
 	m_game_mode = dynamic_cast<GameModeServer *>(m_world->gameMode());
 
 	m_config.m_map_name = m_world ? m_world->mapName() : "";
+	m_telemetry_counters.prev_navi_queries = m_world->naviQueryCounts();
+	m_telemetry_counters.prev_allocs = AllocTracker::totalCount();
+	m_telemetry_counters.prev_alloc_bytes = AllocTracker::totalBytes();
+
+	if(!m_config.m_replay_file.empty()) {
+		if(m_replay_seed) {
+			m_replay_recorder.emplace(*m_world, *m_replay_seed);
+			m_world->setReplayRecorder(m_replay_recorder.get());
+			printf("Recording replay: %s\n", m_config.m_replay_file.c_str());
+		} else {
+			printf("Replay won't be recorded: world wasn't created with Server::makeWorld\n");
+		}
+	}
+}
+
+void Server::saveReplay() {
+	if(auto result = m_replay_recorder->save(m_config.m_replay_file); !result)
+		result.error().print();
+	m_replay_save_time = m_current_time + 30.0;
+}
+
+void Server::sendTelemetry() {
+	auto &counters = m_telemetry_counters;
+	m_telemetry_time = m_current_time + m_config.m_telemetry_interval;
+
+	int entity_counts[count<EntityId>] = {}, num_entities = 0;
+	for(int n = 0; n < m_world->entityCount(); n++)
+		if(const Entity *entity = m_world->refEntity(n)) {
+			entity_counts[(int)entity->typeId()]++;
+			num_entities++;
+		}
+
+	auto navi_queries = m_world->naviQueryCounts();
+	auto &prev_queries = counters.prev_navi_queries;
+	i64 num_allocs = AllocTracker::totalCount(), alloc_bytes = AllocTracker::totalBytes();
+
+	TextFormatter fmt;
+	fmt.stdFormat("{\"time\":%.3f,\"timestamp\":%d,\"ticks\":%d,\"tick_ms_avg\":%.3f,"
+				  "\"tick_ms_max\":%.3f,\"num_entities\":%d,\"entities\":{",
+				  m_current_time, m_timestamp, counters.num_ticks,
+				  counters.num_ticks ? counters.tick_time * 1000.0 / counters.num_ticks : 0.0,
+				  counters.max_tick_time * 1000.0, num_entities);
+	for(auto id : all<EntityId>)
+		fmt.stdFormat("%s\"%s\":%d", (int)id == 0 ? "" : ",", toString(id),
+					  entity_counts[(int)id]);
+	fmt.stdFormat("},\"navi_paths\":%lld,\"navi_closest_pos\":%lld,\"navi_reachability\":%lld,",
+				  (long long)(navi_queries.paths - prev_queries.paths),
+				  (long long)(navi_queries.closest_pos - prev_queries.closest_pos),
+				  (long long)(navi_queries.reachability - prev_queries.reachability));
+	if(auto rss = residentMemorySize())
+		fmt.stdFormat("\"rss_kb\":%lld,", (long long)(*rss / 1024));
+	if(AllocTracker::isEnabled())
+		fmt.stdFormat("\"allocs\":%lld,\"alloc_kb\":%.1f,",
+					  (long long)(num_allocs - counters.prev_allocs),
+					  double(alloc_bytes - counters.prev_alloc_bytes) / 1024.0);
+
+	fmt.stdFormat("\"num_clients\":%d,\"clients\":[", numActiveClients());
+	bool first = true;
+	for(int c = 0; c < (int)m_clients.size(); c++) {
+		const ClientInfo &client = m_clients[c];
+		const RemoteHost *host = client.isValid() ? getRemoteHost(client.host_id) : nullptr;
+		if(!host)
+			continue;
+
+		// Nick names are sent by clients, so they have to be sanitized
+		string nick_name = client.nick_name;
+		for(auto &ch : nick_name)
+			if(ch == '"' || ch == '\\' || (unsigned char)ch < 32)
+				ch = '?';
+		// Bandwidth is in KB/s, averaged over host's sample ring (last RemoteHost::max_samples
+		// frames), not over the telemetry interval
+		auto summary = host->summary();
+		fmt.stdFormat("%s{\"id\":%d,\"nick\":\"%s\",\"in_kb_s\":%.2f,\"out_kb_s\":%.2f,"
+					  "\"rtt_ms\":%.1f,\"budget\":%.3f}",
+					  first ? "" : ",", c, nick_name.c_str(), summary.bytes_in / 1024.0,
+					  summary.bytes_out / 1024.0, summary.rtt * 1000.0f,
+					  summary.max_budget_used);
+		first = false;
+	}
+	fmt("]}");
+	m_telemetry->send(fmt.text());
+
+	counters = {};
+	counters.prev_navi_queries = navi_queries;
+	counters.prev_allocs = num_allocs;
+	counters.prev_alloc_bytes = alloc_bytes;
 }
 
 void Server::replicateEntity(int entity_id) { m_replication_list.emplace_back(entity_id); }
@@ -4,9 +4,11 @@
 #pragma once
 
 #include "game/entity.h"
+#include "game/replay.h"
 #include "game/world.h"
 #include "net/base.h"
 #include "net/host.h"
+#include "net/telemetry.h"
 #include <fwk/bit_vector.h>
 
 namespace net {
@@ -23,7 +25,14 @@ class ServerConfig {
 	string m_map_name;
 	string m_server_name;
 	string m_password;
+	string m_replay_file; // if not empty, session is recorded to this file
 	int m_port, m_max_players;
+	// In console mode network stats are printed (as JSON) every stats_interval seconds
+	int m_stats_interval;
+	// In console mode telemetry is streamed to local viewers (see net/telemetry.h) every
+	// telemetry_interval seconds; 0: disabled
+	int m_telemetry_port;
+	float m_telemetry_interval;
 };
 
 class Server : public net::LocalHost, game::Replicator {
@@ -63,12 +72,18 @@ class Server : public net::LocalHost, game::Replicator {
 	void beginFrame();
 	void finishFrame();
 
+	// Creates the world for this server; It can be called on a loading thread. If session is
+	// recorded, global RNG is reseeded first (entities draw from it when they are created).
+	game::PWorld makeWorld(game::WorldLoadProgress *progress = nullptr);
+	// World should be created with makeWorld (otherwise session won't be recorded)
 	void setWorld(game::PWorld);
 	game::PWorld world() { return m_world; }
 
 	const ServerConfig &config() const { return m_config; }
 
   private:
+	void saveReplay();
+	void sendTelemetry();
 	void handleHostReceiving(RemoteHost &host, int client_id);
 	void handleHostSending(RemoteHost &host, int client_id);
 
@@ -81,8 +96,22 @@ class Server : public net::LocalHost, game::Replicator {
 
 	game::PWorld m_world;
 	game::GameModeServer *m_game_mode;
+	Dynamic<game::ReplayRecorder> m_replay_recorder;
+	Maybe<u32> m_replay_seed; // set by makeWorld
+	Dynamic<TelemetryServer> m_telemetry;
 	double m_current_time;
 	double m_lobby_timeout;
+	double m_replay_save_time;
+	double m_stats_time;
+
+	// Gathered between telemetry samples; prev_* are totals at the previous sample
+	struct TelemetryCounters {
+		int num_ticks = 0;
+		double tick_time = 0.0, max_tick_time = 0.0;
+		NaviMap::QueryCounts prev_navi_queries;
+		i64 prev_allocs = 0, prev_alloc_bytes = 0;
+	} m_telemetry_counters;
+	double m_telemetry_time, m_frame_start_time;
 };
 
 }
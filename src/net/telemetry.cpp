@@ -0,0 +1,236 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#include "net/telemetry.h"
+
+#ifdef _WIN32
+
+typedef int socklen_t;
+#include <winsock2.h>
+
+#else
+
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace net {
+
+static void initSockets() {
+#ifdef _WIN32
+	static bool wsock_initialized = false;
+	if(!wsock_initialized) {
+		WSAData data;
+		WSAStartup(0x2020, &data);
+		wsock_initialized = true;
+	}
+#endif
+}
+
+static void closeSocket(int fd) {
+#ifdef _WIN32
+	closesocket(fd);
+#else
+	::close(fd);
+#endif
+}
+
+static void setNonBlocking(int fd) {
+#ifdef _WIN32
+	unsigned long int non_blocking = 1;
+	ioctlsocket(fd, FIONBIO, &non_blocking);
+#else
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+#endif
+}
+
+static bool wouldBlock() {
+#ifdef _WIN32
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+static sockaddr_in loopbackAddress(u16 port) {
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	return addr;
+}
+
+Ex<TelemetryServer> TelemetryServer::make(u16 port) {
+	initSockets();
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(fd < 0)
+		return FWK_ERROR("Error while creating telemetry socket");
+
+	int reuse = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+	auto addr = loopbackAddress(port);
+	if(bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, max_viewers) < 0) {
+		closeSocket(fd);
+		return FWK_ERROR("Error while binding telemetry socket to port %d", (int)port);
+	}
+	setNonBlocking(fd);
+
+	TelemetryServer out;
+	out.m_fd = fd;
+	out.m_port = port;
+	return out;
+}
+
+TelemetryServer::~TelemetryServer() { close(); }
+
+TelemetryServer::TelemetryServer(TelemetryServer &&rhs)
+	: m_viewers(std::move(rhs.m_viewers)), m_fd(rhs.m_fd), m_port(rhs.m_port) {
+	rhs.m_viewers.clear();
+	rhs.m_fd = -1;
+}
+
+void TelemetryServer::operator=(TelemetryServer &&rhs) {
+	if(&rhs == this)
+		return;
+	close();
+	m_viewers = std::move(rhs.m_viewers);
+	m_fd = rhs.m_fd;
+	m_port = rhs.m_port;
+	rhs.m_viewers.clear();
+	rhs.m_fd = -1;
+}
+
+void TelemetryServer::close() {
+	for(auto &viewer : m_viewers)
+		closeSocket(viewer.fd);
+	m_viewers.clear();
+	if(m_fd != -1) {
+		closeSocket(m_fd);
+		m_fd = -1;
+	}
+}
+
+void TelemetryServer::update() {
+	if(m_fd == -1)
+		return;
+
+	while(true) {
+		int fd = accept(m_fd, nullptr, nullptr);
+		if(fd < 0)
+			break;
+		if((int)m_viewers.size() >= max_viewers) {
+			closeSocket(fd);
+			continue;
+		}
+		setNonBlocking(fd);
+		m_viewers.emplace_back(Viewer{fd, {}});
+	}
+
+	for(int n = 0; n < (int)m_viewers.size(); n++) {
+		auto &viewer = m_viewers[n];
+		bool failed = false;
+
+		int offset = 0;
+		while(offset < (int)viewer.pending.size()) {
+			int ret = ::send(viewer.fd, viewer.pending.data() + offset,
+							 viewer.pending.size() - offset, MSG_NOSIGNAL);
+			if(ret <= 0) {
+				failed = ret < 0 && !wouldBlock();
+				break;
+			}
+			offset += ret;
+		}
+		viewer.pending.erase(0, offset);
+
+		if(failed || (int)viewer.pending.size() > max_pending) {
+			closeSocket(viewer.fd);
+			m_viewers.erase(m_viewers.begin() + n--);
+		}
+	}
+}
+
+void TelemetryServer::send(Str line) {
+	for(auto &viewer : m_viewers) {
+		viewer.pending.append(line.data(), line.size());
+		viewer.pending += '\n';
+	}
+	update();
+}
+
+Ex<TelemetryReader> TelemetryReader::connect(u16 port) {
+	initSockets();
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(fd < 0)
+		return FWK_ERROR("Error while creating socket");
+
+	auto addr = loopbackAddress(port);
+	if(::connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+		closeSocket(fd);
+		return FWK_ERROR("Cannot connect to telemetry port %d", (int)port);
+	}
+
+	TelemetryReader out;
+	out.m_fd = fd;
+	return out;
+}
+
+TelemetryReader::~TelemetryReader() {
+	if(m_fd != -1)
+		closeSocket(m_fd);
+}
+
+TelemetryReader::TelemetryReader(TelemetryReader &&rhs)
+	: m_buffer(std::move(rhs.m_buffer)), m_fd(rhs.m_fd) {
+	rhs.m_fd = -1;
+}
+
+Maybe<string> TelemetryReader::readLine() {
+	while(true) {
+		auto end = m_buffer.find('\n');
+		if(end != string::npos) {
+			string out = m_buffer.substr(0, end);
+			m_buffer.erase(0, end + 1);
+			return out;
+		}
+		if(m_fd == -1)
+			return none;
+
+		char buffer[4096];
+		int ret = recv(m_fd, buffer, sizeof(buffer), 0);
+		if(ret <= 0) {
+			closeSocket(m_fd);
+			m_fd = -1;
+			return none;
+		}
+		m_buffer.append(buffer, ret);
+	}
+}
+
+Maybe<i64> residentMemorySize() {
+#ifdef __linux__
+	FILE *file = fopen("/proc/self/statm", "r");
+	if(!file)
+		return none;
+	long long size = 0, resident = 0;
+	int num_read = fscanf(file, "%lld %lld", &size, &resident);
+	fclose(file);
+	if(num_read != 2)
+		return none;
+	return i64(resident) * sysconf(_SC_PAGESIZE);
+#else
+	return none;
+#endif
+}
+
+}
@@ -0,0 +1,73 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#pragma once
+
+#include "net/base.h"
+
+namespace net {
+
+// Local-only telemetry stream of dedicated servers.
+//
+// Server listens on a loopback TCP port (it's not reachable from other machines); each
+// connected viewer receives the same stream of newline-delimited JSON objects. Sockets are
+// non-blocking & data is never queued for more than max_pending bytes per viewer: viewers
+// which don't keep up are disconnected, so they can't stall the server.
+class TelemetryServer {
+  public:
+	static constexpr int max_viewers = 8, max_pending = 256 * 1024;
+
+	static Ex<TelemetryServer> make(u16 port);
+	~TelemetryServer();
+
+	TelemetryServer(const TelemetryServer &) = delete;
+	void operator=(const TelemetryServer &) = delete;
+	TelemetryServer(TelemetryServer &&);
+	void operator=(TelemetryServer &&);
+
+	// Accepts new viewers & sends queued data; should be called every frame
+	void update();
+	// Queues a single line (newline is appended) for all connected viewers
+	void send(Str line);
+
+	int numViewers() const { return (int)m_viewers.size(); }
+	u16 port() const { return m_port; }
+
+  private:
+	TelemetryServer() = default;
+	void close();
+
+	struct Viewer {
+		int fd;
+		string pending;
+	};
+
+	vector<Viewer> m_viewers;
+	int m_fd = -1;
+	u16 m_port = 0;
+};
+
+// Blocking reader of the telemetry stream; used by telemetry_viewer
+class TelemetryReader {
+  public:
+	static Ex<TelemetryReader> connect(u16 port);
+	~TelemetryReader();
+
+	TelemetryReader(const TelemetryReader &) = delete;
+	void operator=(const TelemetryReader &) = delete;
+	TelemetryReader(TelemetryReader &&);
+
+	// Returns none when connection is closed
+	Maybe<string> readLine();
+
+  private:
+	TelemetryReader() = default;
+
+	string m_buffer;
+	int m_fd = -1;
+};
+
+// Resident set size of current process in bytes (if available on current platform)
+Maybe<i64> residentMemorySize();
+
+}
@@ -0,0 +1,482 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+// Load test of multiplayer server with scripted headless clients.
+// Server (death match) and all clients run in a single process & communicate over real UDP
+// sockets on localhost. Optionally packets pass through a proxy, which drops & delays them.
+// Every client joins the server, adds a character & keeps issuing random orders (moving,
+// attacking, changing stance). Test is repeated for each given number of clients; bandwidth,
+// packet rates, chunk resend rate, RTT & server time per tick are printed as a table and saved
+// in JSON format.
+
+#include "audio/device.h"
+#include "game/actor.h"
+#include "game/character.h"
+#include "game/game_mode.h"
+#include "game/orders/attack.h"
+#include "game/orders/change_stance.h"
+#include "game/orders/move.h"
+#include "game/world.h"
+#include "net/client.h"
+#include "net/server.h"
+#include "res_manager.h"
+#include "sys/stats.h"
+
+#include <fwk/io/file_system.h>
+#include <fwk/sys/expected.h>
+#include <thread>
+
+using namespace game;
+using net::Address;
+
+namespace {
+
+Ex<pair<net::Socket, Address>> makeSocket(u32 ip) {
+	for(int n = 0; n < 100; n++) {
+		u16 port = net::randomPort();
+		if(auto socket = net::Socket::make(Address(port)))
+			return pair<net::Socket, Address>(std::move(*socket), Address(ip, port));
+	}
+	return ERROR("Cannot create socket");
+}
+
+// Forwards packets between clients & server. Every client gets its own upstream socket,
+// so that server sees them as separate hosts. Packets are dropped with given probability
+// and delivered after given latency (+ random jitter); they can get reordered.
+class LossyProxy {
+  public:
+	struct Config {
+		double loss = 0.0;	  // 0 - 1
+		double latency = 0.0; // seconds, one way
+		double jitter = 0.0;  // seconds
+		bool isActive() const { return loss > 0.0 || latency > 0.0 || jitter > 0.0; }
+	};
+
+	static Ex<LossyProxy> make(Address server, Config config) {
+		auto [socket, address] = EX_PASS(makeSocket(server.ip));
+		return LossyProxy(std::move(socket), address, server, config);
+	}
+
+	const Address &address() const { return m_address; }
+	int numDropped() const { return m_num_dropped; }
+
+	Ex<> update() {
+		double time = getTime();
+		char buffer[net::limits::recv_packet_size];
+		Address source;
+
+		while(int size = m_socket.receive(buffer, source)) {
+			int link_id = -1;
+			for(int n = 0; n < (int)m_links.size(); n++)
+				if(m_links[n].client == source)
+					link_id = n;
+			if(link_id == -1) {
+				auto upstream = EX_PASS(makeSocket(m_server.ip));
+				m_links.emplace_back(source, std::move(upstream.first));
+				link_id = (int)m_links.size() - 1;
+			}
+			enqueue(link_id, true, cspan(buffer, size), time);
+		}
+		for(int n = 0; n < (int)m_links.size(); n++)
+			while(int size = m_links[n].socket.receive(buffer, source))
+				if(source == m_server)
+					enqueue(n, false, cspan(buffer, size), time);
+
+		for(int n = 0; n < (int)m_queue.size();) {
+			auto &packet = m_queue[n];
+			if(packet.time > time) {
+				n++;
+				continue;
+			}
+			auto &link = m_links[packet.link_id];
+			if(packet.to_server)
+				link.socket.send(packet.data, m_server);
+			else
+				m_socket.send(packet.data, link.client);
+			std::swap(packet, m_queue.back());
+			m_queue.pop_back();
+		}
+		return {};
+	}
+
+  private:
+	LossyProxy(net::Socket socket, Address address, Address server, Config config)
+		: m_socket(std::move(socket)), m_address(address), m_server(server), m_config(config) {}
+
+	void enqueue(int link_id, bool to_server, CSpan<char> data, double time) {
+		if(frand() < m_config.loss) {
+			m_num_dropped++;
+			return;
+		}
+		double delay = m_config.latency + frand() * m_config.jitter;
+		vector<char> packet(data.begin(), data.end());
+		m_queue.emplace_back(time + delay, link_id, to_server, std::move(packet));
+	}
+
+	struct Link {
+		Link(Address client, net::Socket socket) : client(client), socket(std::move(socket)) {}
+
+		Address client;
+		net::Socket socket;
+	};
+
+	struct DelayedPacket {
+		double time;
+		int link_id;
+		bool to_server;
+		vector<char> data;
+	};
+
+	net::Socket m_socket;
+	Address m_address, m_server;
+	Config m_config;
+	vector<Link> m_links;
+	vector<DelayedPacket> m_queue;
+	int m_num_dropped = 0;
+};
+
+// Headless client which issues random orders to its character
+class Bot {
+  public:
+	Bot(string nick) : m_client(new net::Client), m_nick(std::move(nick)) {}
+
+	void connect(Address address) { m_client->connect(address, m_nick, ""); }
+
+	bool hasJoined() { return findActor() != nullptr; }
+	bool hasFailed() const {
+		auto mode = m_client->mode();
+		return mode == net::Client::Mode::refused || mode == net::Client::Mode::timeout;
+	}
+
+	void tick(double time) {
+		m_client->beginFrame();
+		if(m_client->needWorldUpdate()) {
+			auto &info = m_client->levelInfo();
+			m_client->setWorld(PWorld(new World(info.map_name, World::Mode::client)));
+		}
+
+		if(m_client->mode() == net::Client::Mode::playing) {
+			auto *game_mode = dynamic_cast<GameModeClient *>(m_client->world()->gameMode());
+			if(!m_pc_added && game_mode) {
+				Character character(m_nick, "CORE_prefab2", "male");
+				PlayableCharacter pc(character, CharacterClass::defaultId());
+				m_pc_added = game_mode->addPC(pc);
+			}
+			if(time >= m_next_order_time)
+				if(auto *actor = findActor()) {
+					issueOrder(*actor);
+					m_next_order_time = time + 0.5 + frand() * 2.0;
+				}
+		}
+		m_client->finishFrame();
+	}
+
+  private:
+	const Actor *findActor() {
+		auto *world = m_client->world().get();
+		if(!world || m_client->mode() != net::Client::Mode::playing)
+			return nullptr;
+		auto *game_mode = world->gameMode();
+		auto *current = game_mode ? game_mode->currentClient() : nullptr;
+		if(!current || current->pcs.empty())
+			return nullptr;
+		return world->refEntity<Actor>(current->pcs.front().entityRef());
+	}
+
+	void issueOrder(const Actor &actor) {
+		World &world = *m_client->world();
+		EntityRef actor_ref = actor.ref();
+		int choice = rand() % 100;
+
+		if(choice < 60) {
+			int3 target = int3(actor.pos()) + int3(rand() % 41 - 20, 0, rand() % 41 - 20);
+			world.sendOrder(new MoveOrder(target, rand() % 2 == 0), actor_ref);
+		} else if(choice < 85) {
+			const Actor *target = nullptr;
+			float min_dist = inf;
+			for(int n = 0; n < world.entityCount(); n++)
+				if(auto *other = world.refEntity<Actor>(n))
+					if(other != &actor && !other->isDead()) {
+						float dist = distanceSq(other->pos(), actor.pos());
+						if(dist < min_dist) {
+							min_dist = dist;
+							target = other;
+						}
+					}
+			if(target)
+				world.sendOrder(new AttackOrder(none, target->ref()), actor_ref);
+			else
+				world.sendOrder(new AttackOrder(none, actor.pos() + float3(5.0f, 0.0f, 5.0f)),
+								actor_ref);
+		} else {
+			world.sendOrder(new ChangeStanceOrder(Stance(rand() % count<Stance>)), actor_ref);
+		}
+	}
+
+	net::PClient m_client;
+	string m_nick;
+	double m_next_order_time = 0.0;
+	bool m_pc_added = false;
+};
+
+struct TestConfig {
+	string map_name;
+	LossyProxy::Config proxy;
+	double tick_rate = 30.0;
+	double join_timeout = 60.0, warmup_time = 2.0, measure_time = 10.0;
+};
+
+struct TestResult {
+	int num_clients, num_joined;
+	double kbytes_out, kbytes_in;	// per second (server side)
+	double packets_out, packets_in; // per second (server side)
+	double resend_rate;				// resent / sent reliable chunks
+	double rtt_ms;					// mean over clients
+	int num_dropped;				// by proxy
+	Percentiles server_ms;
+};
+
+net::HostStats sumStats(const net::Server &server) {
+	net::HostStats out;
+	for(int n = 0; n < server.numRemoteHosts(); n++)
+		if(auto *host = server.getRemoteHost(n)) {
+			auto &stats = host->stats();
+			out.bytes_in += stats.bytes_in;
+			out.bytes_out += stats.bytes_out;
+			out.packets_in += stats.packets_in;
+			out.packets_out += stats.packets_out;
+			out.chunks_out += stats.chunks_out;
+			out.chunks_resent += stats.chunks_resent;
+		}
+	return out;
+}
+
+Ex<TestResult> runTest(const TestConfig &config, int num_clients) {
+	u32 localhost = EX_PASS(net::resolveName("localhost"));
+
+	net::ServerConfig server_config;
+	server_config.m_server_name = "net_loadtest";
+	server_config.m_map_name = config.map_name;
+	server_config.m_port = net::randomPort();
+	server_config.m_max_players = num_clients;
+	server_config.m_console_mode = true;
+
+	net::PServer server(new net::Server(server_config));
+	PWorld world = server->makeWorld();
+	server->setWorld(world);
+
+	Address server_address(localhost, server_config.m_port);
+	Maybe<LossyProxy> proxy;
+	if(config.proxy.isActive())
+		proxy = EX_PASS(LossyProxy::make(server_address, config.proxy));
+
+	vector<Bot> bots;
+	bots.reserve(num_clients);
+	for(int n = 0; n < num_clients; n++) {
+		bots.emplace_back(stdFormat("bot%02d", n));
+		bots.back().connect(proxy ? proxy->address() : server_address);
+	}
+
+	double time_step = 1.0 / config.tick_rate;
+	auto tick = [&](double time) -> Ex<double> {
+		if(proxy)
+			EXPECT(proxy->update());
+		for(auto &bot : bots)
+			bot.tick(time);
+		if(proxy)
+			EXPECT(proxy->update());
+
+		double server_time = getTime();
+		server->beginFrame();
+		world->simulate(time_step);
+		server->finishFrame();
+		return (getTime() - server_time) * 1000.0;
+	};
+	auto waitForNextTick = [&](double tick_start) {
+		double wait_time = tick_start + time_step - getTime();
+		if(wait_time > 0.0)
+			std::this_thread::sleep_for(std::chrono::microseconds(int(wait_time * 1000000.0)));
+	};
+
+	// Clients load their worlds synchronously, so join phase is not timed strictly
+	double start_time = getTime();
+	while(getTime() - start_time < config.join_timeout) {
+		double tick_start = getTime();
+		EX_PASS(tick(tick_start));
+		bool all_done = std::all_of(begin(bots), end(bots), [](Bot &bot) {
+			return bot.hasJoined() || bot.hasFailed();
+		});
+		if(all_done)
+			break;
+		waitForNextTick(tick_start);
+	}
+
+	TestResult result{};
+	result.num_clients = num_clients;
+	for(auto &bot : bots)
+		result.num_joined += bot.hasJoined() ? 1 : 0;
+
+	start_time = getTime();
+	while(getTime() - start_time < config.warmup_time) {
+		double tick_start = getTime();
+		EX_PASS(tick(tick_start));
+		waitForNextTick(tick_start);
+	}
+
+	auto stats_before = sumStats(*server);
+	int dropped_before = proxy ? proxy->numDropped() : 0;
+	vector<double> server_times;
+	start_time = getTime();
+	while(getTime() - start_time < config.measure_time) {
+		double tick_start = getTime();
+		server_times.emplace_back(EX_PASS(tick(tick_start)));
+		waitForNextTick(tick_start);
+	}
+	double duration = getTime() - start_time;
+	auto stats = sumStats(*server);
+
+	result.kbytes_out = double(stats.bytes_out - stats_before.bytes_out) / (1024.0 * duration);
+	result.kbytes_in = double(stats.bytes_in - stats_before.bytes_in) / (1024.0 * duration);
+	result.packets_out = double(stats.packets_out - stats_before.packets_out) / duration;
+	result.packets_in = double(stats.packets_in - stats_before.packets_in) / duration;
+	i64 chunks_out = stats.chunks_out - stats_before.chunks_out;
+	i64 chunks_resent = stats.chunks_resent - stats_before.chunks_resent;
+	result.resend_rate = chunks_out ? double(chunks_resent) / double(chunks_out) : 0.0;
+	result.num_dropped = proxy ? proxy->numDropped() - dropped_before : 0;
+	result.server_ms = computePercentiles(server_times);
+
+	int num_hosts = 0;
+	for(int n = 0; n < server->numRemoteHosts(); n++)
+		if(auto *host = server->getRemoteHost(n)) {
+			result.rtt_ms += host->stats().rtt * 1000.0;
+			num_hosts++;
+		}
+	if(num_hosts)
+		result.rtt_ms /= num_hosts;
+
+	bots.clear();
+	server->beginFrame();
+	server->finishFrame();
+	return result;
+}
+
+}
+
+Ex<int> exMain(int argc, char **argv) {
+	TestConfig config;
+	string output_file;
+	vector<int> client_counts = {1, 2, 4, 8, 16, 32};
+	unsigned seed = 1;
+
+	for(int n = 1; n < argc; n++) {
+		if(strcmp(argv[n], "-c") == 0 && n + 1 < argc) {
+			client_counts.clear();
+			for(const char *text = argv[++n]; *text;) {
+				char *end = nullptr;
+				client_counts.emplace_back(max(1, (int)strtol(text, &end, 10)));
+				text = *end == ',' ? end + 1 : "";
+			}
+		} else if(strcmp(argv[n], "-t") == 0 && n + 1 < argc)
+			config.measure_time = max(1.0, atof(argv[++n]));
+		else if(strcmp(argv[n], "-w") == 0 && n + 1 < argc)
+			config.warmup_time = max(0.0, atof(argv[++n]));
+		else if(strcmp(argv[n], "-r") == 0 && n + 1 < argc)
+			config.tick_rate = clamp(atof(argv[++n]), 1.0, 240.0);
+		else if(strcmp(argv[n], "-loss") == 0 && n + 1 < argc)
+			config.proxy.loss = clamp(atof(argv[++n]), 0.0, 1.0);
+		else if(strcmp(argv[n], "-latency") == 0 && n + 1 < argc)
+			config.proxy.latency = max(0.0, atof(argv[++n]) * 0.001);
+		else if(strcmp(argv[n], "-jitter") == 0 && n + 1 < argc)
+			config.proxy.jitter = max(0.0, atof(argv[++n]) * 0.001);
+		else if(strcmp(argv[n], "-s") == 0 && n + 1 < argc)
+			seed = (unsigned)atoi(argv[++n]);
+		else if(strcmp(argv[n], "-o") == 0 && n + 1 < argc)
+			output_file = argv[++n];
+		else if(argv[n][0] != '-' && config.map_name.empty())
+			config.map_name = argv[n];
+		else {
+			config.map_name.clear();
+			break;
+		}
+	}
+
+	if(config.map_name.empty()) {
+		printf("Usage:\n%s map_name [options]\n\n"
+			   "Options:\n"
+			   "-c counts    Comma separated numbers of clients (default: 1,2,4,8,16,32)\n"
+			   "             Single server can handle up to %d clients\n"
+			   "-t time      Measurement time in seconds for each count (default: 10)\n"
+			   "-w time      Warm-up time in seconds (default: 2)\n"
+			   "-r rate      Ticks per second (default: 30)\n"
+			   "-loss value  Probability of dropping a packet by the proxy (0 - 1)\n"
+			   "-latency ms  One-way latency added by the proxy\n"
+			   "-jitter ms   Maximum random delay added by the proxy\n"
+			   "-s seed      Random seed (default: 1)\n"
+			   "-o file      Saves results in JSON format to given file;\n"
+			   "             By default they are printed in the last line of output\n\n"
+			   "Proxy is only used if loss, latency or jitter is specified.\n"
+			   "Example: %s mission05.mod -c 4,16 -loss 0.05 -latency 50\n",
+			   argv[0], (int)net::LocalHost::max_remote_hosts, argv[0]);
+		return 0;
+	}
+
+	ResManager res_mgr(none, true);
+	audio::initSoundMap();
+	game::loadData();
+	srand(seed);
+
+	vector<TestResult> results;
+	for(int num_clients : client_counts) {
+		if(num_clients > net::LocalHost::max_remote_hosts) {
+			printf("Skipping %d clients: server is limited to %d clients\n", num_clients,
+				   (int)net::LocalHost::max_remote_hosts);
+			continue;
+		}
+		printf("Testing %d client(s)...\n", num_clients);
+		results.emplace_back(EX_PASS(runTest(config, num_clients)));
+	}
+
+	printf("\n%7s  %6s  %9s  %9s  %8s  %8s  %8s  %7s  %8s  %8s  %8s\n", "clients", "joined",
+		   "KB/s out", "KB/s in", "pkt/s out", "pkt/s in", "resend %", "rtt ms", "srv mean",
+		   "srv p99", "srv max");
+	for(auto &result : results)
+		printf("%7d  %6d  %9.1f  %9.1f  %8.1f  %8.1f  %8.2f  %7.1f  %8.3f  %8.3f  %8.3f\n",
+			   result.num_clients, result.num_joined, result.kbytes_out, result.kbytes_in,
+			   result.packets_out, result.packets_in, result.resend_rate * 100.0, result.rtt_ms,
+			   result.server_ms.mean, result.server_ms.p99, result.server_ms.max);
+	printf("\nTraffic is measured on the server side; srv: server time per tick in ms\n");
+
+	TextFormatter json;
+	json.stdFormat("{\"map\":\"%s\",\"seed\":%u,\"tick_rate\":%.2f,\"measure_time\":%.2f,"
+				   "\"loss\":%.4f,\"latency_ms\":%.2f,\"jitter_ms\":%.2f,\"results\":[",
+				   config.map_name.c_str(), seed, config.tick_rate, config.measure_time,
+				   config.proxy.loss, config.proxy.latency * 1000.0, config.proxy.jitter * 1000.0);
+	for(int n = 0; n < (int)results.size(); n++) {
+		auto &result = results[n];
+		auto &server_ms = result.server_ms;
+		json.stdFormat("%s{\"clients\":%d,\"joined\":%d,\"kbytes_out\":%.3f,\"kbytes_in\":%.3f,"
+					   "\"packets_out\":%.2f,\"packets_in\":%.2f,\"resend_rate\":%.5f,"
+					   "\"rtt_ms\":%.3f,\"dropped\":%d,\"server_ms\":{\"mean\":%.4f,\"p50\":%.4f,"
+					   "\"p99\":%.4f,\"max\":%.4f}}",
+					   n == 0 ? "" : ",", result.num_clients, result.num_joined,
+					   result.kbytes_out, result.kbytes_in, result.packets_out, result.packets_in,
+					   result.resend_rate, result.rtt_ms, result.num_dropped, server_ms.mean,
+					   server_ms.p50, server_ms.p99, server_ms.max);
+	}
+	json("]}\n");
+
+	if(output_file.empty())
+		printf("%s", json.text().c_str());
+	else
+		EXPECT(saveFile(output_file, json.text()));
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	auto result = exMain(argc, argv);
+	if(!result) {
+		result.error().print();
+		return 1;
+	}
+	return *result;
+}
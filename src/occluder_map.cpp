@@ -2,6 +2,8 @@
 // This file is part of FreeFT. See license.txt for details.
 
 #include "occluder_map.h"
+#include "sys/alloc_tracker.h"
+#include "sys/frame_allocator.h"
 #include <algorithm>
 #include <map>
 
@@ -203,6 +205,24 @@ bool OccluderMap::verifyBBoxes(int occluder_id, const vector<FBox> &bboxes) cons
 	return bobjects == objects;
 }
 
+Ex<void> OccluderMap::assign(CSpan<FBox> bboxes) {
+	DASSERT(m_occluders.empty());
+	m_occluders.resize(bboxes.size());
+	for(int n = 0; n < (int)bboxes.size(); n++)
+		m_occluders[n].bbox = bboxes[n];
+
+	for(int n = 0; n < m_grid.size(); n++) {
+		int occ_id = m_grid[n].occluder_id;
+		if(occ_id != -1 && m_grid[n].ptr) {
+			EXPECT(occ_id < size());
+			m_occluders[occ_id].objects.emplace_back(n);
+		}
+	}
+	for(auto &occluder : m_occluders)
+		EXPECT(!occluder.objects.empty());
+	return {};
+}
+
 Ex<void> OccluderMap::loadFromXML(const XmlDocument &doc) {
 	clear();
 
@@ -293,7 +313,7 @@ bool OccluderMap::isUnder(int lower_id, int upper_id) const {
 	if(lower_id == upper_id)
 		return false;
 
-	vector<int> temp;
+	FrameVector<int> temp;
 	temp.reserve(1024);
 
 	FBox bbox = upper.bbox;
@@ -318,22 +338,22 @@ bool OccluderConfig::update() {
 }
 
 bool OccluderConfig::update(const FBox &bbox) {
+	ALLOC_TAG("occluders");
 	//TODO: hiding when close to a door/window
 	FBox test_box(bbox.x(), bbox.y() + 1.0f, bbox.z(), bbox.ex(), 256, bbox.ez());
 	float3 mid_point = asXZY(test_box.center().xz(), bbox.y() + 2.0f);
 
 	bool vis_changed = update();
-	vector<int> temp;
+	FrameVector<int> temp;
 	temp.reserve(256);
 	IRect test_rect = (IRect)worldToScreen(bbox);
 	const Grid &grid = m_map.m_grid;
 	grid.findAll(temp, test_rect);
 
-	vector<int> temp2;
+	FrameVector<int> temp2;
 	temp2.reserve(256);
 
-	PodVector<int> overlaps(m_map.size());
-	memset(overlaps.data(), 0, m_map.size() * sizeof(int));
+	FrameVector<int> overlaps(m_map.size(), 0);
 
 	for(int i = 0; i < (int)temp.size(); i++) {
 		const auto &object = grid[temp[i]];
@@ -20,6 +20,9 @@ class OccluderMap {
 
 	Ex<void> loadFromXML(const XmlDocument &);
 	void saveToXML(const PodVector<int> &tile_ids, XmlDocument &) const;
+	// Creates occluders from occluder_ids already assigned to grid objects;
+	// Occluder map has to be empty
+	Ex<void> assign(CSpan<FBox> bboxes);
 
 	struct Occluder {
 		FBox bbox;
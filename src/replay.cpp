@@ -0,0 +1,119 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+// Headless replay of recorded server sessions (see game/replay.h).
+// Whole session is re-simulated as fast as possible; world state is compared with hashes
+// stored in the log & time of each tick is measured. Selected range of ticks can be captured
+// with the profiler, which is useful for investigating CPU spikes of a recorded match.
+
+#include "audio/device.h"
+#include "game/replay.h"
+#include "res_manager.h"
+#include "sys/profiler.h"
+#include "sys/stats.h"
+
+#include <algorithm>
+#include <fwk/sys/expected.h>
+
+using namespace game;
+
+Ex<int> exMain(int argc, char **argv) {
+	string replay_file, trace_file;
+	int trace_start = -1, trace_ticks = 0, num_slowest = 10;
+
+	for(int n = 1; n < argc; n++) {
+		if(strcmp(argv[n], "-trace") == 0 && n + 3 < argc) {
+			trace_start = max(0, atoi(argv[n + 1]));
+			trace_ticks = max(1, atoi(argv[n + 2]));
+			trace_file = argv[n + 3];
+			n += 3;
+		} else if(strcmp(argv[n], "-slowest") == 0 && n + 1 < argc)
+			num_slowest = max(0, atoi(argv[++n]));
+		else if(argv[n][0] != '-' && replay_file.empty())
+			replay_file = argv[n];
+		else {
+			replay_file.clear();
+			break;
+		}
+	}
+
+	if(replay_file.empty()) {
+		printf("Usage:\n%s replay_file [options]\n\n"
+			   "Options:\n"
+			   "-trace first count file  Captures profiler trace of given range of ticks\n"
+			   "                         and saves it in Chrome JSON format\n"
+			   "-slowest count           Number of slowest ticks to list (default: 10)\n\n"
+			   "Replays are recorded by servers with replay_file attribute in config.\n"
+			   "Example: %s match.replay -trace 1200 60 spike.json\n",
+			   argv[0], argv[0]);
+		return 0;
+	}
+
+	ResManager res_mgr(none, true);
+	audio::initSoundMap();
+	game::loadData();
+
+	auto player = EX_PASS(ReplayPlayer::load(replay_file));
+	auto &header = player.header();
+	printf("Replay: %s  map: %s  seed: %u  hash interval: %d\n", replay_file.c_str(),
+		   header.map_name.c_str(), header.seed, header.hash_interval);
+	PWorld world = EX_PASS(player.makeWorld());
+	if(player.divergedTick())
+		printf("Initial world state differs from the recorded one\n");
+
+	vector<pair<double, int>> tick_times;
+	double total_time = getTime();
+	while(true) {
+		int tick = player.currentTick();
+		if(tick == trace_start)
+			Profiler::captureTrace(trace_file, trace_ticks);
+
+		double time = getTime();
+		bool has_tick = EX_PASS(player.tick(*world));
+		if(!has_tick)
+			break;
+		tick_times.emplace_back((getTime() - time) * 1000.0, tick);
+		Profiler::nextFrame();
+	}
+	total_time = getTime() - total_time;
+	// Finishing trace capture, in case if log ended before it
+	while(Profiler::isCapturing())
+		Profiler::nextFrame();
+
+	vector<double> tick_ms;
+	for(auto &[ms, tick] : tick_times)
+		tick_ms.emplace_back(ms);
+	auto stats = computePercentiles(std::move(tick_ms));
+	printf("Replayed %d ticks in %.2f sec; ms per tick: p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+		   (int)tick_times.size(), total_time, stats.p50, stats.p90, stats.p99, stats.max);
+
+	std::sort(begin(tick_times), end(tick_times));
+
+	int num_listed = min(num_slowest, (int)tick_times.size());
+	if(num_listed > 0) {
+		printf("Slowest ticks:");
+		for(int n = 0; n < num_listed; n++) {
+			auto &[ms, tick] = tick_times[tick_times.size() - 1 - n];
+			printf(" %d (%.2f ms)", tick, ms);
+		}
+		printf("\n");
+	}
+	if(!trace_file.empty() && trace_start < (int)tick_times.size())
+		printf("Trace saved: %s\n", trace_file.c_str());
+
+	if(auto tick = player.divergedTick()) {
+		printf("Replay diverged after tick %d\n", *tick);
+		return 1;
+	}
+	printf("World state matched in all %d hashed ticks\n", player.numHashedTicks());
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	auto result = exMain(argc, argv);
+	if(!result) {
+		result.error().print();
+		return 1;
+	}
+	return *result;
+}
@@ -4,7 +4,11 @@
 #include "res_manager.h"
 
 #include "game/tile.h"
+#include "gfx/texture_arena.h"
+#include "sys/parallel.h"
 
+#include <algorithm>
+#include <atomic>
 #include <fwk/gfx/font.h>
 #include <fwk/gfx/image.h>
 #include <fwk/hash_map.h>
@@ -25,12 +29,15 @@
 // causes problems in copy constructors & operator=
 // TODO: there is a need for data structure which doesn't move resources in memory
 // after thet are created
-//
-// TODO: dont return references but identifiers (TileId: u16)
 
 struct ResManager::Impl {
 	HashMap<string, PVImageView> textures;
-	std::map<string, Dynamic<game::Tile>> tiles;
+	HashMap<string, int> tile_indices;
+	vector<string> tile_names;
+	// Has to be destroyed after the tiles
+	TextureArena tile_arena;
+	vector<Dynamic<game::Tile>> tiles;
+	ResidencyTracker tile_residency{ResidencyCategory::tile_frames};
 	std::map<string, Font> fonts;
 	std::map<string, vector<char>> others;
 };
@@ -54,6 +61,9 @@ ResManager::ResManager(Maybe<VDeviceRef> device, bool console_mode)
 		m_data_path = FilePath(executablePath()).parent() / "data";
 		if(!m_data_path.ends_with('/'))
 			m_data_path += '/';
+		m_cache_path = FilePath(executablePath()).parent() / "cache";
+		if(!m_cache_path.ends_with('/'))
+			m_cache_path += '/';
 	} else {
 		m_data_path = "data/";
 	}
@@ -62,6 +72,27 @@ ResManager::ResManager(Maybe<VDeviceRef> device, bool console_mode)
 		m_paths[rtype] = {m_data_path + default_paths[rtype].first, default_paths[rtype].second};
 
 	m_impl.emplace();
+
+	auto pack_path = m_data_path + "resources.pack";
+	if(platform != Platform::html && access(pack_path)) {
+		auto pack = ResPack::open(pack_path);
+		if(pack) {
+			print("Using resource pack: % (% files)\n", pack_path, pack->size());
+			m_pack = std::move(*pack);
+
+			// Tile indices are assigned in the order of pack index
+			auto &paths = default_paths[ResType::tile];
+			auto [first, end] = m_pack->prefixRange(paths.first);
+			for(int n = first; n < end; n++) {
+				string name = m_pack->name(n);
+				if(removePrefix(name, paths.first) && removeSuffix(name, paths.second))
+					tileIndex(name);
+			}
+		} else {
+			print("Error while opening resource pack: %\n", pack_path);
+			pack.error().print();
+		}
+	}
 }
 
 ResManager::~ResManager() {
@@ -74,11 +105,33 @@ void fixGrayTransTexture(Image &tex) {
 		pixel = IColor(u8(255), u8(255), u8(255), pixel.r);
 }
 
+static string packedName(Str res_name, ResType type) {
+	auto &paths = default_paths[type];
+	return format("%%%", paths.first, res_name, paths.second);
+}
+
+const ResPack *ResManager::activePack() {
+	return g_instance && g_instance->m_pack ? &*g_instance->m_pack : nullptr;
+}
+
+Maybe<CSpan<char>> ResManager::findPacked(Str path) {
+	if(auto *pack = activePack())
+		return pack->findData(path);
+	return none;
+}
+
 Ex<PVImageView> ResManager::getTexture(Str name, bool font_tex) {
 	auto &textures = m_impl->textures;
 	auto it = textures.find(name);
 	if(it == textures.end()) {
-		auto tex = Image::load(fullPath(name, ResType::texture));
+		auto tex = [&]() -> Ex<Image> {
+			auto ext = fileNameExtension(name);
+			if(auto packed = findPacked(name); packed && ext) {
+				auto ldr = memoryLoader(*packed);
+				return Image::load(ldr, *ext);
+			}
+			return Image::load(fullPath(name, ResType::texture));
+		}();
 		tex.check();
 		if(font_tex)
 			fixGrayTransTexture(*tex);
@@ -96,7 +149,14 @@ const Font &ResManager::getFont(Str name) {
 	auto &fonts = m_impl->fonts;
 	auto it = fonts.find(name);
 	if(it == fonts.end()) {
-		auto vcore = FontCore::load(fullPath(name, ResType::font));
+		auto vcore = [&]() -> Ex<FontCore> {
+			if(auto packed = findPacked(packedName(name, ResType::font))) {
+				auto ldr = memoryLoader(*packed);
+				auto doc = EX_PASS(XmlDocument::load(ldr));
+				return FontCore::load(doc);
+			}
+			return FontCore::load(fullPath(name, ResType::font));
+		}();
 		vcore.check();
 		FontCore core(std::move(*vcore));
 		auto tex = getTexture("fonts/" + core.textureName(), true);
@@ -106,25 +166,114 @@ const Font &ResManager::getFont(Str name) {
 	return it->second;
 }
 
-const game::Tile &ResManager::getTile(Str name) {
-	auto &tiles = m_impl->tiles;
-	auto it = tiles.find(name);
-	if(it == tiles.end()) {
-		auto ldr = fileLoader(fullPath(name, ResType::tile));
-		ldr.check();
-		Dynamic<game::Tile> tile;
-		tile.emplace();
-		auto result = tile->load(*ldr);
-		tile->setResourceName(name);
-		result.check();
-		it = tiles.emplace(name, std::move(tile)).first;
+TileIndex ResManager::tileIndex(Str name) {
+	if(auto index = findTile(name))
+		return *index;
+
+	int index = m_impl->tiles.size();
+	m_impl->tiles.emplace_back();
+	m_impl->tile_names.emplace_back(name);
+	m_impl->tile_indices.emplace(name, index);
+	return TileIndex(index);
+}
+
+Maybe<TileIndex> ResManager::findTile(Str name) const {
+	auto it = m_impl->tile_indices.find(name);
+	if(it == m_impl->tile_indices.end())
+		return none;
+	return TileIndex(it->value);
+}
+
+const string &ResManager::tileName(TileIndex index) const {
+	DASSERT(index && index.index() < tileCount());
+	return m_impl->tile_names[index.index()];
+}
+
+int ResManager::tileCount() const { return m_impl->tiles.size(); }
+
+Ex<Dynamic<game::Tile>> ResManager::loadTile(const string &name) {
+	Dynamic<game::Tile> tile;
+	tile.emplace();
+	if(auto packed = findPacked(packedName(name, ResType::tile))) {
+		// Frames will reference mapped pack directly
+		auto ldr = memoryLoader(*packed);
+		EXPECT(tile->load(ldr, *packed));
+	} else {
+		auto ldr = EX_PASS(fileLoader(fullPath(name, ResType::tile)));
+		EXPECT(tile->load(ldr));
+	}
+	tile->share(m_impl->tile_arena);
+	tile->setResourceName(name);
+	return tile;
+}
+
+const game::Tile &ResManager::getTile(TileIndex index) {
+	DASSERT(index && index.index() < tileCount());
+	auto &tile = m_impl->tiles[index.index()];
+	if(!tile) {
+		tile = loadTile(m_impl->tile_names[index.index()]).get();
+		m_impl->tile_residency.setResident(index.index(), tile->memorySize());
+	} else {
+		m_impl->tile_residency.touch(index.index());
+	}
+	return *tile;
+}
+
+Ex<void> ResManager::loadTiles(CSpan<TileIndex> indices,
+							   const std::function<void(float)> &progress) {
+	vector<int> missing;
+	for(auto index : indices) {
+		DASSERT(index && index.index() < tileCount());
+		if(!m_impl->tiles[index.index()])
+			missing.emplace_back(index.index());
 	}
-	return *it->second;
+	makeSortedUnique(missing);
+
+	// Every task writes to a different slot; containers are not resized in the meantime
+	vector<Maybe<Error>> errors(missing.size());
+	std::atomic<int> num_loaded = 0;
+	parallelFor((int)missing.size(), 0, [&](int n) {
+		int index = missing[n];
+		auto tile = loadTile(m_impl->tile_names[index]);
+		if(tile)
+			m_impl->tiles[index] = std::move(*tile);
+		else
+			errors[n] = tile.error();
+		if(progress)
+			progress(float(++num_loaded) / missing.size());
+	});
+
+	for(int index : missing)
+		if(m_impl->tiles[index])
+			m_impl->tile_residency.setResident(index, m_impl->tiles[index]->memorySize());
+	for(auto &error : errors)
+		if(error)
+			return *error;
+	if(progress)
+		progress(1.0f);
+	return {};
+}
+
+const TextureArena &ResManager::tileArena() const { return m_impl->tile_arena; }
+
+ResidencyRef ResManager::tileRef(TileIndex index) {
+	DASSERT(index && index.index() < tileCount());
+	return ResidencyRef(m_impl->tile_residency, index.index());
+}
+
+int ResManager::trimTiles() {
+	return m_impl->tile_residency.trim([&](int index) {
+		m_impl->tiles[index] = Dynamic<game::Tile>();
+		m_impl->tile_residency.setResident(index, 0);
+		return true;
+	});
 }
 
 vector<char> ResManager::getOther(Str name) const {
 	auto it = m_impl->others.find(name);
 	if(it == m_impl->others.end()) {
+		if(auto packed = findPacked(name))
+			return vector<char>(packed->begin(), packed->end());
 		auto data = loadFile(format("%%", m_data_path, name));
 		data.check();
 		return std::move(*data);
@@ -132,7 +281,20 @@ vector<char> ResManager::getOther(Str name) const {
 	return it->second;
 }
 
-const std::map<string, Dynamic<game::Tile>> &ResManager::allTiles() { return m_impl->tiles; }
+vector<const game::Tile *> ResManager::allTiles() const {
+	vector<int> indices;
+	for(int n = 0; n < tileCount(); n++)
+		if(m_impl->tiles[n] && m_impl->tile_residency.isReferenced(n))
+			indices.emplace_back(n);
+	std::sort(begin(indices), end(indices),
+			  [&](int a, int b) { return m_impl->tile_names[a] < m_impl->tile_names[b]; });
+
+	vector<const game::Tile *> out;
+	out.reserve(indices.size());
+	for(int n : indices)
+		out.emplace_back(m_impl->tiles[n].get());
+	return out;
+}
 
 Ex<void> ResManager::loadResource(Str name, Stream &sr, ResType type) {
 	DASSERT(sr.isLoading());
@@ -141,8 +303,11 @@ Ex<void> ResManager::loadResource(Str name, Stream &sr, ResType type) {
 		Dynamic<game::Tile> tile;
 		tile.emplace();
 		EXPECT(tile->load(sr));
+		tile->share(m_impl->tile_arena);
 		tile->setResourceName(name);
-		m_impl->tiles[name] = std::move(tile);
+		int index = tileIndex(name).index();
+		m_impl->tile_residency.setResident(index, tile->memorySize());
+		m_impl->tiles[index] = std::move(tile);
 	} else if(type == ResType::sprite) {
 		FATAL("write me");
 	} else if(type == ResType::font) {
@@ -175,6 +340,14 @@ Ex<void> ResManager::loadResource(Str name, CSpan<char> data, ResType type) {
 	return loadResource(name, mem_loader, type);
 }
 
+Ex<string> ResManager::cacheFile(Str file_name) const {
+	if(m_cache_path.empty())
+		return ERROR("Cache is not available on this platform");
+	auto path = FilePath(m_cache_path) / file_name;
+	EXPECT(mkdirRecursive(path.parent()));
+	return (string)path;
+}
+
 Maybe<ResType> ResManager::classifyPath(Str path, bool ignore_prefix) const {
 	if(path.endsWith(".zar") || path.endsWith(".png") || path.endsWith(".tga")) {
 		if(ignore_prefix || path.startsWith(m_data_path))
@@ -4,9 +4,27 @@
 #pragma once
 
 #include "base.h"
+#include "res_pack.h"
+#include "residency.h"
+#include <functional>
 
 DEFINE_ENUM(ResType, tile, sprite, font, texture, other);
 
+// Dense index of a tile in ResManager; Names are resolved to indices only when loading
+// (maps, tile groups); Afterwards tiles can be accessed without any string lookups.
+class TileIndex {
+  public:
+	TileIndex() = default;
+	explicit TileIndex(int idx) : m_idx(idx) {}
+	explicit operator bool() const { return m_idx != -1; }
+
+	bool operator==(const TileIndex &rhs) const { return m_idx == rhs.m_idx; }
+	int index() const { return m_idx; }
+
+  private:
+	int m_idx = -1;
+};
+
 // Only single instance allowed
 class ResManager {
   public:
@@ -24,8 +42,33 @@ class ResManager {
 
 	Ex<PVImageView> getTexture(Str, bool font_tex);
 	const Font &getFont(Str);
-	const game::Tile &getTile(Str);
-	const std::map<string, Dynamic<game::Tile>> &allTiles();
+	// With resource pack, all tiles are indexed when ResManager is created, otherwise
+	// indices are assigned when tile names are resolved for the first time
+	TileIndex tileIndex(Str);
+	Maybe<TileIndex> findTile(Str) const;
+	const string &tileName(TileIndex) const;
+	int tileCount() const;
+
+	// Tile is loaded when accessed for the first time; Unless tile is referenced (tileRef),
+	// returned reference is only valid until next trimTiles
+	const game::Tile &getTile(TileIndex);
+	// Loads given tiles on multiple threads; progress is called with values in [0, 1]
+	// (possibly from other threads). Other tiles cannot be accessed in the meantime.
+	Ex<void> loadTiles(CSpan<TileIndex>, const std::function<void(float)> &progress = {});
+	const game::Tile &getTile(Str name) { return getTile(tileIndex(name)); }
+	// All loaded & referenced tiles, sorted by name; Pointers stay valid for as long as
+	// the tiles are referenced
+	vector<const game::Tile *> allTiles() const;
+
+	// Referenced tiles stay resident; Unreferenced tiles may be evicted (and loaded again
+	// when accessed) if tile memory goes over the budget, so pointers to them shouldn't be kept.
+	ResidencyRef tileRef(TileIndex);
+	// Evicts least recently used unreferenced tiles until they fit in the budget;
+	// It's never called implicitly: only after a world is torn down & on res_trim command
+	int trimTiles();
+	// Tile pixel data (if not in the pack) & palettes; It is kept when tiles are evicted,
+	// so reloading them doesn't allocate any more memory
+	const TextureArena &tileArena() const;
 
 	// Other resource will only be stored in manager with loadResource.
 	// Otherwise it will simply be loaded from file every time when getOther() is called.
@@ -41,9 +84,21 @@ class ResManager {
 	string fullPath(Str res_name, ResType) const;
 	const auto &dataPath() const { return m_data_path; }
 
+	// Cache directory is next to data/ and keeps data derived from resources
+	// (compiled maps, decoded textures, etc.); It can be safely removed.
+	// Returns full path to given file, making sure that its directory exists.
+	Ex<string> cacheFile(Str file_name) const;
+
 	Pair<Str> prefixSuffix(ResType type) const { return m_paths[type]; }
 
+	// Pack (data/resources.pack) is used if it's present; Files in the pack take precedence
+	// over files in data/. Both functions work also when ResManager doesn't exist.
+	static const ResPack *activePack();
+	// Contents of packed file (path relative to data/)
+	static Maybe<CSpan<char>> findPacked(Str path);
+
   private:
+	Ex<Dynamic<game::Tile>> loadTile(const string &name);
 	Ex<void> loadPackage(Str, Str);
 
 	static ResManager *g_instance;
@@ -51,7 +106,8 @@ class ResManager {
 	Dynamic<Impl> m_impl;
 
 	Maybe<VDeviceRef> m_device;
+	Maybe<ResPack> m_pack;
 	EnumMap<ResType, Pair<string, string>> m_paths;
-	string m_data_path;
+	string m_data_path, m_cache_path;
 	bool m_console_mode;
 };
@@ -0,0 +1,157 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#include "res_pack.h"
+
+#include <algorithm>
+#include <fwk/io/file_stream.h>
+#include <fwk/io/file_system.h>
+
+namespace {
+
+const char pack_magic[4] = {'F', 'T', 'P', 'K'};
+const u32 pack_version = 1;
+
+struct Header {
+	char magic[4];
+	u32 version, count, names_size;
+};
+
+}
+
+struct ResPack::Entry {
+	u64 offset, size;
+	u32 name_offset, name_size;
+};
+
+static_assert(sizeof(Header) == 16);
+
+ResPack::ResPack() = default;
+ResPack::ResPack(ResPack &&) = default;
+ResPack &ResPack::operator=(ResPack &&) = default;
+ResPack::~ResPack() = default;
+
+Ex<ResPack> ResPack::open(ZStr file_name) {
+	ResPack out;
+	out.m_file = EX_PASS(MappedFile::open(file_name));
+
+	auto &file = out.m_file;
+	EXPECT(file.size() >= (i64)sizeof(Header));
+	auto &header = *file.at<Header>(0);
+	if(memcmp(header.magic, pack_magic, sizeof(pack_magic)) != 0)
+		return ERROR("Invalid resource pack: '%'", file_name);
+	if(header.version != pack_version)
+		return ERROR("Unsupported version of resource pack: % (expected: %)", header.version,
+					 pack_version);
+
+	i64 names_offset = sizeof(Header) + i64(header.count) * sizeof(Entry);
+	EXPECT(names_offset + header.names_size <= file.size());
+	out.m_count = header.count;
+
+	// Validating whole index, so that later accesses don't have to
+	for(int n = 0; n < out.m_count; n++) {
+		auto &entry = out.entry(n);
+		EXPECT(i64(entry.name_offset) + entry.name_size <= header.names_size);
+		EXPECT(entry.offset % data_alignment == 0 && entry.offset <= u64(file.size()) &&
+			   entry.size <= u64(file.size()) - entry.offset);
+		if(n > 0)
+			EXPECT(out.name(n - 1) < out.name(n));
+	}
+
+	return out;
+}
+
+Ex<void> ResPack::create(ZStr file_name, vector<Pair<string>> files) {
+	std::sort(begin(files), end(files));
+	for(int n = 1; n < (int)files.size(); n++)
+		if(files[n - 1].first == files[n].first)
+			return ERROR("Duplicated file in resource pack: '%'", files[n].first);
+
+	Header header;
+	memcpy(header.magic, pack_magic, sizeof(pack_magic));
+	header.version = pack_version;
+	header.count = files.size();
+	header.names_size = 0;
+
+	vector<Entry> entries(files.size());
+	for(int n = 0; n < (int)files.size(); n++) {
+		auto &name = files[n].first;
+		entries[n].name_offset = header.names_size;
+		entries[n].name_size = name.size();
+		header.names_size += name.size();
+	}
+
+	auto saver = EX_PASS(fileSaver(file_name));
+	saver.saveData(cspan(&header, 1));
+	saver.saveData(entries);
+	for(auto &[name, path] : files)
+		saver.saveData(cspan(name));
+
+	// Contents are written after the index; Offsets are filled in afterwards
+	char padding[data_alignment] = {};
+	for(int n = 0; n < (int)files.size(); n++) {
+		auto data = EX_PASS(loadFile(files[n].second));
+		i64 pos = saver.pos();
+		i64 aligned_pos = (pos + data_alignment - 1) / data_alignment * data_alignment;
+		saver.saveData(cspan(padding, aligned_pos - pos));
+		entries[n].offset = aligned_pos;
+		entries[n].size = data.size();
+		saver.saveData(data);
+	}
+
+	saver.seek(sizeof(Header));
+	saver.saveData(entries);
+	EX_CATCH();
+	return {};
+}
+
+const ResPack::Entry &ResPack::entry(int index) const {
+	DASSERT(index >= 0 && index < m_count);
+	return *m_file.at<Entry>(sizeof(Header) + i64(index) * sizeof(Entry));
+}
+
+Str ResPack::name(int index) const {
+	auto &entry = this->entry(index);
+	i64 names_offset = sizeof(Header) + i64(m_count) * sizeof(Entry);
+	return Str(m_file.data().data() + names_offset + entry.name_offset, entry.name_size);
+}
+
+CSpan<char> ResPack::data(int index) const {
+	auto &entry = this->entry(index);
+	return CSpan<char>(m_file.data().data() + entry.offset, (int)entry.size);
+}
+
+Maybe<int> ResPack::find(Str name) const {
+	int lo = 0, hi = m_count;
+	while(lo < hi) {
+		int mid = (lo + hi) / 2;
+		if(this->name(mid) < name)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if(lo < m_count && this->name(lo) == name)
+		return lo;
+	return none;
+}
+
+Maybe<CSpan<char>> ResPack::findData(Str name) const {
+	if(auto index = find(name))
+		return data(*index);
+	return none;
+}
+
+Pair<int> ResPack::prefixRange(Str prefix) const {
+	int lo = 0, hi = m_count;
+	while(lo < hi) {
+		int mid = (lo + hi) / 2;
+		if(name(mid) < prefix)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	int end = lo;
+	while(end < m_count && name(end).startsWith(prefix))
+		end++;
+	return {lo, end};
+}
@@ -0,0 +1,40 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#pragma once
+
+#include "base.h"
+#include "sys/mapped_file.h"
+
+// Single file with many resources (created with: convert pack). It contains a name-sorted
+// index followed by aligned file contents; Whole pack is memory-mapped and files are
+// accessed without copying.
+class ResPack {
+  public:
+	static constexpr int data_alignment = 64;
+
+	ResPack();
+	ResPack(ResPack &&);
+	ResPack &operator=(ResPack &&);
+	~ResPack();
+
+	static Ex<ResPack> open(ZStr file_name);
+	// files: pairs of (name in pack, source file path)
+	static Ex<void> create(ZStr file_name, vector<Pair<string>> files);
+
+	int size() const { return m_count; }
+	Str name(int index) const;
+	CSpan<char> data(int index) const;
+
+	Maybe<int> find(Str name) const;
+	Maybe<CSpan<char>> findData(Str name) const;
+	// Range of indices of all files with given prefix
+	Pair<int> prefixRange(Str prefix) const;
+
+  private:
+	struct Entry;
+	const Entry &entry(int index) const;
+
+	MappedFile m_file;
+	int m_count = 0;
+};
@@ -0,0 +1,177 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#include "residency.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace {
+
+constexpr i64 mbytes = 1024 * 1024;
+
+// Plain arrays, so that trackers can be registered during static initialization
+std::atomic<i64> s_budgets[count<ResidencyCategory>] = {256 * mbytes, 256 * mbytes,
+														 64 * mbytes};
+ResidencyTracker *s_trackers[count<ResidencyCategory>] = {};
+
+}
+
+ResidencyTracker::ResidencyTracker(ResidencyCategory category) : m_category(category) {
+	ASSERT(s_trackers[(int)category] == nullptr);
+	s_trackers[(int)category] = this;
+}
+
+ResidencyTracker::~ResidencyTracker() {
+	DASSERT(s_trackers[(int)m_category] == this);
+	s_trackers[(int)m_category] = nullptr;
+}
+
+ResidencyTracker::Entry &ResidencyTracker::access(int id) {
+	DASSERT(id >= 0);
+	if(id >= (int)m_entries.size())
+		m_entries.resize(id + 1);
+	return m_entries[id];
+}
+
+void ResidencyTracker::acquire(int id) {
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	auto &entry = access(id);
+	if(entry.refs++ == 0)
+		m_referenced++;
+	entry.last_use = ++m_clock;
+}
+
+void ResidencyTracker::release(int id) {
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	auto &entry = access(id);
+	DASSERT(entry.refs > 0);
+	if(--entry.refs == 0)
+		m_referenced--;
+	entry.last_use = ++m_clock;
+}
+
+bool ResidencyTracker::isReferenced(int id) const {
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	return id >= 0 && id < (int)m_entries.size() && m_entries[id].refs > 0;
+}
+
+void ResidencyTracker::touch(int id) {
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	access(id).last_use = ++m_clock;
+}
+
+void ResidencyTracker::setResident(int id, i64 bytes) {
+	DASSERT(bytes >= 0);
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	auto &entry = access(id);
+	m_resident += int(bytes > 0) - int(entry.bytes > 0);
+	m_bytes += bytes - entry.bytes;
+	entry.bytes = bytes;
+	entry.last_use = ++m_clock;
+}
+
+bool ResidencyTracker::isOverBudget() const { return m_bytes > s_budgets[(int)m_category]; }
+
+bool ResidencyTracker::overBudget() const {
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	return isOverBudget();
+}
+
+int ResidencyTracker::trim(const std::function<bool(int)> &evict) {
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	if(!isOverBudget())
+		return 0;
+
+	vector<int> candidates;
+	for(int n = 0; n < (int)m_entries.size(); n++)
+		if(m_entries[n].bytes > 0 && m_entries[n].refs == 0)
+			candidates.emplace_back(n);
+	std::sort(begin(candidates), end(candidates),
+			  [&](int a, int b) { return m_entries[a].last_use < m_entries[b].last_use; });
+
+	int count = 0;
+	for(int id : candidates) {
+		if(!isOverBudget())
+			break;
+		if(evict(id)) {
+			DASSERT(m_entries[id].bytes == 0);
+			count++;
+		}
+	}
+	m_evicted += count;
+	return count;
+}
+
+ResidencyStats ResidencyTracker::stats() const {
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	ResidencyStats out;
+	out.bytes = m_bytes;
+	out.budget = s_budgets[(int)m_category];
+	out.resident = m_resident;
+	out.referenced = m_referenced;
+	out.evicted = m_evicted;
+	return out;
+}
+
+void ResidencyTracker::setBudget(ResidencyCategory category, i64 bytes) {
+	s_budgets[(int)category] = max(bytes, i64(0));
+}
+
+i64 ResidencyTracker::budget(ResidencyCategory category) { return s_budgets[(int)category]; }
+
+ResidencyStats ResidencyTracker::stats(ResidencyCategory category) {
+	if(auto *tracker = s_trackers[(int)category])
+		return tracker->stats();
+	ResidencyStats out;
+	out.budget = s_budgets[(int)category];
+	return out;
+}
+
+void ResidencyTracker::printInfo() {
+	printf("%-14s  %10s  %10s  %8s  %10s  %8s\n", "category", "memory KB", "budget KB",
+		   "resident", "referenced", "evicted");
+	for(auto category : all<ResidencyCategory>) {
+		auto stats = ResidencyTracker::stats(category);
+		printf("%-14s  %10lld  %10lld  %8d  %10d  %8d\n", toString(category),
+			   (long long)(stats.bytes / 1024), (long long)(stats.budget / 1024), stats.resident,
+			   stats.referenced, stats.evicted);
+	}
+}
+
+ResidencyRef::ResidencyRef(ResidencyTracker &tracker, int id) : m_tracker(&tracker), m_id(id) {
+	m_tracker->acquire(m_id);
+}
+
+ResidencyRef::ResidencyRef(const ResidencyRef &rhs) : m_tracker(rhs.m_tracker), m_id(rhs.m_id) {
+	if(m_tracker)
+		m_tracker->acquire(m_id);
+}
+
+ResidencyRef::ResidencyRef(ResidencyRef &&rhs) : m_tracker(rhs.m_tracker), m_id(rhs.m_id) {
+	rhs.m_tracker = nullptr;
+	rhs.m_id = -1;
+}
+
+ResidencyRef::~ResidencyRef() {
+	if(m_tracker)
+		m_tracker->release(m_id);
+}
+
+ResidencyRef &ResidencyRef::operator=(const ResidencyRef &rhs) {
+	if(this != &rhs)
+		*this = ResidencyRef(rhs);
+	return *this;
+}
+
+ResidencyRef &ResidencyRef::operator=(ResidencyRef &&rhs) {
+	if(this != &rhs) {
+		if(m_tracker)
+			m_tracker->release(m_id);
+		m_tracker = rhs.m_tracker;
+		m_id = rhs.m_id;
+		rhs.m_tracker = nullptr;
+		rhs.m_id = -1;
+	}
+	return *this;
+}
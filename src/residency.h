@@ -0,0 +1,94 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#pragma once
+
+#include "base.h"
+#include <functional>
+#include <mutex>
+
+DEFINE_ENUM(ResidencyCategory, sprite_images, tile_frames, sound_buffers);
+
+struct ResidencyStats {
+	i64 bytes = 0, budget = 0;
+	int resident = 0, referenced = 0, evicted = 0;
+};
+
+// Tracks memory used by resources of single category & references to them (from live
+// entities, loaded levels, the editor, etc.). When memory goes over the category budget,
+// unreferenced resources are evicted, least recently used first.
+//
+// Resources are identified with dense indices; Only one tracker per category is allowed.
+// Trackers are thread-safe: levels are loaded (and resources acquired) on loading threads
+// while the main thread trims. Tracker stays locked during trim, so resources can't be
+// acquired while they're being evicted.
+class ResidencyTracker {
+  public:
+	ResidencyTracker(ResidencyCategory);
+	~ResidencyTracker();
+
+	ResidencyTracker(const ResidencyTracker &) = delete;
+	void operator=(const ResidencyTracker &) = delete;
+
+	void acquire(int id);
+	void release(int id);
+	bool isReferenced(int id) const;
+
+	// Marks resource as used right now
+	void touch(int id);
+	// bytes == 0 means that resource is not resident
+	void setResident(int id, i64 bytes);
+
+	// Evicts unreferenced resources until used memory fits in the budget; evict should
+	// free given resource & call setResident(id, 0); it may refuse by returning false.
+	// evict is called with the tracker locked (it can use the tracker on the same thread).
+	// Returns number of evicted resources.
+	int trim(const std::function<bool(int)> &evict);
+	bool overBudget() const;
+
+	ResidencyStats stats() const;
+	ResidencyCategory category() const { return m_category; }
+
+	// Budgets are shared between all trackers of given category
+	static void setBudget(ResidencyCategory, i64 bytes);
+	static i64 budget(ResidencyCategory);
+	static ResidencyStats stats(ResidencyCategory);
+	static void printInfo();
+
+  private:
+	struct Entry {
+		i64 bytes = 0;
+		u64 last_use = 0;
+		int refs = 0;
+	};
+
+	Entry &access(int id);
+	bool isOverBudget() const;
+
+	mutable std::recursive_mutex m_mutex;
+	vector<Entry> m_entries;
+	ResidencyCategory m_category;
+	i64 m_bytes = 0;
+	u64 m_clock = 0;
+	int m_resident = 0, m_referenced = 0, m_evicted = 0;
+};
+
+// Keeps resource referenced for as long as it exists
+class ResidencyRef {
+  public:
+	ResidencyRef() = default;
+	ResidencyRef(ResidencyTracker &, int id);
+	ResidencyRef(const ResidencyRef &);
+	ResidencyRef(ResidencyRef &&);
+	~ResidencyRef();
+
+	ResidencyRef &operator=(const ResidencyRef &);
+	ResidencyRef &operator=(ResidencyRef &&);
+
+	explicit operator bool() const { return m_tracker != nullptr; }
+	int id() const { return m_id; }
+
+  private:
+	ResidencyTracker *m_tracker = nullptr;
+	int m_id = -1;
+};
@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include "sys/alloc_tracker.h"
 #include <fwk/sys/memory.h>
 #include <fwk/sys_base.h>
 #include <limits>
@@ -16,6 +17,9 @@ template <class T, int alignment = 64> class AlignedAllocator {
 	};
 	bool operator==(const AlignedAllocator &other) { return true; }
 
-	T *allocate(size_t n) { return (T *)fwk::allocate(n * sizeof(T), alignment); }
+	T *allocate(size_t n) {
+		AllocTracker::recordAlloc(n * sizeof(T));
+		return (T *)fwk::allocate(n * sizeof(T), alignment);
+	}
 	void deallocate(T *ptr, size_t n) { fwk::deallocate(ptr); }
 };
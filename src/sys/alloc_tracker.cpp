@@ -0,0 +1,229 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#include "sys/alloc_tracker.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+std::atomic<bool> AllocTracker::s_enabled = false;
+
+namespace {
+
+constexpr int max_tags = AllocTracker::max_tags;
+
+// Everything used by operator new is constant-initialized, so that allocations done during
+// static initialization are safe
+std::atomic<i64> s_counts[max_tags], s_bytes[max_tags];
+std::atomic<i64> s_violations = 0;
+std::atomic<bool> s_abort_on_violation = false;
+std::atomic<int> s_num_tags = 1;
+const char *s_tag_names[max_tags] = {"untagged"};
+std::mutex s_tag_mutex;
+
+thread_local int t_tag_id = 0;
+thread_local int t_no_alloc_depth = 0;
+
+// Accessed only from the main thread
+i64 s_prev_counts[max_tags], s_prev_bytes[max_tags];
+AllocTracker::TagStats s_frame_stats[max_tags];
+
+void onAlloc(size_t bytes) {
+	int tag_id = t_tag_id;
+	s_counts[tag_id].fetch_add(1, std::memory_order_relaxed);
+	s_bytes[tag_id].fetch_add(i64(bytes), std::memory_order_relaxed);
+
+	if(t_no_alloc_depth > 0) {
+		s_violations.fetch_add(1, std::memory_order_relaxed);
+		if(s_abort_on_violation.load(std::memory_order_relaxed)) {
+			t_no_alloc_depth = 0;
+			FATAL("Allocation of %d bytes inside NoAllocScope (tag: %s)", int(bytes),
+				  s_tag_names[tag_id]);
+		}
+	}
+}
+
+void *trackedAlloc(size_t size) noexcept {
+	void *ptr = malloc(size ? size : 1);
+	if(ptr && AllocTracker::isEnabled())
+		onAlloc(size);
+	return ptr;
+}
+
+void *trackedAlignedAlloc(size_t size, std::align_val_t align) noexcept {
+	size_t alignment = max(size_t(align), sizeof(void *));
+#ifdef _WIN32
+	void *ptr = _aligned_malloc(size ? size : 1, alignment);
+#else
+	void *ptr = nullptr;
+	if(posix_memalign(&ptr, alignment, size ? size : 1) != 0)
+		ptr = nullptr;
+#endif
+	if(ptr && AllocTracker::isEnabled())
+		onAlloc(size);
+	return ptr;
+}
+
+void alignedFree(void *ptr) noexcept {
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+}
+
+void AllocTracker::setEnabled(bool enable) { s_enabled = enable; }
+
+void AllocTracker::nextFrame() {
+	int num_tags = s_num_tags.load();
+	for(int n = 0; n < num_tags; n++) {
+		i64 count = s_counts[n].load(std::memory_order_relaxed);
+		i64 bytes = s_bytes[n].load(std::memory_order_relaxed);
+
+		auto &stats = s_frame_stats[n];
+		stats.name = s_tag_names[n];
+		stats.count = count - s_prev_counts[n];
+		stats.bytes = bytes - s_prev_bytes[n];
+		stats.max_count = max(stats.max_count, stats.count);
+		stats.max_bytes = max(stats.max_bytes, stats.bytes);
+		stats.total_count = count;
+		stats.total_bytes = bytes;
+		s_prev_counts[n] = count;
+		s_prev_bytes[n] = bytes;
+	}
+}
+
+vector<AllocTracker::TagStats> AllocTracker::stats() {
+	vector<TagStats> out;
+	int num_tags = s_num_tags.load();
+	for(int n = 0; n < num_tags; n++)
+		if(s_frame_stats[n].total_count > 0)
+			out.emplace_back(s_frame_stats[n]);
+	std::stable_sort(begin(out), end(out),
+					 [](const TagStats &a, const TagStats &b) { return a.bytes > b.bytes; });
+	return out;
+}
+
+string AllocTracker::statsText(int max_lines) {
+	if(!isEnabled())
+		return {};
+
+	TextFormatter fmt;
+	fmt.stdFormat("Allocations (frame/max): violations: %lld\n", (long long)numViolations());
+	auto stats = AllocTracker::stats();
+	for(int n = 0; n < min(max_lines, (int)stats.size()); n++) {
+		auto &tag = stats[n];
+		fmt.stdFormat("%-16s %5lld / %5lld  %7.1f / %7.1f KB\n", tag.name, (long long)tag.count,
+					  (long long)tag.max_count, double(tag.bytes) / 1024.0,
+					  double(tag.max_bytes) / 1024.0);
+	}
+	return fmt.text();
+}
+
+i64 AllocTracker::totalCount() {
+	i64 out = 0;
+	for(int n = 0, num_tags = s_num_tags.load(); n < num_tags; n++)
+		out += s_counts[n].load(std::memory_order_relaxed);
+	return out;
+}
+
+i64 AllocTracker::totalBytes() {
+	i64 out = 0;
+	for(int n = 0, num_tags = s_num_tags.load(); n < num_tags; n++)
+		out += s_bytes[n].load(std::memory_order_relaxed);
+	return out;
+}
+
+i64 AllocTracker::numViolations() { return s_violations.load(); }
+void AllocTracker::setAbortOnViolation(bool enable) { s_abort_on_violation = enable; }
+
+void AllocTracker::recordAlloc(size_t bytes) {
+	if(isEnabled())
+		onAlloc(bytes);
+}
+
+int AllocTracker::registerTag(const char *name) {
+	std::lock_guard<std::mutex> lock(s_tag_mutex);
+	int num_tags = s_num_tags.load();
+	for(int n = 0; n < num_tags; n++)
+		if(strcmp(s_tag_names[n], name) == 0)
+			return n;
+	if(num_tags == max_tags)
+		return 0;
+	s_tag_names[num_tags] = name;
+	s_num_tags = num_tags + 1;
+	return num_tags;
+}
+
+int AllocTracker::swapTag(int tag_id) {
+	DASSERT(tag_id >= 0 && tag_id < max_tags);
+	int prev_id = t_tag_id;
+	t_tag_id = tag_id;
+	return prev_id;
+}
+
+void AllocTracker::beginNoAlloc() { t_no_alloc_depth++; }
+void AllocTracker::endNoAlloc() {
+	if(t_no_alloc_depth > 0)
+		t_no_alloc_depth--;
+}
+
+void *operator new(size_t size) {
+	if(void *ptr = trackedAlloc(size))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) {
+	if(void *ptr = trackedAlloc(size))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return trackedAlloc(size); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return trackedAlloc(size); }
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { free(ptr); }
+void operator delete(void *ptr, const std::nothrow_t &) noexcept { free(ptr); }
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept { free(ptr); }
+
+void *operator new(size_t size, std::align_val_t align) {
+	if(void *ptr = trackedAlignedAlloc(size, align))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void *operator new[](size_t size, std::align_val_t align) {
+	if(void *ptr = trackedAlignedAlloc(size, align))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void *operator new(size_t size, std::align_val_t align, const std::nothrow_t &) noexcept {
+	return trackedAlignedAlloc(size, align);
+}
+void *operator new[](size_t size, std::align_val_t align, const std::nothrow_t &) noexcept {
+	return trackedAlignedAlloc(size, align);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept { alignedFree(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { alignedFree(ptr); }
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept { alignedFree(ptr); }
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept { alignedFree(ptr); }
+void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept {
+	alignedFree(ptr);
+}
+void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept {
+	alignedFree(ptr);
+}
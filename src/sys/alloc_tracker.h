@@ -0,0 +1,90 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#pragma once
+
+#include "base.h"
+#include <atomic>
+
+// Tracker of heap allocations; global operator new & delete (aligned versions included) are
+// replaced, but allocations are only counted when tracker is enabled (otherwise the cost is
+// a single relaxed load).
+//
+// Memory allocated directly with malloc or fwk::allocate is not seen by the tracker. That
+// includes storage of fwk::vector & PodVector, which libfwk allocates with fwk::allocate.
+// Such allocations can be reported with recordAlloc (AlignedAllocator does that).
+//
+// Every allocation is attributed to the innermost ALLOC_TAG scope of the allocating thread
+// (or to "untagged"). Counts are gathered per frame (nextFrame has to be called once per frame
+// on the main thread) & reported for each tag separately.
+//
+// NoAllocScope marks code which isn't supposed to allocate at all (for example steady state
+// of the simulation). Tracked allocations inside it are counted as violations & can abort the
+// program; Untracked ones (see above) go unnoticed.
+// Tag names have to be static strings.
+class AllocTracker {
+  public:
+	static constexpr int max_tags = 64;
+
+	static void setEnabled(bool);
+	static bool isEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+	static void nextFrame();
+
+	struct TagStats {
+		const char *name;
+		i64 count, bytes;		  // during last frame
+		i64 max_count, max_bytes; // maximum in a single frame
+		i64 total_count, total_bytes;
+	};
+	// Tags which allocated anything, sorted by bytes allocated during last frame
+	static vector<TagStats> stats();
+	static string statsText(int max_lines = 16);
+
+	// Totals over all tags since the program started (only while enabled)
+	static i64 totalCount();
+	static i64 totalBytes();
+
+	// Violations are only detected when tracker is enabled
+	static i64 numViolations();
+	static void setAbortOnViolation(bool);
+
+	// For allocations which don't go through operator new (malloc, fwk::allocate, etc.)
+	static void recordAlloc(size_t bytes);
+
+	// Low-level interface; Use ALLOC_TAG & NoAllocScope instead
+	static int registerTag(const char *name);
+	static int swapTag(int tag_id);
+	static void beginNoAlloc();
+	static void endNoAlloc();
+
+  private:
+	static std::atomic<bool> s_enabled;
+};
+
+class AllocTagScope {
+  public:
+	AllocTagScope(int tag_id) : m_prev_id(AllocTracker::swapTag(tag_id)) {}
+	~AllocTagScope() { AllocTracker::swapTag(m_prev_id); }
+
+	AllocTagScope(const AllocTagScope &) = delete;
+	void operator=(const AllocTagScope &) = delete;
+
+  private:
+	int m_prev_id;
+};
+
+class NoAllocScope {
+  public:
+	NoAllocScope() { AllocTracker::beginNoAlloc(); }
+	~NoAllocScope() { AllocTracker::endNoAlloc(); }
+
+	NoAllocScope(const NoAllocScope &) = delete;
+	void operator=(const NoAllocScope &) = delete;
+};
+
+#define ALLOC_CAT_(a, b) a##b
+#define ALLOC_CAT(a, b) ALLOC_CAT_(a, b)
+
+#define ALLOC_TAG(name)                                                                            \
+	static const int ALLOC_CAT(alloc_tag_id_, __LINE__) = AllocTracker::registerTag(name);         \
+	AllocTagScope ALLOC_CAT(alloc_tag_, __LINE__)(ALLOC_CAT(alloc_tag_id_, __LINE__))
@@ -26,4 +26,5 @@ void Config::load(CXmlNode node) {
 		window_pos = node.attrib<int2>("window_pos", int2(0, 0));
 	fullscreen_on = node.attrib<bool>("fullscreen", fullscreen_on);
 	profiler_on = node.attrib<bool>("profiler", profiler_on);
+	disk_texture_cache = node.attrib<bool>("disk_texture_cache", disk_texture_cache);
 }
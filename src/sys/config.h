@@ -15,4 +15,5 @@ struct Config {
 	Maybe<int2> window_pos;
 	bool fullscreen_on = false;
 	bool profiler_on = false;
+	bool disk_texture_cache = false;
 };
@@ -0,0 +1,128 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#include "sys/frame_allocator.h"
+
+#include "sys/alloc_tracker.h"
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+struct Arena {
+	~Arena() { ::free(buffer); }
+
+	bool contains(const void *ptr) const {
+		return (const char *)ptr >= buffer && (const char *)ptr < buffer + reserve;
+	}
+
+	void resize(size_t new_reserve) {
+		DASSERT(num_blocks == 0);
+		::free(buffer);
+		buffer = (char *)malloc(new_reserve);
+		if(!buffer)
+			FATAL("FrameAllocator: failed to allocate %d bytes", int(new_reserve));
+		AllocTracker::recordAlloc(new_reserve);
+		reserve = new_reserve;
+		offset = 0;
+	}
+
+	// Enlarges the buffer, so that it can hold everything which was allocated at once
+	void grow() {
+		size_t new_reserve = max(reserve, FrameAllocator::default_reserve);
+		while(new_reserve < peak && new_reserve < FrameAllocator::max_reserve)
+			new_reserve *= 2;
+		new_reserve = min(new_reserve, FrameAllocator::max_reserve);
+		if(!buffer || new_reserve != reserve)
+			resize(new_reserve);
+	}
+
+	char *buffer = nullptr;
+	size_t reserve = 0, offset = 0;
+	size_t overflow_bytes = 0; // currently allocated with operator new
+	size_t peak = 0, frame_peak = 0;
+	int num_blocks = 0;
+};
+
+thread_local Arena t_arena;
+
+class FrameMemoryResource final : public std::pmr::memory_resource {
+	void *do_allocate(size_t bytes, size_t alignment) final {
+		return FrameAllocator::alloc(bytes, alignment);
+	}
+	void do_deallocate(void *ptr, size_t bytes, size_t alignment) final {
+		FrameAllocator::free(ptr, bytes, alignment);
+	}
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept final {
+		return this == &other;
+	}
+};
+
+FrameMemoryResource s_resource;
+
+}
+
+void *FrameAllocator::alloc(size_t bytes, size_t alignment) {
+	DASSERT(alignment > 0 && (alignment & (alignment - 1)) == 0);
+	auto &arena = t_arena;
+	if(arena.num_blocks == 0) {
+		arena.peak = max(arena.peak, bytes + alignment);
+		arena.grow();
+	}
+
+	size_t base = (size_t)arena.buffer;
+	size_t offset = ((base + arena.offset + alignment - 1) & ~(alignment - 1)) - base;
+	void *out;
+	if(offset + bytes <= arena.reserve) {
+		out = arena.buffer + offset;
+		arena.offset = offset + bytes;
+	} else {
+		out = alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__ ?
+				  ::operator new(bytes, std::align_val_t(alignment)) :
+				  ::operator new(bytes);
+		arena.overflow_bytes += bytes;
+	}
+
+	arena.num_blocks++;
+	size_t used = arena.offset + arena.overflow_bytes;
+	arena.peak = max(arena.peak, used);
+	arena.frame_peak = max(arena.frame_peak, used);
+	return out;
+}
+
+void FrameAllocator::free(void *ptr, size_t bytes, size_t alignment) {
+	if(!ptr)
+		return;
+
+	auto &arena = t_arena;
+	DASSERT(arena.num_blocks > 0);
+	arena.num_blocks--;
+
+	if(arena.contains(ptr)) {
+		if((char *)ptr + bytes == arena.buffer + arena.offset)
+			arena.offset = (char *)ptr - arena.buffer;
+	} else {
+		if(alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+			::operator delete(ptr, std::align_val_t(alignment));
+		else
+			::operator delete(ptr);
+		arena.overflow_bytes -= bytes;
+	}
+
+	if(arena.num_blocks == 0)
+		arena.offset = 0;
+}
+
+void FrameAllocator::nextFrame() {
+	auto &arena = t_arena;
+	if(arena.num_blocks == 0)
+		arena.grow();
+	arena.frame_peak = 0;
+}
+
+FrameAllocator::Stats FrameAllocator::stats() {
+	auto &arena = t_arena;
+	return {arena.reserve, arena.frame_peak, arena.overflow_bytes, arena.num_blocks};
+}
+
+std::pmr::memory_resource *FrameAllocator::resource() { return &s_resource; }
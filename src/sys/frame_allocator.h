@@ -0,0 +1,63 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#pragma once
+
+#include "base.h"
+#include <memory_resource>
+#include <vector>
+
+// Thread-local bump arena for scratch data which doesn't outlive current tick / frame.
+//
+// Each thread has its own block of memory; allocation only moves an offset. Freeing the most
+// recent allocation gives the memory back; when everything allocated from the arena is freed,
+// it's reset to the beginning. Allocations which don't fit are served by operator new; peak
+// usage is remembered & the block is enlarged (up to max_reserve) once the arena is empty, so
+// that in steady state scratch containers don't touch the global heap at all.
+//
+// Memory has to be freed by the same thread which allocated it.
+class FrameAllocator {
+  public:
+	static constexpr size_t default_reserve = 64 * 1024;
+	static constexpr size_t max_reserve = 32 * 1024 * 1024;
+
+	static void *alloc(size_t bytes, size_t alignment = alignof(std::max_align_t));
+	static void free(void *ptr, size_t bytes, size_t alignment = alignof(std::max_align_t));
+
+	// Resizes the arena of calling thread (if it's empty) & starts gathering new peak usage;
+	// Should be called once per tick / frame.
+	static void nextFrame();
+
+	struct Stats {
+		size_t reserve, frame_peak, overflow_bytes;
+		int num_blocks;
+	};
+	// Arena of calling thread
+	static Stats stats();
+
+	// Adaptor for std::pmr containers; Allocates from the arena of the calling thread
+	static std::pmr::memory_resource *resource();
+};
+
+// Stateless STL allocator which uses FrameAllocator
+template <class T> class TFrameAllocator {
+  public:
+	using value_type = T;
+	template <class U> struct rebind {
+		using other = TFrameAllocator<U>;
+	};
+
+	TFrameAllocator() = default;
+	template <class U> TFrameAllocator(const TFrameAllocator<U> &) {}
+
+	T *allocate(size_t count) { return (T *)FrameAllocator::alloc(count * sizeof(T), alignof(T)); }
+	void deallocate(T *ptr, size_t count) {
+		FrameAllocator::free(ptr, count * sizeof(T), alignof(T));
+	}
+
+	template <class U> bool operator==(const TFrameAllocator<U> &) const { return true; }
+	template <class U> bool operator!=(const TFrameAllocator<U> &) const { return false; }
+};
+
+// Scratch vector; shouldn't be stored anywhere or passed to other threads
+template <class T> using FrameVector = std::vector<T, TFrameAllocator<T>>;
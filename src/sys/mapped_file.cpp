@@ -0,0 +1,74 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#include "sys/mapped_file.h"
+
+#include <fwk/io/file_system.h>
+
+#if (defined(__linux__) || defined(__APPLE__)) && !defined(FWK_PLATFORM_HTML)
+#define USE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() = default;
+MappedFile::~MappedFile() { reset(); }
+
+MappedFile::MappedFile(MappedFile &&rhs)
+	: m_data(rhs.m_data), m_size(rhs.m_size), m_loaded_data(std::move(rhs.m_loaded_data)) {
+	if(!m_loaded_data.empty())
+		m_data = m_loaded_data.data();
+	rhs.m_data = nullptr;
+	rhs.m_size = 0;
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&rhs) {
+	if(this != &rhs) {
+		reset();
+		m_size = rhs.m_size;
+		m_loaded_data = std::move(rhs.m_loaded_data);
+		m_data = m_loaded_data.empty() ? rhs.m_data : m_loaded_data.data();
+		rhs.m_data = nullptr;
+		rhs.m_size = 0;
+	}
+	return *this;
+}
+
+void MappedFile::reset() {
+#ifdef USE_MMAP
+	if(isMapped())
+		munmap((void *)m_data, m_size);
+#endif
+	m_data = nullptr;
+	m_size = 0;
+	m_loaded_data.clear();
+}
+
+Ex<MappedFile> MappedFile::open(ZStr file_name) {
+	MappedFile out;
+#ifdef USE_MMAP
+	int fd = ::open(file_name.c_str(), O_RDONLY);
+	if(fd == -1)
+		return ERROR("Cannot open file for mapping: '%'", file_name);
+
+	struct stat file_stat;
+	void *ptr = MAP_FAILED;
+	if(fstat(fd, &file_stat) == 0 && file_stat.st_size > 0)
+		ptr = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// Mapping stays valid after descriptor is closed
+	close(fd);
+
+	if(ptr != MAP_FAILED) {
+		out.m_data = (const char *)ptr;
+		out.m_size = file_stat.st_size;
+		return out;
+	}
+#endif
+
+	out.m_loaded_data = EX_PASS(loadFile(file_name));
+	out.m_data = out.m_loaded_data.data();
+	out.m_size = out.m_loaded_data.size();
+	return out;
+}
@@ -0,0 +1,35 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#pragma once
+
+#include "base.h"
+
+// Read-only view of whole file contents; File is memory-mapped if platform supports it,
+// otherwise it's simply loaded into memory.
+class MappedFile {
+  public:
+	MappedFile();
+	MappedFile(MappedFile &&);
+	MappedFile &operator=(MappedFile &&);
+	~MappedFile();
+
+	static Ex<MappedFile> open(ZStr file_name);
+
+	CSpan<char> data() const { return CSpan<char>(m_data, (int)m_size); }
+	i64 size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+	bool isMapped() const { return m_data && m_loaded_data.empty(); }
+
+	template <class T> const T *at(i64 offset) const {
+		DASSERT(offset >= 0 && offset + (i64)sizeof(T) <= m_size);
+		return reinterpret_cast<const T *>(m_data + offset);
+	}
+
+  private:
+	void reset();
+
+	const char *m_data = nullptr;
+	i64 m_size = 0;
+	vector<char> m_loaded_data;
+};
@@ -0,0 +1,40 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#include "sys/parallel.h"
+
+#include <atomic>
+#include <thread>
+
+int parallelThreadCount() {
+#ifdef FWK_PLATFORM_HTML
+	return 1;
+#else
+	return max(1, (int)std::thread::hardware_concurrency());
+#endif
+}
+
+void parallelFor(int count, int num_threads, const std::function<void(int)> &func) {
+	if(num_threads <= 0)
+		num_threads = parallelThreadCount();
+	num_threads = min(num_threads, count);
+	if(num_threads <= 1) {
+		for(int n = 0; n < count; n++)
+			func(n);
+		return;
+	}
+
+	std::atomic<int> next_index = 0;
+	auto worker = [&]() {
+		for(int n = next_index++; n < count; n = next_index++)
+			func(n);
+	};
+
+	vector<std::thread> threads;
+	threads.reserve(num_threads - 1);
+	for(int t = 1; t < num_threads; t++)
+		threads.emplace_back(worker);
+	worker();
+	for(auto &thread : threads)
+		thread.join();
+}
@@ -0,0 +1,15 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#pragma once
+
+#include "base.h"
+#include <functional>
+
+// Number of threads which should be used for parallel computations (at least 1)
+int parallelThreadCount();
+
+// Calls func(index) for every index in [0, count) using up to num_threads threads
+// (calling thread included). Order of calls is undefined, so results should be written to
+// separate slots and merged afterwards. If num_threads <= 0, parallelThreadCount() is used.
+void parallelFor(int count, int num_threads, const std::function<void(int)> &func);
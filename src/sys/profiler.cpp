@@ -0,0 +1,398 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#include "sys/profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fwk/hash_map.h>
+#include <fwk/io/file_system.h>
+#include <mutex>
+
+std::atomic<bool> Profiler::s_enabled = false;
+
+namespace {
+
+struct Event {
+	const char *name;
+	u64 start, end;
+	double value;
+	int depth; // -1 for counters
+};
+
+// If thread records more events than that in a single frame, oldest events are lost
+constexpr int buffer_size = 1 << 15;
+constexpr int stats_frames = 30;
+
+struct ThreadBuffer {
+	ThreadBuffer(int thread_id) : thread_id(thread_id) {}
+
+	vector<Event> events = vector<Event>(buffer_size);
+	std::atomic<u64> write_pos = 0;
+	u64 read_pos = 0;
+	int depth = 0;
+	int thread_id;
+};
+
+struct Accum {
+	const char *name;
+	int depth, count = 0, frame_count = 0;
+	u64 total = 0, frame_total = 0, max_frame = 0;
+};
+
+struct CounterAccum {
+	double sum = 0.0;
+	int count = 0;
+};
+
+struct Capture {
+	string file_name;
+	int frames_left = 0;
+	bool was_enabled = false;
+	vector<Pair<Event, int>> events;
+	vector<u64> frame_starts;
+};
+
+std::mutex s_mutex;
+vector<Dynamic<ThreadBuffer>> s_buffers;
+vector<ThreadBuffer *> s_free_buffers;
+
+HashMap<string, Accum> s_accums;
+HashMap<const char *, CounterAccum> s_counters;
+vector<Profiler::ScopeStats> s_stats, s_frame_stats;
+vector<Pair<const char *, double>> s_counter_stats;
+int s_frame_count = 0;
+u64 s_frame_start = 0;
+Maybe<Capture> s_capture;
+
+// Buffers of finished threads are reused by new threads
+struct ThreadBufferRef {
+	~ThreadBufferRef() {
+		if(buffer) {
+			std::lock_guard<std::mutex> lock(s_mutex);
+			s_free_buffers.emplace_back(buffer);
+		}
+	}
+	ThreadBuffer *buffer = nullptr;
+};
+
+thread_local ThreadBufferRef t_buffer;
+
+ThreadBuffer &threadBuffer() {
+	if(!t_buffer.buffer) {
+		std::lock_guard<std::mutex> lock(s_mutex);
+		if(!s_free_buffers.empty()) {
+			t_buffer.buffer = s_free_buffers.back();
+			s_free_buffers.pop_back();
+		} else {
+			s_buffers.emplace_back(Dynamic<ThreadBuffer>((int)s_buffers.size() + 1));
+			t_buffer.buffer = s_buffers.back().get();
+		}
+	}
+	return *t_buffer.buffer;
+}
+
+void record(ThreadBuffer &buffer, const Event &event) {
+	u64 pos = buffer.write_pos.load(std::memory_order_relaxed);
+	buffer.events[pos % buffer_size] = event;
+	buffer.write_pos.store(pos + 1, std::memory_order_release);
+}
+
+// Owning thread keeps recording while events are copied, so at most buffer_size - read_margin
+// events are read; Events which were overwritten in the meantime anyway are dropped
+constexpr int read_margin = 1024;
+
+// Events which were recorded since last call
+vector<Event> readEvents(ThreadBuffer &buffer) {
+	constexpr u64 max_events = buffer_size - read_margin;
+	u64 end = buffer.write_pos.load(std::memory_order_acquire);
+	u64 begin = max(buffer.read_pos, end > max_events ? end - max_events : 0);
+	buffer.read_pos = end;
+
+	vector<Event> out;
+	out.reserve(end - begin);
+	for(u64 pos = begin; pos < end; pos++)
+		out.emplace_back(buffer.events[pos % buffer_size]);
+
+	// Slot of event at pos is reused by event at pos + buffer_size
+	std::atomic_thread_fence(std::memory_order_acquire);
+	u64 new_end = buffer.write_pos.load(std::memory_order_relaxed);
+	if(new_end + 1 > begin + buffer_size) {
+		u64 num_lost = min(new_end + 1 - buffer_size - begin, u64(out.size()));
+		out.erase(out.begin(), out.begin() + num_lost);
+	}
+	return out;
+}
+
+// Scopes are aggregated by their path in the scope tree
+void aggregate(vector<Event> &events) {
+	std::sort(begin(events), end(events), [](const Event &a, const Event &b) {
+		return a.start != b.start ? a.start < b.start : a.depth < b.depth;
+	});
+
+	vector<const Event *> stack;
+	string path;
+	for(auto &event : events) {
+		if(event.depth < 0) {
+			auto it = s_counters.find(event.name);
+			if(it == s_counters.end()) {
+				s_counters.emplace(event.name, CounterAccum());
+				it = s_counters.find(event.name);
+			}
+			it->value.sum += event.value;
+			it->value.count++;
+			continue;
+		}
+
+		while(!stack.empty() &&
+			  (stack.back()->end <= event.start || stack.back()->depth >= event.depth))
+			stack.pop_back();
+		stack.emplace_back(&event);
+
+		path.clear();
+		for(auto *scope : stack) {
+			path += scope->name;
+			path += '\1';
+		}
+
+		auto it = s_accums.find(path);
+		if(it == s_accums.end()) {
+			s_accums.emplace(path, Accum{event.name, (int)stack.size() - 1});
+			it = s_accums.find(path);
+		}
+		auto &accum = it->value;
+		accum.frame_count++;
+		accum.frame_total += event.end - event.start;
+	}
+}
+
+// Separator is lower than any printable character, so parents go before children
+vector<Pair<string, Accum>> sortedAccums(bool current_frame) {
+	vector<Pair<string, Accum>> out;
+	for(auto &it : s_accums)
+		if(current_frame ? it.value.frame_count : it.value.count)
+			out.emplace_back(it.key, it.value);
+	std::sort(begin(out), end(out), [](const auto &a, const auto &b) { return a.first < b.first; });
+	return out;
+}
+
+void finishFrame() {
+	s_frame_stats.clear();
+	for(auto &[path, accum] : sortedAccums(true)) {
+		double time = double(accum.frame_total) * 1e-6;
+		s_frame_stats.emplace_back(accum.name, accum.depth, accum.frame_count, time, time);
+	}
+
+	for(auto &it : s_accums) {
+		auto &accum = it.value;
+		accum.count += accum.frame_count;
+		accum.total += accum.frame_total;
+		accum.max_frame = max(accum.max_frame, accum.frame_total);
+		accum.frame_total = 0;
+		accum.frame_count = 0;
+	}
+}
+
+void publishStats() {
+	auto accums = sortedAccums(false);
+
+	s_stats.clear();
+	for(auto &[path, accum] : accums)
+		s_stats.emplace_back(accum.name, accum.depth, accum.count,
+							 double(accum.total) * 1e-6 / s_frame_count,
+							 double(accum.max_frame) * 1e-6);
+
+	s_counter_stats.clear();
+	for(auto &it : s_counters)
+		s_counter_stats.emplace_back(it.key, it.value.sum / s_frame_count);
+	std::sort(begin(s_counter_stats), end(s_counter_stats),
+			  [](const auto &a, const auto &b) { return strcmp(a.first, b.first) < 0; });
+
+	s_accums.clear();
+	s_counters.clear();
+	s_frame_count = 0;
+}
+
+void appendEscaped(string &out, const char *text) {
+	for(; *text; text++) {
+		if(*text == '"' || *text == '\\')
+			out += '\\';
+		out += *text;
+	}
+}
+
+Ex<void> saveTrace(const Capture &capture) {
+	// Frame start is unknown if capture started in first frame
+	u64 base = ~u64(0);
+	for(auto time : capture.frame_starts)
+		if(time)
+			base = min(base, time);
+	for(auto &[event, thread_id] : capture.events)
+		base = min(base, event.start);
+	auto micros = [&](u64 time) { return double(i64(time - base)) * 1e-3; };
+
+	string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	char buf[256];
+	int max_thread_id = 0;
+	for(auto &[event, thread_id] : capture.events)
+		max_thread_id = max(max_thread_id, thread_id);
+	for(int tid = 1; tid <= max_thread_id; tid++) {
+		snprintf(buf, sizeof(buf),
+				 "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+				 "\"args\":{\"name\":\"%s %d\"}},\n",
+				 tid, tid == 1 ? "main" : "thread", tid);
+		out += buf;
+	}
+	for(int n = 0; n < (int)capture.frame_starts.size(); n++) {
+		if(!capture.frame_starts[n])
+			continue;
+		snprintf(buf, sizeof(buf),
+				 "{\"name\":\"frame %d\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":1,"
+				 "\"ts\":%.3f},\n",
+				 n, micros(capture.frame_starts[n]));
+		out += buf;
+	}
+
+	for(auto &[event, thread_id] : capture.events) {
+		out += "{\"name\":\"";
+		appendEscaped(out, event.name);
+		if(event.depth < 0)
+			snprintf(buf, sizeof(buf),
+					 "\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"value\":%g}},\n",
+					 thread_id, micros(event.start), event.value);
+		else
+			snprintf(buf, sizeof(buf),
+					 "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f},\n",
+					 thread_id, micros(event.start), double(event.end - event.start) * 1e-3);
+		out += buf;
+	}
+	if(out.ends_with(",\n"))
+		out.resize(out.size() - 2);
+	out += "\n]}\n";
+
+	return saveFile(capture.file_name, out);
+}
+
+}
+
+void Profiler::setEnabled(bool enable) { s_enabled = enable; }
+
+u64 Profiler::timestamp() {
+	using namespace std::chrono;
+	return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void Profiler::beginScope() { threadBuffer().depth++; }
+
+void Profiler::endScope(const char *name, u64 start_time) {
+	auto &buffer = threadBuffer();
+	int depth = --buffer.depth;
+	record(buffer, {name, start_time, timestamp(), 0.0, max(depth, 0)});
+}
+
+void Profiler::accumScope(const char *name, u64 total_time) {
+	auto &buffer = threadBuffer();
+	u64 time = timestamp();
+	record(buffer, {name, time, time + total_time, 0.0, buffer.depth});
+}
+
+void Profiler::counter(const char *name, double value) {
+	auto &buffer = threadBuffer();
+	u64 time = timestamp();
+	record(buffer, {name, time, time, value, -1});
+}
+
+void Profiler::nextFrame() {
+	// Main thread gets the first buffer
+	threadBuffer();
+
+	std::lock_guard<std::mutex> lock(s_mutex);
+	u64 frame_end = timestamp();
+	if(!isEnabled()) {
+		for(auto &buffer : s_buffers)
+			buffer->read_pos = buffer->write_pos.load();
+		s_accums.clear();
+		s_counters.clear();
+		s_frame_stats.clear();
+		s_frame_count = 0;
+		s_frame_start = frame_end;
+		return;
+	}
+
+	for(auto &buffer : s_buffers) {
+		auto events = readEvents(*buffer);
+		if(s_capture)
+			for(auto &event : events)
+				s_capture->events.emplace_back(event, buffer->thread_id);
+		aggregate(events);
+	}
+
+	finishFrame();
+	if(++s_frame_count == stats_frames)
+		publishStats();
+
+	if(s_capture) {
+		s_capture->frame_starts.emplace_back(s_frame_start);
+		if(--s_capture->frames_left <= 0) {
+			auto result = saveTrace(*s_capture);
+			if(result)
+				print("Profiler trace saved: % (% frames, % events)\n", s_capture->file_name,
+					  s_capture->frame_starts.size(), s_capture->events.size());
+			else
+				result.error().print();
+			s_enabled = s_capture->was_enabled;
+			s_capture = none;
+		}
+	}
+	s_frame_start = frame_end;
+}
+
+vector<Profiler::ScopeStats> Profiler::stats() {
+	std::lock_guard<std::mutex> lock(s_mutex);
+	return s_stats;
+}
+
+vector<Profiler::ScopeStats> Profiler::frameStats() {
+	std::lock_guard<std::mutex> lock(s_mutex);
+	return s_frame_stats;
+}
+
+string Profiler::statsText(int max_lines) {
+	std::lock_guard<std::mutex> lock(s_mutex);
+	if(!isEnabled() || s_stats.empty())
+		return "";
+
+	TextFormatter fmt;
+	fmt("Profiler (avg / max ms per frame):\n");
+	int num_lines = 0;
+	for(auto &stat : s_stats) {
+		if(num_lines++ == max_lines)
+			break;
+		fmt.stdFormat("%*s%s: %.2f / %.2f", stat.depth * 2, "", stat.name, stat.avg_ms,
+					  stat.max_ms);
+		if(stat.count > stats_frames)
+			fmt.stdFormat(" (x%d)", stat.count / stats_frames);
+		fmt("\n");
+	}
+	for(auto &[name, value] : s_counter_stats)
+		fmt.stdFormat("%s: %.1f\n", name, value);
+	return fmt.text();
+}
+
+void Profiler::captureTrace(string file_name, int num_frames) {
+	std::lock_guard<std::mutex> lock(s_mutex);
+	if(s_capture)
+		print("Profiler: previous capture (%) will be dropped\n", s_capture->file_name);
+	Capture capture;
+	capture.file_name = std::move(file_name);
+	capture.frames_left = max(1, num_frames);
+	capture.was_enabled = s_capture ? s_capture->was_enabled : isEnabled();
+	s_capture = std::move(capture);
+	s_enabled = true;
+}
+
+bool Profiler::isCapturing() {
+	std::lock_guard<std::mutex> lock(s_mutex);
+	return !!s_capture;
+}
@@ -0,0 +1,110 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#pragma once
+
+#include "base.h"
+#include <atomic>
+
+// Hierarchical profiler with low overhead; it's always compiled in & can be enabled at runtime.
+//
+// Every thread records finished scopes into its own ring buffer (no locking); Buffers are
+// collected in nextFrame (main thread). Collected scopes are aggregated over several frames
+// into a table (statsText) & optionally saved as a trace in Chrome JSON format, which can be
+// viewed in chrome://tracing or ui.perfetto.dev.
+//
+// Scope & counter names have to be static strings (they are kept as pointers).
+class Profiler {
+  public:
+	static void setEnabled(bool);
+	static bool isEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+	// Should be called once per frame on the main thread
+	static void nextFrame();
+
+	struct ScopeStats {
+		const char *name;
+		int depth, count;
+		double avg_ms, max_ms; // per frame
+	};
+	// Scopes (in tree order) aggregated over last completed group of frames
+	static vector<ScopeStats> stats();
+	// Scopes recorded during last frame (avg_ms & max_ms are equal)
+	static vector<ScopeStats> frameStats();
+	static string statsText(int max_lines = 32);
+
+	// Records following num_frames frames & saves them to a file when done; Profiler is
+	// enabled if necessary (and disabled afterwards if it was off).
+	static void captureTrace(string file_name, int num_frames);
+	static bool isCapturing();
+
+	// Low-level interface; Use PROFILE_SCOPE, PROFILE_COUNTER & ProfileTimer instead
+	static u64 timestamp();
+	static void beginScope();
+	static void endScope(const char *name, u64 start_time);
+	static void counter(const char *name, double value);
+	// Records a child of current scope which took total_time (in ns); It starts at current time,
+	// so that it doesn't overlap scopes which were recorded before.
+	static void accumScope(const char *name, u64 total_time);
+
+  private:
+	static std::atomic<bool> s_enabled;
+};
+
+class ProfileScope {
+  public:
+	ProfileScope(const char *name) : m_name(Profiler::isEnabled() ? name : nullptr) {
+		if(m_name) {
+			Profiler::beginScope();
+			m_start = Profiler::timestamp();
+		}
+	}
+	~ProfileScope() {
+		if(m_name)
+			Profiler::endScope(m_name, m_start);
+	}
+
+	ProfileScope(const ProfileScope &) = delete;
+	void operator=(const ProfileScope &) = delete;
+
+  private:
+	const char *m_name;
+	u64 m_start = 0;
+};
+
+// Sums up time of many short sections (too short & too numerous for separate scopes);
+// Total time is recorded as a single scope when timer is destroyed.
+class ProfileTimer {
+  public:
+	ProfileTimer(const char *name) : m_name(Profiler::isEnabled() ? name : nullptr) {}
+	~ProfileTimer() {
+		if(m_name)
+			Profiler::accumScope(m_name, m_total);
+	}
+
+	ProfileTimer(const ProfileTimer &) = delete;
+	void operator=(const ProfileTimer &) = delete;
+
+	void start() {
+		if(m_name)
+			m_start = Profiler::timestamp();
+	}
+	void stop() {
+		if(m_name)
+			m_total += Profiler::timestamp() - m_start;
+	}
+
+  private:
+	const char *m_name;
+	u64 m_start = 0, m_total = 0;
+};
+
+#define PROFILE_CAT_(a, b) a##b
+#define PROFILE_CAT(a, b) PROFILE_CAT_(a, b)
+
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CAT(profile_scope_, __LINE__)(name)
+#define PROFILE_COUNTER(name, value)                                                               \
+	do {                                                                                           \
+		if(Profiler::isEnabled())                                                                  \
+			Profiler::counter(name, value);                                                        \
+	} while(0)
@@ -0,0 +1,27 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#include "sys/stats.h"
+
+#include <algorithm>
+#include <cmath>
+
+Percentiles computePercentiles(vector<double> values) {
+	Percentiles out;
+	if(values.empty())
+		return out;
+	std::sort(begin(values), end(values));
+	auto at = [&](double fraction) {
+		int idx = (int)std::ceil(fraction * values.size()) - 1;
+		return values[clamp(idx, 0, (int)values.size() - 1)];
+	};
+	double sum = 0.0;
+	for(auto value : values)
+		sum += value;
+	out.mean = sum / values.size();
+	out.p50 = at(0.5);
+	out.p90 = at(0.9);
+	out.p99 = at(0.99);
+	out.max = values.back();
+	return out;
+}
@@ -0,0 +1,13 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+#pragma once
+
+#include "base.h"
+
+// Summary of measured values (ms per tick, etc.); Used by benchmarks & tools
+struct Percentiles {
+	double mean = 0.0, p50 = 0.0, p90 = 0.0, p99 = 0.0, max = 0.0;
+};
+
+Percentiles computePercentiles(vector<double> values);
@@ -0,0 +1,94 @@
+// Copyright (C) Krzysztof Jakubowski <nadult@fastmail.fm>
+// This file is part of FreeFT. See license.txt for details.
+
+// Console viewer of telemetry streamed by dedicated servers (see net/telemetry.h).
+// Connects to a server running on the same machine & prints a row for every received sample.
+// With -raw, samples are printed as they arrive (newline-delimited JSON).
+
+#include "net/telemetry.h"
+
+#include <fwk/sys/expected.h>
+
+namespace {
+
+// Finds numeric value of a given key (first occurrence after pos)
+double findNumber(const string &line, const char *key, size_t pos = 0) {
+	auto pattern = stdFormat("\"%s\":", key);
+	auto it = line.find(pattern, pos);
+	return it == string::npos ? 0.0 : atof(line.c_str() + it + pattern.size());
+}
+
+void printClients(const string &line) {
+	const string pattern = "\"nick\":\"";
+	for(size_t pos = line.find(pattern); pos != string::npos; pos = line.find(pattern, pos)) {
+		pos += pattern.size();
+		string nick = line.substr(pos, line.find('"', pos) - pos);
+		printf("    %-16s in %7.2f KB/s  out %7.2f KB/s  rtt %6.1f ms  budget %3.0f%%\n",
+			   nick.c_str(), findNumber(line, "in_kb_s", pos), findNumber(line, "out_kb_s", pos),
+			   findNumber(line, "rtt_ms", pos), findNumber(line, "budget", pos) * 100.0);
+	}
+}
+
+}
+
+Ex<int> exMain(int argc, char **argv) {
+	int port = 0;
+	bool raw = false, show_clients = false;
+
+	for(int n = 1; n < argc; n++) {
+		if(strcmp(argv[n], "-raw") == 0)
+			raw = true;
+		else if(strcmp(argv[n], "-clients") == 0)
+			show_clients = true;
+		else if(argv[n][0] != '-' && !port)
+			port = atoi(argv[n]);
+		else {
+			port = 0;
+			break;
+		}
+	}
+
+	if(port <= 0 || port >= 65536) {
+		printf("Usage:\n%s port [options]\n\n"
+			   "Options:\n"
+			   "-raw       Prints samples as received (one JSON object per line)\n"
+			   "-clients   Prints bandwidth of each client\n\n"
+			   "Telemetry is enabled by telemetry_port attribute in server config.\n"
+			   "Example: %s 20100 -clients\n",
+			   argv[0], argv[0]);
+		return 0;
+	}
+
+	auto reader = EX_PASS(net::TelemetryReader::connect(port));
+	int num_lines = 0;
+	while(auto line = reader.readLine()) {
+		if(raw) {
+			printf("%s\n", line->c_str());
+		} else {
+			if(num_lines++ % 20 == 0)
+				printf("%9s %6s %8s %8s %8s %7s %6s %6s %9s\n", "time", "ticks", "avg ms",
+					   "max ms", "entities", "clients", "paths", "reach", "rss MB");
+			printf("%9.1f %6.0f %8.3f %8.3f %8.0f %7.0f %6.0f %6.0f %9.1f\n",
+				   findNumber(*line, "time"), findNumber(*line, "ticks"),
+				   findNumber(*line, "tick_ms_avg"), findNumber(*line, "tick_ms_max"),
+				   findNumber(*line, "num_entities"), findNumber(*line, "num_clients"),
+				   findNumber(*line, "navi_paths"), findNumber(*line, "navi_reachability"),
+				   findNumber(*line, "rss_kb") / 1024.0);
+			if(show_clients)
+				printClients(*line);
+		}
+		fflush(stdout);
+	}
+
+	printf("Connection closed\n");
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	auto result = exMain(argc, argv);
+	if(!result) {
+		result.error().print();
+		return 1;
+	}
+	return *result;
+}
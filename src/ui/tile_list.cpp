@@ -60,10 +60,7 @@ namespace {
 }
 
 PTileListModel allTilesModel() {
-	vector<const Tile *> tiles;
-	for(auto &[name, tile] : ResManager::instance().allTiles())
-		tiles.emplace_back(tile.get());
-	return make_shared<VectorBasedModel>(tiles);
+	return make_shared<VectorBasedModel>(ResManager::instance().allTiles());
 }
 
 PTileListModel groupedTilesModel(const TileGroup &tile_group, bool only_uniform) {